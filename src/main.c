@@ -1,4 +1,5 @@
 #include "wslua.h"
+#include "wst_store.h"
 
 #ifndef LUAWSTYPES_API
 #ifdef _WIN32
@@ -11,10 +12,33 @@
 extern int Struct_register(lua_State* L);
 extern int UInt64_register(lua_State* L);
 extern int Int64_register(lua_State* L);
+extern int Layout_register(lua_State* L);
+extern int View_register(lua_State* L);
+extern int Dispatcher_register(lua_State* L);
+extern int Index_register(lua_State* L);
+extern int Cache_register(lua_State* L);
+extern int Column_register(lua_State* L);
+extern int Buffer_register(lua_State* L);
+extern int Ring_register(lua_State* L);
+#ifdef LUAWSTYPES_GENERATED
+extern int wstgen_register(lua_State* L);
+#endif
 
 LUAWSTYPES_API int luaopen_wiresharktypes(lua_State* L) {
+    wst_store_preload();
     Int64_register(L);
     UInt64_register(L);
     Struct_register(L);
+    Layout_register(L);
+    View_register(L);
+    Dispatcher_register(L);
+    Index_register(L);
+    Cache_register(L);
+    Column_register(L);
+    Buffer_register(L);
+    Ring_register(L);
+#ifdef LUAWSTYPES_GENERATED
+    wstgen_register(L);
+#endif
     return 1;
 }
\ No newline at end of file
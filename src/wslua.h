@@ -63,6 +63,8 @@ inline void g_error(const char* fmt, ...)
 
 #endif
 
+#include "wst_abi.h"
+
 #ifndef ws_debug_printf
 #define ws_debug_printf     printf
 #endif
@@ -469,14 +471,29 @@ typedef struct _wslua_class {
 } wslua_class;
 void wslua_register_classinstance_meta(lua_State* L, const wslua_class* cls_def);
 void wslua_register_class(lua_State* L, const wslua_class* cls_def);
+WSLUA_API void wslua_setfuncs(lua_State *L, const luaL_Reg *l, int nup);
 
 extern gboolean wslua_optbool(lua_State* L, int n, gboolean def);
 
 extern const char* wslua_checkstring_only(lua_State* L, int n);
 extern const char* wslua_checklstring_only(lua_State* L, int n, size_t* l);
+/* the bytes of a Lua string or a Buffer, without coercion */
+extern const guchar* wslua_checkbytes(lua_State* L, int n, size_t* l);
+/* Buffers over bytes they do not own, such as records in shared memory: the owner of the
+   bytes points the view elsewhere, or closes it with NULL, when they go away */
+struct _wst_buffer;
+extern struct _wst_buffer* wslua_pushbufferview(lua_State* L, const guchar* data, size_t len);
+extern void wslua_setbufferview(struct _wst_buffer* b, const guchar* data, size_t len);
 extern int wslua__concat(lua_State* L);
 
 
+extern gint64 checkInt64(lua_State* L, int idx);
+extern gboolean isInt64(lua_State* L, int i);
+extern gint64* pushInt64(lua_State* L, gint64 v);
+extern guint64 checkUInt64(lua_State* L, int idx);
+extern gboolean isUInt64(lua_State* L, int i);
+extern guint64* pushUInt64(lua_State* L, guint64 v);
+
 extern void Int64_pack(lua_State* L, luaL_Buffer* b, gint idx, gboolean asLittleEndian);
 extern int Int64_unpack(lua_State* L, const gchar* buff, gboolean asLittleEndian);
 extern void UInt64_pack(lua_State* L, luaL_Buffer* b, gint idx, gboolean asLittleEndian);
@@ -0,0 +1,229 @@
+/*
+ * wslua_buffer.c
+ *
+ * A Lua userdata object for read-only bytes that live outside the Lua heap,
+ * such as a memory-mapped file.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "wslua.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* WSLUA_MODULE Buffer Bytes Outside the Lua Heap
+
+  A `Buffer` holds bytes that are not a Lua string, such as a file mapped into memory
+  with `Buffer.map()`, or a record of a shared memory `Ring`. `Struct.unpack()` and the
+  scanning functions of `Struct` (`Struct.filter()`, `Struct.aggregate()`, `Struct.sort()`
+  and `Struct.bsearch()`) read a `Buffer` in place wherever they accept a binary string,
+  as do `Int64.decode()` and `UInt64.decode()`, so large binary tables need not be loaded
+  into Lua.
+ */
+
+typedef struct _wst_buffer {
+    const guchar *data;     /* NULL once closed */
+    size_t len;
+    void *map;              /* the mapping to release, NULL if none */
+    size_t maplen;
+} wst_buffer;
+
+typedef wst_buffer *Buffer;
+
+WSLUA_CLASS_DEFINE(Buffer,NOP);
+/* A read-only range of bytes outside the Lua heap. */
+
+/* Releases the bytes of a buffer; it reads as closed afterwards */
+static void buffer_release(wst_buffer *b) {
+    if (b->map) {
+#ifdef _WIN32
+        UnmapViewOfFile(b->map);
+#else
+        munmap(b->map, b->maplen);
+#endif
+    }
+    b->map = NULL;
+    b->data = NULL;
+    b->len = 0;
+}
+
+const guchar *wslua_checkbytes(lua_State *L, int n, size_t *l) {
+    if (lua_type(L, n) == LUA_TSTRING)
+        return (const guchar *)lua_tolstring(L, n, l);
+    if (isBuffer(L, n)) {
+        Buffer b = toBuffer(L, n);
+        if (b == NULL || b->data == NULL)
+            luaL_argerror(L, n, "buffer is closed");
+        if (l)
+            *l = b->len;
+        return b->data;
+    }
+    luaL_argerror(L, n, "must be a Lua string or a Buffer");
+    return NULL;
+}
+
+struct _wst_buffer *wslua_pushbufferview(lua_State *L, const guchar *data, size_t len) {
+    Buffer b = (Buffer)calloc(1, sizeof(wst_buffer));
+    if (b == NULL)
+        luaL_error(L, "out of memory");
+    pushBuffer(L, b);
+    wslua_setbufferview(b, data, len);
+    return b;
+}
+
+void wslua_setbufferview(struct _wst_buffer *b, const guchar *data, size_t len) {
+    b->data = data;
+    b->len = data ? len : 0;
+}
+
+WSLUA_CONSTRUCTOR Buffer_map(lua_State *L) {
+    /* Maps a file into memory, read-only. The file should not be truncated while it is mapped. */
+#define WSLUA_ARG_Buffer_map_PATH 1 /* The path of the file. */
+    const gchar *path = luaL_checkstring(L, WSLUA_ARG_Buffer_map_PATH);
+    Buffer b = (Buffer)calloc(1, sizeof(wst_buffer));
+    static const guchar empty[1] = { 0 };
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+#else
+    struct stat st;
+    int fd;
+#endif
+
+    if (b == NULL)
+        return luaL_error(L, "out of memory");
+    pushBuffer(L, b);  /* owns b, so errors below do not leak */
+#ifdef _WIN32
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return luaL_error(L, "cannot open %s", path);
+    if (!GetFileSizeEx(file, &size) || (guint64)size.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return luaL_error(L, "cannot map %s", path);
+    }
+    if (size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        b->map = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (mapping)
+            CloseHandle(mapping);
+        if (b->map == NULL) {
+            CloseHandle(file);
+            return luaL_error(L, "cannot map %s", path);
+        }
+    }
+    CloseHandle(file);
+    b->maplen = (size_t)size.QuadPart;
+#else
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return luaL_error(L, "cannot open %s: %s", path, strerror(errno));
+    if (fstat(fd, &st) != 0 || (guint64)st.st_size > (size_t)-1) {
+        close(fd);
+        return luaL_error(L, "cannot map %s", path);
+    }
+    if (st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return luaL_error(L, "cannot map %s: %s", path, strerror(errno));
+        }
+        b->map = p;
+    }
+    close(fd);
+    b->maplen = (size_t)st.st_size;
+#endif
+    b->data = b->map ? (const guchar *)b->map : empty;
+    b->len = b->maplen;
+    WSLUA_RETURN(1); /* The `Buffer`. */
+}
+
+WSLUA_METHOD Buffer_sub(lua_State *L) {
+    /* Copies bytes of the buffer to a Lua string, with the same arguments as `string.sub()`. */
+#define WSLUA_ARG_Buffer_sub_I 2 /* The position of the first byte. */
+#define WSLUA_OPTARG_Buffer_sub_J 3 /* The position of the last byte (default=-1). */
+    size_t len;
+    const guchar *data = wslua_checkbytes(L, 1, &len);
+    lua_Integer i = luaL_checkinteger(L, WSLUA_ARG_Buffer_sub_I);
+    lua_Integer j = luaL_optinteger(L, WSLUA_OPTARG_Buffer_sub_J, -1);
+
+    if (i < 0) i += (lua_Integer)len + 1;
+    if (j < 0) j += (lua_Integer)len + 1;
+    if (i < 1) i = 1;
+    if (j > (lua_Integer)len) j = (lua_Integer)len;
+    if (i <= j)
+        lua_pushlstring(L, (const gchar *)data + i - 1, (size_t)(j - i + 1));
+    else
+        lua_pushliteral(L, "");
+    WSLUA_RETURN(1); /* The bytes. */
+}
+
+WSLUA_METHOD Buffer_close(lua_State *L) {
+    /* Releases the bytes now, instead of when the buffer is collected. A closed buffer
+       cannot be read. */
+    Buffer b = checkBuffer(L, 1);
+    buffer_release(b);
+    return 0;
+}
+
+WSLUA_METAMETHOD Buffer__len(lua_State *L) {
+    /* The number of bytes in the buffer, 0 once closed. */
+    Buffer b = checkBuffer(L, 1);
+    lua_pushinteger(L, (lua_Integer)b->len);
+    return 1;
+}
+
+WSLUA_METAMETHOD Buffer__tostring(lua_State *L) {
+    Buffer b = checkBuffer(L, 1);
+    if (b->data)
+        lua_pushfstring(L, "Buffer(%d bytes)", (int)b->len);
+    else
+        lua_pushliteral(L, "Buffer(closed)");
+    return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Buffer__gc(lua_State *L) {
+    Buffer *p = (Buffer *)lua_touserdata(L, 1);
+    if (p && *p) {
+        buffer_release(*p);
+        free(*p);
+        *p = NULL;
+    }
+    return 0;
+}
+
+WSLUA_METHODS Buffer_methods[] = {
+    WSLUA_CLASS_FNREG(Buffer,map),
+    WSLUA_CLASS_FNREG(Buffer,sub),
+    WSLUA_CLASS_FNREG(Buffer,close),
+    { NULL, NULL }
+};
+
+WSLUA_META Buffer_meta[] = {
+    WSLUA_CLASS_MTREG(Buffer,len),
+    WSLUA_CLASS_MTREG(Buffer,tostring),
+    { NULL, NULL }
+};
+
+LUALIB_API int Buffer_register(lua_State* L) {
+    WSLUA_REGISTER_CLASS(Buffer);
+    return 0;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local Variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
@@ -147,13 +147,16 @@ WSLUA_CONSTRUCTOR Int64_decode(lua_State* L) {
     /* Decodes an 8-byte Lua string, using given endianness, into a new `Int64` object.
        @since 1.11.3
      */
-#define WSLUA_ARG_Int64_decode_STRING 1 /* The Lua string containing a binary 64-bit integer. */
+#define WSLUA_ARG_Int64_decode_STRING 1 /* The Lua string or `Buffer` containing a binary 64-bit integer. */
 #define WSLUA_OPTARG_Int64_decode_ENDIAN 2 /* If set to true then little-endian is used,
                                               if false then big-endian; if missing/nil, native
                                               host endian. */
     gboolean asLittleEndian = IS_LITTLE_ENDIAN;
     size_t len = 0;
-    const gchar *s = luaL_checklstring(L, WSLUA_ARG_Int64_decode_STRING, &len);
+    /* a Buffer is read in place; anything else is coerced to a string as before */
+    const gchar *s = lua_type(L, WSLUA_ARG_Int64_decode_STRING) == LUA_TUSERDATA
+        ? (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Int64_decode_STRING, &len)
+        : luaL_checklstring(L, WSLUA_ARG_Int64_decode_STRING, &len);
 
     if (lua_gettop(L) >= WSLUA_OPTARG_Int64_decode_ENDIAN) {
         if (lua_type(L,WSLUA_OPTARG_Int64_decode_ENDIAN) == LUA_TBOOLEAN)
@@ -699,13 +702,16 @@ WSLUA_CONSTRUCTOR UInt64_decode(lua_State* L) {
     /* Decodes an 8-byte Lua binary string, using given endianness, into a new `UInt64` object.
        @since 1.11.3
      */
-#define WSLUA_ARG_UInt64_decode_STRING 1 /* The Lua string containing a binary 64-bit integer. */
+#define WSLUA_ARG_UInt64_decode_STRING 1 /* The Lua string or `Buffer` containing a binary 64-bit integer. */
 #define WSLUA_OPTARG_UInt64_decode_ENDIAN 2 /* If set to true then little-endian is used,
                                                if false then big-endian; if missing/nil,
                                                native host endian. */
     gboolean asLittleEndian = IS_LITTLE_ENDIAN;
     size_t len = 0;
-    const gchar *s = luaL_checklstring(L, WSLUA_ARG_UInt64_decode_STRING, &len);
+    /* a Buffer is read in place; anything else is coerced to a string as before */
+    const gchar *s = lua_type(L, WSLUA_ARG_UInt64_decode_STRING) == LUA_TUSERDATA
+        ? (const gchar *)wslua_checkbytes(L, WSLUA_ARG_UInt64_decode_STRING, &len)
+        : luaL_checklstring(L, WSLUA_ARG_UInt64_decode_STRING, &len);
 
     if (lua_gettop(L) >= WSLUA_OPTARG_UInt64_decode_ENDIAN) {
         if (lua_type(L,WSLUA_OPTARG_UInt64_decode_ENDIAN) == LUA_TBOOLEAN)
@@ -0,0 +1,298 @@
+/*
+ * wslua_ring.c
+ *
+ * A Lua userdata object for the shared memory rings of wst_ring.h: records
+ * handed from a producer process to consumer processes without copying.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "wslua.h"
+#include "wst_ring.h"
+
+/* WSLUA_MODULE Ring Records in Shared Memory
+
+  A `Ring` passes records from one producer process to consumer processes through shared
+  memory, without copying them: a consumer gets each record as a `Buffer` over the ring's
+  memory, which `Struct.unpack()` reads in place. Each record goes to one consumer.
+
+  Consumers take records in batches with `ring:acquire()`, and give the batch back with
+  `ring:release()` once read, or by acquiring the next one. Each batch comes in a new table
+  of new `Buffer` views, which are closed when it is released, so a view kept from an earlier
+  batch raises an error instead of reading a slot the producer is reusing.
+
+  @code
+  local ring = Ring.open("/capture")
+  while true do
+    local batch = ring:acquire(64, -1)
+    if batch == nil then break end  -- the producer closed the ring
+    for i = 1, #batch do
+      local src, dst = Struct.unpack(">I4 I4", batch[i], 13)
+    end
+  end
+  @endcode
+ */
+
+/* the records an acquire returns by default */
+#define RING_BATCH  64
+
+typedef struct _wst_lring {
+    wst_ring *ring;             /* NULL once closed */
+    gboolean producer;
+    guint64 first;              /* the batch held by a consumer */
+    guint32 n;
+    guint32 nviews;             /* views made for the batch */
+    guint32 cap;                /* entries allocated in views */
+    struct _wst_buffer **views; /* anchored in the environment, [1] */
+} wst_lring;
+
+typedef wst_lring *Ring;
+
+WSLUA_CLASS_DEFINE(Ring,NOP);
+/* The producer or a consumer end of a shared memory ring. */
+
+/* Gives back the batch held; its views are closed unless they may be collected already */
+static void ring_release(Ring r, gboolean views) {
+    guint32 i;
+    if (views) {
+        for (i = 0; i < r->nviews; i++)
+            wslua_setbufferview(r->views[i], NULL, 0);
+    }
+    r->nviews = 0;
+    if (r->n == 0)
+        return;
+    wst_ring_release(r->ring, r->first, r->n);
+    r->n = 0;
+}
+
+static Ring ring_check(lua_State *L, int idx) {
+    Ring r = checkRing(L, idx);
+    if (r->ring == NULL)
+        luaL_argerror(L, idx, "ring is closed");
+    return r;
+}
+
+/* Pushes a new Ring for 'ring', with its environment: [1] the views of the batch held,
+   [2] the environment of the views, which holds the Ring */
+static int ring_push(lua_State *L, wst_ring *ring, gboolean producer) {
+    Ring r = (Ring)calloc(1, sizeof(wst_lring));
+    if (r == NULL) {
+        wst_ring_close(ring);
+        return luaL_error(L, "out of memory");
+    }
+    r->ring = ring;
+    r->producer = producer;
+    pushRing(L, r);
+    lua_createtable(L, 2, 0);
+    lua_newtable(L);
+    lua_rawseti(L, -2, 1);
+    /* a view keeps the ring, and so the memory it reads, from being collected */
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, -3);
+    lua_rawseti(L, -2, 1);
+    lua_rawseti(L, -2, 2);
+    lua_setfenv(L, -2);
+    return 1;
+}
+
+WSLUA_CONSTRUCTOR Ring_create(lua_State *L) {
+    /* Creates a ring, for its producer, replacing any ring of the same name. */
+#define WSLUA_ARG_Ring_create_NAME 1 /* The name of the ring, such as "/capture". */
+#define WSLUA_ARG_Ring_create_SLOTS 2 /* The number of records it holds, rounded up to a power of 2. */
+#define WSLUA_ARG_Ring_create_SLOTSIZE 3 /* The size of the largest record, in bytes. */
+    const gchar *name = luaL_checkstring(L, WSLUA_ARG_Ring_create_NAME);
+    lua_Integer nslots = luaL_checkinteger(L, WSLUA_ARG_Ring_create_SLOTS);
+    lua_Integer slotsize = luaL_checkinteger(L, WSLUA_ARG_Ring_create_SLOTSIZE);
+    char err[256];
+    wst_ring *ring;
+
+    luaL_argcheck(L, nslots >= 1 && nslots <= (lua_Integer)WST_RING_MAXSLOTS, WSLUA_ARG_Ring_create_SLOTS, "out of range");
+    luaL_argcheck(L, slotsize >= 1 && slotsize <= (lua_Integer)WST_RING_MAXSLOTSIZE, WSLUA_ARG_Ring_create_SLOTSIZE, "out of range");
+    ring = wst_ring_create(name, (guint32)nslots, (guint32)slotsize, err, sizeof(err));
+    if (ring == NULL)
+        return luaL_error(L, "%s", err);
+    ring_push(L, ring, TRUE);
+    WSLUA_RETURN(1); /* The `Ring`. */
+}
+
+WSLUA_CONSTRUCTOR Ring_open(lua_State *L) {
+    /* Opens a ring made by a producer, for a consumer. */
+#define WSLUA_ARG_Ring_open_NAME 1 /* The name of the ring. */
+    const gchar *name = luaL_checkstring(L, WSLUA_ARG_Ring_open_NAME);
+    char err[256];
+    wst_ring *ring = wst_ring_open(name, err, sizeof(err));
+    if (ring == NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    ring_push(L, ring, FALSE);
+    WSLUA_RETURN(1); /* The `Ring`, or nil and an error message. */
+}
+
+WSLUA_METHOD Ring_push(lua_State *L) {
+    /* Copies records to the ring, in order, and makes them visible to the consumers.
+       It stops at the first record the ring has no free slot for. */
+#define WSLUA_ARG_Ring_push_RECORD 2 /* The record, a Lua string or `Buffer`; more records can follow. */
+    Ring r = ring_check(L, 1);
+    int i, top = lua_gettop(L);
+
+    if (!r->producer)
+        return luaL_error(L, "only the producer can push records");
+    for (i = WSLUA_ARG_Ring_push_RECORD; i <= top; i++) {
+        size_t len;
+        const guchar *data = wslua_checkbytes(L, i, &len);
+        int rc = wst_ring_push(r->ring, data, len);
+        if (rc < 0) {
+            wst_ring_publish(r->ring);
+            return luaL_argerror(L, i, "record larger than a slot");
+        }
+        if (rc == 0)
+            break;
+    }
+    wst_ring_publish(r->ring);
+    lua_pushinteger(L, i - WSLUA_ARG_Ring_push_RECORD);
+    WSLUA_RETURN(1); /* The number of records pushed. */
+}
+
+WSLUA_METHOD Ring_acquire(lua_State *L) {
+    /* Takes a batch of records, releasing the batch held before. */
+#define WSLUA_OPTARG_Ring_acquire_MAX 2 /* The most records to take (default=64). */
+#define WSLUA_OPTARG_Ring_acquire_TIMEOUT 3 /* The seconds to wait for a record, if none is waiting
+                                               (default=0); a negative number waits until one comes. */
+    Ring r = ring_check(L, 1);
+    lua_Integer max = luaL_optinteger(L, WSLUA_OPTARG_Ring_acquire_MAX, RING_BATCH);
+    lua_Number timeout = luaL_optnumber(L, WSLUA_OPTARG_Ring_acquire_TIMEOUT, 0);
+    long ms = timeout < 0 ? -1 : (timeout * 1000 > G_MAXINT32 ? G_MAXINT32 : (long)(timeout * 1000 + 0.5));
+    long got;
+    guint32 i;
+
+    if (r->producer)
+        return luaL_error(L, "only consumers can acquire records");
+    luaL_argcheck(L, max >= 1 && max <= (lua_Integer)WST_RING_MAXSLOTS, WSLUA_OPTARG_Ring_acquire_MAX, "out of range");
+    ring_release(r, TRUE);
+    got = wst_ring_acquire_wait(r->ring, (guint32)max, &r->first, ms);
+    if (got < 0) {
+        lua_pushnil(L);
+        WSLUA_RETURN(1); /* A table of the records, as `Buffer` views: empty if none came in time,
+                            or nil if the producer has closed the ring and every record was taken. */
+    }
+    r->n = (guint32)got;
+
+    if (r->n > r->cap) {
+        struct _wst_buffer **views = (struct _wst_buffer **)realloc(r->views, r->n * sizeof(*views));
+        if (views == NULL) {
+            ring_release(r, FALSE);
+            return luaL_error(L, "out of memory");
+        }
+        r->views = views;
+        r->cap = r->n;
+    }
+
+    lua_settop(L, 1);
+    lua_getfenv(L, 1);
+    lua_createtable(L, (int)r->n, 0);   /* 3: the batch */
+    lua_createtable(L, (int)r->n, 0);   /* 4: its views, anchored while it is held */
+    lua_pushvalue(L, 4);
+    lua_rawseti(L, 2, 1);
+    lua_rawgeti(L, 2, 2);               /* 5: the environment of the views */
+    for (i = 0; i < r->n; i++) {
+        size_t len;
+        const void *rec = wst_ring_record(r->ring, r->first + i, &len);
+        struct _wst_buffer *view = wslua_pushbufferview(L, (const guchar *)rec, len);
+        lua_pushvalue(L, 5);
+        lua_setfenv(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, 4, (int)i + 1);
+        r->views[i] = view;
+        r->nviews = i + 1;
+        lua_rawseti(L, 3, (int)i + 1);
+    }
+    lua_settop(L, 3);
+    return 1;
+}
+
+WSLUA_METHOD Ring_release(lua_State *L) {
+    /* Gives back the batch of records held, once read; its views are closed. */
+    Ring r = ring_check(L, 1);
+    ring_release(r, TRUE);
+    return 0;
+}
+
+WSLUA_METHOD Ring_close(lua_State *L) {
+    /* Closes the ring. A consumer gives back its batch; the producer tells the consumers that
+       no more records will come, and removes the name of the ring. */
+    Ring r = checkRing(L, 1);
+    if (r->ring) {
+        ring_release(r, TRUE);
+        wst_ring_close(r->ring);
+        r->ring = NULL;
+    }
+    return 0;
+}
+
+WSLUA_METAMETHOD Ring__len(lua_State *L) {
+    /* The number of records waiting to be acquired. */
+    Ring r = ring_check(L, 1);
+    lua_pushnumber(L, (lua_Number)wst_ring_pending(r->ring));
+    return 1;
+}
+
+WSLUA_METAMETHOD Ring__tostring(lua_State *L) {
+    Ring r = checkRing(L, 1);
+    if (r->ring)
+        lua_pushfstring(L, "Ring(%d slots of %d bytes)", (int)wst_ring_slots(r->ring), (int)wst_ring_slotsize(r->ring));
+    else
+        lua_pushliteral(L, "Ring(closed)");
+    return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Ring__gc(lua_State *L) {
+    Ring *p = (Ring *)lua_touserdata(L, 1);
+    if (p && *p) {
+        /* the views keep the ring, so they are being collected with it, and may be gone already */
+        if ((*p)->ring) {
+            ring_release(*p, FALSE);
+            wst_ring_close((*p)->ring);
+        }
+        free((*p)->views);
+        free(*p);
+        *p = NULL;
+    }
+    return 0;
+}
+
+WSLUA_METHODS Ring_methods[] = {
+    WSLUA_CLASS_FNREG(Ring,create),
+    WSLUA_CLASS_FNREG(Ring,open),
+    WSLUA_CLASS_FNREG(Ring,push),
+    WSLUA_CLASS_FNREG(Ring,acquire),
+    WSLUA_CLASS_FNREG(Ring,release),
+    WSLUA_CLASS_FNREG(Ring,close),
+    { NULL, NULL }
+};
+
+WSLUA_META Ring_meta[] = {
+    WSLUA_CLASS_MTREG(Ring,len),
+    WSLUA_CLASS_MTREG(Ring,tostring),
+    { NULL, NULL }
+};
+
+LUALIB_API int Ring_register(lua_State* L) {
+    WSLUA_REGISTER_CLASS(Ring);
+    return 0;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local Variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
@@ -52,20 +52,38 @@
 ** cn    - sequence of `n' chars (from/to a string); when packing, n==0 means
            the whole string; when unpacking, n==0 means use the previous
            read number as the string length
-** s  - zero-terminated string
+** sn - zero-terminated string; if n is given, the terminator must be found
+          within n bytes
+** wn - zero-terminated UTF-16 string (current endianness), to/from UTF-8;
+          if n is given, the terminator must be found within n code units
+** Wn - sequence of `n' UTF-16 code units (current endianness), to/from UTF-8;
+          n==0 works like for `c0'
 ** ' ' - ignored
 ** '(' ')'  - stop assigning items. ')' start assigning (padding when packing)
 ** '='      - return current position / offset
+** n<opt>   - repeat option opt n times (not control options)
+** [...]    - group; n[...] repeats the group n times
+** *<opt>, *[...] - repeat count taken from the previous value
 */
 
 #include <assert.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <stdio.h>
 
 #include "wslua.h"
+#include "wst_columns.h"
+#include "wst_layout.h"
+#include "wst_registry.h"
+#include "wst_store.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STRUCT_USE_SSE2
+#endif
 
 /* WSLUA_MODULE Struct Binary encode/decode support
 
@@ -85,6 +103,24 @@
   The main functions are `Struct.pack`, which packs multiple Lua values into a struct-like
   Lua binary string; and `Struct.unpack`, which unpacks multiple Lua values from a given
   struct-like Lua binary string. There are some additional helper functions available as well.
+  A format string used for many records can be compiled once with `Struct.compile`, once for
+  all the Lua states of the process (see also `Struct.share`) and, with
+  `Struct.save_layouts`, for the processes started later, and
+  `Struct.switch` decodes messages whose format is selected by a leading type tag.
+  `Struct.filter` selects, without decoding them into Lua values, the records of an array of
+  fixed-size records that match a predicate, and `Struct.aggregate` computes per-key counts,
+  sums, minimums and maximums over such an array, which `Struct.sort` sorts by a key and
+  `Struct.bsearch` searches once sorted; `Struct.index` builds a hash index of one by key.
+  These also read arrays mapped from files into a `Buffer`. `Struct.cache` makes a bounded
+  cache of decoded records, for data decoded again and again, and `Struct.parallel_unpack`
+  decodes a large array into native columns on several threads. Under LuaJIT,
+  `Struct.compile_ffi` turns a fixed-size format into a plain Lua function that reads
+  the fields through the FFI, so that it can be compiled into the trace of the calling loop,
+  and `Struct.to_cdef` translates one into a C struct declaration to cast record pointers to.
+  Unix builds can also specialize named formats at build time (see `src/wst_formats.txt`):
+  each gets a `Struct.unpack_<name>(data [, pos])` and a `Struct.pack_<name>(...)`, which
+  behave like `Struct.unpack` and `Struct.pack` with the format, and `Struct.generated`
+  maps the names to their formats.
 
   All functions in the Struct library are called as static member functions, not object methods,
   so they are invoked as "Struct.pack(...)" instead of "object:pack(...)".
@@ -118,6 +154,14 @@
     * `++f++' a float (native size).
     * `++d++' a double (native size).
     * `++s++' a zero-terminated string.
+    * `++s++__n__' like `++s++', but the terminator must be found within 'n' bytes (including the
+      terminator itself), so a malformed string cannot make unpacking scan the rest of the data.
+    * `++w++' a zero-terminated UTF-16 string, in the current endianness, converted to/from a UTF-8
+      Lua string. Invalid surrogates are replaced with U+FFFD.
+    * `++w++__n__' like `++w++', but the terminator must be found within 'n' code units.
+    * `++W++__n__' a sequence of exactly 'n' UTF-16 code units, converted to/from a UTF-8 Lua string.
+      An absent 'n' means 1. `++W0++' takes 'n' from the length of the given string when packing,
+      and from the previous unpacked value when unpacking, like `++c0++'.
     * `++c++__n__' a sequence of exactly 'n' chars corresponding to a single Lua string. An absent 'n'
       means 1. When packing, the given string must have at least 'n' characters (extra
       characters are discarded).
@@ -128,6 +172,14 @@
     * `++X++__n__' pad to 'n' alignment, default MAXALIGN.
     * `++(++' to stop assigning items, and `++)++' start assigning (padding when packing).
     * `++=++' to return the current position / offset.
+    * __n__ in front of an element repeats it 'n' times, e.g. `++16I4++' is sixteen 4-byte integers.
+      Control options such as `++>++' or `++!++' cannot be repeated. As options like `++I++' and
+      `++c++' take a number themselves, `++I 4B++' and `++I4B++' differ: separate them with a space.
+    * `++[++' and `++]++' group elements, so a repeat count in front of `++[++' repeats the whole group,
+      e.g. `++3[B >H]++'. Groups use brackets because `++(++' and `++)++' already mean "do not assign".
+    * `++*++' in front of an element or group is a repeat count taken from the previous value:
+      when packing, the previous argument; when unpacking, the previous unpacked value (which is
+      then not returned, like for `++c0++'). `Struct.size` and `Struct.values` reject it.
 
   [NOTE]
   ====
@@ -212,29 +264,13 @@ static int getnum (const gchar **fmt, int df) {
 
 /* gets size (number of bytes) for a given type */
 static size_t optsize (lua_State *L, gchar opt, const gchar **fmt) {
-  switch (opt) {
-    case 'B': case 'b': return sizeof(gchar);
-    case 'H': case 'h': return sizeof(gshort);
-    case 'L': case 'l': return sizeof(glong);
-    case 'E': case 'e': return sizeof(gint64);
-    case 'T': return sizeof(size_t);
-    case 'f': return sizeof(gfloat);
-    case 'd': return sizeof(gdouble);
-    case 'x': return getnum(fmt, 1);
-    case 'X': return getnum(fmt, MAXALIGN);
-    case 'c': return getnum(fmt, 1);
-    case 'i': case 'I': {
-      int sz = getnum(fmt, sizeof(int));
-      if (sz > MAXINTSIZE)
-        luaL_error(L, "integral size %d is larger than limit of %d",
-                       sz, MAXINTSIZE);
-      return sz;
-    }
-    case 's': case ' ':
-    case '<': case '>':
-    case '(': case ')':
-    case '!': case '=':
-              return 0;  /* these cases do not have a size */
+  size_t size = 0;
+  switch (wst_optsize(opt, fmt, &size)) {
+    case WST_OK:
+      return size;
+    case WST_EINTSIZE:
+      return luaL_error(L, "integral size %d is larger than limit of %d",
+                        (int)size, MAXINTSIZE);
     default: {
       const gchar *msg = lua_pushfstring(L, "invalid format option [%c]", opt);
       return luaL_argerror(L, 1, msg);
@@ -248,7 +284,7 @@ static size_t optsize (lua_State *L, gchar opt, const gchar **fmt) {
 ** at current position 'len'
 */
 static int gettoalign (size_t len, Header *h, int opt, size_t size) {
-  if (size == 0 || opt == 'c' || opt == 's') return 0;
+  if (size == 0 || opt == 'c' || opt == 's' || opt == 'w' || opt == 'W') return 0;
   if (size > (size_t)h->align)
     size = h->align;  /* respect max. alignment */
   return (int)((size - (len & (size - 1))) & (size - 1));
@@ -280,6 +316,61 @@ static void controloptions (lua_State *L, int opt, const gchar **fmt,
   }
 }
 
+#define iscontrolopt(opt) \
+  ((opt) == ' ' || (opt) == '<' || (opt) == '>' || (opt) == '(' || (opt) == ')' || (opt) == '!')
+
+/* getrepeat() result for '*', a count taken from the previous value */
+#define REPEAT_PREV     (-1)
+
+/* maximum nesting of '[' ']' groups */
+#define MAXGROUPDEPTH   32
+
+/*
+** Gets the optional repeat count in front of an option or a '[' group and
+** the option (or '[') itself. Returns the count, REPEAT_PREV for '*', or 1.
+*/
+static long getrepeat (lua_State *L, const gchar **fmt, const gchar *fmtend, int *opt) {
+  long count = 1;
+  gboolean prefix = TRUE;
+  if (**fmt == '*') {
+    count = REPEAT_PREV;
+    (*fmt)++;
+  }
+  else if (g_ascii_isdigit(**fmt)) {
+    count = 0;
+    do {
+      if (count > (G_MAXINT - 9) / 10)
+        luaL_error(L, "repeat count too large");
+      count = count*10 + *((*fmt)++) - '0';
+    } while (g_ascii_isdigit(**fmt));
+  }
+  else
+    prefix = FALSE;
+  if (prefix) {
+    if (*fmt == fmtend)
+      luaL_error(L, "missing option after repeat count");
+    if (iscontrolopt(**fmt))
+      luaL_error(L, "control option '%c' cannot be repeated", **fmt);
+  }
+  *opt = *(*fmt)++;
+  return count;
+}
+
+/* Gets the ']' that closes the group whose content starts at 'fmt' */
+static const gchar *groupend (lua_State *L, const gchar *fmt, const gchar *fmtend) {
+  int depth = 1;
+  for (; fmt < fmtend; fmt++) {
+    if (*fmt == '[') {
+      if (++depth > MAXGROUPDEPTH)
+        luaL_error(L, "groups nested too deeply");
+    }
+    else if (*fmt == ']' && --depth == 0)
+      return fmt;
+  }
+  luaL_error(L, "missing ']' in format");
+  return NULL;
+}
+
 /* Encodes a Lua number as an integer of given size and endianness into a string struct */
 static void putinteger (lua_State *L, luaL_Buffer *b, int arg, int endian,
                         int size) {
@@ -322,86 +413,311 @@ static void correctbytes (gchar *b, int size, int endian) {
   }
 }
 
+/* Returns the index of the first zero code unit in the UTF-16 string 's' of
+ * 'units' code units, or 'units' if there is none. A zero unit is zero in
+ * either byte order, so this does not need to know the endianness.
+ */
+static size_t utf16_nul (const guchar *s, size_t units) {
+  size_t i = 0;
+#ifdef STRUCT_USE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= units; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i*2));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+    if (mask) {
+      while (!(mask & 3)) { mask >>= 2; i++; }
+      return i;
+    }
+  }
+#else
+  for (; i + 4 <= units; i += 4) {
+    guint64 v;
+    memcpy(&v, s + i*2, sizeof(v));
+    /* a 16-bit lane is zero iff this leaves its high bit set */
+    if ((v - G_GUINT64_CONSTANT(0x0001000100010001)) & ~v & G_GUINT64_CONSTANT(0x8000800080008000))
+      break;
+  }
+#endif
+  for (; i < units; i++) {
+    if (s[i*2] == 0 && s[i*2+1] == 0)
+      break;
+  }
+  return i;
+}
+
+#define utf16_unit(s,endian) \
+  ((endian) == BIG ? (guint)(((s)[0] << 8) | (s)[1]) : (guint)(((s)[1] << 8) | (s)[0]))
 
-WSLUA_CONSTRUCTOR Struct_pack (lua_State *L) {
-  /* Returns a string containing the values arg1, arg2, etc. packed/encoded according to the format string. */
-#define WSLUA_ARG_Struct_pack_FORMAT 1 /* The format string */
-#define WSLUA_ARG_Struct_pack_VALUE  2 /* One or more Lua value(s) to encode, based on the given format. */
+/* Appends 'c' encoded as UTF-8 to 'p', returns the new end */
+static gchar *utf8_put (gchar *p, guint c) {
+  if (c < 0x80) {
+    *p++ = (gchar)c;
+  } else if (c < 0x800) {
+    *p++ = (gchar)(0xC0 | (c >> 6));
+    *p++ = (gchar)(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    *p++ = (gchar)(0xE0 | (c >> 12));
+    *p++ = (gchar)(0x80 | ((c >> 6) & 0x3F));
+    *p++ = (gchar)(0x80 | (c & 0x3F));
+  } else {
+    *p++ = (gchar)(0xF0 | (c >> 18));
+    *p++ = (gchar)(0x80 | ((c >> 12) & 0x3F));
+    *p++ = (gchar)(0x80 | ((c >> 6) & 0x3F));
+    *p++ = (gchar)(0x80 | (c & 0x3F));
+  }
+  return p;
+}
+
+/* Pushes the UTF-8 conversion of 'units' UTF-16 code units at 's'. Runs of
+ * ASCII are validated and narrowed 8 units at a time; unpaired surrogates
+ * become U+FFFD.
+ */
+static void pushutf16 (lua_State *L, const guchar *s, size_t units, int endian) {
   luaL_Buffer b;
-  const char *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_pack_FORMAT);
-  Header h;
-  int poscnt = 0;
-  int posBuf[10];
-  int arg = 2;
-  size_t totalsize = 0;
-  defaultoptions(&h);
-  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  gchar chunk[256];
+  gchar *p = chunk;
+  size_t i = 0;
   luaL_buffinit(L, &b);
-  while (*fmt != '\0') {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    int toalign = gettoalign(totalsize, &h, opt, size);
-    totalsize += toalign;
-    while (toalign-- > 0) luaL_addchar(&b, '\0');
-    if (opt == 'X') size = 0; /* 'X' is about alignment, not size */
-    if (h.noassign && size) opt = 'x'; /* for pack, "(i4)" is the same as "x4" */
-    switch (opt) {
-      case 'b': case 'B': case 'h': case 'H':
-      case 'l': case 'L': case 'T': case 'i': case 'I': {  /* integer types */
-        putinteger(L, &b, arg++, h.endian, (int)size);
-        break;
-      }
-      case 'e': {
-        Int64_pack(L, &b, arg++, h.endian == LITTLE);
-        break;
-      }
-      case 'E': {
-        UInt64_pack(L, &b, arg++, h.endian == LITTLE);
-        break;
+  while (i < units) {
+    guint c;
+    if (p > chunk + sizeof(chunk) - 8) {
+      luaL_addlstring(&b, chunk, p - chunk);
+      p = chunk;
+    }
+#ifdef STRUCT_USE_SSE2
+    if (i + 8 <= units) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i*2));
+      if (endian != LITTLE)
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)),
+                                            _mm_setzero_si128())) == 0xFFFF) {
+        _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(v, v));
+        p += 8;
+        i += 8;
+        continue;
       }
-      case 'x': case 'X': {
-        size_t len = size;
-        while (len-- > 0)
-          luaL_addchar(&b, '\0');
-        break;
+    }
+#endif
+    c = utf16_unit(s + i*2, endian);
+    i++;
+    if (c >= 0xD800 && c <= 0xDBFF) {
+      guint lo = (i < units) ? utf16_unit(s + i*2, endian) : 0;
+      if (lo >= 0xDC00 && lo <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+        i++;
+      } else {
+        c = 0xFFFD;
       }
-      case 'f': {
-        gfloat f = (gfloat)luaL_checknumber(L, arg++);
-        correctbytes((gchar *)&f, (int)size, h.endian);
-        luaL_addlstring(&b, (gchar *)&f, size);
-        break;
+    } else if (c >= 0xDC00 && c <= 0xDFFF) {
+      c = 0xFFFD;
+    }
+    p = utf8_put(p, c);
+  }
+  luaL_addlstring(&b, chunk, p - chunk);
+  luaL_pushresult(&b);
+}
+
+/* Decodes one code point from the UTF-8 string 's' of length 'len' into '*c',
+ * returns the number of bytes used; invalid sequences decode as U+FFFD.
+ */
+static size_t utf8_get (const guchar *s, size_t len, guint *c) {
+  guint v = s[0];
+  size_t n, i;
+  if (v < 0x80) { *c = v; return 1; }
+  else if (v >= 0xC2 && v <= 0xDF) { n = 2; v &= 0x1F; }
+  else if (v >= 0xE0 && v <= 0xEF) { n = 3; v &= 0x0F; }
+  else if (v >= 0xF0 && v <= 0xF4) { n = 4; v &= 0x07; }
+  else { *c = 0xFFFD; return 1; }
+  if (n > len) { *c = 0xFFFD; return 1; }
+  for (i = 1; i < n; i++) {
+    if ((s[i] & 0xC0) != 0x80) { *c = 0xFFFD; return i; }
+    v = (v << 6) | (s[i] & 0x3F);
+  }
+  if ((n == 3 && (v < 0x800 || (v >= 0xD800 && v <= 0xDFFF))) ||
+      (n == 4 && (v < 0x10000 || v > 0x10FFFF)))
+    v = 0xFFFD;
+  *c = v;
+  return n;
+}
+
+/* Adds the UTF-16 encoding of the UTF-8 string 's' to the buffer, stopping
+ * before exceeding 'maxunits' code units; returns the number of code units
+ * added, and sets '*used' to the number of bytes of 's' converted.
+ */
+static size_t addutf16 (luaL_Buffer *b, const guchar *s, size_t len, int endian,
+                        size_t maxunits, size_t *used) {
+  size_t i = 0, units = 0;
+  while (i < len && units < maxunits) {
+    guint c, w[2];
+    int n = 1, k;
+    size_t step = utf8_get(s + i, len - i, &c);
+    if (c >= 0x10000) {
+      if (units + 2 > maxunits) break;
+      c -= 0x10000;
+      w[0] = 0xD800 | (c >> 10);
+      w[1] = 0xDC00 | (c & 0x3FF);
+      n = 2;
+    } else {
+      w[0] = c;
+    }
+    i += step;
+    for (k = 0; k < n; k++) {
+      if (endian == BIG) {
+        luaL_addchar(b, (gchar)(w[k] >> 8));
+        luaL_addchar(b, (gchar)(w[k] & 0xFF));
+      } else {
+        luaL_addchar(b, (gchar)(w[k] & 0xFF));
+        luaL_addchar(b, (gchar)(w[k] >> 8));
       }
-      case 'd': {
-        gdouble d = luaL_checknumber(L, arg++);
-        correctbytes((gchar *)&d, (int)size, h.endian);
-        luaL_addlstring(&b, (gchar *)&d, size);
-        break;
+    }
+    units += n;
+  }
+  *used = i;
+  return units;
+}
+
+/* the state of Struct.pack */
+typedef struct PackState {
+  luaL_Buffer b;
+  Header h;
+  int arg;            /* the next argument to pack */
+  size_t totalsize;
+  int poscnt;
+  int posBuf[10];
+} PackState;
+
+/* Packs one element of option 'opt' */
+static void pack_element (lua_State *L, PackState *ps, int opt, size_t size, size_t bound) {
+  luaL_Buffer *b = &ps->b;
+  int toalign = gettoalign(ps->totalsize, &ps->h, opt, size);
+  ps->totalsize += toalign;
+  while (toalign-- > 0) luaL_addchar(b, '\0');
+  if (opt == 'X') size = 0; /* 'X' is about alignment, not size */
+  if (ps->h.noassign && size) opt = 'x'; /* for pack, "(i4)" is the same as "x4" */
+  switch (opt) {
+    case 'b': case 'B': case 'h': case 'H':
+    case 'l': case 'L': case 'T': case 'i': case 'I': {  /* integer types */
+      putinteger(L, b, ps->arg++, ps->h.endian, (int)size);
+      break;
+    }
+    case 'e': {
+      Int64_pack(L, b, ps->arg++, ps->h.endian == LITTLE);
+      break;
+    }
+    case 'E': {
+      UInt64_pack(L, b, ps->arg++, ps->h.endian == LITTLE);
+      break;
+    }
+    case 'x': case 'X': {
+      size_t len = size;
+      while (len-- > 0)
+        luaL_addchar(b, '\0');
+      break;
+    }
+    case 'f': {
+      gfloat f = (gfloat)luaL_checknumber(L, ps->arg++);
+      correctbytes((gchar *)&f, (int)size, ps->h.endian);
+      luaL_addlstring(b, (gchar *)&f, size);
+      break;
+    }
+    case 'd': {
+      gdouble d = luaL_checknumber(L, ps->arg++);
+      correctbytes((gchar *)&d, (int)size, ps->h.endian);
+      luaL_addlstring(b, (gchar *)&d, size);
+      break;
+    }
+    case 'c': case 's': {
+      size_t l;
+      int arg = ++ps->arg;
+      const gchar *s = luaL_checklstring(L, arg - 1, &l);
+      if (size == 0) size = l;
+      luaL_argcheck(L, l >= (size_t)size, arg, "string too short");
+      luaL_argcheck(L, bound == 0 || size < bound, arg - 1, "string too long");
+      luaL_addlstring(b, s, size);
+      if (opt == 's') {
+        luaL_addchar(b, '\0');  /* add zero at the end */
+        size++;
       }
-      case 'c': case 's': {
-        size_t l;
-        const gchar *s = luaL_checklstring(L, arg++, &l);
-        if (size == 0) size = l;
-        luaL_argcheck(L, l >= (size_t)size, arg, "string too short");
-        luaL_addlstring(&b, s, size);
-        if (opt == 's') {
-          luaL_addchar(&b, '\0');  /* add zero at the end */
-          size++;
-        }
-        break;
+      break;
+    }
+    case 'w': case 'W': {
+      size_t l, used, units;
+      int arg = ++ps->arg;
+      const gchar *s = luaL_checklstring(L, arg - 1, &l);
+      size_t maxunits = (opt == 'W' && size) ? size / 2 : (bound ? bound - 1 : (size_t)-1);
+      units = addutf16(b, (const guchar *)s, l, ps->h.endian, maxunits, &used);
+      if (opt == 'W' && size)
+        luaL_argcheck(L, units == maxunits, arg - 1, "string too short");
+      else
+        luaL_argcheck(L, used == l, arg - 1, "string too long");
+      size = units * 2;
+      if (opt == 'w') {
+        luaL_addchar(b, '\0');  /* add zero code unit at the end */
+        luaL_addchar(b, '\0');
+        size += 2;
       }
-      case '=': {
-        if (poscnt < (int)(sizeof(posBuf)/sizeof(posBuf[0])))
-          posBuf[poscnt++] = (int)totalsize + 1;
-        break;
+      break;
+    }
+    case '=': {
+      if (ps->poscnt < (int)(sizeof(ps->posBuf)/sizeof(ps->posBuf[0])))
+        ps->posBuf[ps->poscnt++] = (int)ps->totalsize + 1;
+      break;
+    }
+    default: break;
+  }
+  ps->totalsize += size;
+}
+
+/* Packs the elements of the format between 'fmt' and 'fmtend' */
+static void pack_range (lua_State *L, PackState *ps, const gchar *fmt, const gchar *fmtend) {
+  while (fmt < fmtend) {
+    int opt;
+    long count = getrepeat(L, &fmt, fmtend, &opt);
+    if (count == REPEAT_PREV) {  /* the previous argument is the count */
+      if (ps->arg <= 2)
+        luaL_error(L, "repeat count `*' needs a previous value");
+      count = (long)wslua_toguint32(L, ps->arg - 1);
+    }
+    if (opt == '[') {
+      const gchar *gend = groupend(L, fmt, fmtend);
+      while (count-- > 0)
+        pack_range(L, ps, fmt, gend);
+      fmt = gend + 1;
+    }
+    else if (iscontrolopt(opt)) {
+      controloptions(L, opt, &fmt, &ps->h);
+    }
+    else {
+      size_t bound = 0;
+      size_t size = optsize(L, opt, &fmt);
+      if (opt == 's' || opt == 'w') {  /* the number is a maximum length */
+        bound = size;
+        size = 0;
       }
-      default: controloptions(L, opt, &fmt, &h);
+      while (count-- > 0)
+        pack_element(L, ps, opt, size, bound);
     }
-    totalsize += size;
   }
-  luaL_pushresult(&b);
-  for (arg = 0; arg < poscnt; arg++)
-    lua_pushinteger(L, posBuf[arg]);
-  WSLUA_RETURN(poscnt + 1); /* The packed binary Lua string, plus any positions due to '=' being used in format. */
+}
+
+WSLUA_CONSTRUCTOR Struct_pack (lua_State *L) {
+  /* Returns a string containing the values arg1, arg2, etc. packed/encoded according to the format string. */
+#define WSLUA_ARG_Struct_pack_FORMAT 1 /* The format string */
+#define WSLUA_ARG_Struct_pack_VALUE  2 /* One or more Lua value(s) to encode, based on the given format. */
+  const char *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_pack_FORMAT);
+  PackState ps;
+  int i;
+  defaultoptions(&ps.h);
+  ps.arg = 2;
+  ps.totalsize = 0;
+  ps.poscnt = 0;
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &ps.b);
+  pack_range(L, &ps, fmt, fmt + strlen(fmt));
+  luaL_pushresult(&ps.b);
+  for (i = 0; i < ps.poscnt; i++)
+    lua_pushinteger(L, ps.posBuf[i]);
+  WSLUA_RETURN(ps.poscnt + 1); /* The packed binary Lua string, plus any positions due to '=' being used in format. */
 }
 
 /* Decodes an integer from a string struct into a Lua number, based on
@@ -436,101 +752,377 @@ static lua_Number getinteger (const gchar *buff, int endian,
 
 #define b_pushnumber(n) { if (!h.noassign) lua_pushnumber(L, (lua_Number)(n)); }
 
+/* errors in the data being unpacked; the functions that do not raise them return their codes */
+#define UNPACK_OK           0
+#define UNPACK_ESHORT       1   /* data string too short */
+#define UNPACK_EUNFINISHED  2   /* no terminator before the end of the data */
+#define UNPACK_EBOUND       3   /* no terminator within the maximum length */
+#define UNPACK_ENOSIZE_C    4   /* 'c0' without a previous number */
+#define UNPACK_ENOSIZE_W    5   /* 'W0' without a previous number */
+#define UNPACK_ENOCOUNT     6   /* '*' without a previous number */
+
+static const gchar *const unpack_codes[] = {
+  NULL, "short", "unfinished", "bound", "nosize", "nosize", "nosize"
+};
+
+/* Raises the error for an unpack error code */
+static int unpack_error (lua_State *L, int code) {
+  switch (code) {
+    case UNPACK_ESHORT: return luaL_argerror(L, 2, "data string too short");
+    case UNPACK_EUNFINISHED: return luaL_error(L, "unfinished string in data");
+    case UNPACK_EBOUND: return luaL_error(L, "string exceeds maximum length");
+    case UNPACK_ENOSIZE_C: return luaL_error(L, "format `c0' needs a previous size");
+    case UNPACK_ENOSIZE_W: return luaL_error(L, "format `W0' needs a previous size");
+    default: return luaL_error(L, "repeat count `*' needs a previous number");
+  }
+}
+
+/* Returns nil, the code of an unpack error and the position where it happened */
+static int unpack_fail (lua_State *L, int code, size_t pos) {
+  lua_pushnil(L);
+  lua_pushstring(L, unpack_codes[code]);
+  lua_pushinteger(L, (lua_Integer)pos + 1);
+  return 3;
+}
+
+/* Decodes the element described by 'f' from data+pos and pushes its value,
+ * unless it is in a '(' ')' section; stores the number of bytes it used in
+ * *used. Returns UNPACK_OK or an error code.
+ * This is shared by Struct.unpack and compiled layouts so they cannot differ.
+ */
+static int unpack_element (lua_State *L, const wst_field *f, const gchar *data,
+                           size_t ld, size_t pos, size_t *used) {
+  size_t size = f->size;
+  gboolean noassign = f->flags & WST_NOASSIGN;
+  switch (f->opt) {
+    case 'b': case 'B': case 'h': case 'H':
+    case 'l': case 'L': case 'T': case 'i':  case 'I': {  /* integer types */
+      int issigned = g_ascii_islower(f->opt);
+      lua_Number res = getinteger(data+pos, f->endian, issigned, (int)size);
+      lua_pushnumber(L, res);
+      break;
+    }
+    case 'e': {
+      Int64_unpack(L, data+pos, f->endian == LITTLE);
+      break;
+    }
+    case 'E': {
+      UInt64_unpack(L, data+pos, f->endian == LITTLE);
+      break;
+    }
+    case 'x': case 'X': {
+      break;
+    }
+    case 'f': {
+      gfloat fl;
+      memcpy(&fl, data+pos, size);
+      correctbytes((gchar *)&fl, sizeof(fl), f->endian);
+      lua_pushnumber(L, fl);
+      break;
+    }
+    case 'd': {
+      gdouble d;
+      memcpy(&d, data+pos, size);
+      correctbytes((gchar *)&d, sizeof(d), f->endian);
+      lua_pushnumber(L, d);
+      break;
+    }
+    case 'c': {
+      if (size == 0) {
+        if (!lua_isnumber(L, -1))
+          return UNPACK_ENOSIZE_C;
+        size = wslua_toguint32(L, -1);
+        lua_pop(L, 1);
+        if (pos+size > ld)
+          return UNPACK_ESHORT;
+      }
+      if (!noassign)
+        lua_pushlstring(L, data+pos, size);
+      break;
+    }
+    case 's': {
+      size_t avail = ld - pos;
+      gboolean bounded = f->bound && f->bound < avail;
+      const gchar *e = (const char *)memchr(data+pos, '\0', bounded ? f->bound : avail);
+      if (e == NULL)
+        return bounded ? UNPACK_EBOUND : UNPACK_EUNFINISHED;
+      size = (e - (data+pos)) + 1;
+      if (!noassign)
+        lua_pushlstring(L, data+pos, size - 1);
+      break;
+    }
+    case 'w': {
+      size_t avail = (ld - pos) / 2;
+      gboolean bounded = f->bound && f->bound < avail;
+      size_t n = utf16_nul((const guchar *)data+pos, bounded ? f->bound : avail);
+      if (n == (bounded ? f->bound : avail))
+        return bounded ? UNPACK_EBOUND : UNPACK_EUNFINISHED;
+      size = (n + 1) * 2;
+      if (!noassign)
+        pushutf16(L, (const guchar *)data+pos, n, f->endian);
+      break;
+    }
+    case 'W': {
+      if (size == 0) {
+        if (!lua_isnumber(L, -1))
+          return UNPACK_ENOSIZE_W;
+        size = (size_t)wslua_toguint32(L, -1) * 2;
+        lua_pop(L, 1);
+        if (pos+size > ld)
+          return UNPACK_ESHORT;
+      }
+      if (!noassign)
+        pushutf16(L, (const guchar *)data+pos, size / 2, f->endian);
+      break;
+    }
+    case '=': {
+      lua_pushinteger(L, pos + 1);
+      break;
+    }
+    default:
+      break;
+  }
+  *used = size;
+  return UNPACK_OK;
+}
+
+/*
+** With a result table at stack index 'into', moves the values above 'base'
+** into it, at *n+1 onwards, except for the newest 'keep' ones (which a
+** following 'c0' or 'W0' may still need).
+*/
+static void store_values (lua_State *L, int into, int base, int keep, int *n) {
+  while (lua_gettop(L) > base + keep) {
+    lua_pushvalue(L, base + 1);
+    lua_rawseti(L, into, ++*n);
+    lua_remove(L, base + 1);
+  }
+}
+
+/*
+** Takes the count for a '*' from the value on top of the stack, which must
+** be one of those unpacked since stack index 'base'.
+*/
+static int prevcount (lua_State *L, int base, long *count) {
+  if (lua_gettop(L) <= base || !lua_isnumber(L, -1))
+    return UNPACK_ENOCOUNT;
+  *count = (long)wslua_toguint32(L, -1);
+  lua_pop(L, 1);
+  return UNPACK_OK;
+}
+
+/*
+** Unpacks the elements of the format between 'fmt' and 'fmtend' from
+** data+*ppos, pushing their values, or if 'into' is not 0, storing them in
+** the table at that stack index from index *n+1 onwards and updating *n.
+** 'base' is the stack top before the first value. Returns UNPACK_OK and
+** advances *ppos past them, or returns an error code with *ppos at the
+** element in error. Errors in the format itself are raised.
+*/
+static int unpack_range (lua_State *L, Header *h, const gchar *fmt, const gchar *fmtend,
+                         const gchar *data, size_t ld, size_t *ppos,
+                         int base, int into, int *n) {
+  size_t pos = *ppos;
+  int rc;
+  while (fmt < fmtend) {
+    int opt;
+    long count = getrepeat(L, &fmt, fmtend, &opt);
+    if (count == REPEAT_PREV && (rc = prevcount(L, base, &count)) != UNPACK_OK) {
+      *ppos = pos;
+      return rc;
+    }
+    if (opt == '[') {
+      const gchar *gend = groupend(L, fmt, fmtend);
+      gboolean first = TRUE;
+      while (count-- > 0) {
+        size_t start = pos;
+        int top = lua_gettop(L), stored = into ? *n : 0;
+        rc = unpack_range(L, h, fmt, gend, data, ld, &pos, base, into, n);
+        if (rc != UNPACK_OK) {
+          *ppos = pos;
+          return rc;
+        }
+        /* a repetition that reads nothing and has no values leaves the next ones the same
+           input; after the first one, which may change the options, they do nothing either */
+        if (!first && pos == start && lua_gettop(L) == top && (into ? *n : 0) == stored)
+          break;
+        first = FALSE;
+      }
+      fmt = gend + 1;
+    }
+    else {
+      size_t bound = 0;
+      size_t size = optsize(L, opt, &fmt);
+      wst_field f;
+      if (opt == 's' || opt == 'w') {  /* the number is a maximum length */
+        bound = size;
+        size = 0;
+      }
+      f.opt = (gchar)opt;
+      f.bound = (guint32)bound;
+      while (count-- > 0) {
+        size_t used;
+        pos += gettoalign(pos, h, opt, size);
+        if (pos+size > ld) {
+          *ppos = pos;
+          return UNPACK_ESHORT;
+        }
+        if (opt != 'X' && h->noassign && size > 0) {
+          /* if we're not assigning, and the opt type has a size, then loop again */
+          /* this will not be the case for control options, 'c0', 'W0', 's', 'w', and '=' */
+          pos += size;
+          continue;
+        }
+        if (iscontrolopt(opt)) {
+          controloptions(L, opt, &fmt, h);
+          continue;
+        }
+        f.endian = (guint8)h->endian;
+        f.flags = h->noassign ? WST_NOASSIGN : 0;
+        f.size = (opt == 'X') ? 0 : (guint32)size;
+        luaL_checkstack(L, 1, "too many results");
+        rc = unpack_element(L, &f, data, ld, pos, &used);
+        if (rc != UNPACK_OK) {
+          *ppos = pos;
+          return rc;
+        }
+        pos += used;
+        if (into)
+          store_values(L, into, base, 1, n);
+        /* 'x0', or an 'X' once aligned, reads nothing and has no value: the next
+           repetitions would do nothing either, however large a '*' count the data gives */
+        if (used == 0 && (opt == 'x' || opt == 'X'))
+          break;
+      }
+    }
+  }
+  *ppos = pos;
+  return UNPACK_OK;
+}
+
+/*
+** Unpacks the values of format 'fmt' from data+*ppos, like unpack_range()
+** does for a whole format string.
+*/
+static int unpack_format (lua_State *L, const gchar *fmt, const gchar *data,
+                          size_t ld, size_t *ppos, int into, int *n) {
+  Header h;
+  int base = lua_gettop(L);
+  int rc;
+  defaultoptions(&h);
+  rc = unpack_range(L, &h, fmt, fmt + strlen(fmt), data, ld, ppos, base, into, n);
+  if (rc == UNPACK_OK && into)
+    store_values(L, into, base, 0, n);
+  return rc;
+}
+
 WSLUA_CONSTRUCTOR Struct_unpack (lua_State *L) {
   /*  Unpacks/decodes multiple Lua values from a given struct-like binary Lua string.
       The number of returned values depends on the format given, plus an additional value of the position where it stopped reading is returned. */
 #define WSLUA_ARG_Struct_unpack_FORMAT 1 /* The format string */
-#define WSLUA_ARG_Struct_unpack_STRUCT 2 /* The binary Lua string to unpack */
+#define WSLUA_ARG_Struct_unpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
 #define WSLUA_OPTARG_Struct_unpack_BEGIN  3 /* The position to begin reading from (default=1) */
-  Header h;
   const char *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_unpack_FORMAT);
   size_t ld;
-  const char *data = wslua_checklstring_only(L, WSLUA_ARG_Struct_unpack_STRUCT, &ld);
+  const char *data = (const char *)wslua_checkbytes(L, WSLUA_ARG_Struct_unpack_STRUCT, &ld);
   size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_unpack_BEGIN, 1) - 1;
-  defaultoptions(&h);
+  int rc;
+  lua_settop(L, 2);
+  rc = unpack_format(L, fmt, data, ld, &pos, 0, NULL);
+  if (rc != UNPACK_OK)
+    return unpack_error(L, rc);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* One or more values based on format, plus the position it stopped unpacking. */
+}
+
+WSLUA_CONSTRUCTOR Struct_tryunpack (lua_State *L) {
+  /* Like `Struct.unpack()`, but malformed data makes it return nil, an error code and the position
+     of the element in error, instead of raising an error. The error codes are "short" (the data
+     ends too early), "unfinished" (no string terminator), "bound" (no string terminator within the
+     maximum length) and "nosize" (no number before a `c0` or `W0`). Errors in the format string
+     are still raised. */
+#define WSLUA_ARG_Struct_tryunpack_FORMAT 1 /* The format string */
+#define WSLUA_ARG_Struct_tryunpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Struct_tryunpack_BEGIN  3 /* The position to begin reading from (default=1) */
+  const char *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_tryunpack_FORMAT);
+  size_t ld;
+  const char *data = (const char *)wslua_checkbytes(L, WSLUA_ARG_Struct_tryunpack_STRUCT, &ld);
+  size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_tryunpack_BEGIN, 1) - 1;
+  int rc;
   lua_settop(L, 2);
-  while (*fmt) {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    pos += gettoalign(pos, &h, opt, size);
-    luaL_argcheck(L, pos+size <= ld, 2, "data string too short");
-
-    if (opt == 'X') size = 0;
-    if (h.noassign && size > 0) {
-      /* if we're not assigning, and the opt type has a size, then loop again */
-      /* this will not be the case for control options, 'c0', 's', and '=' */
-      pos += size;
+  rc = unpack_format(L, fmt, data, ld, &pos, 0, NULL);
+  if (rc != UNPACK_OK)
+    return unpack_fail(L, rc, pos);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* One or more values based on format, plus the position it stopped unpacking;
+                                      or nil, an error code and a position. */
+}
+
+
+WSLUA_CONSTRUCTOR Struct_unpack_into (lua_State *L) {
+  /* Like `Struct.unpack()`, but stores the values in a table at indices 1 to n instead of returning
+     them, so the same table can be reused for every record and wide formats do not grow the Lua
+     stack. Entries after the last value are left untouched. */
+#define WSLUA_ARG_Struct_unpack_into_TABLE 1 /* The table to store the values in */
+#define WSLUA_ARG_Struct_unpack_into_FORMAT 2 /* The format string */
+#define WSLUA_ARG_Struct_unpack_into_STRUCT 3 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Struct_unpack_into_BEGIN  4 /* The position to begin reading from (default=1) */
+  const char *fmt;
+  size_t ld;
+  const char *data;
+  size_t pos;
+  int rc, n = 0;
+  luaL_checktype(L, WSLUA_ARG_Struct_unpack_into_TABLE, LUA_TTABLE);
+  fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_unpack_into_FORMAT);
+  data = (const char *)wslua_checkbytes(L, WSLUA_ARG_Struct_unpack_into_STRUCT, &ld);
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_unpack_into_BEGIN, 1) - 1;
+  lua_settop(L, 3);
+  rc = unpack_format(L, fmt, data, ld, &pos, WSLUA_ARG_Struct_unpack_into_TABLE, &n);
+  if (rc != UNPACK_OK) {
+    if (rc == UNPACK_ESHORT)  /* the data is argument 3 here */
+      return luaL_argerror(L, WSLUA_ARG_Struct_unpack_into_STRUCT, "data string too short");
+    return unpack_error(L, rc);
+  }
+  lua_pushinteger(L, pos + 1);
+  lua_pushinteger(L, n);
+  WSLUA_RETURN(2); /* The position it stopped unpacking, and the number of values stored. */
+}
+
+
+/* Adds the size of the elements of the format between 'fmt' and 'fmtend' to *pos */
+static void size_range (lua_State *L, Header *h, const gchar *fmt, const gchar *fmtend, size_t *pos) {
+  while (fmt < fmtend) {
+    int opt;
+    long count = getrepeat(L, &fmt, fmtend, &opt);
+    if (count == REPEAT_PREV)
+      luaL_argerror(L, 1, "repeat count '*' has no fixed size");
+    if (opt == '[') {
+      const gchar *gend = groupend(L, fmt, fmtend);
+      while (count-- > 0)
+        size_range(L, h, fmt, gend, pos);
+      fmt = gend + 1;
       continue;
     }
-
-    luaL_checkstack(L, 1, "too many results");
-    switch (opt) {
-      case 'b': case 'B': case 'h': case 'H':
-      case 'l': case 'L': case 'T': case 'i':  case 'I': {  /* integer types */
-        int issigned = g_ascii_islower(opt);
-        lua_Number res = getinteger(data+pos, h.endian, issigned, (int)size);
-        lua_pushnumber(L, res);
-        break;
-      }
-      case 'e': {
-        Int64_unpack(L, data+pos, h.endian == LITTLE);
-        break;
-      }
-      case 'E': {
-        UInt64_unpack(L, data+pos, h.endian == LITTLE);
-        break;
-      }
-      case 'x': case 'X': {
-        break;
-      }
-      case 'f': {
-        gfloat f;
-        memcpy(&f, data+pos, size);
-        correctbytes((gchar *)&f, sizeof(f), h.endian);
-        lua_pushnumber(L, f);
-        break;
-      }
-      case 'd': {
-        gdouble d;
-        memcpy(&d, data+pos, size);
-        correctbytes((gchar *)&d, sizeof(d), h.endian);
-        lua_pushnumber(L, d);
-        break;
-      }
-      case 'c': {
-        if (size == 0) {
-          if (!lua_isnumber(L, -1))
-            luaL_error(L, "format `c0' needs a previous size");
-          size = wslua_toguint32(L, -1);
-          lua_pop(L, 1);
-          luaL_argcheck(L, pos+size <= ld, 2, "data string too short");
-        }
-        if (!h.noassign)
-          lua_pushlstring(L, data+pos, size);
-        break;
-      }
-      case 's': {
-        const gchar *e = (const char *)memchr(data+pos, '\0', ld - pos);
-        if (e == NULL)
-          luaL_error(L, "unfinished string in data");
-        size = (e - (data+pos)) + 1;
-        if (!h.noassign)
-          lua_pushlstring(L, data+pos, size - 1);
-        break;
+    else {
+      size_t size = optsize(L, opt, &fmt);
+      if (opt == 's')
+        luaL_argerror(L, 1, "option 's' has no fixed size");
+      else if (opt == 'w')
+        luaL_argerror(L, 1, "option 'w' has no fixed size");
+      else if (opt == 'c' && size == 0)
+        luaL_argerror(L, 1, "option 'c0' has no fixed size");
+      else if (opt == 'W' && size == 0)
+        luaL_argerror(L, 1, "option 'W0' has no fixed size");
+      while (count-- > 0) {
+        *pos += gettoalign(*pos, h, opt, size);
+        if (!g_ascii_isalnum(opt))
+          controloptions(L, opt, &fmt, h);
+        *pos += size;
       }
-      case '=': {
-        lua_pushinteger(L, pos + 1);
-        break;
-      }
-      default: controloptions(L, opt, &fmt, &h);
     }
-    pos += size;
   }
-  lua_pushinteger(L, pos + 1);
-  WSLUA_RETURN(lua_gettop(L) - 2); /* One or more values based on format, plus the position it stopped unpacking. */
 }
 
-
 WSLUA_CONSTRUCTOR Struct_size (lua_State *L) {
   /* Returns the length of a binary string that would be consumed/handled by the given format string. */
 #define WSLUA_ARG_Struct_size_FORMAT 1 /* The format string */
@@ -538,22 +1130,50 @@ WSLUA_CONSTRUCTOR Struct_size (lua_State *L) {
   const gchar *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_size_FORMAT);
   size_t pos = 0;
   defaultoptions(&h);
-  while (*fmt) {
-    int opt = *fmt++;
-    size_t size = optsize(L, opt, &fmt);
-    pos += gettoalign(pos, &h, opt, size);
-    if (opt == 's')
-      luaL_argerror(L, 1, "option 's' has no fixed size");
-    else if (opt == 'c' && size == 0)
-      luaL_argerror(L, 1, "option 'c0' has no fixed size");
-    if (!g_ascii_isalnum(opt))
-      controloptions(L, opt, &fmt, &h);
-    pos += size;
-  }
+  size_range(L, &h, fmt, fmt + strlen(fmt), &pos);
   lua_pushinteger(L, pos);
   WSLUA_RETURN(1); /* The size number */
 }
 
+/* Returns the number of values of the elements of the format between 'fmt' and 'fmtend' */
+static size_t values_range (lua_State *L, Header *h, const gchar *fmt, const gchar *fmtend) {
+  size_t vals = 0;
+  while (fmt < fmtend) {
+    int opt;
+    long count = getrepeat(L, &fmt, fmtend, &opt);
+    if (count == REPEAT_PREV)
+      luaL_argerror(L, 1, "repeat count '*' has no fixed number of values");
+    if (opt == '[') {
+      const gchar *gend = groupend(L, fmt, fmtend);
+      while (count-- > 0)  /* control options in the group may change what follows */
+        vals += values_range(L, h, fmt, gend);
+      fmt = gend + 1;
+    }
+    else {
+      /* we use a size != 0 to mean it is a value */
+      size_t size = optsize(L, opt, &fmt);
+      /* but some will be zero and not be a value, or vice-versa */
+      switch (opt) {
+        case 's': case 'c': case 'w': case 'W':
+          /* these are values */
+          size = 1;
+          break;
+        case 'x': case 'X':
+          /* these are not */
+          size = 0;
+          break;
+        default:
+          break;
+      }
+      if (!g_ascii_isalnum(opt))
+        controloptions(L, opt, &fmt, h);
+      else if (size && !h->noassign)
+        vals += count;
+    }
+  }
+  return vals;
+}
+
 WSLUA_CONSTRUCTOR Struct_values (lua_State *L) {
   /* Returns the number of Lua values contained in the given format string.
      This will be the number of returned values from a call to Struct.unpack()
@@ -563,31 +1183,8 @@ WSLUA_CONSTRUCTOR Struct_values (lua_State *L) {
 #define WSLUA_ARG_Struct_values_FORMAT 1 /* The format string */
   Header h;
   const gchar *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_values_FORMAT);
-  size_t vals = 0;
   defaultoptions(&h);
-  while (*fmt) {
-    int opt = *fmt++;
-    /* we use a size != 0 to mean it is a value */
-    size_t size = optsize(L, opt, &fmt);
-    /* but some will be zero and not be a value, or vice-versa */
-    switch (opt) {
-      case 's': case 'c':
-        /* these are values */
-        size = 1;
-        break;
-      case 'x': case 'X':
-        /* these are not */
-        size = 0;
-        break;
-      default:
-        break;
-    }
-    if (!g_ascii_isalnum(opt))
-      controloptions(L, opt, &fmt, &h);
-    else if (size && !h.noassign)
-      vals++;
-  }
-  lua_pushinteger(L, vals);
+  lua_pushinteger(L, values_range(L, &h, fmt, fmt + strlen(fmt)));
   WSLUA_RETURN(1); /* The number of values */
 }
 
@@ -629,6 +1226,3547 @@ WSLUA_CONSTRUCTOR Struct_fromhex (lua_State *L) {
   WSLUA_RETURN(1); /* The Lua binary string */
 }
 
+typedef size_t (*addrtostr_func)(char *buf, const uint8_t *addr);
+typedef int (*strtoaddr_func)(const char *s, size_t len, uint8_t *addr);
+
+/* Common part of the address formatters: arg 1 is the binary string, arg 2 the
+ * optional begin position, and args 3/4 the optional batch count and stride. */
+static int addrtostr (lua_State *L, addrtostr_func tostr, size_t addrlen) {
+  gchar buf[WST_IPV6_STRLEN];
+  size_t ld;
+  const gchar *data = wslua_checklstring_only(L, 1, &ld);
+  lua_Integer pos = luaL_optinteger(L, 2, 1) - 1;
+  lua_Integer count, stride, i;
+  luaL_argcheck(L, pos >= 0, 2, "position must be positive");
+
+  if (lua_isnoneornil(L, 3)) {
+    luaL_argcheck(L, (size_t)pos <= ld && addrlen <= ld - (size_t)pos, 1, "data string too short");
+    lua_pushlstring(L, buf, tostr(buf, (const guint8 *)data + pos));
+    return 1;
+  }
+
+  count = luaL_checkinteger(L, 3);
+  stride = luaL_optinteger(L, 4, (lua_Integer)addrlen);
+  luaL_argcheck(L, count >= 0 && count <= INT_MAX, 3, "count out of range");
+  luaL_argcheck(L, stride > 0, 4, "stride must be positive");
+  /* checked without multiplying, which could overflow for a huge count or stride */
+  luaL_argcheck(L, count == 0 || ((size_t)pos <= ld && addrlen <= ld - (size_t)pos
+                                  && (size_t)(count - 1) <= (ld - (size_t)pos - addrlen) / (size_t)stride),
+                1, "data string too short");
+
+  lua_createtable(L, (int)count, 0);
+  for (i = 0; i < count; i++) {
+    lua_pushlstring(L, buf, tostr(buf, (const guint8 *)data + pos + i * stride));
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+  return 1;
+}
+
+/* Common part of the address parsers: arg 1 is either one string, or an array
+ * table of strings whose binary forms are concatenated. */
+static int strtoaddr (lua_State *L, strtoaddr_func fromstr, size_t addrlen) {
+  guint8 addr[16];
+  size_t len;
+  const gchar *s;
+
+  if (!lua_istable(L, 1)) {
+    s = wslua_checklstring_only(L, 1, &len);
+    if (fromstr(s, len, addr))
+      lua_pushlstring(L, (const gchar *)addr, addrlen);
+    else
+      lua_pushnil(L);
+    return 1;
+  }
+  else {
+    luaL_Buffer b;
+    int n = (int)lua_objlen(L, 1);
+    int i;
+    luaL_buffinit(L, &b);
+    for (i = 1; i <= n; i++) {
+      gboolean ok;
+      lua_rawgeti(L, 1, i);
+      s = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : NULL;
+      ok = s && fromstr(s, len, addr);
+      lua_pop(L, 1);
+      if (!ok) {
+        luaL_pushresult(&b);
+        lua_pushnil(L);
+        lua_pushinteger(L, i);
+        return 2;
+      }
+      luaL_addlstring(&b, (const gchar *)addr, addrlen);
+    }
+    luaL_pushresult(&b);
+    return 1;
+  }
+}
+
+WSLUA_CONSTRUCTOR Struct_ipv4tostr (lua_State *L) {
+  /* Converts a 4-byte binary IPv4 address to its dotted-decimal string, or with a count,
+     a column of them into an array table of strings. */
+#define WSLUA_ARG_Struct_ipv4tostr_BYTESTRING 1 /* A Lua binary string containing the address(es). */
+#define WSLUA_OPTARG_Struct_ipv4tostr_BEGIN  2 /* The position of the (first) address (default=1). */
+#define WSLUA_OPTARG_Struct_ipv4tostr_COUNT  3 /* The number of addresses to convert (default=nil, a single address). */
+#define WSLUA_OPTARG_Struct_ipv4tostr_STRIDE 4 /* The distance in bytes between addresses when a count is given (default=4). */
+  WSLUA_RETURN(addrtostr(L, wst_ipv4_to_str, 4)); /* The address string, or an array table of them. */
+}
+
+WSLUA_CONSTRUCTOR Struct_ipv6tostr (lua_State *L) {
+  /* Converts a 16-byte binary IPv6 address to its RFC 5952 canonical string, or with a count,
+     a column of them into an array table of strings. */
+#define WSLUA_ARG_Struct_ipv6tostr_BYTESTRING 1 /* A Lua binary string containing the address(es). */
+#define WSLUA_OPTARG_Struct_ipv6tostr_BEGIN  2 /* The position of the (first) address (default=1). */
+#define WSLUA_OPTARG_Struct_ipv6tostr_COUNT  3 /* The number of addresses to convert (default=nil, a single address). */
+#define WSLUA_OPTARG_Struct_ipv6tostr_STRIDE 4 /* The distance in bytes between addresses when a count is given (default=16). */
+  WSLUA_RETURN(addrtostr(L, wst_ipv6_to_str, 16)); /* The address string, or an array table of them. */
+}
+
+WSLUA_CONSTRUCTOR Struct_ethertostr (lua_State *L) {
+  /* Converts a 6-byte binary Ethernet address to its "xx:xx:xx:xx:xx:xx" string, or with a count,
+     a column of them into an array table of strings. */
+#define WSLUA_ARG_Struct_ethertostr_BYTESTRING 1 /* A Lua binary string containing the address(es). */
+#define WSLUA_OPTARG_Struct_ethertostr_BEGIN  2 /* The position of the (first) address (default=1). */
+#define WSLUA_OPTARG_Struct_ethertostr_COUNT  3 /* The number of addresses to convert (default=nil, a single address). */
+#define WSLUA_OPTARG_Struct_ethertostr_STRIDE 4 /* The distance in bytes between addresses when a count is given (default=6). */
+  WSLUA_RETURN(addrtostr(L, wst_ether_to_str, 6)); /* The address string, or an array table of them. */
+}
+
+WSLUA_CONSTRUCTOR Struct_strtoipv4 (lua_State *L) {
+  /* Converts a dotted-decimal IPv4 address string to its 4-byte binary form. */
+#define WSLUA_ARG_Struct_strtoipv4_ADDRESS 1 /* The address string, or an array table of address strings. */
+  WSLUA_RETURN(strtoaddr(L, wst_str_to_ipv4, 4)); /* The binary string (addresses concatenated for a table),
+                                                         or nil plus the failing table index if invalid. */
+}
+
+WSLUA_CONSTRUCTOR Struct_strtoipv6 (lua_State *L) {
+  /* Converts an IPv6 address string in any RFC 4291 text form to its 16-byte binary form. */
+#define WSLUA_ARG_Struct_strtoipv6_ADDRESS 1 /* The address string, or an array table of address strings. */
+  WSLUA_RETURN(strtoaddr(L, wst_str_to_ipv6, 16)); /* The binary string (addresses concatenated for a table),
+                                                          or nil plus the failing table index if invalid. */
+}
+
+WSLUA_CONSTRUCTOR Struct_strtoether (lua_State *L) {
+  /* Converts an Ethernet address string ("xx:xx:xx:xx:xx:xx", "xx-xx-xx-xx-xx-xx" or
+     "xxxxxxxxxxxx") to its 6-byte binary form. */
+#define WSLUA_ARG_Struct_strtoether_ADDRESS 1 /* The address string, or an array table of address strings. */
+  WSLUA_RETURN(strtoaddr(L, wst_str_to_ether, 6)); /* The binary string (addresses concatenated for a table),
+                                                          or nil plus the failing table index if invalid. */
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Compiled layouts and tag dispatch
+** =======================================================
+*/
+
+typedef wst_layout *Layout;
+
+WSLUA_CLASS_DEFINE(Layout,NOP);
+/* A `Layout` is a format string compiled by `Struct.compile()`. Decoding with it
+   does not re-parse the format, and when every element has a fixed size the
+   element offsets are computed once, at compile time. */
+
+/* A record decoded on access, made by `Layout:view()` */
+typedef struct _wst_view {
+  wst_layout *layout;   /* a fixed layout */
+  const gchar *data;    /* the data string, anchored in the view's environment table */
+  size_t ld;
+  size_t pos;           /* the start of the record in the data */
+} wst_view;
+
+typedef wst_view *View;
+
+WSLUA_CLASS_DEFINE(View,NOP);
+/* A `View` decodes the values of one record only when they are read: `view[i]` is
+   the i-th value `Struct.unpack()` would return for the record, and `view.name` the
+   value given that name by `Struct.compile()`. Each read costs one decode at an offset
+   precomputed in the layout. `#view` is the number of values. Method names take
+   precedence over value names, which can still be read by index. */
+
+/* Dispatches on a tag to one of several layouts, built by `Struct.switch()`.
+   Dense tag ranges use a jump table, sparse ones an open-addressing hash. */
+typedef struct _wst_dispatch {
+  wst_layout *tag;      /* the layout of the tag; its first value is the tag */
+  wst_layout *other;    /* the default layout, or NULL */
+  gboolean dense;       /* TRUE for a jump table indexed by tag - min */
+  lua_Integer min;      /* the smallest tag, for a jump table */
+  guint32 nslots;       /* number of entries in slots[] (a power of 2 for a hash) */
+  struct {
+    lua_Integer tag;
+    wst_layout *layout; /* NULL for an empty slot */
+  } slots[1];
+} wst_dispatch;
+
+typedef wst_dispatch *Dispatcher;
+
+WSLUA_CLASS_DEFINE(Dispatcher,NOP);
+/* A `Dispatcher` decodes a tag and then the layout selected by it, see `Struct.switch()`. */
+
+/* return number of bytes needed to align at 'pos' for the alignment of compiled element 'f' */
+#define fieldalign(pos,f) \
+  ((f)->align ? (((f)->align - ((pos) & ((f)->align - 1))) & ((f)->align - 1)) : 0)
+
+/*
+** Decodes the elements l->fields[i..end) at data+*pos, one at a time, the
+** way unpack_range() does; '[' elements repeat the elements up to their ']'.
+*/
+static int layout_range (lua_State *L, const wst_layout *l, guint32 i, guint32 end,
+                         const gchar *data, size_t ld, size_t *pos,
+                         int base, int into, int *n) {
+  size_t p = *pos, used;
+  int rc;
+  for (; i < end; i++) {
+    const wst_field *f = &l->fields[i];
+    size_t need = (f->opt == 'X') ? f->bound : f->size;
+    long count = f->count;
+    if ((f->flags & WST_PREVCOUNT) && (rc = prevcount(L, base, &count)) != UNPACK_OK) {
+      *pos = p;
+      return rc;
+    }
+    if (f->opt == '[') {
+      while (count-- > 0) {
+        size_t start = p;
+        int top = lua_gettop(L), stored = into ? *n : 0;
+        rc = layout_range(L, l, i + 1, f->bound, data, ld, &p, base, into, n);
+        if (rc != UNPACK_OK) {
+          *pos = p;
+          return rc;
+        }
+        /* a repetition that reads nothing and has no values, such as those of "I4 *[]",
+           leaves the next ones the same input: they would do nothing either */
+        if (p == start && lua_gettop(L) == top && (into ? *n : 0) == stored)
+          break;
+      }
+      i = f->bound;  /* skip the group and its ']' */
+      continue;
+    }
+    while (count-- > 0) {
+      p += fieldalign(p, f);
+      if (p+need > ld) {
+        *pos = p;
+        return UNPACK_ESHORT;
+      }
+      if ((f->flags & WST_NOASSIGN) && f->size > 0) {
+        p += f->size;
+        continue;
+      }
+      luaL_checkstack(L, 1, "too many results");
+      rc = unpack_element(L, f, data, ld, p, &used);
+      if (rc != UNPACK_OK) {
+        *pos = p;
+        return rc;
+      }
+      p += used;
+      if (into)
+        store_values(L, into, base, 1, n);
+      /* as in unpack_range(), 'x0' or an aligned 'X' does nothing once repeated */
+      if (used == 0 && (f->opt == 'x' || f->opt == 'X'))
+        break;
+    }
+  }
+  *pos = p;
+  return UNPACK_OK;
+}
+
+/*
+** Decodes the record described by 'l' at data+*pos, pushing its values
+** exactly like Struct.unpack would, or storing them like unpack_format()
+** does if 'into' is not 0. Returns UNPACK_OK and advances *pos past the
+** record, or returns an error code with *pos at the element in error.
+*/
+static int layout_unpack (lua_State *L, const wst_layout *l, const gchar *data,
+                          size_t ld, size_t *pos, int into, int *n) {
+  size_t p = *pos, used;
+  int base = lua_gettop(L);
+  int rc = UNPACK_OK;
+  guint32 i, k;
+  if (l->fixed && (p & (l->align - 1)) == 0 && p <= ld && l->extent <= ld - p) {
+    /* the precomputed offsets are valid and one bounds check covers the whole
+       record; otherwise layout_range() finds the element in error */
+    if (!into)
+      luaL_checkstack(L, (int)MIN(l->nvalues, G_MAXINT / 2), "too many results");
+    for (i = 0; i < l->nfields; i++) {
+      const wst_field *f = &l->fields[i];
+      size_t off = p + f->offset;
+      if ((f->flags & WST_NOASSIGN) && f->size > 0)
+        continue;
+      for (k = 0; k < f->count; k++, off += f->size) {
+        unpack_element(L, f, data, ld, off, &used);  /* cannot fail */
+        if (into && lua_gettop(L) > base)  /* no 'c0' or 'W0' here: store it right away */
+          lua_rawseti(L, into, ++*n);
+      }
+    }
+    p += l->size;
+  }
+  else {
+    rc = layout_range(L, l, 0, l->nfields, data, ld, &p, base, into, n);
+    if (rc == UNPACK_OK && into)
+      store_values(L, into, base, 0, n);
+  }
+  *pos = p;
+  return rc;
+}
+
+/* Gets a new reference to the layout at 'idx', compiling it if it is a format string */
+static wst_layout *getlayout (lua_State *L, int idx, int arg) {
+  wst_layout *l;
+  gchar err[64];
+  if (isLayout(L, idx))
+    return wst_layout_ref(toLayout(L, idx));
+  if (lua_type(L, idx) != LUA_TSTRING)
+    luaL_argerror(L, arg, "format string or Layout expected");
+  l = wst_layout_compile(lua_tostring(L, idx), err, sizeof(err));
+  if (l == NULL)
+    luaL_argerror(L, arg, err);
+  return l;
+}
+
+WSLUA_CONSTRUCTOR Struct_compile (lua_State *L) {
+  /* Compiles a format string into a `Layout`, for decoding many records of the same format.
+     Compiled layouts are shared by all the Lua states of the process: a format compiled with
+     the same names in any state, in any thread, is not compiled again while a `Layout` of it
+     is in use. */
+#define WSLUA_ARG_Struct_compile_FORMAT 1 /* The format string */
+#define WSLUA_OPTARG_Struct_compile_NAMES 2 /* An array of names for the values, in the order `Struct.unpack()`
+                                               returns them; `false` or "" leaves a value unnamed. Views of the
+                                               layout get the values by these names. */
+  wst_layout *l;
+  const gchar *fmt = wslua_checkstring_only(L, WSLUA_ARG_Struct_compile_FORMAT);
+  const gchar *key;
+  size_t keylen;
+  luaL_Buffer b;
+  lua_settop(L, 2);
+
+  /* the key of the layout in the registry: the format, then each name after a NUL */
+  luaL_buffinit(L, &b);
+  luaL_addchar(&b, 'F');
+  luaL_addstring(&b, fmt);
+  if (lua_istable(L, WSLUA_OPTARG_Struct_compile_NAMES)) {
+    size_t n = lua_objlen(L, WSLUA_OPTARG_Struct_compile_NAMES), i;
+    for (i = 1; i <= n; i++) {
+      luaL_addchar(&b, '\0');
+      lua_rawgeti(L, WSLUA_OPTARG_Struct_compile_NAMES, (int)i);
+      if (lua_type(L, -1) == LUA_TSTRING) {
+        /* the NUL separates the names, so a name cannot hold one */
+        if (strlen(lua_tostring(L, -1)) != lua_objlen(L, -1))
+          luaL_argerror(L, WSLUA_OPTARG_Struct_compile_NAMES, "names cannot contain NUL bytes");
+        luaL_addvalue(&b);
+      }
+      else
+        lua_pop(L, 1);
+    }
+  }
+  luaL_pushresult(&b);
+  key = lua_tolstring(L, 3, &keylen);
+  l = wst_registry_find(key, keylen);
+  if (l != NULL) {
+    pushLayout(L, l);
+    WSLUA_RETURN(1); /* The `Layout` object. */
+  }
+
+  l = getlayout(L, WSLUA_ARG_Struct_compile_FORMAT, WSLUA_ARG_Struct_compile_FORMAT);
+  pushLayout(L, l);  /* owns l, so errors below do not leak */
+  if (!lua_isnoneornil(L, WSLUA_OPTARG_Struct_compile_NAMES)) {
+    size_t n, i;
+    const gchar **names;
+    gchar err[64];
+    wst_layout *nl;
+    luaL_checktype(L, WSLUA_OPTARG_Struct_compile_NAMES, LUA_TTABLE);
+    n = lua_objlen(L, WSLUA_OPTARG_Struct_compile_NAMES);
+    names = (const gchar **)lua_newuserdata(L, (n ? n : 1) * sizeof(*names));
+    for (i = 0; i < n; i++) {
+      lua_rawgeti(L, WSLUA_OPTARG_Struct_compile_NAMES, (int)i + 1);
+      if (lua_type(L, -1) == LUA_TSTRING)
+        names[i] = lua_tostring(L, -1);  /* anchored in the names table */
+      else if (lua_toboolean(L, -1))
+        luaL_argerror(L, WSLUA_OPTARG_Struct_compile_NAMES, "names must be strings");
+      else
+        names[i] = NULL;
+      lua_pop(L, 1);
+    }
+    nl = wst_layout_name(l, names, n, err, sizeof(err));
+    if (nl == NULL)
+      luaL_argerror(L, WSLUA_OPTARG_Struct_compile_NAMES, err);
+    lua_pop(L, 2);
+    pushLayout(L, nl);
+  }
+  /* another thread may have registered the same layout in the meantime; use the first one */
+  l = wst_registry_add(key, keylen, toLayout(L, -1), 0);
+  if (l != NULL)
+    pushLayout(L, l);
+  WSLUA_RETURN(1); /* The `Layout` object. */
+}
+
+WSLUA_CONSTRUCTOR Struct_share (lua_State *L) {
+  /* Registers a layout under a name for all the Lua states of the process, so that states running
+     in other threads can get it with `Struct.shared()` instead of compiling their own. The first
+     layout registered under a name stays registered for the life of the process. */
+#define WSLUA_ARG_Struct_share_NAME 1 /* The name. */
+#define WSLUA_ARG_Struct_share_FORMAT 2 /* The format string or `Layout`. */
+  wst_layout *l;
+  wslua_checkstring_only(L, WSLUA_ARG_Struct_share_NAME);
+  lua_settop(L, 2);
+  pushLayout(L, getlayout(L, WSLUA_ARG_Struct_share_FORMAT, WSLUA_ARG_Struct_share_FORMAT));
+  lua_pushliteral(L, "N");
+  lua_pushvalue(L, WSLUA_ARG_Struct_share_NAME);
+  lua_concat(L, 2);
+  l = wst_registry_add(lua_tostring(L, -1), lua_objlen(L, -1), toLayout(L, 3), 1);
+  if (l == NULL)
+    return luaL_error(L, "not enough memory");
+  pushLayout(L, l);
+  WSLUA_RETURN(1); /* The `Layout` registered under the name: this one, or the one registered first. */
+}
+
+WSLUA_CONSTRUCTOR Struct_shared (lua_State *L) {
+  /* Gets the layout registered under a name by `Struct.share()`, in any Lua state of the process. */
+#define WSLUA_ARG_Struct_shared_NAME 1 /* The name. */
+  wst_layout *l;
+  wslua_checkstring_only(L, WSLUA_ARG_Struct_shared_NAME);
+  lua_settop(L, 1);
+  lua_pushliteral(L, "N");
+  lua_pushvalue(L, WSLUA_ARG_Struct_shared_NAME);
+  lua_concat(L, 2);
+  l = wst_registry_find(lua_tostring(L, -1), lua_objlen(L, -1));
+  if (l == NULL)
+    lua_pushnil(L);
+  else
+    pushLayout(L, l);
+  WSLUA_RETURN(1); /* The `Layout`, or nil if there is none. */
+}
+
+WSLUA_CONSTRUCTOR Struct_save_layouts (lua_State *L) {
+  /* Saves the layouts shared, and those compiled and still in use, by all the Lua states of the
+     process to a file, which `Struct.load_layouts()` loads back without compiling them again.
+     Compiled layouts no longer in use are saved too until they are dropped. A file saved by
+     another build of the library is not loaded. Setting the environment variable
+     `WIRESHARKTYPES_LAYOUTS` to the path of such a file loads it when the library is opened. */
+#define WSLUA_ARG_Struct_save_layouts_PATH 1 /* The path of the file. */
+  gchar err[128];
+  long n = wst_store_save(wslua_checkstring_only(L, WSLUA_ARG_Struct_save_layouts_PATH), err, sizeof(err));
+  if (n < 0)
+    return luaL_error(L, "%s", err);
+  lua_pushinteger(L, (lua_Integer)n);
+  WSLUA_RETURN(1); /* The number of layouts saved. */
+}
+
+WSLUA_CONSTRUCTOR Struct_load_layouts (lua_State *L) {
+  /* Loads a file saved by `Struct.save_layouts()`. The file is mapped into memory and its layouts are
+     used from there, by `Struct.compile()` and `Struct.shared()` in all the Lua states of the process. */
+#define WSLUA_ARG_Struct_load_layouts_PATH 1 /* The path of the file. */
+  gchar err[128];
+  long n = wst_store_load(wslua_checkstring_only(L, WSLUA_ARG_Struct_load_layouts_PATH), err, sizeof(err));
+  if (n < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  lua_pushinteger(L, (lua_Integer)n);
+  WSLUA_RETURN(1); /* The number of layouts in the file, or nil and an error message if it cannot be
+                      read, is damaged or was saved by another build of the library. */
+}
+
+WSLUA_METHOD Layout_unpack (lua_State *L) {
+  /* Unpacks a record, the same as `Struct.unpack()` with the layout's format string. */
+#define WSLUA_ARG_Layout_unpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Layout_unpack_BEGIN  3 /* The position to begin reading from (default=1) */
+  Layout l = checkLayout(L, 1);
+  size_t ld;
+  const gchar *data = (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Layout_unpack_STRUCT, &ld);
+  size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Layout_unpack_BEGIN, 1) - 1;
+  int rc;
+  lua_settop(L, 2);
+  rc = layout_unpack(L, l, data, ld, &pos, 0, NULL);
+  if (rc != UNPACK_OK)
+    return unpack_error(L, rc);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* One or more values based on format, plus the position it stopped unpacking. */
+}
+
+WSLUA_METHOD Layout_tryunpack (lua_State *L) {
+  /* Unpacks a record, the same as `Struct.tryunpack()` with the layout's format string. */
+#define WSLUA_ARG_Layout_tryunpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Layout_tryunpack_BEGIN  3 /* The position to begin reading from (default=1) */
+  Layout l = checkLayout(L, 1);
+  size_t ld;
+  const gchar *data = (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Layout_tryunpack_STRUCT, &ld);
+  size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Layout_tryunpack_BEGIN, 1) - 1;
+  int rc;
+  lua_settop(L, 2);
+  rc = layout_unpack(L, l, data, ld, &pos, 0, NULL);
+  if (rc != UNPACK_OK)
+    return unpack_fail(L, rc, pos);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* One or more values based on format, plus the position it stopped unpacking;
+                                      or nil, an error code and a position. */
+}
+
+WSLUA_METHOD Layout_unpack_into (lua_State *L) {
+  /* Unpacks a record into a table, the same as `Struct.unpack_into()` with the layout's format string. */
+#define WSLUA_ARG_Layout_unpack_into_TABLE 2 /* The table to store the values in */
+#define WSLUA_ARG_Layout_unpack_into_STRUCT 3 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Layout_unpack_into_BEGIN  4 /* The position to begin reading from (default=1) */
+  Layout l = checkLayout(L, 1);
+  size_t ld;
+  const gchar *data;
+  size_t pos;
+  int rc, n = 0;
+  luaL_checktype(L, WSLUA_ARG_Layout_unpack_into_TABLE, LUA_TTABLE);
+  data = (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Layout_unpack_into_STRUCT, &ld);
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Layout_unpack_into_BEGIN, 1) - 1;
+  lua_settop(L, 3);
+  rc = layout_unpack(L, l, data, ld, &pos, WSLUA_ARG_Layout_unpack_into_TABLE, &n);
+  if (rc != UNPACK_OK) {
+    if (rc == UNPACK_ESHORT)
+      return luaL_argerror(L, WSLUA_ARG_Layout_unpack_into_STRUCT, "data string too short");
+    return unpack_error(L, rc);
+  }
+  lua_pushinteger(L, pos + 1);
+  lua_pushinteger(L, n);
+  WSLUA_RETURN(2); /* The position it stopped unpacking, and the number of values stored. */
+}
+
+WSLUA_METHOD Layout_pack (lua_State *L) {
+  /* Packs values, the same as `Struct.pack()` with the layout's format string. */
+  Layout l = checkLayout(L, 1);
+  lua_pushstring(L, wst_layout_format(l));
+  lua_replace(L, 1);
+  WSLUA_RETURN(Struct_pack(L)); /* The packed binary Lua string, plus any positions due to '=' being used in format. */
+}
+
+/* WSLUA_ATTRIBUTE Layout_format RO The format string the layout was compiled from. */
+static int Layout_get_format (lua_State *L) {
+  Layout l = checkLayout(L, 1);
+  lua_pushstring(L, wst_layout_format(l));
+  return 1;
+}
+
+/* WSLUA_ATTRIBUTE Layout_size RO The size of a record, or nil if it has elements of variable size. */
+static int Layout_get_size (lua_State *L) {
+  Layout l = checkLayout(L, 1);
+  if (l->fixed)
+    lua_pushinteger(L, l->size);
+  else
+    lua_pushnil(L);
+  return 1;
+}
+
+/* WSLUA_ATTRIBUTE Layout_values RO The number of values in a record, as `Struct.values()` counts them,
+   or nil if a `*` repeat count makes it depend on the data. */
+static int Layout_get_values (lua_State *L) {
+  Layout l = checkLayout(L, 1);
+  if (l->variable)
+    lua_pushnil(L);
+  else
+    lua_pushinteger(L, l->nvalues);
+  return 1;
+}
+
+/* Points the view at userdata index 'idx' at the record at the position in argument
+   'posarg' of the data string in argument 'arg', and anchors the string */
+static void view_target (lua_State *L, int idx, wst_view *v, int arg, int posarg) {
+  size_t ld;
+  const gchar *data = wslua_checklstring_only(L, arg, &ld);
+  size_t pos = luaL_optinteger(L, posarg, 1) - 1;
+  const wst_layout *l = v->layout;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, posarg, "position not aligned for the layout");
+  luaL_argcheck(L, pos <= ld && l->extent <= ld - pos, arg, "data string too short");
+  v->data = data;
+  v->ld = ld;
+  v->pos = pos;
+  lua_getfenv(L, idx);
+  lua_pushvalue(L, arg);
+  lua_rawseti(L, -2, 1);
+  lua_pop(L, 1);
+}
+
+WSLUA_METHOD Layout_view (lua_State *L) {
+  /* Makes a `View` of a record, which decodes its values only when they are read.
+     The layout must have a fixed size. */
+#define WSLUA_ARG_Layout_view_STRUCT 2 /* The binary Lua string holding the record */
+#define WSLUA_OPTARG_Layout_view_BEGIN  3 /* The position of the record (default=1) */
+  Layout l = checkLayout(L, 1);
+  wst_view *v;
+  if (!l->fixed)
+    return luaL_error(L, "a view needs a layout of fixed size");
+  lua_settop(L, 3);
+  v = (wst_view *)calloc(1, sizeof(wst_view));
+  if (v == NULL)
+    return luaL_error(L, "not enough memory");
+  v->layout = wst_layout_ref(l);
+  pushView(L, v);  /* owns v from here on */
+  lua_createtable(L, 1, 0);  /* the environment, holding the data string */
+  lua_setfenv(L, 4);
+  view_target(L, 4, v, WSLUA_ARG_Layout_view_STRUCT, WSLUA_OPTARG_Layout_view_BEGIN);
+  WSLUA_RETURN(1); /* The `View` object. */
+}
+
+WSLUA_METAMETHOD Layout__tostring (lua_State *L) {
+  Layout l = checkLayout(L, 1);
+  lua_pushfstring(L, "Layout(\"%s\")", wst_layout_format(l));
+  return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Layout__gc (lua_State *L) {
+  Layout *p = (Layout *)lua_touserdata(L, 1);
+  if (p && *p) {
+    wst_layout_unref(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+WSLUA_METHODS Layout_methods[] = {
+  WSLUA_CLASS_FNREG(Layout,unpack),
+  WSLUA_CLASS_FNREG(Layout,tryunpack),
+  WSLUA_CLASS_FNREG(Layout,unpack_into),
+  WSLUA_CLASS_FNREG(Layout,pack),
+  WSLUA_CLASS_FNREG(Layout,view),
+  { NULL, NULL }
+};
+
+WSLUA_META Layout_meta[] = {
+  WSLUA_CLASS_MTREG(Layout,tostring),
+  { NULL, NULL }
+};
+
+WSLUA_ATTRIBUTES Layout_attributes[] = {
+  WSLUA_ATTRIBUTE_ROREG(Layout,format),
+  WSLUA_ATTRIBUTE_ROREG(Layout,size),
+  WSLUA_ATTRIBUTE_ROREG(Layout,values),
+  { NULL, NULL, NULL }
+};
+
+WSLUA_METHOD View_retarget (lua_State *L) {
+  /* Points the view at another record, without allocating. */
+#define WSLUA_ARG_View_retarget_STRUCT 2 /* The binary Lua string holding the record */
+#define WSLUA_OPTARG_View_retarget_BEGIN  3 /* The position of the record (default=1) */
+  View v = checkView(L, 1);
+  lua_settop(L, 3);
+  view_target(L, 1, v, WSLUA_ARG_View_retarget_STRUCT, WSLUA_OPTARG_View_retarget_BEGIN);
+  lua_settop(L, 1);
+  WSLUA_RETURN(1); /* The view. */
+}
+
+/* Gets a value by index or name, or a method (the methods table is the upvalue) */
+static int View__index (lua_State *L) {
+  View v = checkView(L, 1);
+  const wst_field *f;
+  lua_Integer i;
+  guint32 off;
+  size_t used;
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    i = lua_tointeger(L, 2) - 1;
+  }
+  else {
+    size_t len;
+    const gchar *name = luaL_checklstring(L, 2, &len);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    if (!lua_isnil(L, -1))
+      return 1;
+    i = (lua_Integer)wst_layout_lookup(v->layout, name, len);
+    if (i < 0)
+      return luaL_error(L, "no value named '%s' in the view", name);
+  }
+  f = (i >= 0 && i <= G_MAXUINT32) ? wst_layout_value(v->layout, (guint32)i, &off) : NULL;
+  if (f == NULL) {
+    lua_pushnil(L);
+    return 1;
+  }
+  unpack_element(L, f, v->data, v->ld, v->pos + off, &used);  /* fixed: cannot fail */
+  return 1;
+}
+
+WSLUA_METAMETHOD View__len (lua_State *L) {
+  View v = checkView(L, 1);
+  lua_pushinteger(L, v->layout->nresults);
+  WSLUA_RETURN(1); /* The number of values of the record. */
+}
+
+WSLUA_METAMETHOD View__tostring (lua_State *L) {
+  View v = checkView(L, 1);
+  lua_pushfstring(L, "View(\"%s\") at %d", wst_layout_format(v->layout), (int)v->pos + 1);
+  return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int View__gc (lua_State *L) {
+  View *p = (View *)lua_touserdata(L, 1);
+  if (p && *p) {
+    wst_layout_unref((*p)->layout);
+    free(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+WSLUA_METHODS View_methods[] = {
+  WSLUA_CLASS_FNREG(View,retarget),
+  { NULL, NULL }
+};
+
+WSLUA_META View_meta[] = {
+  WSLUA_CLASS_MTREG(View,len),
+  WSLUA_CLASS_MTREG(View,tostring),
+  { NULL, NULL }
+};
+
+/* the slot of 'tag' in a hash of 'mask'+1 slots */
+#define tagslot(tag,mask) \
+  ((guint32)(((guint64)(tag) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32) & (mask))
+
+/* Finds the layout for 'tag', or the default layout (which may be NULL) */
+static wst_layout *dispatch_find (const wst_dispatch *d, lua_Integer tag) {
+  if (d->dense) {
+    guint64 i = (guint64)tag - (guint64)d->min;
+    if (i < d->nslots && d->slots[i].layout)
+      return d->slots[i].layout;
+  }
+  else {
+    guint32 mask = d->nslots - 1;
+    guint32 i = tagslot(tag, mask);
+    while (d->slots[i].layout) {
+      if (d->slots[i].tag == tag)
+        return d->slots[i].layout;
+      i = (i + 1) & mask;
+    }
+  }
+  return d->other;
+}
+
+/* Gets map key at the top of the stack as an integral tag */
+static lua_Integer checktag (lua_State *L, int arg) {
+  lua_Number n;
+  lua_Integer tag;
+  if (lua_type(L, -2) != LUA_TNUMBER)
+    luaL_argerror(L, arg, "tags must be numbers");
+  n = lua_tonumber(L, -2);
+  tag = (lua_Integer)n;
+  if ((lua_Number)tag != n)
+    luaL_argerror(L, arg, "tags must be integers");
+  return tag;
+}
+
+WSLUA_CONSTRUCTOR Struct_switch (lua_State *L) {
+  /* Builds a `Dispatcher` that decodes a tag with one format, then decodes the rest of
+     the message with the format the tag selects, in a single call of its `unpack()` method. */
+#define WSLUA_ARG_Struct_switch_TAGFORMAT 1 /* The format string (or `Layout`) of the tag; its first value is the tag. */
+#define WSLUA_ARG_Struct_switch_CASES 2 /* A table mapping integer tags to format strings or `Layout` objects. */
+#define WSLUA_OPTARG_Struct_switch_DEFAULT 3 /* The format string (or `Layout`) for tags not in the table. */
+  wst_dispatch *d;
+  lua_Integer min = 0, max = 0;
+  guint32 n = 0, nslots;
+  gboolean dense;
+  size_t bytes;
+
+  luaL_checktype(L, WSLUA_ARG_Struct_switch_CASES, LUA_TTABLE);
+  lua_settop(L, 3);
+  lua_pushnil(L);
+  while (lua_next(L, WSLUA_ARG_Struct_switch_CASES)) {
+    lua_Integer tag = checktag(L, WSLUA_ARG_Struct_switch_CASES);
+    if (n == 0 || tag < min) min = tag;
+    if (n == 0 || tag > max) max = tag;
+    n++;
+    lua_pop(L, 1);
+  }
+
+  /* a jump table as long as at most 3/4 of it is unused */
+  dense = n == 0 || (guint64)max - (guint64)min < (guint64)n * 4;
+  if (dense)
+    nslots = n ? (guint32)((guint64)max - (guint64)min + 1) : 0;
+  else
+    for (nslots = 2; nslots < n * 2; nslots <<= 1) ;  /* load factor at most 1/2 */
+
+  bytes = sizeof(wst_dispatch) + (nslots ? nslots - 1 : 0) * sizeof(d->slots[0]);
+  d = (wst_dispatch *)calloc(1, bytes);
+  if (d == NULL)
+    return luaL_error(L, "not enough memory");
+  /* owned by the userdata from here on, so errors below do not leak */
+  pushDispatcher(L, d);
+  d->dense = dense;
+  d->min = min;
+  d->nslots = nslots;
+
+  d->tag = getlayout(L, WSLUA_ARG_Struct_switch_TAGFORMAT, WSLUA_ARG_Struct_switch_TAGFORMAT);
+  if (d->tag->nvalues == 0)
+    luaL_argerror(L, WSLUA_ARG_Struct_switch_TAGFORMAT, "tag format has no values");
+  if (!lua_isnil(L, WSLUA_OPTARG_Struct_switch_DEFAULT))
+    d->other = getlayout(L, WSLUA_OPTARG_Struct_switch_DEFAULT, WSLUA_OPTARG_Struct_switch_DEFAULT);
+
+  lua_pushnil(L);
+  while (lua_next(L, WSLUA_ARG_Struct_switch_CASES)) {
+    lua_Integer tag = checktag(L, WSLUA_ARG_Struct_switch_CASES);
+    guint32 i;
+    if (dense) {
+      i = (guint32)((guint64)tag - (guint64)min);
+    }
+    else {
+      i = tagslot(tag, nslots - 1);
+      while (d->slots[i].layout)
+        i = (i + 1) & (nslots - 1);
+    }
+    d->slots[i].tag = tag;
+    d->slots[i].layout = getlayout(L, lua_gettop(L), WSLUA_ARG_Struct_switch_CASES);
+    lua_pop(L, 1);
+  }
+  WSLUA_RETURN(1); /* The `Dispatcher` object. */
+}
+
+/*
+** Unpacks the tag at data+*pos and the record it selects. Returns UNPACK_OK,
+** an error code, or DISPATCH_NOTAG if no layout matches the tag.
+*/
+#define DISPATCH_NOTAG  (-1)
+
+static int dispatch_unpack (lua_State *L, const wst_dispatch *d, const gchar *data,
+                            size_t ld, size_t *pos) {
+  wst_layout *l = d->other;
+  int base = lua_gettop(L);
+  int rc = layout_unpack(L, d->tag, data, ld, pos, 0, NULL);
+  if (rc != UNPACK_OK)
+    return rc;
+  if (lua_type(L, base + 1) == LUA_TNUMBER) {
+    lua_Number n = lua_tonumber(L, base + 1);
+    lua_Integer tag = (lua_Integer)n;
+    if ((lua_Number)tag == n)
+      l = dispatch_find(d, tag);
+  }
+  if (l == NULL)
+    return DISPATCH_NOTAG;
+  return layout_unpack(L, l, data, ld, pos, 0, NULL);
+}
+
+WSLUA_METHOD Dispatcher_unpack (lua_State *L) {
+  /* Unpacks the tag and then the record selected by it. */
+#define WSLUA_ARG_Dispatcher_unpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Dispatcher_unpack_BEGIN  3 /* The position to begin reading from (default=1) */
+  Dispatcher d = checkDispatcher(L, 1);
+  size_t ld;
+  const gchar *data = (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Dispatcher_unpack_STRUCT, &ld);
+  size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Dispatcher_unpack_BEGIN, 1) - 1;
+  int rc;
+  lua_settop(L, 2);
+  rc = dispatch_unpack(L, d, data, ld, &pos);
+  if (rc == DISPATCH_NOTAG) {
+    lua_pushnil(L);
+    lua_pushvalue(L, 3);
+    WSLUA_RETURN(2); /* nil and the tag, if there is no layout for the tag. */
+  }
+  if (rc != UNPACK_OK)
+    return unpack_error(L, rc);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* The values of the tag format, then those of the selected format,
+                                      plus the position it stopped unpacking. */
+}
+
+WSLUA_METHOD Dispatcher_tryunpack (lua_State *L) {
+  /* Like `Dispatcher:unpack()`, but malformed data makes it return nil, an error code and a
+     position, as `Struct.tryunpack()` does. A tag without a layout still returns nil and the tag. */
+#define WSLUA_ARG_Dispatcher_tryunpack_STRUCT 2 /* The binary Lua string or `Buffer` to unpack */
+#define WSLUA_OPTARG_Dispatcher_tryunpack_BEGIN  3 /* The position to begin reading from (default=1) */
+  Dispatcher d = checkDispatcher(L, 1);
+  size_t ld;
+  const gchar *data = (const gchar *)wslua_checkbytes(L, WSLUA_ARG_Dispatcher_tryunpack_STRUCT, &ld);
+  size_t pos = luaL_optinteger(L, WSLUA_OPTARG_Dispatcher_tryunpack_BEGIN, 1) - 1;
+  int rc;
+  lua_settop(L, 2);
+  rc = dispatch_unpack(L, d, data, ld, &pos);
+  if (rc == DISPATCH_NOTAG) {
+    lua_pushnil(L);
+    lua_pushvalue(L, 3);
+    WSLUA_RETURN(2); /* nil and the tag, if there is no layout for the tag. */
+  }
+  if (rc != UNPACK_OK)
+    return unpack_fail(L, rc, pos);
+  lua_pushinteger(L, pos + 1);
+  WSLUA_RETURN(lua_gettop(L) - 2); /* The values of the tag format, then those of the selected format,
+                                      plus the position it stopped unpacking; or nil, an error code and a position. */
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Dispatcher__gc (lua_State *L) {
+  Dispatcher *p = (Dispatcher *)lua_touserdata(L, 1);
+  if (p && *p) {
+    wst_dispatch *d = *p;
+    guint32 i;
+    wst_layout_unref(d->tag);
+    wst_layout_unref(d->other);
+    for (i = 0; i < d->nslots; i++)
+      wst_layout_unref(d->slots[i].layout);
+    free(d);
+    *p = NULL;
+  }
+  return 0;
+}
+
+WSLUA_METHODS Dispatcher_methods[] = {
+  WSLUA_CLASS_FNREG(Dispatcher,unpack),
+  WSLUA_CLASS_FNREG(Dispatcher,tryunpack),
+  { NULL, NULL }
+};
+
+WSLUA_META Dispatcher_meta[] = {
+  { NULL, NULL }
+};
+
+/* Layout and Dispatcher objects are only created by Struct functions, so
+   their metatables are registered without a global class table. */
+LUALIB_API int Layout_register(lua_State* L) {
+  const wslua_class Layout_class = {
+    .name               = "Layout",
+    .instance_methods   = Layout_methods,
+    .instance_meta      = Layout_meta,
+    .attrs              = Layout_attributes
+  };
+  wslua_register_classinstance_meta(L, &Layout_class);
+  WSLUA_REGISTER_GC(Layout);
+  return 0;
+}
+
+/* Values are looked up by number and by name, so View has its own __index
+   instead of the one wslua_register_classinstance_meta makes. */
+LUALIB_API int View_register(lua_State* L) {
+  luaL_newmetatable(L, "View");
+  wslua_setfuncs(L, View_meta, 0);
+  lua_pushstring(L, "View");
+  lua_setfield(L, -2, WSLUA_TYPEOF_FIELD);
+  lua_newtable(L);
+  wslua_setfuncs(L, View_methods, 0);
+  lua_pushcclosure(L, View__index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  WSLUA_REGISTER_GC(View);
+  return 0;
+}
+
+LUALIB_API int Dispatcher_register(lua_State* L) {
+  const wslua_class Dispatcher_class = {
+    .name               = "Dispatcher",
+    .instance_methods   = Dispatcher_methods,
+    .instance_meta      = Dispatcher_meta
+  };
+  wslua_register_classinstance_meta(L, &Dispatcher_class);
+  WSLUA_REGISTER_GC(Dispatcher);
+  return 0;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** LuaJIT FFI unpackers
+** =======================================================
+*/
+
+/* the most values a generated unpacker returns, as each needs a register */
+#define FFI_MAXVALUES   180
+
+/* registry key of the table caching the unpackers by format string */
+static const char ffi_cache_key = 'F';
+
+/* the start of the generated chunks: the library functions and helpers the
+   expressions built by ffi_addelement() use */
+static const char ffi_helpers[] =
+  "local ffi, bit, unpack, fmt = ...\n"
+  "local type, cast, tostr = type, ffi.cast, ffi.string\n"
+  "local band, bor, lshift, arshift, bswap = bit.band, bit.bor, bit.lshift, bit.arshift, bit.bswap\n"
+  "local pu8 = ffi.typeof('const uint8_t *')\n"
+  "local pu16, pi16 = ffi.typeof('const uint16_t *'), ffi.typeof('const int16_t *')\n"
+  "local pu32, pi32 = ffi.typeof('const uint32_t *'), ffi.typeof('const int32_t *')\n"
+  "local le = ffi.abi('le')\n"
+  "local fu = ffi.new('union { int32_t i; float f; }')\n"
+  "local du = ffi.new('union { int32_t i[2]; double d; }')\n"
+  /* NaNs are returned as 0/0, as LuaJIT may not canonicalize those read from cdata */
+  "local function rf(p, swap)\n"
+  "  local i = cast(pi32, p)[0]\n"
+  "  if swap then i = bswap(i) end\n"
+  "  if band(i, 0x7f800000) == 0x7f800000 and band(i, 0x7fffff) ~= 0 then return 0/0 end\n"
+  "  fu.i = i\n"
+  "  return fu.f\n"
+  "end\n"
+  "local function rd(p, swap)\n"
+  "  local a, b = cast(pi32, p)[0], cast(pi32, p)[1]\n"
+  "  if swap then a, b = bswap(b), bswap(a) end\n"
+  "  local hi, lo = a, b\n"
+  "  if le then hi, lo = b, a end\n"
+  "  if band(hi, 0x7ff00000) == 0x7ff00000 and (band(hi, 0xfffff) ~= 0 or lo ~= 0) then return 0/0 end\n"
+  "  du.i[0], du.i[1] = a, b\n"
+  "  return du.d\n"
+  "end\n";
+
+/*
+** Adds an expression for the 'size'-byte integer at q[off], giving the
+** same number getinteger() does (so 'size' is at most sizeof(Uinttype)).
+*/
+static void ffi_addinteger (lua_State *L, luaL_Buffer *b, int off, int size,
+                            int endian, int issigned) {
+  if (size == 1) {
+    lua_pushfstring(L, issigned ? "arshift(lshift(q[%d],24),24)" : "q[%d]", off);
+    luaL_addvalue(b);
+  }
+  else if ((size == 2 || size == 4) && endian == native.endian) {
+    lua_pushfstring(L, "cast(p%c%d,q+%d)[0]", issigned ? 'i' : 'u', size * 8, off);
+    luaL_addvalue(b);
+  }
+  else if (size == 2 || size == 3) {
+    int hi = (endian == BIG) ? off : off + size - 1;
+    int step = (endian == BIG) ? 1 : -1;
+    if (issigned)
+      luaL_addstring(b, "arshift(lshift(");
+    if (size == 2)
+      lua_pushfstring(L, "bor(lshift(q[%d],8),q[%d])", hi, hi + step);
+    else
+      lua_pushfstring(L, "bor(lshift(q[%d],16),lshift(q[%d],8),q[%d])", hi, hi + step, hi + 2*step);
+    luaL_addvalue(b);
+    if (issigned) {
+      lua_pushfstring(L, ",%d),%d)", 32 - size*8, 32 - size*8);
+      luaL_addvalue(b);
+    }
+  }
+  else if (size == 4) {
+    lua_pushfstring(L, issigned ? "bswap(cast(pi32,q+%d)[0])" : "(bswap(cast(pi32,q+%d)[0])%%4294967296)", off);
+    luaL_addvalue(b);
+  }
+  else {  /* high part * 2^32 + low 4 bytes, rounded once like the C cast */
+    int lo = (endian == LITTLE) ? off : off + size - 4;
+    int hi = (endian == LITTLE) ? off + 4 : off;
+    luaL_addstring(b, "(");
+    ffi_addinteger(L, b, hi, size - 4, endian, issigned);
+    luaL_addstring(b, "*4294967296+");
+    ffi_addinteger(L, b, lo, 4, endian, FALSE);
+    luaL_addstring(b, ")");
+  }
+}
+
+/* Adds an expression for the value of element 'f' at q[off] */
+static void ffi_addelement (lua_State *L, luaL_Buffer *b, const wst_field *f, int off) {
+  char efmt[16];
+  switch (f->opt) {
+    case 'b': case 'B': case 'h': case 'H':
+    case 'l': case 'L': case 'T': case 'i': case 'I':
+      if (f->size <= sizeof(Uinttype)) {
+        ffi_addinteger(L, b, off, (int)f->size, f->endian, g_ascii_islower(f->opt));
+        return;
+      }
+      break;
+    case 'f': case 'd':
+      lua_pushfstring(L, "r%c(q+%d,%s)", f->opt, off, f->endian == native.endian ? "false" : "true");
+      luaL_addvalue(b);
+      return;
+    case 'c':
+      lua_pushfstring(L, "tostr(q+%d,%d)", off, (int)f->size);
+      luaL_addvalue(b);
+      return;
+    case '=':
+      lua_pushfstring(L, "(o+%d)", off + 1);
+      luaL_addvalue(b);
+      return;
+    default:
+      break;
+  }
+  /* 'e', 'E', 'W' and integers too wide for the Lua number path: let
+     Struct.unpack decode a copy of just this element */
+  if (f->opt == 'W')
+    g_snprintf(efmt, sizeof(efmt), "%cW%u", f->endian == BIG ? '>' : '<', f->size / 2);
+  else if (f->opt == 'e' || f->opt == 'E')
+    g_snprintf(efmt, sizeof(efmt), "%c%c", f->endian == BIG ? '>' : '<', f->opt);
+  else
+    g_snprintf(efmt, sizeof(efmt), "%c%c%u", f->endian == BIG ? '>' : '<', f->opt, f->size);
+  lua_pushfstring(L, "(unpack('%s',tostr(q+%d,%d)))", efmt, off, (int)f->size);
+  luaL_addvalue(b);
+}
+
+/* Generates the source of the unpacker for fixed layout 'l' */
+static void ffi_source (lua_State *L, const wst_layout *l) {
+  luaL_Buffer b;
+  guint32 i, k;
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, ffi_helpers);
+  lua_pushfstring(L, "return function(data, pos)\n"
+                     "  if pos == nil then pos = 1 elseif type(pos) ~= 'number' then return unpack(fmt, data, pos) end\n"
+                     "  local o = pos - 1\n"
+                     "  if type(data) ~= 'string' or o < 0 or o %% %d ~= 0 or o + %d > #data then\n"
+                     "    return unpack(fmt, data, pos)\n"
+                     "  end\n"
+                     "  local q = cast(pu8, data) + o\n"
+                     "  return ", (int)l->align, (int)l->extent);
+  luaL_addvalue(&b);
+  for (i = 0; i < l->nfields; i++) {
+    const wst_field *f = &l->fields[i];
+    if (f->opt == 'x' || f->opt == 'X' || ((f->flags & WST_NOASSIGN) && f->size > 0))
+      continue;
+    for (k = 0; k < f->count; k++) {
+      ffi_addelement(L, &b, f, (int)(f->offset + k * f->size));
+      luaL_addstring(&b, ", ");
+    }
+  }
+  lua_pushfstring(L, "pos + %d\nend\n", (int)l->size);
+  luaL_addvalue(&b);
+  luaL_pushresult(&b);
+}
+
+/* Pushes the module 'name' or raises an error */
+static void ffi_require (lua_State *L, const char *name) {
+  lua_getglobal(L, "require");
+  lua_pushstring(L, name);
+  if (lua_pcall(L, 1, 1, 0) != 0)
+    luaL_error(L, "Struct.compile_ffi needs LuaJIT's '%s' module", name);
+}
+
+WSLUA_CONSTRUCTOR Struct_compile_ffi (lua_State *L) {
+  /* Generates a Lua function that unpacks a fixed-size format with LuaJIT's FFI,
+     which LuaJIT can compile into the trace of the calling loop. The function takes
+     the binary Lua string and an optional position, and returns the same values as
+     `Struct.unpack()` with the format; if the position is not suitably aligned or
+     the string is too short it calls `Struct.unpack()` itself, so errors are the same.
+     The functions are cached by format string. */
+#define WSLUA_ARG_Struct_compile_ffi_FORMAT 1 /* The format string */
+  wst_layout *l;
+  wslua_checkstring_only(L, WSLUA_ARG_Struct_compile_ffi_FORMAT);
+  lua_settop(L, 1);
+  lua_pushlightuserdata(L, (void *)&ffi_cache_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (lua_isnil(L, 2)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushlightuserdata(L, (void *)&ffi_cache_key);
+    lua_pushvalue(L, 2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+  lua_pushvalue(L, 1);
+  lua_rawget(L, 2);
+  if (!lua_isnil(L, 3))
+    WSLUA_RETURN(1); /* The unpacking function. */
+  lua_pop(L, 1);
+
+  l = getlayout(L, 1, WSLUA_ARG_Struct_compile_ffi_FORMAT);
+  if (!l->fixed || l->nvalues > FFI_MAXVALUES || l->extent > G_MAXINT / 2) {
+    gboolean fixed = l->fixed;
+    wst_layout_unref(l);
+    return luaL_argerror(L, WSLUA_ARG_Struct_compile_ffi_FORMAT,
+                         fixed ? "format has too many values" : "format has no fixed size");
+  }
+  ffi_source(L, l);
+  wst_layout_unref(l);
+  if (luaL_loadbuffer(L, lua_tostring(L, 3), lua_objlen(L, 3), "=Struct.compile_ffi") != 0)
+    return lua_error(L);
+  ffi_require(L, "ffi");
+  ffi_require(L, "bit");
+  lua_pushcfunction(L, Struct_unpack);
+  lua_pushvalue(L, 1);
+  lua_call(L, 4, 1);
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, 2);
+  WSLUA_RETURN(1); /* The unpacking function. */
+}
+
+WSLUA_CONSTRUCTOR Struct_cdef (lua_State *L) {
+  /* Returns the C declarations of the library's plain C entry points (`wst_load_u32be()`,
+     `wst_bin2hex()`, the address formatters and parsers, ...), for LuaJIT's `ffi.cdef()`.
+     They are exported by the module's shared library, so after
+     `ffi.cdef(Struct.cdef())` they can be called through `ffi.load()` of that library. */
+  lua_pushstring(L, wst_cdef());
+  WSLUA_RETURN(1); /* The declarations, as a string. */
+}
+
+/* Does compiled element 'f' need a method to be read from a C struct overlay? */
+static gboolean cdef_needsmethod (const wst_field *f) {
+  switch (f->opt) {
+    case 'b': case 'B': case 'h': case 'H':
+    case 'l': case 'L': case 'T': case 'i': case 'I':
+      if (f->size == 1)
+        return FALSE;
+      return !((f->size == 2 || f->size == 4 || f->size == 8) && f->endian == native.endian);
+    case 'f': case 'd': case 'e': case 'E':
+      return f->endian != native.endian;
+    case 'W':
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Adds the struct member declaration for compiled element 'f', value number 'v' */
+static void cdef_addmember (lua_State *L, luaL_Buffer *b, const wst_field *f, int v) {
+  const gchar *type = NULL;
+  gboolean bytes = FALSE;  /* an array of f->size bytes? */
+  if (cdef_needsmethod(f)) {
+    /* the raw bits, read by the method */
+    bytes = !(f->size == 2 || f->size == 4 || f->size == 8);
+    lua_pushfstring(L, bytes ? "  uint8_t _f%d" : "  uint%d_t _f%d", bytes ? v : (int)f->size * 8, v);
+  }
+  else {
+    switch (f->opt) {
+      case 'f': type = "float"; break;
+      case 'd': type = "double"; break;
+      case 'e': type = "int64_t"; break;
+      case 'E': type = "uint64_t"; break;
+      case 'c': type = "char"; bytes = TRUE; break;
+      default: break;
+    }
+    if (type)
+      lua_pushfstring(L, "  %s f%d", type, v);
+    else  /* the integer types */
+      lua_pushfstring(L, "  %sint%d_t f%d", g_ascii_islower(f->opt) ? "" : "u", (int)f->size * 8, v);
+  }
+  luaL_addvalue(b);
+  if (f->count > 1) {
+    lua_pushfstring(L, "[%d]", (int)f->count);
+    luaL_addvalue(b);
+  }
+  if (bytes) {
+    lua_pushfstring(L, "[%d]", (int)f->size);
+    luaL_addvalue(b);
+  }
+  luaL_addstring(b, ";\n");
+}
+
+/* Adds a padding member of 'n' bytes, the 'k'th one */
+static void cdef_addpadding (lua_State *L, luaL_Buffer *b, guint32 n, int k) {
+  lua_pushfstring(L, "  uint8_t _pad%d[%d];\n", k, (int)n);
+  luaL_addvalue(b);
+}
+
+/* is 's' a C identifier? */
+static gboolean iscident (const gchar *s) {
+  if (*s == '\0' || g_ascii_isdigit(*s))
+    return FALSE;
+  for (; *s; s++)
+    if (!g_ascii_isalnum(*s) && *s != '_')
+      return FALSE;
+  return TRUE;
+}
+
+WSLUA_CONSTRUCTOR Struct_to_cdef (lua_State *L) {
+  /* Translates a fixed-size format into a packed C struct declaration for LuaJIT's `ffi.cdef()`,
+     so that records can be read by casting a pointer to the data, without decoding.
+     Members are named after the number of the value `Struct.unpack()` would return: `f1`, `f2`, ...
+     with repeated elements becoming arrays; padding, `X` alignment and elements inside `(` `)`
+     become `_pad` members at the same offsets `Struct.unpack()` uses for a suitably aligned start.
+
+     Elements that cannot be read as a plain C member (multi-byte values in the non-native
+     byte order, integers of 3, 5, 6, 7 or more than 8 bytes, and `W`) are stored as raw
+     `_fN` members instead, and read by methods: the second result is the source of a Lua chunk
+     which, called with `ffi`, `bit` and `Struct.unpack`, returns a table of them for the
+     `__index` of `ffi.metatype()`. `rec:fN()` then returns the value as `Struct.unpack()`
+     would, and `rec:fN(i)` element `i` (from 0) of an array. */
+#define WSLUA_ARG_Struct_to_cdef_FORMAT 1 /* The format string */
+#define WSLUA_ARG_Struct_to_cdef_NAME 2 /* The name of the struct type, a C identifier */
+  const gchar *name;
+  wst_layout *l;
+  luaL_Buffer b;
+  guint32 i, cur = 0;
+  int v = 1, pads = 0;
+  wslua_checkstring_only(L, WSLUA_ARG_Struct_to_cdef_FORMAT);
+  name = wslua_checkstring_only(L, WSLUA_ARG_Struct_to_cdef_NAME);
+  luaL_argcheck(L, iscident(name), WSLUA_ARG_Struct_to_cdef_NAME, "name must be a C identifier");
+  lua_settop(L, 2);
+  l = getlayout(L, 1, WSLUA_ARG_Struct_to_cdef_FORMAT);
+  if (!l->fixed) {
+    wst_layout_unref(l);
+    return luaL_argerror(L, WSLUA_ARG_Struct_to_cdef_FORMAT, "format has no fixed size");
+  }
+
+  /* the declaration */
+  luaL_buffinit(L, &b);
+  lua_pushfstring(L, "typedef struct __attribute__((packed)) %s {\n", name);
+  luaL_addvalue(&b);
+  for (i = 0; i < l->nfields; i++) {
+    const wst_field *f = &l->fields[i];
+    if (f->opt == 'x' || f->opt == 'X' || ((f->flags & WST_NOASSIGN) && f->size > 0))
+      continue;  /* covered by padding */
+    if (f->opt != '=') {
+      if (f->offset > cur)
+        cdef_addpadding(L, &b, f->offset - cur, ++pads);
+      cdef_addmember(L, &b, f, v);
+      cur = f->offset + f->size * f->count;
+    }
+    v += f->count;
+  }
+  if (l->size > cur)
+    cdef_addpadding(L, &b, l->size - cur, ++pads);
+  lua_pushfstring(L, "} %s;\n", name);
+  luaL_addvalue(&b);
+  luaL_pushresult(&b);
+
+  /* the methods */
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, ffi_helpers);
+  luaL_addstring(&b, "local m = {}\n");
+  for (i = 0, v = 1; i < l->nfields; i++) {
+    const wst_field *f = &l->fields[i];
+    if (f->opt == 'x' || f->opt == 'X' || ((f->flags & WST_NOASSIGN) && f->size > 0))
+      continue;
+    if (cdef_needsmethod(f)) {
+      if (f->count > 1)
+        lua_pushfstring(L, "m.f%d = function(s, i) local q = cast(pu8, s) + i * %d return ", v, (int)f->size);
+      else
+        lua_pushfstring(L, "m.f%d = function(s) local q = cast(pu8, s) return ", v);
+      luaL_addvalue(&b);
+      ffi_addelement(L, &b, f, (int)f->offset);
+      luaL_addstring(&b, " end\n");
+    }
+    v += f->count;
+  }
+  luaL_addstring(&b, "return m\n");
+  luaL_pushresult(&b);
+  wst_layout_unref(l);
+  WSLUA_RETURN(2); /* The C declaration, and the source of the methods chunk. */
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Type-Length-Value sequences
+** =======================================================
+*/
+
+/* Struct.tlv() flags */
+#define TLV_HEADER  0x01  /* 'h': the length counts the tag and length fields too */
+#define TLV_ARRAYS  0x02  /* 'a': return arrays instead of an iterator */
+
+/* the field of a tag/length layout holding its (integer) value, or NULL if there is none */
+static const wst_field *intfield (const wst_layout *l) {
+  guint32 i;
+  if (!l->fixed || l->align > 1)
+    return NULL;
+  for (i = 0; i < l->nfields; i++) {
+    const wst_field *f = &l->fields[i];
+    if (f->opt == 'x' || f->opt == 'X' || (f->flags & WST_NOASSIGN))
+      continue;
+    switch (f->opt) {
+      case 'b': case 'B': case 'h': case 'H':
+      case 'l': case 'L': case 'T': case 'i': case 'I':
+        return f;
+      default:
+        return NULL;
+    }
+  }
+  return NULL;
+}
+
+static lua_Number fieldinteger (const wst_field *f, const gchar *data) {
+  return getinteger(data + f->offset, f->endian, g_ascii_islower(f->opt), (int)f->size);
+}
+
+/*
+** Reads the TLV at data+*pos, not going past 'end'. Returns 1 and advances
+** *pos past the value if there is one, 0 at 'end', and -1 if it is malformed.
+*/
+static int tlv_next (const wst_layout *tl, const wst_layout *ll, int flags,
+                     const gchar *data, size_t *pos, size_t end,
+                     lua_Number *tag, size_t *voff, size_t *vlen) {
+  size_t hdr = tl->size + ll->size;
+  size_t p = *pos;
+  lua_Number len;
+  if (p >= end)
+    return 0;
+  if (end - p < hdr)
+    return -1;
+  *tag = fieldinteger(intfield(tl), data + p);
+  len = fieldinteger(intfield(ll), data + p + tl->size);
+  if (flags & TLV_HEADER) {
+    if (len < (lua_Number)hdr)
+      return -1;
+    len -= (lua_Number)hdr;
+  }
+  if (len < 0 || len > (lua_Number)(end - p - hdr))
+    return -1;
+  *voff = p + hdr;
+  *vlen = (size_t)len;
+  *pos = *voff + *vlen;
+  return 1;
+}
+
+static int tlv_iter (lua_State *L) {
+  size_t ld;
+  const gchar *data = lua_tolstring(L, lua_upvalueindex(1), &ld);
+  Layout tl = toLayout(L, lua_upvalueindex(2));
+  Layout ll = toLayout(L, lua_upvalueindex(3));
+  size_t pos = (size_t)lua_tointeger(L, lua_upvalueindex(4));
+  size_t end = (size_t)lua_tointeger(L, lua_upvalueindex(5));
+  int flags = (int)lua_tointeger(L, lua_upvalueindex(6));
+  lua_Number tag;
+  size_t voff, vlen;
+  if (tlv_next(tl, ll, flags, data, &pos, end, &tag, &voff, &vlen) <= 0) {
+    /* stop for good, also after a malformed element */
+    lua_pushinteger(L, (lua_Integer)end);
+    lua_replace(L, lua_upvalueindex(4));
+    return 0;
+  }
+  lua_pushinteger(L, (lua_Integer)pos);
+  lua_replace(L, lua_upvalueindex(4));
+  lua_pushnumber(L, tag);
+  lua_pushinteger(L, (lua_Integer)voff + 1);
+  lua_pushinteger(L, (lua_Integer)vlen);
+  return 3;
+}
+
+WSLUA_CONSTRUCTOR Struct_tlv (lua_State *L) {
+  /* Walks a sequence of Type-Length-Value elements, such as RADIUS attributes or DHCP options.
+     By default it returns an iterator, for use in a generic `for`, giving the tag, the position
+     of the value and the length of the value of each element. Iteration stops without an error
+     at the first malformed element. */
+#define WSLUA_ARG_Struct_tlv_STRUCT 1 /* The binary Lua string to walk. */
+#define WSLUA_ARG_Struct_tlv_TAGFORMAT 2 /* The format string (or `Layout`) of the tag, e.g. "B" or ">I2";
+                                            its first value must be an integer. */
+#define WSLUA_ARG_Struct_tlv_LENFORMAT 3 /* The format string (or `Layout`) of the length, which follows the tag. */
+#define WSLUA_OPTARG_Struct_tlv_BEGIN 4 /* The position of the first element (default=1). */
+#define WSLUA_OPTARG_Struct_tlv_END 5 /* The position of the last byte of the sequence (default=the end of the string). */
+#define WSLUA_OPTARG_Struct_tlv_FLAGS 6 /* A string of flags: "h" if the length includes the tag and length
+                                           fields, "a" to return arrays instead of an iterator. */
+  size_t ld;
+  const gchar *data = wslua_checklstring_only(L, WSLUA_ARG_Struct_tlv_STRUCT, &ld);
+  lua_Integer begin = luaL_optinteger(L, WSLUA_OPTARG_Struct_tlv_BEGIN, 1);
+  lua_Integer end = luaL_optinteger(L, WSLUA_OPTARG_Struct_tlv_END, (lua_Integer)ld);
+  const gchar *opts = luaL_optstring(L, WSLUA_OPTARG_Struct_tlv_FLAGS, "");
+  int flags = 0;
+  Layout tl, ll;
+
+  for (; *opts; opts++) {
+    switch (*opts) {
+      case 'h': flags |= TLV_HEADER; break;
+      case 'a': flags |= TLV_ARRAYS; break;
+      default: {
+        const gchar *msg = lua_pushfstring(L, "invalid flag [%c]", *opts);
+        return luaL_argerror(L, WSLUA_OPTARG_Struct_tlv_FLAGS, msg);
+      }
+    }
+  }
+  luaL_argcheck(L, begin >= 1, WSLUA_OPTARG_Struct_tlv_BEGIN, "position out of range");
+  if (end > (lua_Integer)ld)
+    end = (lua_Integer)ld;
+
+  lua_settop(L, 3);
+  tl = getlayout(L, WSLUA_ARG_Struct_tlv_TAGFORMAT, WSLUA_ARG_Struct_tlv_TAGFORMAT);
+  pushLayout(L, tl);
+  ll = getlayout(L, WSLUA_ARG_Struct_tlv_LENFORMAT, WSLUA_ARG_Struct_tlv_LENFORMAT);
+  pushLayout(L, ll);
+  luaL_argcheck(L, intfield(tl) != NULL, WSLUA_ARG_Struct_tlv_TAGFORMAT,
+                "format must have a fixed size, no alignment and an integer value");
+  luaL_argcheck(L, intfield(ll) != NULL, WSLUA_ARG_Struct_tlv_LENFORMAT,
+                "format must have a fixed size, no alignment and an integer value");
+  luaL_argcheck(L, tl->size + ll->size > 0, WSLUA_ARG_Struct_tlv_TAGFORMAT, "empty header");
+  if (end < begin - 1)
+    end = begin - 1;
+
+  if (flags & TLV_ARRAYS) {
+    size_t pos = (size_t)begin - 1;
+    lua_Number tag;
+    size_t voff, vlen;
+    int n = 0;
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_newtable(L);
+    while (tlv_next(tl, ll, flags, data, &pos, (size_t)end, &tag, &voff, &vlen) > 0) {
+      n++;
+      lua_pushnumber(L, tag);
+      lua_rawseti(L, -4, n);
+      lua_pushinteger(L, (lua_Integer)voff + 1);
+      lua_rawseti(L, -3, n);
+      lua_pushinteger(L, (lua_Integer)vlen);
+      lua_rawseti(L, -2, n);
+    }
+    lua_pushinteger(L, (lua_Integer)pos + 1);
+    WSLUA_RETURN(4); /* With the "a" flag: arrays of the tags, value positions and value lengths,
+                        plus the position where it stopped (after `END` unless an element was malformed). */
+  }
+
+  lua_pushvalue(L, WSLUA_ARG_Struct_tlv_STRUCT);
+  lua_pushvalue(L, 4);
+  lua_pushvalue(L, 5);
+  lua_pushinteger(L, begin - 1);
+  lua_pushinteger(L, end);
+  lua_pushinteger(L, flags);
+  lua_pushcclosure(L, tlv_iter, 6);
+  WSLUA_RETURN(1); /* The iterator function. */
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** ASN.1 BER/DER
+** =======================================================
+*/
+
+/* default and hard limit for the nesting depth of Struct.ber() */
+#define BER_DEFDEPTH  32
+#define BER_MAXDEPTH  256
+
+/* the columns of the table returned by Struct.ber(), in stack order */
+static const gchar *const ber_columns[] = {
+  "class", "tag", "constructed", "header", "offset", "length", "depth", NULL
+};
+#define BER_NCOLUMNS  7
+
+/* an open constructed element */
+typedef struct {
+  int node;         /* its index in the result */
+  size_t content;   /* offset of its content */
+  size_t end;       /* offset of the end of its content, or of the enclosing data if indefinite */
+  gboolean indefinite;
+} ber_open;
+
+/*
+** Parses the identifier and length octets at data+*pos, not going past 'limit'.
+** Returns NULL and advances *pos to the content, or returns an error message.
+*/
+static const gchar *ber_header (const guchar *data, size_t *pos, size_t limit,
+                                int *cls, guint32 *tag, gboolean *constructed,
+                                size_t *len, gboolean *indefinite) {
+  size_t p = *pos;
+  guchar c;
+  if (p >= limit) return "truncated identifier";
+  c = data[p++];
+  *cls = c >> 6;
+  *constructed = (c & 0x20) != 0;
+  *tag = c & 0x1F;
+  if (*tag == 0x1F) {  /* high tag number form */
+    *tag = 0;
+    do {
+      if (p >= limit) return "truncated identifier";
+      if (*tag > (G_MAXUINT32 >> 7)) return "tag number too large";
+      c = data[p++];
+      *tag = (*tag << 7) | (c & 0x7F);
+    } while (c & 0x80);
+  }
+  if (p >= limit) return "truncated length";
+  c = data[p++];
+  *indefinite = FALSE;
+  if (c < 0x80)
+    *len = c;
+  else if (c == 0x80) {
+    if (!*constructed) return "indefinite length on a primitive element";
+    *indefinite = TRUE;
+    *len = 0;
+  }
+  else {
+    int n = c & 0x7F;
+    if (n == 0x7F) return "reserved length octet";
+    if (n > (int)sizeof(size_t)) return "length too large";
+    if (limit - p < (size_t)n) return "truncated length";
+    *len = 0;
+    while (n-- > 0)
+      *len = (*len << 8) | data[p++];
+  }
+  if (!*indefinite && *len > limit - p) return "length exceeds the enclosing data";
+  *pos = p;
+  return NULL;
+}
+
+WSLUA_CONSTRUCTOR Struct_ber (lua_State *L) {
+  /* Parses ASN.1 BER (and so also DER) encoded data into a flat list of its elements, in
+     document order, without copying any content. The result is a table of arrays: `class`
+     (0 to 3), `tag` (the tag number), `constructed` (a boolean), `header` (the position of
+     the identifier octets), `offset` (the position of the content), `length` (the length of
+     the content, excluding any end-of-contents octets) and `depth` (0 for the outermost
+     elements); its field `n` is the number of elements. */
+#define WSLUA_ARG_Struct_ber_STRUCT 1 /* The binary Lua string to parse. */
+#define WSLUA_OPTARG_Struct_ber_BEGIN 2 /* The position of the first element (default=1). */
+#define WSLUA_OPTARG_Struct_ber_END 3 /* The position of the last byte to parse (default=the end of the string). */
+#define WSLUA_OPTARG_Struct_ber_MAXDEPTH 4 /* The maximum nesting depth (default=32, at most 256). */
+  size_t ld;
+  const guchar *data = (const guchar *)wslua_checklstring_only(L, WSLUA_ARG_Struct_ber_STRUCT, &ld);
+  lua_Integer begin = luaL_optinteger(L, WSLUA_OPTARG_Struct_ber_BEGIN, 1);
+  lua_Integer last = luaL_optinteger(L, WSLUA_OPTARG_Struct_ber_END, (lua_Integer)ld);
+  int maxdepth = (int)luaL_optinteger(L, WSLUA_OPTARG_Struct_ber_MAXDEPTH, BER_DEFDEPTH);
+  ber_open open[BER_MAXDEPTH];
+  int sp = 0, n = 0, i, result;
+  size_t pos, end;
+  const gchar *err = NULL;
+
+  luaL_argcheck(L, begin >= 1, WSLUA_OPTARG_Struct_ber_BEGIN, "position out of range");
+  luaL_argcheck(L, maxdepth >= 1 && maxdepth <= BER_MAXDEPTH, WSLUA_OPTARG_Struct_ber_MAXDEPTH,
+                "depth out of range");
+  if (last > (lua_Integer)ld)
+    last = (lua_Integer)ld;
+  pos = (size_t)begin - 1;
+  end = last < begin ? pos : (size_t)last;
+
+  lua_settop(L, 1);
+  lua_newtable(L);  /* the result, at index 2; the columns follow at 3..9 */
+  result = lua_gettop(L);
+  for (i = 0; i < BER_NCOLUMNS; i++)
+    lua_newtable(L);
+#define BER_COLUMN(c)  (result + 1 + (c))
+
+  for (;;) {
+    int cls;
+    guint32 tag;
+    gboolean constructed, indefinite;
+    size_t len, hdr, limit;
+
+    /* close the definite-length elements that end here */
+    while (sp > 0 && !open[sp-1].indefinite && pos == open[sp-1].end)
+      sp--;
+    limit = sp > 0 ? open[sp-1].end : end;
+    if (pos == limit) {
+      if (sp == 0) break;
+      err = "missing end-of-contents";
+      break;
+    }
+    if (sp > 0 && open[sp-1].indefinite && limit - pos >= 2 &&
+        data[pos] == 0 && data[pos+1] == 0) {
+      /* end-of-contents of an indefinite-length element */
+      lua_pushinteger(L, (lua_Integer)(pos - open[sp-1].content));
+      lua_rawseti(L, BER_COLUMN(5), open[sp-1].node);
+      pos += 2;
+      sp--;
+      continue;
+    }
+
+    hdr = pos;
+    err = ber_header(data, &pos, limit, &cls, &tag, &constructed, &len, &indefinite);
+    if (err) {
+      pos = hdr;
+      break;
+    }
+    if (cls == 0 && tag == 0) {
+      err = "unexpected end-of-contents";
+      pos = hdr;
+      break;
+    }
+
+    n++;
+    lua_pushinteger(L, cls);
+    lua_rawseti(L, BER_COLUMN(0), n);
+    lua_pushnumber(L, (lua_Number)tag);
+    lua_rawseti(L, BER_COLUMN(1), n);
+    lua_pushboolean(L, constructed);
+    lua_rawseti(L, BER_COLUMN(2), n);
+    lua_pushinteger(L, (lua_Integer)hdr + 1);
+    lua_rawseti(L, BER_COLUMN(3), n);
+    lua_pushinteger(L, (lua_Integer)pos + 1);
+    lua_rawseti(L, BER_COLUMN(4), n);
+    lua_pushinteger(L, (lua_Integer)len);  /* replaced when an indefinite length ends */
+    lua_rawseti(L, BER_COLUMN(5), n);
+    lua_pushinteger(L, sp);
+    lua_rawseti(L, BER_COLUMN(6), n);
+
+    if (constructed) {
+      if (sp >= maxdepth) {
+        err = "maximum depth exceeded";
+        pos = hdr;
+        break;
+      }
+      open[sp].node = n;
+      open[sp].content = pos;
+      open[sp].end = indefinite ? limit : pos + len;
+      open[sp].indefinite = indefinite;
+      sp++;
+    }
+    else {
+      pos += len;
+    }
+  }
+
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    lua_pushinteger(L, (lua_Integer)pos + 1);
+    WSLUA_RETURN(3); /* nil, an error message and the position of the element in error, if the data is malformed. */
+  }
+  for (i = BER_NCOLUMNS - 1; i >= 0; i--)
+    lua_setfield(L, result, ber_columns[i]);
+  lua_pushinteger(L, n);
+  lua_setfield(L, result, "n");
+  lua_pushinteger(L, (lua_Integer)pos + 1);
+#undef BER_COLUMN
+  WSLUA_RETURN(2); /* The table of elements, and the position after the last one. */
+}
+
+/* Gets the content range arguments of the BER value helpers */
+static const guchar *ber_content (lua_State *L, size_t *len) {
+  size_t ld;
+  const guchar *data = (const guchar *)wslua_checklstring_only(L, 1, &ld);
+  lua_Integer pos = luaL_optinteger(L, 2, 1);
+  lua_Integer n;
+  luaL_argcheck(L, pos >= 1 && (size_t)pos <= ld + 1, 2, "position out of range");
+  n = luaL_optinteger(L, 3, (lua_Integer)(ld - (size_t)(pos - 1)));
+  luaL_argcheck(L, n >= 0 && (size_t)n <= ld - (size_t)(pos - 1), 3, "length out of range");
+  *len = (size_t)n;
+  return data + (pos - 1);
+}
+
+WSLUA_CONSTRUCTOR Struct_berinteger (lua_State *L) {
+  /* Decodes the content of a BER INTEGER (or ENUMERATED) into an `Int64`, or into a `UInt64`
+     if it is positive but too large for an `Int64`. */
+#define WSLUA_ARG_Struct_berinteger_STRUCT 1 /* The binary Lua string. */
+#define WSLUA_OPTARG_Struct_berinteger_BEGIN 2 /* The position of the content (default=1). */
+#define WSLUA_OPTARG_Struct_berinteger_LENGTH 3 /* The length of the content (default=the rest of the string). */
+  size_t len;
+  const guchar *c = ber_content(L, &len);
+  gchar buff[8];
+  size_t i;
+  if (len == 0 || len > 9 || (len == 9 && c[0] != 0)) {
+    lua_pushnil(L);
+    WSLUA_RETURN(1); /* The `Int64` or `UInt64`, or nil if the content is empty or too large. */
+  }
+  if (len == 9) {  /* 2^63 and above, with a leading zero octet */
+    memcpy(buff, c + 1, 8);
+    UInt64_unpack(L, buff, FALSE);
+    WSLUA_RETURN(1); /* The `Int64` or `UInt64`, or nil if the content is empty or too large. */
+  }
+  /* sign-extend to 8 bytes, big-endian */
+  memset(buff, (c[0] & 0x80) ? 0xFF : 0, 8 - len);
+  for (i = 0; i < len; i++)
+    buff[8 - len + i] = (gchar)c[i];
+  Int64_unpack(L, buff, FALSE);
+  WSLUA_RETURN(1); /* The `Int64` or `UInt64`, or nil if the content is empty or too large. */
+}
+
+/* appends 'v' in decimal */
+static void addguint64 (luaL_Buffer *b, guint64 v) {
+  gchar buff[20];
+  int i = sizeof(buff);
+  do {
+    buff[--i] = (gchar)('0' + (v % 10));
+    v /= 10;
+  } while (v);
+  luaL_addlstring(b, buff + i, sizeof(buff) - i);
+}
+
+WSLUA_CONSTRUCTOR Struct_beroid (lua_State *L) {
+  /* Decodes the content of a BER OBJECT IDENTIFIER into its dotted form, e.g. "1.2.840.113549". */
+#define WSLUA_ARG_Struct_beroid_STRUCT 1 /* The binary Lua string. */
+#define WSLUA_OPTARG_Struct_beroid_BEGIN 2 /* The position of the content (default=1). */
+#define WSLUA_OPTARG_Struct_beroid_LENGTH 3 /* The length of the content (default=the rest of the string). */
+  size_t len, i;
+  const guchar *c = ber_content(L, &len);
+  luaL_Buffer b;
+  gboolean first = TRUE;
+  guint64 v = 0;
+  if (len == 0 || (c[len-1] & 0x80)) {
+    lua_pushnil(L);
+    WSLUA_RETURN(1); /* The dotted string, or nil if the content is not a valid OID. */
+  }
+  luaL_buffinit(L, &b);
+  for (i = 0; i < len; i++) {
+    if (v == 0 && c[i] == 0x80) {  /* subidentifiers must be minimally encoded */
+      lua_pushnil(L);
+      WSLUA_RETURN(1); /* The dotted string, or nil if the content is not a valid OID. */
+    }
+    if (v > (G_MAXUINT64 >> 7)) {
+      lua_pushnil(L);
+      WSLUA_RETURN(1); /* The dotted string, or nil if the content is not a valid OID. */
+    }
+    v = (v << 7) | (c[i] & 0x7F);
+    if (c[i] & 0x80)
+      continue;
+    if (first) {  /* the first subidentifier holds two arcs */
+      guint64 arc1 = v < 40 ? 0 : (v < 80 ? 1 : 2);
+      addguint64(&b, arc1);
+      luaL_addchar(&b, '.');
+      addguint64(&b, v - arc1 * 40);
+      first = FALSE;
+    }
+    else {
+      luaL_addchar(&b, '.');
+      addguint64(&b, v);
+    }
+    v = 0;
+  }
+  luaL_pushresult(&b);
+  WSLUA_RETURN(1); /* The dotted string, or nil if the content is not a valid OID. */
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Protocol Buffers wire format
+** =======================================================
+*/
+
+/* default and hard limit for the nesting depth of Struct.pbscan() */
+#define PB_DEFDEPTH  16
+#define PB_MAXDEPTH  64
+
+/* the columns of the table returned by Struct.pbscan(), in stack order */
+static const gchar *const pb_columns[] = {
+  "field", "wiretype", "offset", "length", "value", "depth", "nested", NULL
+};
+#define PB_NCOLUMNS  7
+
+/* wire types */
+#define PB_VARINT  0
+#define PB_I64     1
+#define PB_LEN     2
+#define PB_I32     5
+
+/* Reads a varint at d+*pos, not going past 'end'; returns FALSE if it is malformed */
+static gboolean pb_varint (const guchar *d, size_t *pos, size_t end, guint64 *v) {
+  size_t p = *pos;
+  int shift = 0;
+  *v = 0;
+  do {
+    if (p >= end || shift > 63)
+      return FALSE;
+    *v |= (guint64)(d[p] & 0x7F) << shift;
+    shift += 7;
+  } while (d[p++] & 0x80);
+  *pos = p;
+  return TRUE;
+}
+
+/*
+** Reads the field at d+*pos, not going past 'end'. Returns NULL and advances *pos
+** past the field, or returns an error message.
+*/
+static const gchar *pb_field (const guchar *d, size_t *pos, size_t end, guint32 *field,
+                              int *wt, size_t *voff, size_t *vlen, guint64 *value) {
+  size_t p = *pos;
+  guint64 key;
+  if (!pb_varint(d, &p, end, &key))
+    return "malformed key";
+  if ((key >> 3) == 0 || (key >> 3) > 0x1FFFFFFF)
+    return "invalid field number";
+  *field = (guint32)(key >> 3);
+  *wt = (int)(key & 7);
+  *voff = p;
+  *value = 0;
+  switch (*wt) {
+    case PB_VARINT:
+      if (!pb_varint(d, &p, end, value))
+        return "malformed varint";
+      break;
+    case PB_I64: case PB_I32: {
+      size_t n = *wt == PB_I64 ? 8 : 4;
+      size_t i;
+      if (end - p < n)
+        return "truncated fixed-size value";
+      for (i = n; i > 0; i--)
+        *value = (*value << 8) | d[p + i - 1];
+      p += n;
+      break;
+    }
+    case PB_LEN: {
+      guint64 n;
+      if (!pb_varint(d, &p, end, &n))
+        return "malformed length";
+      if (n > end - p)
+        return "length exceeds the enclosing data";
+      *voff = p;
+      p += (size_t)n;
+      break;
+    }
+    default:
+      return "unsupported wire type";
+  }
+  *vlen = p - *voff;
+  *pos = p;
+  return NULL;
+}
+
+/* does d[pos..end) consist of well-formed fields? */
+static gboolean pb_ismessage (const guchar *d, size_t pos, size_t end) {
+  guint32 field;
+  int wt;
+  size_t voff, vlen;
+  guint64 value;
+  while (pos < end) {
+    if (pb_field(d, &pos, end, &field, &wt, &voff, &vlen, &value) != NULL)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* pushes a decoded varint or fixed value: a number up to 2^53, a UInt64 above */
+static void pb_pushvalue (lua_State *L, guint64 v) {
+  if (v <= (G_GUINT64_CONSTANT(1) << 53))
+    lua_pushnumber(L, (lua_Number)v);
+  else {
+    gchar buff[8];
+    int i;
+    for (i = 0; i < 8; i++, v >>= 8)
+      buff[i] = (gchar)(v & 0xFF);
+    UInt64_unpack(L, buff, TRUE);
+  }
+}
+
+/*
+** Appends the fields of d[pos..end) at 'depth' to the columns starting at
+** stack index 'col', recursing into the length-delimited fields that are
+** well-formed messages. Returns NULL, or an error message and its position.
+*/
+static const gchar *pb_scan (lua_State *L, int col, int *n, const guchar *d,
+                             size_t pos, size_t end, int depth, int maxdepth,
+                             size_t *errpos) {
+  while (pos < end) {
+    guint32 field;
+    int wt;
+    size_t start = pos, voff, vlen;
+    guint64 value;
+    gboolean nested;
+    const gchar *err = pb_field(d, &pos, end, &field, &wt, &voff, &vlen, &value);
+    if (err) {
+      *errpos = start;
+      return err;
+    }
+    nested = wt == PB_LEN && vlen > 0 && depth < maxdepth &&
+             pb_ismessage(d, voff, voff + vlen);
+
+    (*n)++;
+    lua_pushnumber(L, (lua_Number)field);
+    lua_rawseti(L, col + 0, *n);
+    lua_pushinteger(L, wt);
+    lua_rawseti(L, col + 1, *n);
+    lua_pushinteger(L, (lua_Integer)voff + 1);
+    lua_rawseti(L, col + 2, *n);
+    lua_pushinteger(L, (lua_Integer)vlen);
+    lua_rawseti(L, col + 3, *n);
+    if (wt == PB_LEN)
+      lua_pushboolean(L, FALSE);
+    else
+      pb_pushvalue(L, value);
+    lua_rawseti(L, col + 4, *n);
+    lua_pushinteger(L, depth);
+    lua_rawseti(L, col + 5, *n);
+    lua_pushboolean(L, nested);
+    lua_rawseti(L, col + 6, *n);
+
+    if (nested)  /* already checked, so this cannot fail */
+      pb_scan(L, col, n, d, voff, voff + vlen, depth + 1, maxdepth, errpos);
+  }
+  return NULL;
+}
+
+WSLUA_CONSTRUCTOR Struct_pbscan (lua_State *L) {
+  /* Scans data in the Protocol Buffers wire format, without a schema, into a flat list of its
+     fields in document order. The result is a table of arrays: `field` (the field number),
+     `wiretype`, `offset` (the position of the value), `length` (its length in bytes), `value`
+     (the decoded varint, fixed32 or fixed64 as a number, or as a `UInt64` above 2^53; false
+     for length-delimited fields), `depth` and `nested` (true for a length-delimited field that
+     parses as a message, whose fields follow it with a greater depth); its field `n` is the
+     number of fields. */
+#define WSLUA_ARG_Struct_pbscan_STRUCT 1 /* The binary Lua string to scan. */
+#define WSLUA_OPTARG_Struct_pbscan_BEGIN 2 /* The position of the first field (default=1). */
+#define WSLUA_OPTARG_Struct_pbscan_END 3 /* The position of the last byte to scan (default=the end of the string). */
+#define WSLUA_OPTARG_Struct_pbscan_MAXDEPTH 4 /* How deep to look for nested messages (default=16, at most 64);
+                                                0 does not look into length-delimited fields at all. */
+  size_t ld;
+  const guchar *data = (const guchar *)wslua_checklstring_only(L, WSLUA_ARG_Struct_pbscan_STRUCT, &ld);
+  lua_Integer begin = luaL_optinteger(L, WSLUA_OPTARG_Struct_pbscan_BEGIN, 1);
+  lua_Integer last = luaL_optinteger(L, WSLUA_OPTARG_Struct_pbscan_END, (lua_Integer)ld);
+  int maxdepth = (int)luaL_optinteger(L, WSLUA_OPTARG_Struct_pbscan_MAXDEPTH, PB_DEFDEPTH);
+  size_t pos, end, errpos = 0;
+  int result, i, n = 0;
+  const gchar *err;
+
+  luaL_argcheck(L, begin >= 1, WSLUA_OPTARG_Struct_pbscan_BEGIN, "position out of range");
+  luaL_argcheck(L, maxdepth >= 0 && maxdepth <= PB_MAXDEPTH, WSLUA_OPTARG_Struct_pbscan_MAXDEPTH,
+                "depth out of range");
+  if (last > (lua_Integer)ld)
+    last = (lua_Integer)ld;
+  pos = (size_t)begin - 1;
+  end = last < begin ? pos : (size_t)last;
+
+  lua_settop(L, 1);
+  lua_newtable(L);  /* the result, at index 2; the columns follow at 3..9 */
+  result = lua_gettop(L);
+  for (i = 0; i < PB_NCOLUMNS; i++)
+    lua_newtable(L);
+  err = pb_scan(L, result + 1, &n, data, pos, end, 0, maxdepth, &errpos);
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    lua_pushinteger(L, (lua_Integer)errpos + 1);
+    WSLUA_RETURN(3); /* nil, an error message and the position of the field in error, if the data is malformed. */
+  }
+  for (i = PB_NCOLUMNS - 1; i >= 0; i--)
+    lua_setfield(L, result, pb_columns[i]);
+  lua_pushinteger(L, n);
+  lua_setfield(L, result, "n");
+  WSLUA_RETURN(1); /* The table of fields. */
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Scans over arrays of fixed-size records
+** =======================================================
+*/
+
+/* kinds of the values a scan reads */
+#define SCAN_INT    0   /* signed integers, 'e' */
+#define SCAN_UINT   1   /* unsigned integers, 'E' */
+#define SCAN_FLOAT  2   /* 'f', 'd' */
+#define SCAN_BYTES  3   /* 'c' */
+
+/* A number read from a record, or a constant */
+typedef struct {
+  int kind;
+  union {
+    gint64 i;
+    guint64 u;
+    gdouble d;
+  } v;
+} scan_num;
+
+/* A value of the records that a scan reads */
+typedef struct {
+  const wst_field *f;
+  guint32 offset;       /* from the start of the record */
+  int kind;
+} scan_field;
+
+/* Gets the layout of the records at 'arg', which must be fixed and repeatable
+   back to back; the layout is left on the stack, which owns it */
+static const wst_layout *scan_checklayout (lua_State *L, int arg) {
+  wst_layout *l = getlayout(L, arg, arg);
+  pushLayout(L, l);
+  if (!l->fixed)
+    luaL_argerror(L, arg, "records must have a fixed size");
+  if (l->size == 0 || (l->size & (l->align - 1)) != 0)
+    luaL_argerror(L, arg, "records must have a nonzero size that is a multiple of their alignment");
+  return l;
+}
+
+/* Resolves the value index or name at stack index 'idx' in the record layout */
+static void scan_checkfield (lua_State *L, const wst_layout *l, int idx, int arg, scan_field *sf) {
+  lua_Integer i = -1;
+  if (lua_type(L, idx) == LUA_TNUMBER)
+    i = lua_tointeger(L, idx) - 1;
+  else if (lua_type(L, idx) == LUA_TSTRING)
+    i = (lua_Integer)wst_layout_lookup(l, lua_tostring(L, idx), lua_objlen(L, idx));
+  else
+    luaL_argerror(L, arg, "value index or name expected");
+  sf->f = (i >= 0 && i <= G_MAXUINT32) ? wst_layout_value(l, (guint32)i, &sf->offset) : NULL;
+  if (sf->f == NULL)
+    luaL_argerror(L, arg, lua_pushfstring(L, "no value %s in the records", lua_tostring(L, idx)));
+  switch (sf->f->opt) {
+    case 'b': case 'h': case 'l': case 'i': case 'e':
+      sf->kind = SCAN_INT;
+      break;
+    case 'B': case 'H': case 'L': case 'T': case 'I': case 'E':
+      sf->kind = SCAN_UINT;
+      break;
+    case 'f': case 'd':
+      sf->kind = SCAN_FLOAT;
+      break;
+    case 'c':
+      sf->kind = SCAN_BYTES;
+      break;
+    default:
+      luaL_argerror(L, arg, lua_pushfstring(L, "value %s cannot be scanned", lua_tostring(L, idx)));
+  }
+  if (sf->f->size > 8 && sf->kind != SCAN_BYTES)
+    luaL_argerror(L, arg, lua_pushfstring(L, "value %s is wider than 64 bits", lua_tostring(L, idx)));
+}
+
+/* Reads a numeric value of the record at 'rec' */
+static void scan_read (const scan_field *sf, const guchar *rec, scan_num *n) {
+  const guchar *p = rec + sf->offset;
+  guint32 size = sf->f->size;
+  guint64 u = 0;
+  guint32 i;
+  if (sf->f->endian == BIG)
+    for (i = 0; i < size; i++)
+      u = (u << 8) | p[i];
+  else
+    for (i = size; i-- > 0; )
+      u = (u << 8) | p[i];
+  n->kind = sf->kind;
+  switch (sf->kind) {
+    case SCAN_INT:
+      if (size < 8 && (u >> (size*8 - 1)) & 1)
+        u |= ~(guint64)0 << (size*8);  /* sign extension */
+      n->v.i = (gint64)u;
+      break;
+    case SCAN_FLOAT:
+      if (size == sizeof(gfloat)) {
+        guint32 bits = (guint32)u;
+        gfloat f;
+        memcpy(&f, &bits, sizeof(f));
+        n->v.d = f;
+      }
+      else
+        memcpy(&n->v.d, &u, sizeof(n->v.d));
+      break;
+    default:
+      n->v.u = u;
+      break;
+  }
+}
+
+/* Gets the number, Int64 or UInt64 at stack index 'idx' */
+static void scan_checknum (lua_State *L, int idx, int arg, scan_num *n) {
+  if (lua_type(L, idx) == LUA_TNUMBER) {
+    lua_Number d = lua_tonumber(L, idx);
+    if (d >= -9223372036854775808.0 && d < 0 && d == (lua_Number)(gint64)d) {
+      n->kind = SCAN_INT;
+      n->v.i = (gint64)d;
+    }
+    else if (d >= 0 && d < 18446744073709551616.0 && d == (lua_Number)(guint64)d) {
+      n->kind = SCAN_UINT;
+      n->v.u = (guint64)d;
+    }
+    else {
+      n->kind = SCAN_FLOAT;
+      n->v.d = d;
+    }
+  }
+  else if (isInt64(L, idx)) {
+    n->kind = SCAN_INT;
+    n->v.i = checkInt64(L, idx);
+  }
+  else if (isUInt64(L, idx)) {
+    n->kind = SCAN_UINT;
+    n->v.u = checkUInt64(L, idx);
+  }
+  else
+    luaL_argerror(L, arg, "number, Int64 or UInt64 expected");
+}
+
+#define SCAN_UNORDERED  2
+
+#define scan_isnan(n)   ((n)->kind == SCAN_FLOAT && (n)->v.d != (n)->v.d)
+
+/* Gets the index in 'names' of the string at the top of the stack */
+static int scan_checkname (lua_State *L, const gchar *const names[], int arg, const gchar *msg) {
+  int i;
+  if (lua_type(L, -1) == LUA_TSTRING)
+    for (i = 0; names[i]; i++)
+      if (strcmp(lua_tostring(L, -1), names[i]) == 0)
+        return i;
+  return luaL_argerror(L, arg, msg);
+}
+
+/* Compares two integers, SCAN_INT or SCAN_UINT: -1, 0 or 1 */
+static int scan_intcmp (const scan_num *a, const scan_num *b) {
+  gboolean aneg = a->kind == SCAN_INT && a->v.i < 0;
+  gboolean bneg = b->kind == SCAN_INT && b->v.i < 0;
+  if (aneg != bneg)
+    return aneg ? -1 : 1;
+  if (aneg)
+    return (a->v.i > b->v.i) - (a->v.i < b->v.i);
+  return (a->v.u > b->v.u) - (a->v.u < b->v.u);  /* both nonnegative */
+}
+
+/* Compares a float with an integer exactly, without converting the integer to a double,
+   which rounds it above 2^53: -1, 0, 1, or SCAN_UNORDERED for a NaN */
+static int scan_fltcmp (gdouble x, const scan_num *b) {
+  scan_num t;
+  int c;
+  if (x != x)
+    return SCAN_UNORDERED;
+  if (x >= 18446744073709551616.0)
+    return 1;   /* above every integer, as is +inf */
+  if (x < -9223372036854775808.0)
+    return -1;
+  /* the integral part of x is in range, and exact */
+  if (x < 0) {
+    t.kind = SCAN_INT;
+    t.v.i = (gint64)x;
+  }
+  else {
+    t.kind = SCAN_UINT;
+    t.v.u = (guint64)x;
+  }
+  c = scan_intcmp(&t, b);
+  if (c != 0)
+    return c;
+  /* an integral part equal to b: the fraction decides */
+  return x < 0 ? -(x != (gdouble)t.v.i) : (x != (gdouble)t.v.u);
+}
+
+/* Compares two numbers exactly: -1, 0, 1, or SCAN_UNORDERED for a NaN */
+static int scan_numcmp (const scan_num *a, const scan_num *b) {
+  if (a->kind == SCAN_FLOAT && b->kind == SCAN_FLOAT) {
+    gdouble x = a->v.d, y = b->v.d;
+    if (x != x || y != y)
+      return SCAN_UNORDERED;
+    return (x > y) - (x < y);
+  }
+  if (a->kind == SCAN_FLOAT)
+    return scan_fltcmp(a->v.d, b);
+  if (b->kind == SCAN_FLOAT) {
+    int c = scan_fltcmp(b->v.d, a);
+    return c == SCAN_UNORDERED ? c : -c;
+  }
+  return scan_intcmp(a, b);
+}
+
+/* Compares a value of the record at 'rec' with a constant: the string s[0..slen)
+   for a SCAN_BYTES value, the number 'k' for others; returns -1, 0, 1 or SCAN_UNORDERED */
+static int scan_cmp (const scan_field *sf, const guchar *rec, const scan_num *k,
+                     const gchar *s, size_t slen) {
+  scan_num n;
+  if (sf->kind == SCAN_BYTES) {
+    size_t size = sf->f->size;
+    int c = memcmp(rec + sf->offset, s, MIN(size, slen));
+    return c ? (c > 0 ? 1 : -1) : (size > slen) - (size < slen);
+  }
+  scan_read(sf, rec, &n);
+  return scan_numcmp(&n, k);
+}
+
+/* operators of filter predicates, in the order of pred_ops[] */
+#define PRED_AND    0
+#define PRED_OR     1
+#define PRED_NOT    2
+#define PRED_EQ     3
+#define PRED_NE     4
+#define PRED_LT     5
+#define PRED_LE     6
+#define PRED_GT     7
+#define PRED_GE     8
+#define PRED_BITS   9   /* any of the bits of the constant set */
+
+static const gchar *const pred_ops[] = {
+  "and", "or", "not", "==", "~=", "<", "<=", ">", ">=", "&", NULL
+};
+
+/* limits on the nodes and the nesting of a predicate */
+#define PRED_MAXNODES   256
+#define PRED_MAXDEPTH   32
+
+/* A node of a compiled predicate; the operands of 'and', 'or' and 'not'
+   are the subtrees that follow it, up to 'next' */
+typedef struct {
+  int op;
+  guint32 next;         /* the index after this node's subtree */
+  scan_field field;     /* the value compared */
+  scan_num k;           /* the constant, unless the value is SCAN_BYTES */
+  const gchar *s;       /* the string constant of a SCAN_BYTES value, anchored in the predicate */
+  size_t slen;
+} scan_pred;
+
+/* Compiles the predicate table at the top of the stack into nodes[n...]; returns the next free node */
+static guint32 pred_build (lua_State *L, const wst_layout *l, scan_pred *nodes, guint32 n,
+                           int depth, int arg) {
+  int top = lua_gettop(L);
+  guint32 self = n++;
+  scan_pred *p = &nodes[self];
+  if (!lua_istable(L, top))
+    luaL_argerror(L, arg, "predicates must be tables");
+  if (self >= PRED_MAXNODES || depth > PRED_MAXDEPTH)
+    luaL_argerror(L, arg, "predicate too complex");
+  lua_rawgeti(L, top, 1);
+  p->op = scan_checkname(L, pred_ops, arg, "invalid predicate operator");
+  if (p->op <= PRED_NOT) {
+    int i, nargs = (int)lua_objlen(L, top);
+    if (p->op == PRED_NOT && nargs != 2)
+      luaL_argerror(L, arg, "'not' takes one operand");
+    for (i = 2; i <= nargs; i++) {
+      lua_rawgeti(L, top, i);
+      n = pred_build(L, l, nodes, n, depth + 1, arg);
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    lua_rawgeti(L, top, 2);
+    scan_checkfield(L, l, lua_gettop(L), arg, &p->field);
+    lua_rawgeti(L, top, 3);
+    if (p->field.kind == SCAN_BYTES) {
+      if (p->op == PRED_BITS || lua_type(L, -1) != LUA_TSTRING)
+        luaL_argerror(L, arg, "string values can only be compared with strings");
+      p->s = lua_tolstring(L, -1, &p->slen);
+    }
+    else {
+      scan_checknum(L, lua_gettop(L), arg, &p->k);
+      if (p->op == PRED_BITS && (p->field.kind == SCAN_FLOAT || p->k.kind == SCAN_FLOAT))
+        luaL_argerror(L, arg, "'&' needs an integer value and an integer constant");
+    }
+  }
+  lua_settop(L, top);
+  p->next = n;
+  return n;
+}
+
+/* Evaluates the predicate at nodes[i] for the record at 'rec' */
+static gboolean pred_eval (const scan_pred *nodes, guint32 i, const guchar *rec) {
+  const scan_pred *p = &nodes[i];
+  scan_num n;
+  guint32 j;
+  int c;
+  switch (p->op) {
+    case PRED_AND:
+      for (j = i + 1; j < p->next; j = nodes[j].next)
+        if (!pred_eval(nodes, j, rec))
+          return FALSE;
+      return TRUE;
+    case PRED_OR:
+      for (j = i + 1; j < p->next; j = nodes[j].next)
+        if (pred_eval(nodes, j, rec))
+          return TRUE;
+      return FALSE;
+    case PRED_NOT:
+      return !pred_eval(nodes, i + 1, rec);
+    default:
+      break;
+  }
+  if (p->op == PRED_BITS) {
+    scan_read(&p->field, rec, &n);
+    return (n.v.u & p->k.v.u) != 0;  /* the two's complement bits, for signed ones */
+  }
+  c = scan_cmp(&p->field, rec, &p->k, p->s, p->slen);
+  switch (p->op) {
+    case PRED_EQ: return c == 0;
+    case PRED_NE: return c != 0;
+    case PRED_LT: return c == -1;
+    case PRED_LE: return c == -1 || c == 0;
+    case PRED_GT: return c == 1;
+    default: return c == 1 || c == 0;
+  }
+}
+
+static const gchar *const filter_results[] = { "positions", "records", NULL };
+
+WSLUA_CONSTRUCTOR Struct_filter (lua_State *L) {
+  /* Scans records of a fixed-size format stored back to back, and returns those for which
+     a predicate is true. The predicate is evaluated natively, without decoding the records
+     into Lua values.
+
+     A predicate is a table: `{ op, value, constant }` compares a value of the record, given by
+     its index (as in the results of `Struct.unpack()`) or by its name (see `Struct.compile()`),
+     with a constant, where op is one of "==", "~=", "<", "<=", ">", ">=", or "&" (true if any of
+     the constant's bits are set in the value). Constants are numbers, `Int64` or `UInt64` objects,
+     compared exactly with the values, integers and floats alike, even beyond 2^53 or outside
+     the range of 64-bit integers, or strings for `c` values. `{ "and", p1, p2, ... }`,
+     `{ "or", p1, p2, ... }` and `{ "not", p }` combine predicates.
+
+     For example, `Struct.filter(">H H B", data, { "and", { "~=", 3, 0 }, { "==", 2, 443 } })`. */
+#define WSLUA_ARG_Struct_filter_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_filter_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_filter_PREDICATE 3 /* The predicate. */
+#define WSLUA_OPTARG_Struct_filter_BEGIN 4 /* The position of the first record (default=1). */
+#define WSLUA_OPTARG_Struct_filter_RESULT 5 /* "positions" (the default) for an array of the positions
+                                               of the matching records, or "records" for a string of
+                                               the matching records, back to back. */
+  const wst_layout *l;
+  size_t ld, pos;
+  const guchar *data;
+  scan_pred *nodes;
+  gboolean records;
+  lua_Integer n = 0;
+  luaL_Buffer b;
+
+  lua_settop(L, 5);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_filter_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_filter_DATA, &ld);
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_filter_BEGIN, 1) - 1;
+  records = luaL_checkoption(L, WSLUA_OPTARG_Struct_filter_RESULT, "positions", filter_results) == 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_filter_BEGIN, "position not aligned for the records");
+
+  nodes = (scan_pred *)lua_newuserdata(L, PRED_MAXNODES * sizeof(scan_pred));
+  lua_pushvalue(L, WSLUA_ARG_Struct_filter_PREDICATE);
+  pred_build(L, l, nodes, 0, 0, WSLUA_ARG_Struct_filter_PREDICATE);
+  lua_pop(L, 1);
+
+  if (records)
+    luaL_buffinit(L, &b);
+  else
+    lua_newtable(L);
+  for (; pos <= ld && l->extent <= ld - pos; pos += l->size) {
+    if (!pred_eval(nodes, 0, data + pos))
+      continue;
+    if (records)
+      luaL_addlstring(&b, (const gchar *)data + pos, l->size);
+    else {
+      lua_pushinteger(L, (lua_Integer)pos + 1);
+      lua_rawseti(L, -2, (int)++n);
+    }
+  }
+  if (records)
+    luaL_pushresult(&b);
+  lua_pushinteger(L, (lua_Integer)pos + 1);
+  WSLUA_RETURN(2); /* The positions or the records that match, and the position after the last whole record. */
+}
+
+/* the statistics Struct.aggregate computes, in the order of agg_ops[] */
+#define AGG_COUNT   0x01
+#define AGG_SUM     0x02
+#define AGG_MIN     0x04
+#define AGG_MAX     0x08
+
+static const gchar *const agg_ops[] = { "count", "sum", "min", "max", NULL };
+
+/* A group of records with equal keys, in the hash table of Struct.aggregate */
+typedef struct {
+  guint64 key;          /* the key, or the hash of a string key */
+  size_t keypos;        /* the position of the group's first record */
+  guint64 count;        /* 0 for an empty slot */
+  scan_num sum, min, max;
+} agg_group;
+
+/* FNV-1a, for 'c' keys */
+static guint64 agg_hashbytes (const guchar *p, size_t n) {
+  guint64 h = G_GUINT64_CONSTANT(14695981039346656037);
+  while (n-- > 0)
+    h = (h ^ *p++) * G_GUINT64_CONSTANT(1099511628211);
+  return h;
+}
+
+/* the slot of hash 'h' in a table of 'mask'+1 slots */
+#define aggslot(h,mask) \
+  ((guint32)(((h) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32) & (mask))
+
+/* Pushes an integer as a number if that is exact, or else as an Int64/UInt64 */
+static void agg_pushnum (lua_State *L, const scan_num *n) {
+  switch (n->kind) {
+    case SCAN_INT:
+      if (n->v.i >= -(G_GINT64_CONSTANT(1) << 53) && n->v.i <= (G_GINT64_CONSTANT(1) << 53))
+        lua_pushnumber(L, (lua_Number)n->v.i);
+      else
+        pushInt64(L, n->v.i);
+      break;
+    case SCAN_UINT:
+      if (n->v.u <= (G_GUINT64_CONSTANT(1) << 53))
+        lua_pushnumber(L, (lua_Number)n->v.u);
+      else
+        pushUInt64(L, n->v.u);
+      break;
+    default:
+      lua_pushnumber(L, n->v.d);
+      break;
+  }
+}
+
+/* Adds the value to a group's sum, raising an error if an integer sum overflows */
+static void agg_add (lua_State *L, scan_num *sum, const scan_num *v) {
+  switch (v->kind) {
+    case SCAN_INT:
+      if ((v->v.i > 0 && sum->v.i > G_MAXINT64 - v->v.i) || (v->v.i < 0 && sum->v.i < G_MININT64 - v->v.i))
+        luaL_error(L, "sum overflows 64 bits");
+      sum->v.i += v->v.i;
+      break;
+    case SCAN_UINT:
+      if (sum->v.u + v->v.u < sum->v.u)
+        luaL_error(L, "sum overflows 64 bits");
+      sum->v.u += v->v.u;
+      break;
+    default:
+      sum->v.d += v->v.d;
+      break;
+  }
+}
+
+WSLUA_CONSTRUCTOR Struct_aggregate (lua_State *L) {
+  /* Groups records of a fixed-size format stored back to back by the value of a key, and computes
+     the count of each group and the sum, minimum and maximum of another value over it, in one native
+     pass. Integer sums are exact, and an error is raised if one overflows 64 bits. Integers that a
+     Lua number cannot hold exactly, keys included, are returned as `Int64` or `UInt64` objects.
+     NaNs are ignored by the minimum and maximum. */
+#define WSLUA_ARG_Struct_aggregate_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_aggregate_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_aggregate_KEY 3 /* The index or name of the key value, an integer or a `c` string. */
+#define WSLUA_OPTARG_Struct_aggregate_VALUE 4 /* The index or name of the numeric value to aggregate,
+                                                 nil to only count the records. */
+#define WSLUA_OPTARG_Struct_aggregate_OPS 5 /* An array of the statistics wanted, among "count", "sum",
+                                               "min" and "max" (default: all of them, or "count" without
+                                               a value). */
+#define WSLUA_OPTARG_Struct_aggregate_BEGIN 6 /* The position of the first record (default=1). */
+  const wst_layout *l;
+  size_t ld, pos;
+  const guchar *data;
+  scan_field key, value;
+  gboolean hasvalue;
+  int ops = 0;
+  guint32 nslots = 64, ngroups = 0, i;
+  agg_group *groups;
+  int slotsidx;
+
+  lua_settop(L, 6);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_aggregate_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_aggregate_DATA, &ld);
+  scan_checkfield(L, l, WSLUA_ARG_Struct_aggregate_KEY, WSLUA_ARG_Struct_aggregate_KEY, &key);
+  luaL_argcheck(L, key.kind != SCAN_FLOAT, WSLUA_ARG_Struct_aggregate_KEY, "keys must be integers or strings");
+  hasvalue = !lua_isnil(L, WSLUA_OPTARG_Struct_aggregate_VALUE);
+  if (hasvalue) {
+    scan_checkfield(L, l, WSLUA_OPTARG_Struct_aggregate_VALUE, WSLUA_OPTARG_Struct_aggregate_VALUE, &value);
+    luaL_argcheck(L, value.kind != SCAN_BYTES, WSLUA_OPTARG_Struct_aggregate_VALUE, "values must be numbers");
+  }
+  if (lua_isnil(L, WSLUA_OPTARG_Struct_aggregate_OPS))
+    ops = hasvalue ? AGG_COUNT | AGG_SUM | AGG_MIN | AGG_MAX : AGG_COUNT;
+  else {
+    int n;
+    luaL_checktype(L, WSLUA_OPTARG_Struct_aggregate_OPS, LUA_TTABLE);
+    n = (int)lua_objlen(L, WSLUA_OPTARG_Struct_aggregate_OPS);
+    for (i = 1; i <= (guint32)n; i++) {
+      lua_rawgeti(L, WSLUA_OPTARG_Struct_aggregate_OPS, (int)i);
+      ops |= 1 << scan_checkname(L, agg_ops, WSLUA_OPTARG_Struct_aggregate_OPS, "invalid statistic");
+      lua_pop(L, 1);
+    }
+    luaL_argcheck(L, hasvalue || ops == AGG_COUNT || ops == 0, WSLUA_OPTARG_Struct_aggregate_OPS,
+                  "only \"count\" is possible without a value");
+  }
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_aggregate_BEGIN, 1) - 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_aggregate_BEGIN, "position not aligned for the records");
+
+  /* the table is a userdata, so that an error does not leak it */
+  groups = (agg_group *)lua_newuserdata(L, nslots * sizeof(agg_group));
+  memset(groups, 0, nslots * sizeof(agg_group));
+  slotsidx = lua_gettop(L);
+
+  for (; pos <= ld && l->extent <= ld - pos; pos += l->size) {
+    const guchar *rec = data + pos;
+    guint64 h;
+    agg_group *g;
+    if (key.kind == SCAN_BYTES)
+      h = agg_hashbytes(rec + key.offset, key.f->size);
+    else {
+      scan_num k;
+      scan_read(&key, rec, &k);
+      h = k.v.u;
+    }
+    for (i = aggslot(h, nslots - 1); groups[i].count; i = (i + 1) & (nslots - 1)) {
+      if (groups[i].key == h && (key.kind != SCAN_BYTES
+          || memcmp(data + groups[i].keypos + key.offset, rec + key.offset, key.f->size) == 0))
+        break;
+    }
+    g = &groups[i];
+    if (hasvalue) {
+      scan_num v;
+      scan_read(&value, rec, &v);
+      if (g->count == 0) {
+        g->sum.kind = v.kind;
+        g->sum.v.u = 0;
+        g->min = g->max = v;
+      }
+      agg_add(L, &g->sum, &v);
+      if (scan_numcmp(&v, &g->min) == -1 || scan_isnan(&g->min))
+        g->min = v;
+      if (scan_numcmp(&v, &g->max) == 1 || scan_isnan(&g->max))
+        g->max = v;
+    }
+    if (g->count++ == 0) {
+      g->key = h;
+      g->keypos = pos;
+      if (++ngroups > nslots / 2) {  /* load factor at most 1/2 */
+        agg_group *old = groups;
+        guint32 j, oldslots = nslots;
+        if (nslots >= G_MAXUINT32 / 2 / sizeof(agg_group))
+          return luaL_error(L, "too many groups");
+        nslots *= 2;
+        groups = (agg_group *)lua_newuserdata(L, nslots * sizeof(agg_group));
+        memset(groups, 0, nslots * sizeof(agg_group));
+        for (j = 0; j < oldslots; j++) {
+          if (old[j].count) {
+            for (i = aggslot(old[j].key, nslots - 1); groups[i].count; i = (i + 1) & (nslots - 1)) ;
+            groups[i] = old[j];
+          }
+        }
+        lua_replace(L, slotsidx);
+      }
+    }
+  }
+
+  lua_createtable(L, 0, (int)MIN(ngroups, G_MAXINT / 2));
+  for (i = 0; i < nslots; i++) {
+    agg_group *g = &groups[i];
+    scan_num count;
+    if (g->count == 0)
+      continue;
+    if (key.kind == SCAN_BYTES)
+      lua_pushlstring(L, (const gchar *)data + g->keypos + key.offset, key.f->size);
+    else {
+      scan_num k;
+      scan_read(&key, data + g->keypos, &k);
+      agg_pushnum(L, &k);
+    }
+    lua_createtable(L, 0, 4);
+    count.kind = SCAN_UINT;
+    count.v.u = g->count;
+    if (ops & AGG_COUNT) {
+      agg_pushnum(L, &count);
+      lua_setfield(L, -2, "count");
+    }
+    if (ops & AGG_SUM) {
+      agg_pushnum(L, &g->sum);
+      lua_setfield(L, -2, "sum");
+    }
+    if (ops & AGG_MIN) {
+      agg_pushnum(L, &g->min);
+      lua_setfield(L, -2, "min");
+    }
+    if (ops & AGG_MAX) {
+      agg_pushnum(L, &g->max);
+      lua_setfield(L, -2, "max");
+    }
+    lua_rawset(L, -3);
+  }
+  lua_pushinteger(L, (lua_Integer)pos + 1);
+  WSLUA_RETURN(2); /* A table mapping each key to a table of the statistics wanted, and the position
+                      after the last whole record. */
+}
+
+/* Gets the key of the record at 'rec' as an unsigned integer that orders like the key */
+static guint64 sort_key (const scan_field *sf, const guchar *rec) {
+  guint32 bits = sf->f->size * 8;
+  scan_num n;
+  scan_read(sf, rec, &n);
+  switch (sf->kind) {
+    case SCAN_INT:  /* flip the sign bit */
+      return (n.v.u ^ (G_GUINT64_CONSTANT(1) << (bits - 1))) & (~G_GUINT64_CONSTANT(0) >> (64 - bits));
+    case SCAN_FLOAT: {  /* negative numbers have all bits flipped, positive ones the sign bit */
+      guint64 u;
+      if (bits == 32) {
+        gfloat f = (gfloat)n.v.d;
+        guint32 b;
+        memcpy(&b, &f, sizeof(b));
+        u = b;
+      }
+      else
+        memcpy(&u, &n.v.d, sizeof(u));
+      if (u >> (bits - 1))
+        return ~u & (~G_GUINT64_CONSTANT(0) >> (64 - bits));
+      return u | (G_GUINT64_CONSTANT(1) << (bits - 1));
+    }
+    default:
+      return n.v.u;
+  }
+}
+
+static const gchar *const sort_results[] = { "records", "positions", NULL };
+
+WSLUA_CONSTRUCTOR Struct_sort (lua_State *L) {
+  /* Sorts records of a fixed-size format stored back to back by the value of a key, in ascending
+     order, with an LSD radix sort of the key bytes. Records with equal keys keep their order.
+     Integer keys of up to 8 bytes and `f`/`d` keys are supported; NaNs sort at the ends. */
+#define WSLUA_ARG_Struct_sort_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_sort_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_sort_KEY 3 /* The index or name of the key value. */
+#define WSLUA_OPTARG_Struct_sort_RESULT 4 /* "records" (the default) for a string of the sorted records,
+                                             or "positions" for an array of the positions of the records
+                                             in sorted order. */
+#define WSLUA_OPTARG_Struct_sort_BEGIN 5 /* The position of the first record (default=1). */
+  const wst_layout *l;
+  size_t ld, pos, n, i;
+  const guchar *data;
+  scan_field key;
+  gboolean positions;
+  guint64 *keys, *tkeys;
+  guint32 *order, *torder;
+  guint32 pass, npasses;
+
+  lua_settop(L, 5);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_sort_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_sort_DATA, &ld);
+  scan_checkfield(L, l, WSLUA_ARG_Struct_sort_KEY, WSLUA_ARG_Struct_sort_KEY, &key);
+  luaL_argcheck(L, key.kind != SCAN_BYTES, WSLUA_ARG_Struct_sort_KEY, "keys must be numbers");
+  positions = luaL_checkoption(L, WSLUA_OPTARG_Struct_sort_RESULT, "records", sort_results) == 1;
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_sort_BEGIN, 1) - 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_sort_BEGIN, "position not aligned for the records");
+
+  n = (pos <= ld && l->extent <= ld - pos) ? (ld - pos - l->extent) / l->size + 1 : 0;
+  if (n > G_MAXUINT32 || n > ((size_t)-1) / (2 * (sizeof(guint64) + sizeof(guint32))))
+    return luaL_error(L, "too many records");
+
+  /* the keys and record numbers, and the same again for the passes to go back and forth */
+  keys = (guint64 *)lua_newuserdata(L, (n ? n : 1) * 2 * (sizeof(guint64) + sizeof(guint32)));
+  tkeys = keys + n;
+  order = (guint32 *)(tkeys + n);
+  torder = order + n;
+  for (i = 0; i < n; i++) {
+    keys[i] = sort_key(&key, data + pos + i * l->size);
+    order[i] = (guint32)i;
+  }
+
+  npasses = key.f->size;
+  for (pass = 0; pass < npasses; pass++) {
+    size_t count[256];
+    guint32 shift = pass * 8;
+    size_t sum = 0;
+    guint64 *sk;
+    guint32 *so;
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++)
+      count[(keys[i] >> shift) & 0xff]++;
+    if (n == 0 || count[(keys[0] >> shift) & 0xff] == n)
+      continue;  /* all keys have the same byte here */
+    for (i = 0; i < 256; i++) {
+      size_t c = count[i];
+      count[i] = sum;
+      sum += c;
+    }
+    for (i = 0; i < n; i++) {
+      size_t to = count[(keys[i] >> shift) & 0xff]++;
+      tkeys[to] = keys[i];
+      torder[to] = order[i];
+    }
+    sk = keys; keys = tkeys; tkeys = sk;
+    so = order; order = torder; torder = so;
+  }
+
+  if (positions) {
+    lua_createtable(L, (int)MIN(n, G_MAXINT / 2), 0);
+    for (i = 0; i < n; i++) {
+      lua_pushinteger(L, (lua_Integer)(pos + (size_t)order[i] * l->size) + 1);
+      lua_rawseti(L, -2, (int)i + 1);
+    }
+  }
+  else {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (i = 0; i < n; i++)
+      luaL_addlstring(&b, (const gchar *)data + pos + (size_t)order[i] * l->size, l->size);
+    luaL_pushresult(&b);
+  }
+  lua_pushinteger(L, (lua_Integer)(pos + n * l->size) + 1);
+  WSLUA_RETURN(2); /* The sorted records or their positions, and the position after the last whole record. */
+}
+
+/* the modes of Struct.bsearch, in the order of bsearch_modes[] */
+#define BSEARCH_EXACT   0
+#define BSEARCH_LOWER   1
+#define BSEARCH_RANGE   2
+
+static const gchar *const bsearch_modes[] = { "exact", "lower", "range", NULL };
+
+/* Returns the number of leading records among the n at 'data' whose value is less than the
+   constant, or with 'after', less than or equal to it; the records are sorted by the value */
+static size_t bsearch_bound (const scan_field *sf, const guchar *data, size_t size, size_t n,
+                             const scan_num *k, const gchar *s, size_t slen, gboolean after) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = scan_cmp(sf, data + mid * size, k, s, slen);
+    if (c == -1 || (after && c == 0))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+WSLUA_CONSTRUCTOR Struct_bsearch (lua_State *L) {
+  /* Finds a record by binary search among records of a fixed-size format stored back to back
+     and sorted in ascending order of a key, as `Struct.sort()` orders them (`c` keys are compared
+     byte by byte). Only the O(log n) records probed are read, so a large lookup table can be kept
+     in binary form, in a string or in a `Buffer` from `Buffer.map()`.
+
+     The modes are "exact", for the first record whose key equals the value, "lower", for the first
+     record whose key is greater than or equal to the value, and "range", for records holding
+     ranges that do not overlap, sorted by their first value: the key is then a table of the indexes
+     or names of the first and last values of a range, and the record found is the one whose range
+     contains the value. For example, `Struct.bsearch(">I4 I4 c2", data, { 1, 2 }, addr, "range")`. */
+#define WSLUA_ARG_Struct_bsearch_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_bsearch_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_bsearch_KEY 3 /* The index or name of the key value, or for "range" a table
+                                          of the indexes or names of the first and last values. */
+#define WSLUA_ARG_Struct_bsearch_VALUE 4 /* The value searched for: a number, `Int64` or `UInt64`,
+                                            or a string for `c` keys. */
+#define WSLUA_OPTARG_Struct_bsearch_MODE 5 /* "exact" (the default), "lower" or "range". */
+#define WSLUA_OPTARG_Struct_bsearch_BEGIN 6 /* The position of the first record (default=1). */
+  const wst_layout *l;
+  size_t ld, pos, n, i;
+  const guchar *data;
+  scan_field key, last;
+  scan_num k;
+  const gchar *s = NULL;
+  size_t slen = 0;
+  gboolean found;
+  int mode, c;
+
+  lua_settop(L, 6);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_bsearch_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_bsearch_DATA, &ld);
+  mode = luaL_checkoption(L, WSLUA_OPTARG_Struct_bsearch_MODE, "exact", bsearch_modes);
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_bsearch_BEGIN, 1) - 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_bsearch_BEGIN, "position not aligned for the records");
+  if (mode == BSEARCH_RANGE) {
+    luaL_argcheck(L, lua_istable(L, WSLUA_ARG_Struct_bsearch_KEY), WSLUA_ARG_Struct_bsearch_KEY,
+                  "table of the first and last values of a range expected");
+    lua_rawgeti(L, WSLUA_ARG_Struct_bsearch_KEY, 1);
+    scan_checkfield(L, l, lua_gettop(L), WSLUA_ARG_Struct_bsearch_KEY, &key);
+    lua_rawgeti(L, WSLUA_ARG_Struct_bsearch_KEY, 2);
+    scan_checkfield(L, l, lua_gettop(L), WSLUA_ARG_Struct_bsearch_KEY, &last);
+    luaL_argcheck(L, (key.kind == SCAN_BYTES) == (last.kind == SCAN_BYTES), WSLUA_ARG_Struct_bsearch_KEY,
+                  "the first and last values of a range must both be strings or both be numbers");
+  }
+  else
+    scan_checkfield(L, l, WSLUA_ARG_Struct_bsearch_KEY, WSLUA_ARG_Struct_bsearch_KEY, &key);
+  if (key.kind == SCAN_BYTES)
+    s = wslua_checklstring_only(L, WSLUA_ARG_Struct_bsearch_VALUE, &slen);
+  else {
+    scan_checknum(L, WSLUA_ARG_Struct_bsearch_VALUE, WSLUA_ARG_Struct_bsearch_VALUE, &k);
+    luaL_argcheck(L, !scan_isnan(&k), WSLUA_ARG_Struct_bsearch_VALUE, "value is NaN");
+  }
+
+  n = (pos <= ld && l->extent <= ld - pos) ? (ld - pos - l->extent) / l->size + 1 : 0;
+  data += pos;
+  switch (mode) {
+    case BSEARCH_EXACT:
+      i = bsearch_bound(&key, data, l->size, n, &k, s, slen, FALSE);
+      found = i < n && scan_cmp(&key, data + i * l->size, &k, s, slen) == 0;
+      break;
+    case BSEARCH_LOWER:
+      i = bsearch_bound(&key, data, l->size, n, &k, s, slen, FALSE);
+      found = i < n;
+      break;
+    default:
+      /* the last record whose range starts at or before the value */
+      i = bsearch_bound(&key, data, l->size, n, &k, s, slen, TRUE);
+      found = FALSE;
+      if (i-- > 0) {
+        c = scan_cmp(&last, data + i * l->size, &k, s, slen);
+        found = c == 1 || c == 0;
+      }
+      break;
+  }
+  if (found)
+    lua_pushinteger(L, (lua_Integer)(pos + i * l->size) + 1);
+  else
+    lua_pushnil(L);
+  WSLUA_RETURN(1); /* The position of the record found, or nil if there is none. */
+}
+
+/* A hash index of records by key, built by `Struct.index()` */
+typedef struct _wst_index {
+  wst_layout *layout;
+  scan_field key;
+  size_t pos;           /* the position of the first record in the data */
+  size_t end;           /* the position after the last record */
+  guint32 nrecs;
+  guint32 mask;         /* the number of slots - 1 */
+  guint32 *slots;       /* pairs of the hash of a key and the number + 1 of its first record
+                           (0 for an empty slot) */
+  guint32 *next;        /* the number of the next record with the same key, or INDEX_NONE */
+} wst_index;
+
+#define INDEX_NONE  G_MAXUINT32
+
+typedef wst_index *Index;
+
+WSLUA_CLASS_DEFINE(Index,NOP);
+/* An `Index` maps the keys of records stored back to back to the records' positions, see
+   `Struct.index()`. */
+
+/* the hash of the key of the record at 'rec' */
+static guint32 index_hash (const scan_field *sf, const guchar *rec) {
+  guint64 h;
+  if (sf->kind == SCAN_BYTES)
+    h = agg_hashbytes(rec + sf->offset, sf->f->size);
+  else {
+    scan_num n;
+    scan_read(sf, rec, &n);
+    h = n.v.u;
+  }
+  return (guint32)((h * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32);
+}
+
+WSLUA_CONSTRUCTOR Struct_index (lua_State *L) {
+  /* Builds a hash index of records of a fixed-size format stored back to back, by the value of a
+     key, for exact-match lookups that do not scan the records. The index holds no Lua values, only
+     a few 32-bit numbers per record; it keeps a reference to the data, and reads the records' keys
+     there when probed. Keys are integers of up to 8 bytes or `c` strings. */
+#define WSLUA_ARG_Struct_index_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_index_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_index_KEY 3 /* The index or name of the key value. */
+#define WSLUA_OPTARG_Struct_index_BEGIN 4 /* The position of the first record (default=1). */
+  const wst_layout *l;
+  size_t ld, pos, n, nslots;
+  const guchar *data;
+  scan_field key;
+  wst_index *idx;
+  guint32 i;
+
+  lua_settop(L, 4);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_index_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_index_DATA, &ld);
+  scan_checkfield(L, l, WSLUA_ARG_Struct_index_KEY, WSLUA_ARG_Struct_index_KEY, &key);
+  luaL_argcheck(L, key.kind != SCAN_FLOAT, WSLUA_ARG_Struct_index_KEY, "keys must be integers or strings");
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_index_BEGIN, 1) - 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_index_BEGIN, "position not aligned for the records");
+
+  n = (pos <= ld && l->extent <= ld - pos) ? (ld - pos - l->extent) / l->size + 1 : 0;
+  if (n >= G_MAXUINT32 / 4)
+    return luaL_error(L, "too many records");
+  for (nslots = 8; nslots < 2 * n; nslots *= 2)
+    ;
+  idx = (wst_index *)calloc(1, sizeof(wst_index) + (2 * nslots + n) * sizeof(guint32));
+  if (idx == NULL)
+    return luaL_error(L, "not enough memory");
+  idx->layout = wst_layout_ref((wst_layout *)l);
+  idx->key = key;
+  idx->pos = pos;
+  idx->end = pos + n * l->size;
+  idx->nrecs = (guint32)n;
+  idx->mask = (guint32)nslots - 1;
+  idx->slots = (guint32 *)(idx + 1);
+  idx->next = idx->slots + 2 * nslots;
+  pushIndex(L, idx);  /* owns idx from here on */
+  lua_createtable(L, 1, 0);  /* the environment, holding the data */
+  lua_pushvalue(L, WSLUA_ARG_Struct_index_DATA);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, -2);
+
+  /* records are added last to first, so that each chain of equal keys is in record order */
+  data += pos;
+  for (i = (guint32)n; i-- > 0; ) {
+    const guchar *rec = data + (size_t)i * l->size;
+    guint32 h = index_hash(&key, rec);
+    guint32 slot = h & idx->mask;
+    idx->next[i] = INDEX_NONE;
+    for (;;) {
+      guint32 *e = &idx->slots[2 * slot];
+      if (e[1] == 0) {
+        e[0] = h;
+        e[1] = i + 1;
+        break;
+      }
+      if (e[0] == h && memcmp(data + (size_t)(e[1] - 1) * l->size + key.offset, rec + key.offset, key.f->size) == 0) {
+        idx->next[i] = e[1] - 1;
+        e[1] = i + 1;
+        break;
+      }
+      slot = (slot + 1) & idx->mask;
+    }
+  }
+  WSLUA_RETURN(1); /* The `Index`. */
+}
+
+/* Finds the first record whose key is the value at argument 2, and puts the data in *data;
+   returns INDEX_NONE if there is none */
+static guint32 index_find (lua_State *L, wst_index *idx, const guchar **data) {
+  const scan_field *sf = &idx->key;
+  size_t size = idx->layout->size;
+  scan_num k;
+  const gchar *s = NULL;
+  size_t slen = 0, ld;
+  guint64 h;
+  guint32 slot;
+
+  if (sf->kind == SCAN_BYTES) {
+    s = wslua_checklstring_only(L, 2, &slen);
+    if (slen != sf->f->size)
+      return INDEX_NONE;
+    h = agg_hashbytes((const guchar *)s, slen);
+  }
+  else {
+    scan_checknum(L, 2, 2, &k);
+    if (k.kind == SCAN_FLOAT)
+      return INDEX_NONE;  /* no integer equals it */
+    h = k.v.u;
+  }
+  h = (h * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32;
+
+  /* the data is looked up again, as a Buffer may have been closed since */
+  lua_getfenv(L, 1);
+  lua_rawgeti(L, -1, 1);
+  *data = wslua_checkbytes(L, lua_gettop(L), &ld);
+  lua_pop(L, 2);
+  if (ld < idx->end)
+    luaL_error(L, "the indexed data is no longer available");
+  *data += idx->pos;
+
+  for (slot = (guint32)h & idx->mask; idx->slots[2 * slot + 1] != 0; slot = (slot + 1) & idx->mask) {
+    guint32 rec = idx->slots[2 * slot + 1] - 1;
+    if (idx->slots[2 * slot] == (guint32)h && scan_cmp(sf, *data + (size_t)rec * size, &k, s, slen) == 0)
+      return rec;
+  }
+  return INDEX_NONE;
+}
+
+WSLUA_METHOD Index_get (lua_State *L) {
+  /* Finds the first record, in data order, whose key equals a value. */
+#define WSLUA_ARG_Index_get_KEY 2 /* The key: a number, `Int64` or `UInt64`, or a string for a `c` key. */
+  Index idx = checkIndex(L, 1);
+  const guchar *data;
+  guint32 rec = index_find(L, idx, &data);
+  if (rec == INDEX_NONE)
+    lua_pushnil(L);
+  else
+    lua_pushinteger(L, (lua_Integer)(idx->pos + (size_t)rec * idx->layout->size) + 1);
+  WSLUA_RETURN(1); /* The position of the record, or nil if there is none. */
+}
+
+WSLUA_METHOD Index_get_all (lua_State *L) {
+  /* Finds all the records whose key equals a value. */
+#define WSLUA_ARG_Index_get_all_KEY 2 /* The key: a number, `Int64` or `UInt64`, or a string for a `c` key. */
+  Index idx = checkIndex(L, 1);
+  const guchar *data;
+  guint32 rec = index_find(L, idx, &data);
+  int n = 0;
+  lua_newtable(L);
+  for (; rec != INDEX_NONE; rec = idx->next[rec]) {
+    lua_pushinteger(L, (lua_Integer)(idx->pos + (size_t)rec * idx->layout->size) + 1);
+    lua_rawseti(L, -2, ++n);
+  }
+  WSLUA_RETURN(1); /* An array of the positions of the records, in data order. */
+}
+
+WSLUA_METAMETHOD Index__len (lua_State *L) {
+  /* The number of records indexed. */
+  Index idx = checkIndex(L, 1);
+  lua_pushinteger(L, (lua_Integer)idx->nrecs);
+  return 1;
+}
+
+WSLUA_METAMETHOD Index__tostring (lua_State *L) {
+  Index idx = checkIndex(L, 1);
+  lua_pushfstring(L, "Index(\"%s\") of %d records", wst_layout_format(idx->layout), (int)idx->nrecs);
+  return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Index__gc (lua_State *L) {
+  Index *p = (Index *)lua_touserdata(L, 1);
+  if (p && *p) {
+    wst_layout_unref((*p)->layout);
+    free(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+WSLUA_METHODS Index_methods[] = {
+  WSLUA_CLASS_FNREG(Index,get),
+  WSLUA_CLASS_FNREG(Index,get_all),
+  { NULL, NULL }
+};
+
+WSLUA_META Index_meta[] = {
+  WSLUA_CLASS_MTREG(Index,len),
+  WSLUA_CLASS_MTREG(Index,tostring),
+  { NULL, NULL }
+};
+
+/* Index objects are only created by Struct.index(), so there is no global class table. */
+LUALIB_API int Index_register(lua_State* L) {
+  const wslua_class Index_class = {
+    .name               = "Index",
+    .instance_methods   = Index_methods,
+    .instance_meta      = Index_meta
+  };
+  wslua_register_classinstance_meta(L, &Index_class);
+  WSLUA_REGISTER_GC(Index);
+  return 0;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Memoized decoding
+** =======================================================
+*/
+
+/* A decoded record in a Cache */
+typedef struct _cache_entry {
+  struct _cache_entry *prev, *next;   /* the LRU list, most recently used first */
+  struct _cache_entry *chain;         /* the next entry of the same hash bucket */
+  wst_layout *layout;
+  const gchar *data;    /* the data string of a variable layout, anchored in the values table */
+  size_t ld;
+  size_t pos;           /* where the record starts */
+  size_t end;           /* where Struct.unpack stopped */
+  guint64 hash;
+  size_t cost;          /* the estimated memory the entry holds */
+  int ref;              /* the values table, in the cache's environment */
+  guint32 nbytes;       /* the bytes of a fixed-size record, copied to bytes[] */
+  guchar bytes[1];
+} cache_entry;
+
+/* A bounded cache of decoded records, made by `Struct.cache()` */
+typedef struct _wst_cache {
+  cache_entry **buckets;
+  guint32 mask;         /* the number of buckets - 1 */
+  guint32 nentries;
+  cache_entry *head, *tail;
+  size_t bytes;         /* the sum of the entries' costs */
+  size_t budget;
+  guint64 hits, misses, evictions;
+} wst_cache;
+
+typedef wst_cache *Cache;
+
+WSLUA_CLASS_DEFINE(Cache,NOP);
+/* A `Cache` remembers the values of records it has decoded, so that decoding the same
+   record again only copies them out, see `Struct.cache()`. */
+
+/* the default memory budget of a Cache */
+#define CACHE_BUDGET    (16 * 1024 * 1024)
+
+/* the estimated memory of a Lua table and of the values in it */
+#define CACHE_TABLECOST 64
+#define CACHE_VALUECOST 24
+
+static guint64 cache_hash (const wst_layout *l, size_t pos, const void *p, size_t n) {
+  guint64 h = agg_hashbytes((const guchar *)&l, sizeof(l));
+  h = (h ^ agg_hashbytes((const guchar *)&pos, sizeof(pos))) * G_GUINT64_CONSTANT(1099511628211);
+  return (h ^ agg_hashbytes((const guchar *)p, n)) * G_GUINT64_CONSTANT(1099511628211);
+}
+
+/* Unlinks an entry from the LRU list */
+static void cache_unlink (wst_cache *c, cache_entry *e) {
+  if (e->prev) e->prev->next = e->next; else c->head = e->next;
+  if (e->next) e->next->prev = e->prev; else c->tail = e->prev;
+}
+
+/* Links an entry at the head of the LRU list */
+static void cache_push (wst_cache *c, cache_entry *e) {
+  e->prev = NULL;
+  e->next = c->head;
+  if (c->head) c->head->prev = e; else c->tail = e;
+  c->head = e;
+}
+
+/* Removes an entry; the cache's environment table must be at 'env' */
+static void cache_remove (lua_State *L, int env, wst_cache *c, cache_entry *e) {
+  cache_entry **pp = &c->buckets[aggslot(e->hash, c->mask)];
+  while (*pp != e)
+    pp = &(*pp)->chain;
+  *pp = e->chain;
+  cache_unlink(c, e);
+  luaL_unref(L, env, e->ref);
+  c->bytes -= e->cost;
+  c->nentries--;
+  wst_layout_unref(e->layout);
+  free(e);
+}
+
+/* Doubles the number of buckets, when there are more entries than buckets */
+static void cache_grow (wst_cache *c) {
+  guint32 n = (c->mask + 1) * 2, i;
+  cache_entry **b = (cache_entry **)calloc(n, sizeof(cache_entry *));
+  if (b == NULL)
+    return;  /* the chains just get longer */
+  for (i = 0; i <= c->mask; i++) {
+    cache_entry *e = c->buckets[i], *next;
+    for (; e; e = next) {
+      next = e->chain;
+      e->chain = b[aggslot(e->hash, n - 1)];
+      b[aggslot(e->hash, n - 1)] = e;
+    }
+  }
+  free(c->buckets);
+  c->buckets = b;
+  c->mask = n - 1;
+}
+
+WSLUA_CONSTRUCTOR Struct_cache (lua_State *L) {
+  /* Makes a bounded cache of decoded records, for data that is decoded many times over, such
+     as frames dissected again. `cache:unpack()` returns what `Struct.unpack()` would, and only
+     decodes records it has not seen yet, or has evicted: when the estimated memory of the
+     records it holds exceeds the budget, the least recently used ones are evicted.
+
+     Records of a fixed size are looked up by layout, position and content, so equal bytes are
+     found again in another string. Other records are looked up by layout, position and data
+     string, which the cache then keeps alive with them, counting it in the budget. */
+#define WSLUA_OPTARG_Struct_cache_BUDGET 1 /* The memory budget, in bytes (default=16 MiB). */
+  lua_Integer budget = luaL_optinteger(L, WSLUA_OPTARG_Struct_cache_BUDGET, CACHE_BUDGET);
+  wst_cache *c;
+  luaL_argcheck(L, budget >= 0, WSLUA_OPTARG_Struct_cache_BUDGET, "budget must not be negative");
+  c = (wst_cache *)calloc(1, sizeof(wst_cache));
+  if (c == NULL)
+    return luaL_error(L, "not enough memory");
+  c->budget = (size_t)budget;
+  pushCache(L, c);  /* owns c from here on */
+  c->mask = 15;
+  c->buckets = (cache_entry **)calloc(c->mask + 1, sizeof(cache_entry *));
+  if (c->buckets == NULL)
+    return luaL_error(L, "not enough memory");
+  lua_newtable(L);  /* the environment: values tables, and the layouts of format strings */
+  lua_newtable(L);
+  lua_setfield(L, -2, "formats");
+  lua_setfenv(L, -2);
+  WSLUA_RETURN(1); /* The `Cache`. */
+}
+
+WSLUA_METHOD Cache_unpack (lua_State *L) {
+  /* Unpacks a record like `Struct.unpack()`, or returns the values it had the last time. The
+     values are shared between the calls, which matters only for tables given to them. */
+#define WSLUA_ARG_Cache_unpack_FORMAT 2 /* The format string or `Layout`. */
+#define WSLUA_ARG_Cache_unpack_STRUCT 3 /* The binary Lua string to unpack. */
+#define WSLUA_OPTARG_Cache_unpack_BEGIN 4 /* The position to begin reading from (default=1). */
+  Cache c = checkCache(L, 1);
+  size_t ld, pos, end, cost, nbytes = 0;
+  const gchar *data;
+  wst_layout *l;
+  cache_entry *e;
+  guint64 h = 0;
+  int env, vals, n = 0, i, rc;
+
+  lua_settop(L, 4);
+  data = wslua_checklstring_only(L, WSLUA_ARG_Cache_unpack_STRUCT, &ld);
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Cache_unpack_BEGIN, 1) - 1;
+  lua_getfenv(L, 1);
+  env = lua_gettop(L);
+  if (isLayout(L, WSLUA_ARG_Cache_unpack_FORMAT))
+    l = toLayout(L, WSLUA_ARG_Cache_unpack_FORMAT);
+  else {
+    /* format strings are compiled once per cache */
+    wslua_checkstring_only(L, WSLUA_ARG_Cache_unpack_FORMAT);
+    lua_getfield(L, env, "formats");
+    lua_pushvalue(L, WSLUA_ARG_Cache_unpack_FORMAT);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      pushLayout(L, getlayout(L, WSLUA_ARG_Cache_unpack_FORMAT, WSLUA_ARG_Cache_unpack_FORMAT));
+      lua_pushvalue(L, WSLUA_ARG_Cache_unpack_FORMAT);
+      lua_pushvalue(L, -2);
+      lua_rawset(L, -4);
+    }
+    l = toLayout(L, -1);
+    lua_pop(L, 2);
+  }
+
+  if (l->fixed) {
+    if (pos > ld || l->extent > ld - pos)
+      goto decode;  /* for the error */
+    nbytes = l->extent;
+    h = cache_hash(l, pos, data + pos, nbytes);
+  }
+  else
+    h = cache_hash(l, pos, &data, sizeof(data));
+  for (e = c->buckets[aggslot(h, c->mask)]; e; e = e->chain) {
+    if (e->hash == h && e->layout == l && e->pos == pos &&
+        (l->fixed ? memcmp(e->bytes, data + pos, nbytes) == 0 : e->data == data && e->ld == ld)) {
+      c->hits++;
+      cache_unlink(c, e);
+      cache_push(c, e);
+      lua_rawgeti(L, env, e->ref);
+      vals = lua_gettop(L);
+      n = (int)lua_objlen(L, vals);
+      luaL_checkstack(L, n + 1, "too many results");
+      for (i = 1; i <= n; i++)
+        lua_rawgeti(L, vals, i);
+      lua_pushinteger(L, (lua_Integer)e->end + 1);
+      return n + 1;
+    }
+  }
+  c->misses++;
+
+decode:
+  lua_newtable(L);
+  vals = lua_gettop(L);
+  end = pos;
+  rc = layout_unpack(L, l, data, ld, &end, vals, &n);
+  if (rc != UNPACK_OK)
+    return unpack_error(L, rc);
+
+  cost = sizeof(cache_entry) + nbytes + CACHE_TABLECOST + (size_t)n * CACHE_VALUECOST;
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, vals, i);
+    if (lua_type(L, -1) == LUA_TSTRING)
+      cost += lua_objlen(L, -1);
+    lua_pop(L, 1);
+  }
+  if (!l->fixed)
+    cost += ld;
+  if (nbytes || !l->fixed) {
+    if (cost <= c->budget && (e = (cache_entry *)malloc(sizeof(cache_entry) + nbytes)) != NULL) {
+      if (!l->fixed) {
+        lua_pushvalue(L, WSLUA_ARG_Cache_unpack_STRUCT);
+        lua_setfield(L, vals, "data");  /* keeps e->data valid */
+      }
+      lua_pushvalue(L, vals);
+      e->ref = luaL_ref(L, env);
+      e->layout = wst_layout_ref(l);
+      e->data = data;
+      e->ld = ld;
+      e->pos = pos;
+      e->end = end;
+      e->hash = h;
+      e->cost = cost;
+      e->nbytes = (guint32)nbytes;
+      memcpy(e->bytes, data + pos, nbytes);
+      e->chain = c->buckets[aggslot(h, c->mask)];
+      c->buckets[aggslot(h, c->mask)] = e;
+      cache_push(c, e);
+      c->nentries++;
+      c->bytes += cost;
+      while (c->bytes > c->budget) {
+        c->evictions++;
+        cache_remove(L, env, c, c->tail);
+      }
+      if (c->nentries > c->mask && c->mask < G_MAXUINT32 / 4)
+        cache_grow(c);
+    }
+  }
+
+  luaL_checkstack(L, n + 1, "too many results");
+  for (i = 1; i <= n; i++)
+    lua_rawgeti(L, vals, i);
+  lua_pushinteger(L, (lua_Integer)end + 1);
+  WSLUA_RETURN(n + 1); /* One or more values based on format, plus the position it stopped unpacking. */
+}
+
+WSLUA_METHOD Cache_stats (lua_State *L) {
+  /* Gets the statistics of the cache. */
+  Cache c = checkCache(L, 1);
+  lua_createtable(L, 0, 6);
+  lua_pushnumber(L, (lua_Number)c->hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, (lua_Number)c->misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, (lua_Number)c->evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushinteger(L, (lua_Integer)c->nentries);
+  lua_setfield(L, -2, "entries");
+  lua_pushnumber(L, (lua_Number)c->bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushnumber(L, (lua_Number)c->budget);
+  lua_setfield(L, -2, "budget");
+  WSLUA_RETURN(1); /* A table of the number of "hits", "misses" and "evictions" so far, the number of
+                      "entries", their estimated memory in "bytes", and the "budget". */
+}
+
+WSLUA_METHOD Cache_clear (lua_State *L) {
+  /* Evicts all the records and resets the statistics. */
+  Cache c = checkCache(L, 1);
+  lua_settop(L, 1);
+  lua_getfenv(L, 1);
+  while (c->head)
+    cache_remove(L, 2, c, c->head);
+  c->hits = c->misses = c->evictions = 0;
+  return 0;
+}
+
+WSLUA_METAMETHOD Cache__tostring (lua_State *L) {
+  Cache c = checkCache(L, 1);
+  lua_pushfstring(L, "Cache(%d records)", (int)c->nentries);
+  return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Cache__gc (lua_State *L) {
+  Cache *p = (Cache *)lua_touserdata(L, 1);
+  if (p && *p) {
+    wst_cache *c = *p;
+    cache_entry *e, *next;
+    for (e = c->head; e; e = next) {
+      next = e->next;
+      wst_layout_unref(e->layout);
+      free(e);
+    }
+    free(c->buckets);
+    free(c);
+    *p = NULL;
+  }
+  return 0;
+}
+
+WSLUA_METHODS Cache_methods[] = {
+  WSLUA_CLASS_FNREG(Cache,unpack),
+  WSLUA_CLASS_FNREG(Cache,stats),
+  WSLUA_CLASS_FNREG(Cache,clear),
+  { NULL, NULL }
+};
+
+WSLUA_META Cache_meta[] = {
+  WSLUA_CLASS_MTREG(Cache,tostring),
+  { NULL, NULL }
+};
+
+/* Cache objects are only created by Struct.cache(), so there is no global class table. */
+LUALIB_API int Cache_register(lua_State* L) {
+  const wslua_class Cache_class = {
+    .name               = "Cache",
+    .instance_methods   = Cache_methods,
+    .instance_meta      = Cache_meta
+  };
+  wslua_register_classinstance_meta(L, &Cache_class);
+  WSLUA_REGISTER_GC(Cache);
+  return 0;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Columns decoded in parallel
+** =======================================================
+*/
+
+/* The values of one field of many records, in a native array */
+typedef struct _wst_column {
+  int type;             /* WST_COL_* */
+  guint32 width;        /* bytes per element */
+  gboolean objects;     /* 'e'/'E' values, read as Int64/UInt64 as Struct.unpack returns them */
+  size_t n;
+  guchar *data;
+} wst_column;
+
+typedef wst_column *Column;
+
+WSLUA_CLASS_DEFINE(Column,NOP);
+/* A `Column` holds one value of many records in a native array, see `Struct.parallel_unpack()`:
+   `column[i]` is the value of the i-th record, as `Struct.unpack()` would return it, and `#column`
+   the number of records. The array can also be read through the LuaJIT FFI, without making Lua
+   values, with `ffi.cast(column:ctype() .. "*", column:pointer())`. */
+
+/* Pushes element i of a column */
+static void column_push (lua_State *L, const wst_column *c, size_t i) {
+  const guchar *p = c->data + i * c->width;
+  switch (c->type) {
+    case WST_COL_I8:  lua_pushnumber(L, *(const gint8 *)p); break;
+    case WST_COL_I16: lua_pushnumber(L, *(const gint16 *)p); break;
+    case WST_COL_I32: lua_pushnumber(L, *(const gint32 *)p); break;
+    case WST_COL_U8:  lua_pushnumber(L, *(const guint8 *)p); break;
+    case WST_COL_U16: lua_pushnumber(L, *(const guint16 *)p); break;
+    case WST_COL_U32: lua_pushnumber(L, *(const guint32 *)p); break;
+    case WST_COL_I64:
+      if (c->objects)
+        pushInt64(L, *(const gint64 *)p);
+      else
+        lua_pushnumber(L, (lua_Number)*(const gint64 *)p);
+      break;
+    case WST_COL_U64:
+      if (c->objects)
+        pushUInt64(L, *(const guint64 *)p);
+      else
+        lua_pushnumber(L, (lua_Number)*(const guint64 *)p);
+      break;
+    case WST_COL_F32: lua_pushnumber(L, *(const gfloat *)p); break;
+    case WST_COL_F64: lua_pushnumber(L, *(const gdouble *)p); break;
+    case WST_COL_BYTES: lua_pushlstring(L, (const gchar *)p, c->width); break;
+    default: lua_pushinteger(L, (lua_Integer)*(const gint64 *)p); break;
+  }
+}
+
+WSLUA_CONSTRUCTOR Struct_parallel_unpack (lua_State *L) {
+  /* Decodes records of a fixed-size format stored back to back into columns, one per value,
+     using several threads: each decodes a range of the records into native arrays, without
+     Lua values, so that large arrays, such as a mapped `Buffer`, are decoded on all cores.
+     Integer, `f`, `d`, `c` and `=` values are supported. */
+#define WSLUA_ARG_Struct_parallel_unpack_FORMAT 1 /* The format string or `Layout` of a record. */
+#define WSLUA_ARG_Struct_parallel_unpack_DATA 2 /* The binary Lua string or `Buffer` holding the records. */
+#define WSLUA_ARG_Struct_parallel_unpack_THREADS 3 /* The number of threads, at most 64; fewer are used
+                                                      for few records. */
+#define WSLUA_OPTARG_Struct_parallel_unpack_BEGIN 4 /* The position of the first record (default=1). */
+  const wst_layout *l;
+  size_t ld, pos, n;
+  const guchar *data;
+  lua_Integer nthreads;
+  wst_column_spec *specs;
+  guint32 i;
+
+  lua_settop(L, 4);
+  l = scan_checklayout(L, WSLUA_ARG_Struct_parallel_unpack_FORMAT);
+  data = wslua_checkbytes(L, WSLUA_ARG_Struct_parallel_unpack_DATA, &ld);
+  nthreads = luaL_checkinteger(L, WSLUA_ARG_Struct_parallel_unpack_THREADS);
+  luaL_argcheck(L, nthreads >= 1, WSLUA_ARG_Struct_parallel_unpack_THREADS, "at least one thread needed");
+  pos = luaL_optinteger(L, WSLUA_OPTARG_Struct_parallel_unpack_BEGIN, 1) - 1;
+  luaL_argcheck(L, (pos & (l->align - 1)) == 0, WSLUA_OPTARG_Struct_parallel_unpack_BEGIN, "position not aligned for the records");
+
+  n = (pos <= ld && l->extent <= ld - pos) ? (ld - pos - l->extent) / l->size + 1 : 0;
+  specs = (wst_column_spec *)lua_newuserdata(L, (l->nresults ? l->nresults : 1) * sizeof(wst_column_spec));
+  lua_createtable(L, (int)l->nresults, 0);
+  for (i = 0; i < l->nresults; i++) {
+    wst_column *c;
+    const gchar *name;
+    if (wst_column_spec_init(l, i, &specs[i]) != 0)
+      return luaL_argerror(L, WSLUA_ARG_Struct_parallel_unpack_FORMAT,
+                           lua_pushfstring(L, "value %d cannot be decoded into a column", (int)i + 1));
+    if (n > ((size_t)-1) / specs[i].width)
+      return luaL_error(L, "too many records");
+    c = (wst_column *)calloc(1, sizeof(wst_column));
+    if (c == NULL)
+      return luaL_error(L, "not enough memory");
+    pushColumn(L, c);  /* owns c from here on */
+    c->data = (guchar *)malloc(n ? n * specs[i].width : 1);
+    if (c->data == NULL)
+      return luaL_error(L, "not enough memory");
+    c->type = specs[i].type;
+    c->width = specs[i].width;
+    c->objects = specs[i].f->opt == 'e' || specs[i].f->opt == 'E';
+    c->n = n;
+    specs[i].out = c->data;
+    name = wst_layout_valuename(l, i);
+    if (name) {
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -3, name);
+    }
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+
+  wst_columns_decode(l, data + pos, n, pos, specs, l->nresults,
+                     (unsigned)MIN(nthreads, WST_COL_MAXTHREADS));
+  lua_pushinteger(L, (lua_Integer)(pos + n * l->size) + 1);
+  WSLUA_RETURN(2); /* A table of the columns, by value index and by name, and the position after the last
+                      whole record. */
+}
+
+WSLUA_METHOD Column_pointer (lua_State *L) {
+  /* Gets the address of the column's array, for the LuaJIT FFI. It is valid as long as the column is. */
+  Column c = checkColumn(L, 1);
+  lua_pushlightuserdata(L, c->data);
+  WSLUA_RETURN(1); /* The address, as a light userdata. */
+}
+
+WSLUA_METHOD Column_ctype (lua_State *L) {
+  /* Gets the C type of the elements of the column's array. `c` values are `width` bytes each. */
+  Column c = checkColumn(L, 1);
+  lua_pushstring(L, wst_column_ctype(c->type));
+  lua_pushinteger(L, (lua_Integer)c->width);
+  WSLUA_RETURN(2); /* The C type, such as "int32_t", and the width of an element in bytes. */
+}
+
+WSLUA_METAMETHOD Column__len (lua_State *L) {
+  Column c = checkColumn(L, 1);
+  lua_pushinteger(L, (lua_Integer)c->n);
+  return 1;
+}
+
+WSLUA_METAMETHOD Column__tostring (lua_State *L) {
+  Column c = checkColumn(L, 1);
+  lua_pushfstring(L, "Column(%s) of %d values", wst_column_ctype(c->type), (int)c->n);
+  return 1;
+}
+
+/* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
+static int Column__gc (lua_State *L) {
+  Column *p = (Column *)lua_touserdata(L, 1);
+  if (p && *p) {
+    free((*p)->data);
+    free(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+/* Elements are read by number, so Column has its own __index, like View */
+static int Column__index (lua_State *L) {
+  Column c = checkColumn(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i >= 1 && (size_t)i <= c->n && (lua_Number)i == lua_tonumber(L, 2))
+      column_push(L, c, (size_t)i - 1);
+    else
+      lua_pushnil(L);
+    return 1;
+  }
+  lua_pushvalue(L, 2);
+  lua_rawget(L, lua_upvalueindex(1));
+  return 1;
+}
+
+WSLUA_METHODS Column_methods[] = {
+  WSLUA_CLASS_FNREG(Column,pointer),
+  WSLUA_CLASS_FNREG(Column,ctype),
+  { NULL, NULL }
+};
+
+WSLUA_META Column_meta[] = {
+  WSLUA_CLASS_MTREG(Column,len),
+  WSLUA_CLASS_MTREG(Column,tostring),
+  { NULL, NULL }
+};
+
+LUALIB_API int Column_register(lua_State* L) {
+  luaL_newmetatable(L, "Column");
+  wslua_setfuncs(L, Column_meta, 0);
+  lua_pushstring(L, "Column");
+  lua_setfield(L, -2, WSLUA_TYPEOF_FIELD);
+  lua_newtable(L);
+  wslua_setfuncs(L, Column_methods, 0);
+  lua_pushcclosure(L, Column__index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  WSLUA_REGISTER_GC(Column);
+  return 0;
+}
+
 /* }====================================================== */
 
 /* Gets registered as metamethod automatically by WSLUA_REGISTER_CLASS/META */
@@ -639,10 +4777,39 @@ static int Struct__gc(lua_State* L _U_) {
 WSLUA_METHODS Struct_methods[] = {
   WSLUA_CLASS_FNREG(Struct,pack),
   WSLUA_CLASS_FNREG(Struct,unpack),
+  WSLUA_CLASS_FNREG(Struct,tryunpack),
+  WSLUA_CLASS_FNREG(Struct,unpack_into),
   WSLUA_CLASS_FNREG(Struct,size),
   WSLUA_CLASS_FNREG(Struct,values),
   WSLUA_CLASS_FNREG(Struct,tohex),
   WSLUA_CLASS_FNREG(Struct,fromhex),
+  WSLUA_CLASS_FNREG(Struct,ipv4tostr),
+  WSLUA_CLASS_FNREG(Struct,ipv6tostr),
+  WSLUA_CLASS_FNREG(Struct,ethertostr),
+  WSLUA_CLASS_FNREG(Struct,strtoipv4),
+  WSLUA_CLASS_FNREG(Struct,strtoipv6),
+  WSLUA_CLASS_FNREG(Struct,strtoether),
+  WSLUA_CLASS_FNREG(Struct,compile),
+  WSLUA_CLASS_FNREG(Struct,share),
+  WSLUA_CLASS_FNREG(Struct,shared),
+  WSLUA_CLASS_FNREG(Struct,save_layouts),
+  WSLUA_CLASS_FNREG(Struct,load_layouts),
+  WSLUA_CLASS_FNREG(Struct,switch),
+  WSLUA_CLASS_FNREG(Struct,compile_ffi),
+  WSLUA_CLASS_FNREG(Struct,cdef),
+  WSLUA_CLASS_FNREG(Struct,to_cdef),
+  WSLUA_CLASS_FNREG(Struct,tlv),
+  WSLUA_CLASS_FNREG(Struct,ber),
+  WSLUA_CLASS_FNREG(Struct,berinteger),
+  WSLUA_CLASS_FNREG(Struct,beroid),
+  WSLUA_CLASS_FNREG(Struct,pbscan),
+  WSLUA_CLASS_FNREG(Struct,filter),
+  WSLUA_CLASS_FNREG(Struct,aggregate),
+  WSLUA_CLASS_FNREG(Struct,sort),
+  WSLUA_CLASS_FNREG(Struct,bsearch),
+  WSLUA_CLASS_FNREG(Struct,index),
+  WSLUA_CLASS_FNREG(Struct,cache),
+  WSLUA_CLASS_FNREG(Struct,parallel_unpack),
   { NULL, NULL }
 };
 
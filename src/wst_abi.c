@@ -0,0 +1,360 @@
+/*
+ * wst_abi.c
+ *
+ * Plain C entry points to the byte-level kernels, see wst_abi.h.
+ * Nothing here depends on Lua.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <string.h>
+
+#include "wst_abi.h"
+
+uint16_t wst_load_u16be(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint16_t wst_load_u16le(const uint8_t *p) {
+    return (uint16_t)((p[1] << 8) | p[0]);
+}
+
+uint32_t wst_load_u32be(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+uint32_t wst_load_u32le(const uint8_t *p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+uint64_t wst_load_u64be(const uint8_t *p) {
+    return ((uint64_t)wst_load_u32be(p) << 32) | wst_load_u32be(p + 4);
+}
+
+uint64_t wst_load_u64le(const uint8_t *p) {
+    return ((uint64_t)wst_load_u32le(p + 4) << 32) | wst_load_u32le(p);
+}
+
+/* Lookup tables for byte to hex-ascii conversion, shared by wst_bin2hex()
+ * and the address formatters below. */
+static const char byte_to_str_upper[256][3] = {
+    "00","01","02","03","04","05","06","07","08","09","0A","0B","0C","0D","0E","0F",
+    "10","11","12","13","14","15","16","17","18","19","1A","1B","1C","1D","1E","1F",
+    "20","21","22","23","24","25","26","27","28","29","2A","2B","2C","2D","2E","2F",
+    "30","31","32","33","34","35","36","37","38","39","3A","3B","3C","3D","3E","3F",
+    "40","41","42","43","44","45","46","47","48","49","4A","4B","4C","4D","4E","4F",
+    "50","51","52","53","54","55","56","57","58","59","5A","5B","5C","5D","5E","5F",
+    "60","61","62","63","64","65","66","67","68","69","6A","6B","6C","6D","6E","6F",
+    "70","71","72","73","74","75","76","77","78","79","7A","7B","7C","7D","7E","7F",
+    "80","81","82","83","84","85","86","87","88","89","8A","8B","8C","8D","8E","8F",
+    "90","91","92","93","94","95","96","97","98","99","9A","9B","9C","9D","9E","9F",
+    "A0","A1","A2","A3","A4","A5","A6","A7","A8","A9","AA","AB","AC","AD","AE","AF",
+    "B0","B1","B2","B3","B4","B5","B6","B7","B8","B9","BA","BB","BC","BD","BE","BF",
+    "C0","C1","C2","C3","C4","C5","C6","C7","C8","C9","CA","CB","CC","CD","CE","CF",
+    "D0","D1","D2","D3","D4","D5","D6","D7","D8","D9","DA","DB","DC","DD","DE","DF",
+    "E0","E1","E2","E3","E4","E5","E6","E7","E8","E9","EA","EB","EC","ED","EE","EF",
+    "F0","F1","F2","F3","F4","F5","F6","F7","F8","F9","FA","FB","FC","FD","FE","FF"
+};
+static const char byte_to_str_lower[256][3] = {
+    "00","01","02","03","04","05","06","07","08","09","0a","0b","0c","0d","0e","0f",
+    "10","11","12","13","14","15","16","17","18","19","1a","1b","1c","1d","1e","1f",
+    "20","21","22","23","24","25","26","27","28","29","2a","2b","2c","2d","2e","2f",
+    "30","31","32","33","34","35","36","37","38","39","3a","3b","3c","3d","3e","3f",
+    "40","41","42","43","44","45","46","47","48","49","4a","4b","4c","4d","4e","4f",
+    "50","51","52","53","54","55","56","57","58","59","5a","5b","5c","5d","5e","5f",
+    "60","61","62","63","64","65","66","67","68","69","6a","6b","6c","6d","6e","6f",
+    "70","71","72","73","74","75","76","77","78","79","7a","7b","7c","7d","7e","7f",
+    "80","81","82","83","84","85","86","87","88","89","8a","8b","8c","8d","8e","8f",
+    "90","91","92","93","94","95","96","97","98","99","9a","9b","9c","9d","9e","9f",
+    "a0","a1","a2","a3","a4","a5","a6","a7","a8","a9","aa","ab","ac","ad","ae","af",
+    "b0","b1","b2","b3","b4","b5","b6","b7","b8","b9","ba","bb","bc","bd","be","bf",
+    "c0","c1","c2","c3","c4","c5","c6","c7","c8","c9","ca","cb","cc","cd","ce","cf",
+    "d0","d1","d2","d3","d4","d5","d6","d7","d8","d9","da","db","dc","dd","de","df",
+    "e0","e1","e2","e3","e4","e5","e6","e7","e8","e9","ea","eb","ec","ed","ee","ef",
+    "f0","f1","f2","f3","f4","f5","f6","f7","f8","f9","fa","fb","fc","fd","fe","ff"
+};
+
+/* Lookup table for byte to decimal-ascii conversion, used by the IPv4 formatter. */
+static const char byte_to_dec[256][4] = {
+    "0","1","2","3","4","5","6","7","8","9","10","11","12","13","14","15",
+    "16","17","18","19","20","21","22","23","24","25","26","27","28","29","30","31",
+    "32","33","34","35","36","37","38","39","40","41","42","43","44","45","46","47",
+    "48","49","50","51","52","53","54","55","56","57","58","59","60","61","62","63",
+    "64","65","66","67","68","69","70","71","72","73","74","75","76","77","78","79",
+    "80","81","82","83","84","85","86","87","88","89","90","91","92","93","94","95",
+    "96","97","98","99","100","101","102","103","104","105","106","107","108","109","110","111",
+    "112","113","114","115","116","117","118","119","120","121","122","123","124","125","126","127",
+    "128","129","130","131","132","133","134","135","136","137","138","139","140","141","142","143",
+    "144","145","146","147","148","149","150","151","152","153","154","155","156","157","158","159",
+    "160","161","162","163","164","165","166","167","168","169","170","171","172","173","174","175",
+    "176","177","178","179","180","181","182","183","184","185","186","187","188","189","190","191",
+    "192","193","194","195","196","197","198","199","200","201","202","203","204","205","206","207",
+    "208","209","210","211","212","213","214","215","216","217","218","219","220","221","222","223",
+    "224","225","226","227","228","229","230","231","232","233","234","235","236","237","238","239",
+    "240","241","242","243","244","245","246","247","248","249","250","251","252","253","254","255"
+};
+
+size_t wst_bin2hex(char *dst, const uint8_t *src, size_t n, int lowercase) {
+    const char (*byte_to_str)[3] = lowercase ? byte_to_str_lower : byte_to_str_upper;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        *dst++ = byte_to_str[src[i]][0];
+        *dst++ = byte_to_str[src[i]][1];
+    }
+
+    return 2 * n;
+}
+
+/* Lookup table for hex-ascii character to nibble conversion, -1 if not a hex digit. */
+static const int8_t str_to_nibble[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+     0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+size_t wst_hex2bin(uint8_t *dst, const char *src, size_t n, const char *sep) {
+    size_t seplen = sep ? strlen(sep) : 0;
+    size_t i = 0, out = 0;
+    int8_t c, d;
+
+    while (i < n) {
+        c = str_to_nibble[(unsigned char)src[i]];
+        if (c < 0) {
+            if (seplen && seplen <= n - i && strncmp(&src[i], sep, seplen) == 0) {
+                i += seplen;
+                continue;
+            } else {
+                break;
+            }
+        }
+        if (++i == n) break;
+        d = str_to_nibble[(unsigned char)src[i]];
+        if (d < 0) break;
+        dst[out++] = (uint8_t)((c * 16) + d);
+        i++;
+    }
+
+    return out;
+}
+
+/* Writes the dotted-decimal form of a 4-byte IPv4 address into buf, which must
+ * hold at least WST_IPV4_STRLEN bytes. Returns the string length (no NUL is added). */
+size_t wst_ipv4_to_str(char *buf, const uint8_t *addr) {
+    char *p = buf;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        const char* d = byte_to_dec[addr[i]];
+        *p++ = d[0];
+        if (d[1]) { *p++ = d[1]; if (d[2]) *p++ = d[2]; }
+        *p++ = '.';
+    }
+
+    return (size_t)(p - buf) - 1;
+}
+
+/* Writes the RFC 5952 canonical form of a 16-byte IPv6 address into buf, which
+ * must hold at least WST_IPV6_STRLEN bytes: lower-case hex, no leading zeros,
+ * the longest (first on ties) run of two or more zero groups compressed to "::",
+ * and IPv4-mapped addresses in mixed notation. Returns the string length. */
+size_t wst_ipv6_to_str(char *buf, const uint8_t *addr) {
+    static const char nibble_to_str[] = "0123456789abcdef";
+    uint16_t words[8];
+    char *p = buf;
+    int best = -1, bestlen = 1;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        words[i] = (uint16_t)((addr[i*2] << 8) | addr[i*2 + 1]);
+
+    /* find the longest run of zero groups */
+    for (i = 0; i < 8;) {
+        int j = i;
+        while (j < 8 && words[j] == 0) j++;
+        if (j - i > bestlen) {
+            best = i;
+            bestlen = j - i;
+        }
+        i = (j > i) ? j : i + 1;
+    }
+
+    /* ::ffff:a.b.c.d */
+    if (best == 0 && bestlen == 5 && words[5] == 0xffff) {
+        memcpy(p, "::ffff:", 7);
+        p += 7;
+        return (size_t)(p - buf) + wst_ipv4_to_str(p, addr + 12);
+    }
+
+    for (i = 0; i < 8; i++) {
+        uint16_t w = words[i];
+        if (i == best) {
+            *p++ = ':';
+            if (i == 0) *p++ = ':';
+            i += bestlen - 1;
+            continue;
+        }
+        if (w >> 12)       *p++ = nibble_to_str[w >> 12];
+        if (w >> 8)        *p++ = nibble_to_str[(w >> 8) & 0xf];
+        if (w >> 4)        *p++ = nibble_to_str[(w >> 4) & 0xf];
+        *p++ = nibble_to_str[w & 0xf];
+        if (i < 7) *p++ = ':';
+    }
+
+    return (size_t)(p - buf);
+}
+
+/* Writes the colon-separated lower-case hex form of a 6-byte Ethernet address
+ * into buf, which must hold at least WST_ETHER_STRLEN bytes. Returns the string length. */
+size_t wst_ether_to_str(char *buf, const uint8_t *addr) {
+    char *p = buf;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        *p++ = byte_to_str_lower[addr[i]][0];
+        *p++ = byte_to_str_lower[addr[i]][1];
+        *p++ = ':';
+    }
+
+    return (size_t)(p - buf) - 1;
+}
+
+/* Parses a dotted-decimal IPv4 address into 4 bytes. Like inet_pton(), exactly
+ * four decimal parts are required and leading zeros are rejected. */
+int wst_str_to_ipv4(const char *s, size_t len, uint8_t *addr) {
+    size_t i = 0;
+    int part;
+
+    for (part = 0; part < 4; part++) {
+        size_t val = 0;
+        size_t start = i;
+        if (part > 0) {
+            if (i >= len || s[i] != '.') return 0;
+            start = ++i;
+        }
+        while (i < len && s[i] >= '0' && s[i] <= '9') {
+            val = val * 10 + (size_t)(s[i] - '0');
+            if (val > 255 || i - start > 2) return 0;
+            i++;
+        }
+        if (i == start || (s[start] == '0' && i - start > 1)) return 0;
+        addr[part] = (uint8_t)val;
+    }
+
+    return i == len;
+}
+
+/* Parses any RFC 4291 text form of an IPv6 address (including "::" compression
+ * and a trailing dotted-decimal IPv4 part) into 16 bytes. */
+int wst_str_to_ipv6(const char *s, size_t len, uint8_t *addr) {
+    uint8_t tmp[16];
+    int nbytes = 0;
+    int gap = -1;
+    size_t i = 0;
+
+    if (len >= 2 && s[0] == ':' && s[1] == ':') {
+        gap = 0;
+        i = 2;
+    } else if (len >= 1 && s[0] == ':') {
+        return 0;
+    }
+
+    while (i < len) {
+        size_t start = i;
+        size_t val = 0;
+        int8_t n;
+
+        while (i < len && (n = str_to_nibble[(unsigned char)s[i]]) >= 0) {
+            if (i - start == 4) return 0;
+            val = (val << 4) | (size_t)n;
+            i++;
+        }
+
+        if (i < len && s[i] == '.') {
+            /* trailing IPv4 part */
+            if (nbytes > 12 || !wst_str_to_ipv4(s + start, len - start, tmp + nbytes))
+                return 0;
+            nbytes += 4;
+            i = len;
+            break;
+        }
+
+        if (i == start || nbytes == 16) return 0;
+        tmp[nbytes++] = (uint8_t)(val >> 8);
+        tmp[nbytes++] = (uint8_t)(val & 0xff);
+
+        if (i == len) break;
+        if (s[i] != ':' || ++i == len) return 0;
+        if (s[i] == ':') {
+            if (gap >= 0) return 0;
+            gap = nbytes;
+            i++;
+        }
+    }
+
+    if (gap >= 0) {
+        int tail = nbytes - gap;
+        if (nbytes == 16) return 0;
+        memcpy(addr, tmp, gap);
+        memset(addr + gap, 0, 16 - nbytes);
+        memcpy(addr + 16 - tail, tmp + gap, tail);
+        return 1;
+    }
+
+    if (nbytes != 16) return 0;
+    memcpy(addr, tmp, 16);
+    return 1;
+}
+
+/* Parses a 6-byte Ethernet address written as hex byte pairs separated by ':'
+ * or '-' (one separator style throughout), or as 12 contiguous hex digits. */
+int wst_str_to_ether(const char *s, size_t len, uint8_t *addr) {
+    char sep = '\0';
+    size_t i = 0;
+    int part;
+
+    if (len == 17) sep = s[2];
+    else if (len != 12) return 0;
+    if (sep && sep != ':' && sep != '-') return 0;
+
+    for (part = 0; part < 6; part++) {
+        int8_t c, d;
+        if (sep && part > 0 && s[i++] != sep) return 0;
+        c = str_to_nibble[(unsigned char)s[i++]];
+        d = str_to_nibble[(unsigned char)s[i++]];
+        if (c < 0 || d < 0) return 0;
+        addr[part] = (uint8_t)((c << 4) | d);
+    }
+
+    return 1;
+}
+
+const char *wst_cdef(void) {
+    return WST_CDEF;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
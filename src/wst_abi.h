@@ -0,0 +1,80 @@
+/*
+ * wst_abi.h
+ *
+ * Plain C entry points to the byte-level kernels of the library: unaligned
+ * loads, hex conversion and address formatting/parsing. They need no Lua
+ * state, so host C programs can link them directly, and LuaJIT scripts can
+ * call them through the FFI after ffi.cdef(Struct.cdef()).
+ *
+ * The functions below and their signatures are a stable ABI. WST_CDEF must
+ * declare exactly the same functions.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef _WST_ABI_H
+#define _WST_ABI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(_WINDLL)
+#define WST_API __declspec(dllexport)
+#else
+#define WST_API extern
+#endif
+
+/* buffer sizes needed by the address formatters, like INET_ADDRSTRLEN/INET6_ADDRSTRLEN */
+#define WST_IPV4_STRLEN     16
+#define WST_IPV6_STRLEN     46
+#define WST_ETHER_STRLEN    18
+
+/* Loads an unsigned integer of the given byte order from 'p', which need not be aligned */
+WST_API uint16_t wst_load_u16be(const uint8_t *p);
+WST_API uint16_t wst_load_u16le(const uint8_t *p);
+WST_API uint32_t wst_load_u32be(const uint8_t *p);
+WST_API uint32_t wst_load_u32le(const uint8_t *p);
+WST_API uint64_t wst_load_u64be(const uint8_t *p);
+WST_API uint64_t wst_load_u64le(const uint8_t *p);
+
+/* Writes the 2*n hex digits of src[0..n) to dst (no NUL is added). Returns 2*n. */
+WST_API size_t wst_bin2hex(char *dst, const uint8_t *src, size_t n, int lowercase);
+
+/* Converts hex digit pairs from src[0..n) into dst, which must hold n/2 bytes,
+ * skipping occurrences of 'sep' (may be NULL) between pairs and stopping at
+ * anything else. Returns the number of bytes written. */
+WST_API size_t wst_hex2bin(uint8_t *dst, const char *src, size_t n, const char *sep);
+
+/* Address formatters: write the text form of 'addr' to buf, which must hold
+ * WST_*_STRLEN bytes, and return its length (no NUL is added). */
+WST_API size_t wst_ipv4_to_str(char *buf, const uint8_t *addr);
+WST_API size_t wst_ipv6_to_str(char *buf, const uint8_t *addr);
+WST_API size_t wst_ether_to_str(char *buf, const uint8_t *addr);
+
+/* Address parsers: parse s[0..len) into 'addr'. Return 1 on success, 0 if malformed. */
+WST_API int wst_str_to_ipv4(const char *s, size_t len, uint8_t *addr);
+WST_API int wst_str_to_ipv6(const char *s, size_t len, uint8_t *addr);
+WST_API int wst_str_to_ether(const char *s, size_t len, uint8_t *addr);
+
+/* Returns WST_CDEF, for ffi.cdef() */
+WST_API const char *wst_cdef(void);
+
+/* The declarations above, in the form LuaJIT's ffi.cdef() accepts */
+#define WST_CDEF \
+    "uint16_t wst_load_u16be(const uint8_t *p);\n" \
+    "uint16_t wst_load_u16le(const uint8_t *p);\n" \
+    "uint32_t wst_load_u32be(const uint8_t *p);\n" \
+    "uint32_t wst_load_u32le(const uint8_t *p);\n" \
+    "uint64_t wst_load_u64be(const uint8_t *p);\n" \
+    "uint64_t wst_load_u64le(const uint8_t *p);\n" \
+    "size_t wst_bin2hex(char *dst, const uint8_t *src, size_t n, int lowercase);\n" \
+    "size_t wst_hex2bin(uint8_t *dst, const char *src, size_t n, const char *sep);\n" \
+    "size_t wst_ipv4_to_str(char *buf, const uint8_t *addr);\n" \
+    "size_t wst_ipv6_to_str(char *buf, const uint8_t *addr);\n" \
+    "size_t wst_ether_to_str(char *buf, const uint8_t *addr);\n" \
+    "int wst_str_to_ipv4(const char *s, size_t len, uint8_t *addr);\n" \
+    "int wst_str_to_ipv6(const char *s, size_t len, uint8_t *addr);\n" \
+    "int wst_str_to_ether(const char *s, size_t len, uint8_t *addr);\n" \
+    "const char *wst_cdef(void);\n"
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * wst_atomic.h
+ *
+ * The few atomic operations the library needs for reference counts and for
+ * structures shared between threads: the GCC/Clang __atomic builtins, or the
+ * Interlocked functions with MSVC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_ATOMIC_H
+#define _WST_ATOMIC_H
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+
+/* increment/decrement an int32_t, returning the new value */
+#define wst_atomic_inc(p)       InterlockedIncrement((volatile LONG *)(p))
+#define wst_atomic_dec(p)       InterlockedDecrement((volatile LONG *)(p))
+/* load an int32_t with acquire semantics, and compare-and-swap one, returning whether it
+   held 'e' and now holds 'v' */
+#define wst_atomic_load32(p)    InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define wst_atomic_cas32(p,e,v) (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(v), (LONG)(e)) == (LONG)(e))
+/* a full memory barrier */
+#define wst_atomic_fence()      MemoryBarrier()
+/* tell the processor that this is a spin-wait loop */
+#define wst_atomic_pause()      YieldProcessor()
+/* load a pointer with acquire, store one with release semantics */
+#define wst_atomic_loadp(p)     InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL)
+#define wst_atomic_storep(p,v)  ((void)InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v)))
+/* a spinlock on an int32_t that is 0 when free */
+#define wst_atomic_trylock(p)   (InterlockedCompareExchange((volatile LONG *)(p), 1, 0) == 0)
+#define wst_atomic_unlock(p)    ((void)InterlockedExchange((volatile LONG *)(p), 0))
+/* load a uint64_t with acquire, store one with release semantics, and compare-and-swap one,
+   returning whether it held 'e' and now holds 'v' */
+#define wst_atomic_load64(p)    ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+#define wst_atomic_store64(p,v) ((void)InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v)))
+#define wst_atomic_cas64(p,e,v) (InterlockedCompareExchange64((volatile LONG64 *)(p), (LONG64)(v), (LONG64)(e)) == (LONG64)(e))
+
+#else
+
+#define wst_atomic_inc(p)       __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define wst_atomic_dec(p)       __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define wst_atomic_load32(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define wst_atomic_cas32(p,e,v) __extension__ ({ int32_t _e = (e); \
+                                    __atomic_compare_exchange_n((p), &_e, (int32_t)(v), 0, \
+                                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+#define wst_atomic_fence()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#if defined(__i386__) || defined(__x86_64__)
+#define wst_atomic_pause()      __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define wst_atomic_pause()      __asm__ __volatile__("yield")
+#else
+#define wst_atomic_pause()      ((void)0)
+#endif
+#define wst_atomic_loadp(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define wst_atomic_storep(p,v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define wst_atomic_trylock(p)   (__atomic_exchange_n((p), 1, __ATOMIC_ACQUIRE) == 0)
+#define wst_atomic_unlock(p)    __atomic_store_n((p), 0, __ATOMIC_RELEASE)
+#define wst_atomic_load64(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define wst_atomic_store64(p,v) __atomic_store_n((p), (uint64_t)(v), __ATOMIC_RELEASE)
+#define wst_atomic_cas64(p,e,v) __extension__ ({ uint64_t _e = (e); \
+                                    __atomic_compare_exchange_n((p), &_e, (uint64_t)(v), 0, \
+                                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+
+#endif
+
+#endif
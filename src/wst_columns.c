@@ -0,0 +1,209 @@
+/*
+ * wst_columns.c
+ *
+ * Parallel decoding of fixed-size records into columns, see wst_columns.h.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "wst_columns.h"
+
+/* records decoded by a thread, at least, and the multiple its range starts at, so
+   that two threads do not write to the same cache lines of a column */
+#define COL_MINWORK     16384
+#define COL_GRAIN       64
+
+static const char *const col_ctypes[] = {
+    "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    "float", "double", "uint8_t", "int64_t"
+};
+
+const char *wst_column_ctype(int type) {
+    return col_ctypes[type];
+}
+
+int wst_column_spec_init(const wst_layout *l, uint32_t i, wst_column_spec *spec) {
+    const wst_field *f = wst_layout_value(l, i, &spec->offset);
+    uint32_t size;
+    if (f == NULL)
+        return -1;
+    spec->f = f;
+    size = f->size;
+    switch (f->opt) {
+        case 'b': case 'h': case 'l': case 'i': case 'e':
+        case 'B': case 'H': case 'L': case 'T': case 'I': case 'E':
+            if (size > 8)
+                return -1;
+            spec->width = size <= 1 ? 1 : size <= 2 ? 2 : size <= 4 ? 4 : 8;
+            spec->type = (spec->width == 1 ? WST_COL_I8 : spec->width == 2 ? WST_COL_I16 :
+                          spec->width == 4 ? WST_COL_I32 : WST_COL_I64);
+            if (f->opt >= 'A' && f->opt <= 'Z')
+                spec->type += WST_COL_U8 - WST_COL_I8;
+            return 0;
+        case 'f':
+            spec->type = WST_COL_F32;
+            spec->width = 4;
+            return size == sizeof(float) ? 0 : -1;
+        case 'd':
+            spec->type = WST_COL_F64;
+            spec->width = 8;
+            return size == sizeof(double) ? 0 : -1;
+        case 'c':
+            spec->type = WST_COL_BYTES;
+            spec->width = size;
+            return size > 0 ? 0 : -1;
+        case '=':
+            spec->type = WST_COL_POS;
+            spec->width = 8;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Loads an integer of 'size' bytes, sign-extended if 'sgn' */
+static uint64_t col_int(const uint8_t *p, uint32_t size, int endian, int sgn) {
+    uint64_t u = 0;
+    uint32_t i;
+    if (endian == WST_BIG)
+        for (i = 0; i < size; i++)
+            u = (u << 8) | p[i];
+    else
+        for (i = size; i-- > 0; )
+            u = (u << 8) | p[i];
+    if (sgn && size < 8 && ((u >> (size * 8 - 1)) & 1))
+        u |= ~(uint64_t)0 << (size * 8);
+    return u;
+}
+
+#define COL_INTS(T, sgn) \
+    for (i = first; i < last; i++, p += size) \
+        ((T *)c->out)[i] = (T)col_int(p, fs, f->endian, sgn)
+
+/* Decodes records first..last-1 of the value of column 'c' */
+static void col_decode(const wst_column_spec *c, const uint8_t *data, size_t size,
+                       size_t first, size_t last, size_t pos) {
+    const wst_field *f = c->f;
+    const uint8_t *p = data + first * size + c->offset;
+    uint32_t fs = f->size;
+    size_t i;
+    switch (c->type) {
+        case WST_COL_I8:  COL_INTS(int8_t, 1); break;
+        case WST_COL_I16: COL_INTS(int16_t, 1); break;
+        case WST_COL_I32: COL_INTS(int32_t, 1); break;
+        case WST_COL_I64: COL_INTS(int64_t, 1); break;
+        case WST_COL_U8:  COL_INTS(uint8_t, 0); break;
+        case WST_COL_U16: COL_INTS(uint16_t, 0); break;
+        case WST_COL_U32: COL_INTS(uint32_t, 0); break;
+        case WST_COL_U64: COL_INTS(uint64_t, 0); break;
+        case WST_COL_F32:
+            for (i = first; i < last; i++, p += size) {
+                uint32_t bits = (uint32_t)col_int(p, 4, f->endian, 0);
+                memcpy((float *)c->out + i, &bits, sizeof(bits));
+            }
+            break;
+        case WST_COL_F64:
+            for (i = first; i < last; i++, p += size) {
+                uint64_t bits = col_int(p, 8, f->endian, 0);
+                memcpy((double *)c->out + i, &bits, sizeof(bits));
+            }
+            break;
+        case WST_COL_BYTES:
+            for (i = first; i < last; i++, p += size)
+                memcpy((uint8_t *)c->out + i * c->width, p, c->width);
+            break;
+        default:  /* WST_COL_POS */
+            for (i = first; i < last; i++)
+                ((int64_t *)c->out)[i] = (int64_t)(pos + i * size + c->offset + 1);
+            break;
+    }
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t size, pos;
+    size_t first, last;     /* the records of this job */
+    const wst_column_spec *cols;
+    size_t ncols;
+} col_job;
+
+static void col_run(const col_job *j) {
+    size_t k;
+    for (k = 0; k < j->ncols; k++)
+        col_decode(&j->cols[k], j->data, j->size, j->first, j->last, j->pos);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI col_thread(LPVOID arg) {
+    col_run((const col_job *)arg);
+    return 0;
+}
+#else
+static void *col_thread(void *arg) {
+    col_run((const col_job *)arg);
+    return NULL;
+}
+#endif
+
+unsigned wst_columns_decode(const wst_layout *l, const uint8_t *data, size_t n, size_t pos,
+                            wst_column_spec *cols, size_t ncols, unsigned nthreads) {
+    col_job jobs[WST_COL_MAXTHREADS];
+    int started[WST_COL_MAXTHREADS];
+#ifdef _WIN32
+    HANDLE threads[WST_COL_MAXTHREADS];
+#else
+    pthread_t threads[WST_COL_MAXTHREADS];
+#endif
+    size_t work = n * (ncols ? ncols : 1);
+    unsigned t;
+
+    if (nthreads > WST_COL_MAXTHREADS)
+        nthreads = WST_COL_MAXTHREADS;
+    if (nthreads > work / COL_MINWORK)
+        nthreads = (unsigned)(work / COL_MINWORK);
+    if (nthreads == 0)
+        nthreads = 1;
+
+    for (t = 0; t < nthreads; t++) {
+        jobs[t].data = data;
+        jobs[t].size = l->size;
+        jobs[t].pos = pos;
+        jobs[t].cols = cols;
+        jobs[t].ncols = ncols;
+        jobs[t].first = t == 0 ? 0 : jobs[t - 1].last;
+        jobs[t].last = t == nthreads - 1 ? n : (n / nthreads * (t + 1)) / COL_GRAIN * COL_GRAIN;
+        if (jobs[t].last < jobs[t].first)
+            jobs[t].last = jobs[t].first;
+    }
+    for (t = 1; t < nthreads; t++) {
+#ifdef _WIN32
+        threads[t] = CreateThread(NULL, 0, col_thread, &jobs[t], 0, NULL);
+        started[t] = threads[t] != NULL;
+#else
+        started[t] = pthread_create(&threads[t], NULL, col_thread, &jobs[t]) == 0;
+#endif
+    }
+    col_run(&jobs[0]);
+    for (t = 1; t < nthreads; t++) {
+        if (!started[t]) {
+            col_run(&jobs[t]);
+            continue;
+        }
+#ifdef _WIN32
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+#else
+        pthread_join(threads[t], NULL);
+#endif
+    }
+    return nthreads;
+}
@@ -0,0 +1,59 @@
+/*
+ * wst_columns.h
+ *
+ * Decodes arrays of fixed-size records into columns: one native array per
+ * value of the records, such as an int32_t array for an 'i4' value. Ranges of
+ * records are decoded by several threads at once. This part has no Lua
+ * dependency, so the threads never touch a Lua state.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_COLUMNS_H
+#define _WST_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wst_layout.h"
+
+/* types of the elements of a column */
+#define WST_COL_I8      0
+#define WST_COL_I16     1
+#define WST_COL_I32     2
+#define WST_COL_I64     3
+#define WST_COL_U8      4
+#define WST_COL_U16     5
+#define WST_COL_U32     6
+#define WST_COL_U64     7
+#define WST_COL_F32     8
+#define WST_COL_F64     9
+#define WST_COL_BYTES   10  /* 'c' values, 'width' bytes each */
+#define WST_COL_POS     11  /* '=' positions, as int64_t */
+
+/* the maximum number of threads of one decode */
+#define WST_COL_MAXTHREADS  64
+
+typedef struct _wst_column_spec {
+    const wst_field *f;     /* the element of the value */
+    uint32_t offset;        /* the offset of the value in the record */
+    int type;               /* WST_COL_* */
+    uint32_t width;         /* bytes per element of 'out' */
+    void *out;              /* n * width bytes */
+} wst_column_spec;
+
+/* Gets the column type and element width for value 'i' of fixed layout 'l', and fills
+ * spec->f and spec->offset. Returns 0, or -1 if the value cannot go in a column. */
+extern int wst_column_spec_init(const wst_layout *l, uint32_t i, wst_column_spec *spec);
+
+/* Returns the C type of the elements of a column type ("uint8_t" for WST_COL_BYTES) */
+extern const char *wst_column_ctype(int type);
+
+/* Decodes n records of fixed layout 'l' at 'data' into the columns, splitting them in up
+ * to 'nthreads' ranges decoded at the same time. 'pos' is the position of the first record,
+ * for WST_COL_POS values. Returns the number of threads used; if threads cannot be started,
+ * the calling thread decodes their ranges. */
+extern unsigned wst_columns_decode(const wst_layout *l, const uint8_t *data, size_t n, size_t pos,
+                                   wst_column_spec *cols, size_t ncols, unsigned nthreads);
+
+#endif
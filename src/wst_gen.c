@@ -0,0 +1,523 @@
+/*
+ * wst_gen.c
+ *
+ * Build-time generator of specialized decoders. Reads a manifest of named
+ * Struct format strings and writes a C file with an unpack and a pack
+ * function for each, in which the offset, byte order and conversion of
+ * every element are constants. When the library is built with
+ * LUAWSTYPES_GENERATED, they are registered as Struct.unpack_<name>() and
+ * Struct.pack_<name>(), and Struct.generated maps each name to its format.
+ *
+ * Usage: wst_gen manifest output.c
+ *
+ * Each manifest line holds a name, which must be a C identifier, and the
+ * format string after it; '#' starts a comment. Only fixed-size formats can
+ * be specialized, so 's', 'w', 'W', 'c0' and '*' repeat counts are rejected,
+ * as are integers wider than 8 bytes. The sizes of native types ('l', 'L',
+ * 'T', '!') are those of the machine running the generator.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wst_layout.h"
+
+#define MAXLINE     1024
+#define MAXNAME     64
+
+/* Struct.pack returns at most this many '=' positions */
+#define MAXPOSITIONS    10
+
+typedef struct {
+    char name[MAXNAME];
+    char *format;
+    wst_layout *layout;
+} entry;
+
+static const char *manifest;
+static const char *output;
+static FILE *out;
+
+static void fail(int line, const char *fmt, ...) {
+    va_list ap;
+    if (line)
+        fprintf(stderr, "%s:%d: ", manifest, line);
+    else
+        fprintf(stderr, "wst_gen: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    if (out) {
+        fclose(out);
+        remove(output);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/* Why the layout cannot be specialized, or NULL if it can */
+static const char *unsupported(const wst_layout *l) {
+    uint32_t i;
+    if (!l->fixed)
+        return "the format has elements of variable size";
+    for (i = 0; i < l->nfields; i++) {
+        const wst_field *f = &l->fields[i];
+        switch (f->opt) {
+            case 'W':
+                return "option 'W' cannot be specialized";
+            case 'b': case 'B': case 'h': case 'H':
+            case 'l': case 'L': case 'T': case 'i': case 'I':
+                if (f->size > 8)
+                    return "integers wider than 8 bytes cannot be specialized";
+                break;
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
+/* Emits an expression with the value of the 'size' byte integer at p[off] */
+static void emitload(uint32_t off, uint32_t size, int endian) {
+    uint32_t i;
+    if (size > 1)
+        fputc('(', out);
+    for (i = 0; i < size; i++) {
+        uint32_t shift = (size - 1 - i) * 8;
+        uint32_t at = endian == WST_BIG ? off + i : off + size - 1 - i;
+        fprintf(out, "%s(guint64)p[%u]", i ? " | " : "", at);
+        if (shift)
+            fprintf(out, " << %u", shift);
+    }
+    if (size > 1)
+        fputc(')', out);
+}
+
+/* Emits the statements storing the low 'size' bytes of v at r[off] */
+static void emitstore(uint32_t off, uint32_t size, int endian) {
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        uint32_t shift = (size - 1 - i) * 8;
+        uint32_t at = endian == WST_BIG ? off + i : off + size - 1 - i;
+        if (shift)
+            fprintf(out, "    r[%u] = (guchar)(v >> %u);\n", at, shift);
+        else
+            fprintf(out, "    r[%u] = (guchar)v;\n", at);
+    }
+}
+
+static void emitunpack(const entry *e) {
+    const wst_layout *l = e->layout;
+    uint32_t i, k, nvalues = 0;
+
+    fprintf(out, "static int wstgen_unpack_%s (lua_State *L) {\n", e->name);
+    fprintf(out, "    const guchar *p;\n");
+    fprintf(out, "    size_t pos;\n");
+    fprintf(out, "    if (!wstgen_at(L, %u, %u, &p, &pos))\n", l->align, l->extent);
+    fprintf(out, "        return wstgen_fallback(L);\n");
+    fprintf(out, "    luaL_checkstack(L, %u, \"too many results\");\n", l->nvalues + 1);
+    for (i = 0; i < l->nfields; i++) {
+        const wst_field *f = &l->fields[i];
+        if ((f->flags & WST_NOASSIGN) && f->size > 0)
+            continue;
+        for (k = 0; k < f->count; k++) {
+            uint32_t off = f->offset + k * f->size;
+            switch (f->opt) {
+                case 'b': case 'h': case 'l': case 'i':
+                    fprintf(out, "    lua_pushnumber(L, (lua_Number)(wstgen_int)WSTGEN_SEXT(");
+                    emitload(off, f->size, f->endian);
+                    fprintf(out, ", %u));\n", f->size * 8);
+                    break;
+                case 'B': case 'H': case 'L': case 'T': case 'I':
+                    fprintf(out, "    lua_pushnumber(L, (lua_Number)(wstgen_uint)");
+                    emitload(off, f->size, f->endian);
+                    fprintf(out, ");\n");
+                    break;
+                case 'e': case 'E':
+                    fprintf(out, "    %s_unpack(L, (const gchar *)p + %u, %s);\n",
+                            f->opt == 'e' ? "Int64" : "UInt64", off,
+                            f->endian == WST_LITTLE ? "TRUE" : "FALSE");
+                    break;
+                case 'f':
+                    fprintf(out, "    lua_pushnumber(L, wstgen_float((guint32)");
+                    emitload(off, 4, f->endian);
+                    fprintf(out, "));\n");
+                    break;
+                case 'd':
+                    fprintf(out, "    lua_pushnumber(L, wstgen_double(");
+                    emitload(off, 8, f->endian);
+                    fprintf(out, "));\n");
+                    break;
+                case 'c':
+                    fprintf(out, "    lua_pushlstring(L, (const char *)p + %u, %u);\n", off, f->size);
+                    break;
+                case '=':
+                    fprintf(out, "    lua_pushinteger(L, (lua_Integer)(pos + %u));\n", off + 1);
+                    break;
+                default:  /* 'x', 'X' */
+                    continue;
+            }
+            nvalues++;
+        }
+    }
+    fprintf(out, "    lua_pushinteger(L, (lua_Integer)(pos + %u));\n", l->size + 1);
+    fprintf(out, "    return %u;\n", nvalues + 1);
+    fprintf(out, "}\n\n");
+}
+
+static void emitpack(const entry *e) {
+    const wst_layout *l = e->layout;
+    uint32_t i, k, npos = 0, positions[MAXPOSITIONS];
+    int arg = 1, usesv = 0;
+
+    for (i = 0; i < l->nfields; i++) {
+        char opt = l->fields[i].opt;
+        if (l->fields[i].size > 0 && !(l->fields[i].flags & WST_NOASSIGN) && opt != 'x' && opt != 'c')
+            usesv = 1;
+    }
+
+    fprintf(out, "static int wstgen_pack_%s (lua_State *L) {\n", e->name);
+    fprintf(out, "    guchar r[%u];\n", l->size ? l->size : 1);
+    if (usesv)
+        fprintf(out, "    guint64 v;\n");
+    fprintf(out, "    memset(r, 0, sizeof(r));\n");
+    for (i = 0; i < l->nfields; i++) {
+        const wst_field *f = &l->fields[i];
+        if ((f->flags & WST_NOASSIGN) && f->size > 0)
+            continue;  /* for pack, "(i4)" is the same as "x4" */
+        for (k = 0; k < f->count; k++) {
+            uint32_t off = f->offset + k * f->size;
+            switch (f->opt) {
+                case 'b': case 'B': case 'h': case 'H':
+                case 'l': case 'L': case 'T': case 'i': case 'I':
+                    fprintf(out, "    v = wstgen_checkint(L, %d);\n", arg++);
+                    emitstore(off, f->size, f->endian);
+                    break;
+                case 'e': case 'E':
+                    fprintf(out, "    v = (guint64)check%s(L, %d);\n", f->opt == 'e' ? "Int64" : "UInt64", arg++);
+                    emitstore(off, 8, f->endian);
+                    break;
+                case 'f':
+                    fprintf(out, "    v = wstgen_floatbits((gfloat)luaL_checknumber(L, %d));\n", arg++);
+                    emitstore(off, 4, f->endian);
+                    break;
+                case 'd':
+                    fprintf(out, "    v = wstgen_doublebits(luaL_checknumber(L, %d));\n", arg++);
+                    emitstore(off, 8, f->endian);
+                    break;
+                case 'c':
+                    fprintf(out, "    wstgen_putchars(L, %d, r + %u, %u);\n", arg++, off, f->size);
+                    break;
+                case '=':
+                    if (npos < MAXPOSITIONS)
+                        positions[npos++] = off + 1;
+                    break;
+                default:  /* 'x', 'X' */
+                    break;
+            }
+        }
+    }
+    fprintf(out, "    lua_pushlstring(L, (const char *)r, %u);\n", l->size);
+    for (i = 0; i < npos; i++)
+        fprintf(out, "    lua_pushinteger(L, %u);\n", positions[i]);
+    fprintf(out, "    return %u;\n", npos + 1);
+    fprintf(out, "}\n\n");
+}
+
+/* The part of the output that does not depend on the manifest */
+static const char prologue[] =
+    "#include \"wslua.h\"\n"
+    "\n"
+    "#include <string.h>\n"
+    "\n"
+    "/* the same integer type as wslua_struct.c decodes through */\n"
+    "#ifndef STRUCT_INT\n"
+    "#define STRUCT_INT long\n"
+    "#endif\n"
+    "\n"
+    "typedef STRUCT_INT wstgen_int;\n"
+    "typedef unsigned STRUCT_INT wstgen_uint;\n"
+    "\n"
+    "/* sign-extends the 'bits' bit value v */\n"
+    "#define WSTGEN_SEXT(v, bits) \\\n"
+    "    ((gint64)(((v) ^ ((guint64)1 << ((bits) - 1))) - ((guint64)1 << ((bits) - 1))))\n"
+    "\n"
+    "/* Points 'p' at the record at the position in argument 2 of the data string in\n"
+    "   argument 1, if that position is a multiple of 'align' and 'extent' bytes are there */\n"
+    "static int wstgen_at (lua_State *L, size_t align, size_t extent, const guchar **p, size_t *pos) {\n"
+    "    size_t ld;\n"
+    "    lua_Integer i = 1;\n"
+    "    if (lua_type(L, 1) != LUA_TSTRING)\n"
+    "        return 0;\n"
+    "    if (lua_type(L, 2) == LUA_TNUMBER)\n"
+    "        i = lua_tointeger(L, 2);\n"
+    "    else if (!lua_isnoneornil(L, 2))\n"
+    "        return 0;\n"
+    "    *p = (const guchar *)lua_tolstring(L, 1, &ld);\n"
+    "    if (i < 1 || ((size_t)(i - 1) & (align - 1)) != 0 || (size_t)(i - 1) > ld || ld - (size_t)(i - 1) < extent)\n"
+    "        return 0;\n"
+    "    *pos = (size_t)(i - 1);\n"
+    "    *p += *pos;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "/* Everything else goes to Struct.unpack with the format, which are the upvalues */\n"
+    "static int wstgen_fallback (lua_State *L) {\n"
+    "    lua_settop(L, 2);\n"
+    "    lua_pushvalue(L, lua_upvalueindex(1));\n"
+    "    lua_pushvalue(L, lua_upvalueindex(2));\n"
+    "    lua_pushvalue(L, 1);\n"
+    "    lua_pushvalue(L, 2);\n"
+    "    lua_call(L, 3, LUA_MULTRET);\n"
+    "    return lua_gettop(L) - 2;\n"
+    "}\n"
+    "\n";
+
+/* Helpers, emitted only if a format needs them (they are static) */
+static const char float_helpers[] =
+    "static lua_Number wstgen_float (guint32 bits) {\n"
+    "    gfloat f;\n"
+    "    memcpy(&f, &bits, sizeof(f));\n"
+    "    return f;\n"
+    "}\n"
+    "\n"
+    "static guint64 wstgen_floatbits (gfloat f) {\n"
+    "    guint32 bits;\n"
+    "    memcpy(&bits, &f, sizeof(bits));\n"
+    "    return bits;\n"
+    "}\n"
+    "\n";
+
+static const char double_helpers[] =
+    "static lua_Number wstgen_double (guint64 bits) {\n"
+    "    gdouble d;\n"
+    "    memcpy(&d, &bits, sizeof(d));\n"
+    "    return d;\n"
+    "}\n"
+    "\n"
+    "static guint64 wstgen_doublebits (gdouble d) {\n"
+    "    guint64 bits;\n"
+    "    memcpy(&bits, &d, sizeof(bits));\n"
+    "    return bits;\n"
+    "}\n"
+    "\n";
+
+static const char integer_helpers[] =
+    "/* the integer conversion of Struct.pack */\n"
+    "static guint64 wstgen_checkint (lua_State *L, int arg) {\n"
+    "    lua_Number n = luaL_checknumber(L, arg);\n"
+    "    return n < 0 ? (guint64)(gint64)n : (guint64)n;\n"
+    "}\n"
+    "\n";
+
+static const char chars_helpers[] =
+    "static void wstgen_putchars (lua_State *L, int arg, guchar *r, size_t size) {\n"
+    "    size_t l;\n"
+    "    const char *s = luaL_checklstring(L, arg, &l);\n"
+    "    luaL_argcheck(L, l >= size, arg, \"string too short\");\n"
+    "    memcpy(r, s, size);\n"
+    "}\n"
+    "\n";
+
+static const char epilogue[] =
+    "/* Sets Struct[prefix..name] to the function on top of the stack */\n"
+    "static void wstgen_set (lua_State *L, int t, const char *prefix, const char *name) {\n"
+    "    lua_pushfstring(L, \"%s%s\", prefix, name);\n"
+    "    lua_pushvalue(L, -1);\n"
+    "    lua_rawget(L, t);\n"
+    "    if (!lua_isnil(L, -1))\n"
+    "        luaL_error(L, \"generated function '%s' clashes with Struct.%s\", name, lua_tostring(L, -2));\n"
+    "    lua_pop(L, 1);\n"
+    "    lua_insert(L, -2);\n"
+    "    lua_rawset(L, t);\n"
+    "}\n"
+    "\n"
+    "int wstgen_register (lua_State *L) {\n"
+    "    int i, t;\n"
+    "    lua_getglobal(L, \"Struct\");\n"
+    "    t = lua_gettop(L);\n"
+    "    lua_pushstring(L, \"generated\");\n"
+    "    lua_newtable(L);\n"
+    "    for (i = 0; wstgen_formats[i].name; i++) {\n"
+    "        lua_pushstring(L, wstgen_formats[i].format);\n"
+    "        lua_setfield(L, -2, wstgen_formats[i].name);\n"
+    "        lua_getfield(L, t, \"unpack\");\n"
+    "        lua_pushstring(L, wstgen_formats[i].format);\n"
+    "        lua_pushcclosure(L, wstgen_formats[i].unpack, 2);\n"
+    "        wstgen_set(L, t, \"unpack_\", wstgen_formats[i].name);\n"
+    "        lua_pushcfunction(L, wstgen_formats[i].pack);\n"
+    "        wstgen_set(L, t, \"pack_\", wstgen_formats[i].name);\n"
+    "    }\n"
+    "    lua_rawset(L, t);\n"
+    "    lua_pop(L, 1);\n"
+    "    return 0;\n"
+    "}\n";
+
+/* Do any of the formats have a value of one of the options in 'opts'? */
+static int uses(const entry *entries, size_t n, const char *opts) {
+    size_t i;
+    uint32_t j;
+    for (i = 0; i < n; i++) {
+        const wst_layout *l = entries[i].layout;
+        for (j = 0; j < l->nfields; j++)
+            if (!(l->fields[j].flags & WST_NOASSIGN) && strchr(opts, l->fields[j].opt))
+                return 1;
+    }
+    return 0;
+}
+
+/* Writes the format as a C string literal */
+static void emitstring(const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* Splits a manifest line into a name and a format; returns 0 for an empty line */
+static int parseline(char *line, int lineno, entry *e) {
+    char *p = line, *name, *end;
+    size_t len;
+
+    if ((end = strchr(p, '#')) != NULL)
+        *end = '\0';
+    len = strlen(p);
+    while (len > 0 && isspace((unsigned char)p[len - 1]))
+        p[--len] = '\0';
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p == '\0')
+        return 0;
+
+    name = p;
+    if (!isalpha((unsigned char)*p) && *p != '_')
+        fail(lineno, "'%s' is not a valid name", name);
+    while (isalnum((unsigned char)*p) || *p == '_')
+        p++;
+    if (*p != '\0' && !isspace((unsigned char)*p))
+        fail(lineno, "'%s' is not a valid name", name);
+    if ((size_t)(p - name) >= MAXNAME)
+        fail(lineno, "name too long");
+    memcpy(e->name, name, p - name);
+    e->name[p - name] = '\0';
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p == '\0')
+        fail(lineno, "missing format for '%s'", e->name);
+    e->format = strdup(p);
+    if (!e->format)
+        fail(lineno, "out of memory");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    char line[MAXLINE];
+    char err[64];
+    entry *entries = NULL;
+    size_t n = 0, cap = 0, i, j;
+    int lineno = 0;
+    FILE *in;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: wst_gen manifest output.c\n");
+        return EXIT_FAILURE;
+    }
+    manifest = argv[1];
+    output = argv[2];
+
+    in = fopen(manifest, "r");
+    if (!in)
+        fail(0, "cannot open %s", manifest);
+    while (fgets(line, sizeof(line), in)) {
+        entry e;
+        lineno++;
+        if (!strchr(line, '\n') && !feof(in))
+            fail(lineno, "line too long");
+        if (!parseline(line, lineno, &e))
+            continue;
+        for (j = 0; j < n; j++)
+            if (strcmp(entries[j].name, e.name) == 0)
+                fail(lineno, "duplicate name '%s'", e.name);
+        e.layout = wst_layout_compile(e.format, err, sizeof(err));
+        if (!e.layout)
+            fail(lineno, "%s: %s", e.name, err);
+        if (unsupported(e.layout))
+            fail(lineno, "%s: %s", e.name, unsupported(e.layout));
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            entries = (entry*)realloc(entries, cap * sizeof(entry));
+            if (!entries)
+                fail(lineno, "out of memory");
+        }
+        entries[n++] = e;
+    }
+    fclose(in);
+
+    out = fopen(output, "w");
+    if (!out)
+        fail(0, "cannot create %s", output);
+    fprintf(out, "/*\n * %s\n *\n * Generated by wst_gen from %s, do not edit.\n */\n\n", output, manifest);
+    fputs(prologue, out);
+    if (uses(entries, n, "f"))
+        fputs(float_helpers, out);
+    if (uses(entries, n, "d"))
+        fputs(double_helpers, out);
+    if (uses(entries, n, "bBhHlLTiI"))
+        fputs(integer_helpers, out);
+    if (uses(entries, n, "c"))
+        fputs(chars_helpers, out);
+    for (i = 0; i < n; i++) {
+        fprintf(out, "/* %s: ", entries[i].name);
+        for (j = 0; entries[i].format[j]; j++)  /* keep the comment closed */
+            fputc(entries[i].format[j] == '/' ? '?' : entries[i].format[j], out);
+        fprintf(out, " */\n");
+        emitunpack(&entries[i]);
+        emitpack(&entries[i]);
+    }
+    fprintf(out, "static const struct {\n");
+    fprintf(out, "    const char *name;\n");
+    fprintf(out, "    const char *format;\n");
+    fprintf(out, "    lua_CFunction unpack;\n");
+    fprintf(out, "    lua_CFunction pack;\n");
+    fprintf(out, "} wstgen_formats[] = {\n");
+    for (i = 0; i < n; i++) {
+        fprintf(out, "    { \"%s\", ", entries[i].name);
+        emitstring(entries[i].format);
+        fprintf(out, ", wstgen_unpack_%s, wstgen_pack_%s },\n", entries[i].name, entries[i].name);
+    }
+    fprintf(out, "    { NULL, NULL, NULL, NULL }\n};\n\n");
+    fputs(epilogue, out);
+    if (ferror(out) | fclose(out)) {
+        out = NULL;
+        remove(output);
+        fail(0, "cannot write %s", output);
+    }
+
+    for (i = 0; i < n; i++) {
+        wst_layout_unref(entries[i].layout);
+        free(entries[i].format);
+    }
+    free(entries);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,550 @@
+/*
+ * wst_layout.c
+ *
+ * Compiles Struct format strings into layouts, see wst_layout.h.
+ * The format language is the one documented in wslua_struct.c.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wst_atomic.h"
+#include "wst_layout.h"
+
+/* is 'x' a power of 2? */
+#define isp2(x)  ((x) > 0 && ((x) & ((x) - 1)) == 0)
+
+/* dummy structure to get padding/alignment requirements */
+struct cD {
+    char c;
+    double d;
+};
+
+#define PADDING         (sizeof(struct cD) - sizeof(double))
+#define MAXALIGN        (PADDING > sizeof(int) ? PADDING : sizeof(int))
+
+/* trick to determine native endianness of system */
+static const union {
+    int dummy;
+    char endian;
+} native = {1};
+
+/* For options that take a number argument, gets the number */
+static int getnum(const char **fmt, int df) {
+    if (**fmt < '0' || **fmt > '9')  /* no number? */
+        return df;  /* return default value */
+    else {
+        int a = 0;
+        do {
+            a = a*10 + *((*fmt)++) - '0';
+        } while (**fmt >= '0' && **fmt <= '9');
+        return a;
+    }
+}
+
+int wst_optsize(char opt, const char **fmt, size_t *size) {
+    switch (opt) {
+        case 'B': case 'b': *size = sizeof(char); break;
+        case 'H': case 'h': *size = sizeof(short); break;
+        case 'L': case 'l': *size = sizeof(long); break;
+        case 'E': case 'e': *size = sizeof(int64_t); break;
+        case 'T': *size = sizeof(size_t); break;
+        case 'f': *size = sizeof(float); break;
+        case 'd': *size = sizeof(double); break;
+        case 'x': *size = getnum(fmt, 1); break;
+        case 'X': *size = getnum(fmt, MAXALIGN); break;
+        case 'c': *size = getnum(fmt, 1); break;
+        case 'W': *size = (size_t)getnum(fmt, 1) * 2; break;
+        case 's': case 'w': *size = getnum(fmt, 0); break;  /* the maximum length, not a size */
+        case 'i': case 'I': {
+            *size = getnum(fmt, sizeof(int));
+            if (*size > WST_MAXINTSIZE)
+                return WST_EINTSIZE;
+            break;
+        }
+        case ' ':
+        case '<': case '>':
+        case '(': case ')':
+        case '!': case '=':
+            *size = 0;  /* these cases do not have a size */
+            break;
+        default:
+            return WST_EOPTION;
+    }
+    return WST_OK;
+}
+
+/* the alignment argument gettoalign() in wslua_struct.c would use for an element */
+static uint32_t elemalign(char opt, size_t size, int align) {
+    if (size == 0 || opt == 'c' || opt == 's' || opt == 'w' || opt == 'W') return 0;
+    if (size > (size_t)align)
+        size = align;  /* respect max. alignment */
+    return (uint32_t)size;
+}
+
+/* return number of bytes needed to align at 'pos' for alignment argument 'align' */
+static uint32_t toalign(size_t pos, uint32_t align) {
+    if (align == 0) return 0;
+    return (uint32_t)((align - (pos & (align - 1))) & (align - 1));
+}
+
+/* state of the compiler */
+typedef struct {
+    wst_field *fields;      /* the fields so far (grown as needed) */
+    uint32_t nfields;
+    uint32_t cap;
+    int endian;
+    int align;              /* current maximum alignment ('!') */
+    int noassign;
+    int fixed;              /* are all offsets known so far? */
+    int variable;           /* does the number of values depend on the data? */
+    size_t pos;             /* offset of the next element, while fixed */
+    uint32_t maxalign;
+    uint32_t extent;
+    uint32_t nvalues;
+    uint32_t nresults;      /* values, '=' positions included, while fixed */
+    char *err;
+    size_t errlen;
+} compiler;
+
+#define iscontrolopt(opt) \
+    ((opt) == ' ' || (opt) == '<' || (opt) == '>' || (opt) == '(' || (opt) == ')' || (opt) == '!')
+
+/* the most elements a group with a fixed repeat count is unrolled into; a larger one
+   is repeated as a loop instead */
+#define MAXUNROLL   4096
+
+static wst_field *addfield(compiler *c) {
+    if (c->nfields == c->cap) {
+        uint32_t cap = c->cap ? c->cap * 2 : 16;
+        wst_field *fields;
+        if (cap > WST_MAXFIELDS) {
+            snprintf(c->err, c->errlen, "format too large");
+            return NULL;
+        }
+        fields = (wst_field*)realloc(c->fields, cap * sizeof(wst_field));
+        if (!fields) {
+            snprintf(c->err, c->errlen, "out of memory");
+            return NULL;
+        }
+        c->fields = fields;
+        c->cap = cap;
+    }
+    memset(&c->fields[c->nfields], 0, sizeof(wst_field));
+    return &c->fields[c->nfields++];
+}
+
+/* Adds 'count' elements of option 'opt' (0 and 'prev' for a '*' count) */
+static int compileelement(compiler *c, char opt, size_t size, uint32_t count, int prev) {
+    uint32_t falign = elemalign(opt, size, c->align);
+    uint32_t bound = 0;
+    uint32_t n = 1;
+    uint32_t i;
+    int vals, results;
+
+    if (count == 0 && !prev)
+        return 0;  /* like Struct.unpack, not even aligned */
+    while (c->maxalign < falign)
+        c->maxalign <<= 1;
+
+    if (opt == 'X') {  /* 'X' is about alignment, not size */
+        bound = (uint32_t)size;  /* but Struct.unpack checks that much data is present */
+        size = 0;
+    }
+    if (opt == 's' || opt == 'w') {
+        bound = (uint32_t)size;
+        size = 0;
+    }
+    switch (opt) {
+        case 'x': case 'X': case '=':
+            vals = 0;
+            break;
+        case 's': case 'c': case 'w': case 'W':
+            vals = !c->noassign;
+            break;
+        default:
+            vals = size && !c->noassign;
+            break;
+    }
+
+    if (prev || (size == 0 && (opt == 's' || opt == 'w' || opt == 'c' || opt == 'W')))
+        c->fixed = 0;
+    else if (c->fixed && count > 1 && falign > 1 && size % falign != 0)
+        n = count;  /* padding between the elements: one field each */
+    results = c->fixed && (vals || opt == '=');  /* Struct.unpack also returns '=' positions */
+
+    for (i = 0; i < n; i++) {
+        wst_field *f = addfield(c);
+        if (!f)
+            return -1;
+        f->opt = opt;
+        f->endian = (uint8_t)c->endian;
+        f->flags = (c->noassign ? WST_NOASSIGN : 0) | (prev ? WST_PREVCOUNT : 0);
+        f->align = falign;
+        f->size = (uint32_t)size;
+        f->bound = bound;
+        f->count = n > 1 ? 1 : count;
+        f->value = c->nresults + (results ? i : 0);
+        if (c->fixed) {
+            c->pos += toalign(c->pos, falign);
+            f->offset = (uint32_t)c->pos;
+            if (size && f->count > (UINT32_MAX - c->pos) / size) {
+                snprintf(c->err, c->errlen, "record too large");
+                return -1;
+            }
+            if (c->pos + size * f->count + bound > c->extent)
+                c->extent = (uint32_t)(c->pos + size * f->count + bound);
+            c->pos += size * f->count;
+        }
+    }
+
+    if (vals && prev)
+        c->variable = 1;
+    if ((vals && count > UINT32_MAX - c->nvalues) || (results && count > UINT32_MAX - c->nresults)) {
+        snprintf(c->err, c->errlen, "format too large");
+        return -1;
+    }
+    c->nvalues += vals * count;
+    c->nresults += results * count;
+    return 0;
+}
+
+static int compilerange(compiler *c, const char *p, const char *end);
+
+/* Adds a '[' element repeating the group between 'p' and 'end' 'count' times, or as many
+ * times as the previous value if 'prev', and its ']' */
+static int compileloop(compiler *c, const char *p, const char *end, uint32_t count, int prev) {
+    uint32_t open = c->nfields, nvalues;
+    wst_field *f = addfield(c);
+    if (!f)
+        return -1;
+    /* executed as a loop: '[' holds the index of its ']' in bound */
+    f->opt = '[';
+    f->flags = prev ? WST_PREVCOUNT : 0;
+    f->count = count;
+    c->fixed = 0;
+    if (prev)
+        c->variable = 1;
+    nvalues = c->nvalues;
+    if (compilerange(c, p, end) < 0)
+        return -1;
+    f = addfield(c);
+    if (!f)
+        return -1;
+    f->opt = ']';
+    c->fields[open].bound = c->nfields - 1;
+    if (!prev && count > 1) {
+        /* the group's values were counted once */
+        uint32_t vals = c->nvalues - nvalues;
+        if (vals && count - 1 > (UINT32_MAX - c->nvalues) / vals) {
+            snprintf(c->err, c->errlen, "format too large");
+            return -1;
+        }
+        c->nvalues += vals * (count - 1);
+    }
+    return 0;
+}
+
+/* Adds the group between 'p' and 'end' repeated 'count' times: unrolled, so that the
+ * offsets stay precomputed, unless that takes more than MAXUNROLL elements */
+static int compilegroup(compiler *c, const char *p, const char *end, uint32_t count) {
+    compiler start = *c;
+    uint32_t first = c->nfields, i;
+
+    if (count == 0)
+        return 0;
+    if (compilerange(c, p, end) < 0)
+        return -1;
+    if (c->nfields == first)
+        return 0;  /* the other repetitions add nothing either */
+    if ((uint64_t)(c->nfields - first) * count <= MAXUNROLL) {
+        for (i = 1; i < count; i++)
+            if (compilerange(c, p, end) < 0)
+                return -1;
+        return 0;
+    }
+    /* control options in the group apply to the repetitions that follow, so a group that
+       changes them is compiled once as it is repeated first, and as a loop for the rest */
+    if (c->endian == start.endian && c->align == start.align && c->noassign == start.noassign) {
+        start.fields = c->fields;
+        start.cap = c->cap;
+        *c = start;
+        return compileloop(c, p, end, count, 0);
+    }
+    return count > 1 ? compileloop(c, p, end, count - 1, 0) : 0;
+}
+
+/* Compiles the format between 'p' and 'end'; returns -1 on error */
+static int compilerange(compiler *c, const char *p, const char *end) {
+    while (p < end) {
+        uint32_t count = 1;
+        int prev = 0, prefix = 1;
+        char opt;
+        size_t size = 0;
+
+        if (*p == '*') {
+            prev = 1;
+            count = 0;
+            p++;
+        } else if (*p >= '0' && *p <= '9') {
+            count = 0;
+            do {
+                if (count > (INT_MAX - 9) / 10) {
+                    snprintf(c->err, c->errlen, "repeat count too large");
+                    return -1;
+                }
+                count = count*10 + *p++ - '0';
+            } while (*p >= '0' && *p <= '9');
+        } else {
+            prefix = 0;
+        }
+        if (prefix) {
+            if (p == end) {
+                snprintf(c->err, c->errlen, "missing option after repeat count");
+                return -1;
+            }
+            if (iscontrolopt(*p)) {
+                snprintf(c->err, c->errlen, "control option '%c' cannot be repeated", *p);
+                return -1;
+            }
+        }
+        opt = *p++;
+
+        if (opt == '[') {
+            const char *gend = p;
+            int level = 1;
+            for (; gend < end; gend++) {
+                if (*gend == '[') {
+                    if (++level > WST_MAXGROUPDEPTH) {
+                        snprintf(c->err, c->errlen, "groups nested too deeply");
+                        return -1;
+                    }
+                } else if (*gend == ']' && --level == 0) {
+                    break;
+                }
+            }
+            if (gend == end) {
+                snprintf(c->err, c->errlen, "missing ']' in format");
+                return -1;
+            }
+            if ((prev ? compileloop(c, p, gend, 0, 1) : compilegroup(c, p, gend, count)) < 0)
+                return -1;
+            p = gend + 1;
+            continue;
+        }
+
+        switch (wst_optsize(opt, &p, &size)) {
+            case WST_OK:
+                break;
+            case WST_EINTSIZE:
+                snprintf(c->err, c->errlen, "integral size %d is larger than limit of %d",
+                         (int)size, WST_MAXINTSIZE);
+                return -1;
+            default:
+                snprintf(c->err, c->errlen, "invalid format option [%c]", opt);
+                return -1;
+        }
+
+        switch (opt) {
+            case ' ': continue;  /* ignore white spaces */
+            case '>': c->endian = WST_BIG; continue;
+            case '<': c->endian = WST_LITTLE; continue;
+            case '(': c->noassign = 1; continue;
+            case ')': c->noassign = 0; continue;
+            case '!': {
+                int a = getnum(&p, MAXALIGN);
+                if (!isp2(a)) {
+                    snprintf(c->err, c->errlen, "alignment %d is not a power of 2", a);
+                    return -1;
+                }
+                c->align = a;
+                continue;
+            }
+            default:
+                break;
+        }
+
+        if (compileelement(c, opt, size, count, prev) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+wst_layout *wst_layout_compile(const char *fmt, char *err, size_t errlen) {
+    size_t fmtlen = strlen(fmt);
+    compiler c;
+    wst_layout *l;
+    size_t bytes;
+
+    memset(&c, 0, sizeof(c));
+    c.endian = native.endian;
+    c.align = 1;
+    c.fixed = 1;
+    c.maxalign = 1;
+    c.err = err;
+    c.errlen = errlen;
+
+    if (compilerange(&c, fmt, fmt + fmtlen) < 0) {
+        free(c.fields);
+        return NULL;
+    }
+
+    bytes = sizeof(wst_layout) + c.nfields * sizeof(wst_field) + fmtlen + 1;
+    l = (wst_layout*)calloc(1, bytes);
+    if (!l) {
+        free(c.fields);
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    l->refs = 1;
+    l->nfields = c.nfields;
+    if (c.nfields)
+        memcpy(l->fields, c.fields, c.nfields * sizeof(wst_field));
+    free(c.fields);
+    l->nvalues = c.nvalues;
+    l->nresults = c.nresults;
+    l->variable = c.variable;
+    l->align = c.maxalign;
+    l->fixed = c.fixed;
+    if (l->fixed) {
+        l->size = (uint32_t)c.pos;
+        l->extent = c.extent < l->size ? l->size : c.extent;
+    }
+    l->format = (uint32_t)(sizeof(wst_layout) + c.nfields * sizeof(wst_field));
+    memcpy((char*)l + l->format, fmt, fmtlen + 1);
+    l->bytes = (uint32_t)bytes;
+    return l;
+}
+
+/* FNV-1a */
+static uint32_t namehash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    while (len-- > 0)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+#define nameoffsets(l)  ((const uint32_t*)((const char*)(l) + (l)->names))
+#define nameslots(l)    (nameoffsets(l) + (l)->nnames)
+
+wst_layout *wst_layout_name(const wst_layout *l, const char *const *names, size_t n,
+                            char *err, size_t errlen) {
+    size_t base = l->format + strlen(wst_layout_format(l)) + 1;
+    size_t bytes, strings = 0, i;
+    uint32_t nslots = 2, *offsets, *slots;
+    char *p;
+    wst_layout *nl;
+
+    if (n > (l->fixed ? l->nresults : l->nvalues)) {
+        snprintf(err, errlen, "more names than values");
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+        if (names[i])
+            strings += strlen(names[i]) + 1;
+    while (nslots < n * 2)  /* load factor at most 1/2 */
+        nslots <<= 1;
+
+    base = (base + 3) & ~(size_t)3;
+    bytes = base + (n + nslots) * sizeof(uint32_t) + strings;
+    nl = (wst_layout*)calloc(1, bytes);
+    if (!nl) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    memcpy(nl, l, l->format + strlen(wst_layout_format(l)) + 1);
+    nl->refs = 1;
+    nl->flags = 0;
+    nl->bytes = (uint32_t)bytes;
+    nl->names = (uint32_t)base;
+    nl->nnames = (uint32_t)n;
+    nl->nslots = nslots;
+    offsets = (uint32_t*)((char*)nl + base);
+    slots = offsets + n;
+    p = (char*)(slots + nslots);
+    for (i = 0; i < n; i++) {
+        size_t len;
+        uint32_t h;
+        if (!names[i] || !*names[i])
+            continue;
+        len = strlen(names[i]);
+        if (wst_layout_lookup(nl, names[i], len) >= 0) {
+            snprintf(err, errlen, "duplicate name '%.32s'", names[i]);
+            free(nl);
+            return NULL;
+        }
+        offsets[i] = (uint32_t)(p - (char*)nl);
+        memcpy(p, names[i], len + 1);
+        p += len + 1;
+        for (h = namehash(names[i], len) & (nslots - 1); slots[h]; h = (h + 1) & (nslots - 1)) ;
+        slots[h] = (uint32_t)i + 1;
+    }
+    return nl;
+}
+
+int64_t wst_layout_lookup(const wst_layout *l, const char *name, size_t len) {
+    const uint32_t *slots;
+    uint32_t h;
+    if (!l->names)
+        return -1;
+    slots = nameslots(l);
+    for (h = namehash(name, len) & (l->nslots - 1); slots[h]; h = (h + 1) & (l->nslots - 1)) {
+        const char *s = (const char*)l + nameoffsets(l)[slots[h] - 1];
+        if (strncmp(s, name, len) == 0 && s[len] == '\0')
+            return slots[h] - 1;
+    }
+    return -1;
+}
+
+const char *wst_layout_valuename(const wst_layout *l, uint32_t i) {
+    if (i >= l->nnames || nameoffsets(l)[i] == 0)
+        return NULL;
+    return (const char*)l + nameoffsets(l)[i];
+}
+
+const wst_field *wst_layout_value(const wst_layout *l, uint32_t i, uint32_t *offset) {
+    uint32_t lo = 0, hi = l->nfields;
+    const wst_field *f;
+    if (!l->fixed || i >= l->nresults)
+        return NULL;
+    /* the last element whose first value is at most i: elements without
+       values share their index with the next element that has some */
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (l->fields[mid].value <= i)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    f = &l->fields[lo];
+    *offset = f->offset + (i - f->value) * f->size;
+    return f;
+}
+
+wst_layout *wst_layout_ref(wst_layout *l) {
+    if (!(l->flags & WST_LSTATIC))
+        wst_atomic_inc(&l->refs);
+    return l;
+}
+
+void wst_layout_unref(wst_layout *l) {
+    if (l && !(l->flags & WST_LSTATIC) && wst_atomic_dec(&l->refs) == 0)
+        free(l);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,123 @@
+/*
+ * wst_layout.h
+ *
+ * Compiled Struct format strings ("layouts").
+ *
+ * A layout is a Struct format string parsed once into a flat array of
+ * elements, each with its option letter, size, endianness and alignment
+ * already resolved, so decoding does not have to re-parse the format.
+ * This part has no Lua dependency.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_LAYOUT_H
+#define _WST_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* endianness of an element, same values as the Struct interpreter uses */
+#define WST_BIG     0
+#define WST_LITTLE  1
+
+/* maximum size (in bytes) for integral types */
+#define WST_MAXINTSIZE  32
+
+/* maximum nesting of '[' ']' groups */
+#define WST_MAXGROUPDEPTH   32
+
+/* maximum number of elements of a layout, after unrolling groups */
+#define WST_MAXFIELDS   (1u << 20)
+
+/* return codes of wst_optsize() */
+#define WST_OK          0
+#define WST_EOPTION     1   /* invalid format option */
+#define WST_EINTSIZE    2   /* integral size larger than WST_MAXINTSIZE */
+
+/* wst_field.flags */
+#define WST_NOASSIGN    0x01    /* inside '(' ')': consumed, but no value is returned */
+#define WST_PREVCOUNT   0x02    /* '*': the repeat count is the previous value */
+
+/* One element of a compiled format string. Control options (endianness,
+ * alignment, '(' and ')') have been folded into the elements they apply to.
+ * Groups with a fixed repeat count are unrolled, up to a limit; a larger one,
+ * or a group repeated by '*', becomes a '[' element and a ']' element around
+ * the group's elements. */
+typedef struct _wst_field {
+    char     opt;       /* the format option letter */
+    uint8_t  endian;    /* WST_BIG or WST_LITTLE */
+    uint8_t  flags;     /* WST_NOASSIGN, WST_PREVCOUNT */
+    uint8_t  reserved;
+    uint32_t align;     /* alignment applied before the element, 0 for none */
+    uint32_t size;      /* size in bytes, 0 if only known while decoding ('s', 'w', 'c0', 'W0') */
+    uint32_t bound;     /* maximum length of 's'/'w' (0 for unbounded), the checked length of 'X',
+                           the index of the matching ']' for '[' */
+    uint32_t offset;    /* offset from the start of the record (only if the layout is fixed) */
+    uint32_t count;     /* repeat count; consecutive elements 'size' bytes apart (0 if WST_PREVCOUNT) */
+    uint32_t value;     /* index of the element's first value among the values Struct.unpack
+                           returns, '=' positions included (only if the layout is fixed) */
+} wst_field;
+
+/* wst_layout.flags */
+#define WST_LSTATIC     0x01    /* not reference counted, nor freed: the layout lives in memory
+                                   that lasts for the process, such as a mapped layout store */
+
+/* the version of the compiled representation below; change it whenever the representation,
+   or what the compiler produces for a format, changes, so stored layouts are not reused */
+#define WST_LAYOUT_VERSION  2
+
+typedef struct _wst_layout {
+    int32_t   refs;         /* reference count, updated atomically: a layout is immutable once
+                               compiled, so threads can share it */
+    uint32_t  nfields;      /* number of elements in fields[] */
+    uint32_t  nvalues;      /* number of values, as counted by Struct.values() */
+    uint32_t  size;         /* total size in bytes (only if fixed) */
+    uint32_t  extent;       /* bytes that must be present for the record (only if fixed);
+                               a trailing 'X' can make this larger than size */
+    uint32_t  align;        /* power of 2 the start position must be a multiple of
+                               for the precomputed offsets to be valid */
+    uint32_t  fixed;        /* TRUE if every element has a size known in advance */
+    uint32_t  variable;     /* TRUE if nvalues depends on the data ('*' repeat counts) */
+    uint32_t  nresults;     /* number of values Struct.unpack returns, '=' positions included
+                               (only if fixed) */
+    uint32_t  format;       /* offset of the NUL-terminated format string from the start of the layout */
+    uint32_t  names;        /* offset of the names, 0 if there are none: nnames uint32_t offsets of
+                               the NUL-terminated names of values 0..nnames-1 (0 for an unnamed
+                               value), then a hash of nslots uint32_t value indexes + 1 (0 = empty) */
+    uint32_t  nnames;
+    uint32_t  nslots;       /* a power of 2 */
+    uint32_t  bytes;        /* size of the whole layout, format and names included */
+    uint32_t  flags;        /* WST_LSTATIC */
+    wst_field fields[1];
+} wst_layout;
+
+/* the format string a layout was compiled from */
+#define wst_layout_format(l)    ((const char*)(l) + (l)->format)
+
+/* Gets the size of format option 'opt', whose optional number follows at
+ * '*fmt' (and is consumed). For 's'/'w' the size is the maximum length. */
+extern int wst_optsize(char opt, const char **fmt, size_t *size);
+
+/* Compiles a format string. Returns NULL and a message in 'err' on error. */
+extern wst_layout *wst_layout_compile(const char *fmt, char *err, size_t errlen);
+
+/* Returns a copy of 'l' whose values 0..n-1 are named names[0..n-1] (NULL or "" for
+ * none). Returns NULL and a message in 'err' on error. */
+extern wst_layout *wst_layout_name(const wst_layout *l, const char *const *names, size_t n,
+                                   char *err, size_t errlen);
+
+/* Returns the index of the value named 'name' (of 'len' bytes), or -1 */
+extern int64_t wst_layout_lookup(const wst_layout *l, const char *name, size_t len);
+
+/* Returns the name of value 'i', or NULL if it has none */
+extern const char *wst_layout_valuename(const wst_layout *l, uint32_t i);
+
+/* Returns the element holding value 'i' of a fixed layout, and the value's offset
+ * from the start of the record in *offset; NULL if there is no such value */
+extern const wst_field *wst_layout_value(const wst_layout *l, uint32_t i, uint32_t *offset);
+
+extern wst_layout *wst_layout_ref(wst_layout *l);
+extern void wst_layout_unref(wst_layout *l);
+
+#endif
@@ -0,0 +1,435 @@
+/*
+ * wst_pool.c
+ *
+ * Worker pool of Lua states, see wst_pool.h.
+ *
+ * Every record gets a sequence number and the slot 'seq & mask' of the pool,
+ * which holds a copy of the record and, once handled, its result. Each
+ * worker has a queue of sequence numbers, which the submitting thread alone
+ * fills, at 'tail', and that any worker empties, by advancing 'head' with a
+ * compare-and-swap. Record seq goes to queue 'seq % nworkers', and an entry
+ * is queued only while its record is outstanding; as no more than 'window'
+ * records are, a queue never holds more than window / nworkers of them,
+ * rounded up, whatever the stealing. The queues are rings of that many
+ * entries, so neither they nor the slots can overflow. A worker publishes a
+ * result by storing seq + 1 in the slot's 'done'.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "wst_atomic.h"
+#include "wst_pool.h"
+
+extern int luaopen_wiresharktypes(lua_State *L);
+
+/* the most records outstanding at once */
+#define POOL_MAXWINDOW  (1u << 24)
+
+/* rounds of busy waiting, then of yielding, before a waiting thread sleeps POOL_NAPUS
+   microseconds at a time */
+#define POOL_SPINS      256
+#define POOL_NAPUS      50
+
+typedef struct {
+    uint8_t *data;          /* a copy of the record */
+    size_t len, cap;
+    uint8_t *result;        /* the handler's result, if any */
+    size_t rcap;
+    const uint8_t *out;     /* the result given back: 'result' or a static message */
+    size_t outlen;
+    int status;             /* WST_POOL_* */
+    uint64_t done;          /* seq + 1 once the result of record seq is ready */
+} pool_slot;
+
+typedef struct {
+    uint64_t head;          /* the next entry to take, advanced by any worker */
+    char pad1[56];          /* head and tail are written by different threads */
+    uint64_t tail;          /* the next entry to fill, advanced by the submitting thread */
+    uint64_t max_depth;
+    uint64_t *ring;         /* sequence numbers of the records queued */
+    char pad2[40];
+} pool_queue;
+
+typedef struct {
+    pool_queue q;
+    struct _wst_pool *pool;
+    unsigned index;
+    lua_State *L;           /* used by the worker's thread alone once started */
+    int started;
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    /* statistics, written by the worker alone */
+    uint64_t records, bytes, errors, stolen, busy_ns;
+    char pad[64];
+} pool_worker;
+
+struct _wst_pool {
+    unsigned nworkers;
+    uint64_t mask;          /* window - 1 */
+    uint64_t qmask;         /* entries of a queue - 1 */
+    pool_slot *slots;       /* window slots */
+    uint64_t submitted;     /* records submitted, and collected, by the submitting thread */
+    uint64_t collected;
+    uint64_t stop;          /* set when the workers are to return once the queues are empty */
+    pool_worker workers[1];
+};
+
+static uint64_t pool_now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, c;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&c);
+    return (uint64_t)(c.QuadPart / freq.QuadPart) * 1000000000u
+         + (uint64_t)(c.QuadPart % freq.QuadPart) * 1000000000u / (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Waits a little longer each time it is called in a row */
+static void pool_backoff(unsigned *spins) {
+    unsigned n = (*spins)++;
+    if (n < POOL_SPINS)
+        return;
+#ifdef _WIN32
+    Sleep(n < 2 * POOL_SPINS ? 0 : 1);
+#else
+    if (n < 2 * POOL_SPINS) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, POOL_NAPUS * 1000 };
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+/* Makes *buf hold at least n bytes */
+static int pool_reserve(uint8_t **buf, size_t *cap, size_t n) {
+    uint8_t *nbuf;
+    size_t ncap;
+    if (n <= *cap && *buf != NULL)
+        return 1;
+    ncap = n > *cap * 2 ? n : *cap * 2;
+    nbuf = (uint8_t *)realloc(*buf, ncap ? ncap : 1);
+    if (nbuf == NULL)
+        return 0;
+    *buf = nbuf;
+    *cap = ncap;
+    return 1;
+}
+
+/* Takes the oldest record of a queue */
+static int pool_take(pool_queue *q, uint64_t mask, uint64_t *seq) {
+    for (;;) {
+        uint64_t h = wst_atomic_load64(&q->head);
+        if (h == wst_atomic_load64(&q->tail))
+            return 0;
+        /* the entry may be refilled once h is taken, so it is read before taking it */
+        *seq = wst_atomic_load64(&q->ring[h & mask]);
+        if (wst_atomic_cas64(&q->head, h, h + 1))
+            return 1;
+    }
+}
+
+/* Runs the handler on record seq and publishes its result */
+static void pool_handle(pool_worker *w, uint64_t seq) {
+    wst_pool *p = w->pool;
+    pool_slot *s = &p->slots[seq & p->mask];
+    lua_State *L = w->L;
+    uint64_t start = pool_now_ns();
+    const char *r;
+    size_t rlen = 0;
+
+    s->status = WST_POOL_OK;
+    lua_settop(L, 1);
+    lua_pushvalue(L, 1);
+    lua_pushlstring(L, (const char *)s->data, s->len);
+    lua_pushnumber(L, (lua_Number)(seq + 1));
+    if (lua_pcall(L, 2, 1, 0) != 0) {
+        s->status = WST_POOL_ERROR;
+        if (!lua_isstring(L, -1))
+            lua_pushliteral(L, "error object is not a string");
+    } else if (!lua_isnil(L, -1) && !lua_isstring(L, -1)) {
+        s->status = WST_POOL_ERROR;
+        lua_pushfstring(L, "the handler returned a %s, not a string", luaL_typename(L, -1));
+    }
+    r = lua_tolstring(L, -1, &rlen);
+    if (r == NULL) {
+        s->out = (const uint8_t *)"";
+        s->outlen = 0;
+    } else if (pool_reserve(&s->result, &s->rcap, rlen)) {
+        memcpy(s->result, r, rlen);
+        s->out = s->result;
+        s->outlen = rlen;
+    } else {
+        static const char nomem[] = "not enough memory for the result";
+        s->status = WST_POOL_ERROR;
+        s->out = (const uint8_t *)nomem;
+        s->outlen = sizeof(nomem) - 1;
+    }
+    lua_settop(L, 1);
+
+    wst_atomic_store64(&w->records, w->records + 1);
+    wst_atomic_store64(&w->bytes, w->bytes + s->len);
+    if (s->status != WST_POOL_OK)
+        wst_atomic_store64(&w->errors, w->errors + 1);
+    wst_atomic_store64(&w->busy_ns, w->busy_ns + (pool_now_ns() - start));
+    wst_atomic_store64(&s->done, seq + 1);
+}
+
+static void pool_run(pool_worker *w) {
+    wst_pool *p = w->pool;
+    unsigned spins = 0;
+    for (;;) {
+        /* stop is read first, so records submitted before it was set are found below */
+        int stopping = wst_atomic_load64(&p->stop) != 0;
+        uint64_t seq;
+        unsigned i;
+        if (pool_take(&w->q, p->qmask, &seq)) {
+            pool_handle(w, seq);
+            spins = 0;
+            continue;
+        }
+        /* steal from the other queues, starting with the next worker's */
+        for (i = 1; i < p->nworkers; i++) {
+            if (pool_take(&p->workers[(w->index + i) % p->nworkers].q, p->qmask, &seq))
+                break;
+        }
+        if (i < p->nworkers) {
+            wst_atomic_store64(&w->stolen, w->stolen + 1);
+            pool_handle(w, seq);
+            spins = 0;
+            continue;
+        }
+        if (stopping)
+            return;
+        pool_backoff(&spins);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_thread(LPVOID arg) {
+    pool_run((pool_worker *)arg);
+    return 0;
+}
+#else
+static void *pool_thread(void *arg) {
+    pool_run((pool_worker *)arg);
+    return NULL;
+}
+#endif
+
+/* Creates the state of worker 'index', with the handler left at stack index 1 */
+static lua_State *pool_state(const char *script, unsigned index, char *err, size_t errlen) {
+    lua_State *L = luaL_newstate();
+    if (L == NULL) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    luaL_openlibs(L);
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+    lua_pushcfunction(L, luaopen_wiresharktypes);
+    lua_setfield(L, -2, "wiresharktypes");
+    lua_pop(L, 2);
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, "wiresharktypes");
+    if (lua_pcall(L, 1, 0, 0) != 0 || luaL_loadfile(L, script) != 0)
+        goto fail;
+    lua_pushnumber(L, (lua_Number)index);
+    if (lua_pcall(L, 1, 1, 0) != 0)
+        goto fail;
+    if (!lua_isfunction(L, -1)) {
+        lua_pushfstring(L, "%s did not return a handler function", script);
+        goto fail;
+    }
+    lua_settop(L, 1);
+    return L;
+
+fail:
+    snprintf(err, errlen, "%s", lua_isstring(L, -1) ? lua_tostring(L, -1) : "error object is not a string");
+    lua_close(L);
+    return NULL;
+}
+
+/* Stops the workers started and frees the pool */
+static void pool_destroy(wst_pool *p) {
+    unsigned i;
+    uint64_t k;
+
+    wst_atomic_store64(&p->stop, 1);
+    for (i = 0; i < p->nworkers; i++) {
+        pool_worker *w = &p->workers[i];
+        if (w->started) {
+#ifdef _WIN32
+            WaitForSingleObject(w->thread, INFINITE);
+            CloseHandle(w->thread);
+#else
+            pthread_join(w->thread, NULL);
+#endif
+        }
+        if (w->L)
+            lua_close(w->L);
+        free(w->q.ring);
+    }
+    if (p->slots) {
+        for (k = 0; k <= p->mask; k++) {
+            free(p->slots[k].data);
+            free(p->slots[k].result);
+        }
+        free(p->slots);
+    }
+    free(p);
+}
+
+wst_pool *wst_pool_new(const char *script, unsigned nworkers, unsigned window,
+                       char *err, size_t errlen) {
+    wst_pool *p;
+    uint64_t size = 1, qsize = 1;
+    unsigned i;
+
+    if (nworkers == 0 || nworkers > WST_POOL_MAXWORKERS) {
+        snprintf(err, errlen, "the number of workers must be between 1 and %d", WST_POOL_MAXWORKERS);
+        return NULL;
+    }
+    if (window == 0 || window > POOL_MAXWINDOW) {
+        snprintf(err, errlen, "the window must be between 1 and %u records", POOL_MAXWINDOW);
+        return NULL;
+    }
+    while (size < window)
+        size *= 2;
+    while (qsize < (size + nworkers - 1) / nworkers)
+        qsize *= 2;
+
+    p = (wst_pool *)calloc(1, sizeof(wst_pool) + (nworkers - 1) * sizeof(pool_worker));
+    if (p == NULL) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    p->nworkers = nworkers;
+    p->mask = size - 1;
+    p->qmask = qsize - 1;
+    p->slots = (pool_slot *)calloc((size_t)size, sizeof(pool_slot));
+    if (p->slots == NULL) {
+        p->mask = 0;
+        pool_destroy(p);
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+
+    /* the states are made here, one after the other, so script errors are reported */
+    for (i = 0; i < nworkers; i++) {
+        pool_worker *w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+        w->q.ring = (uint64_t *)calloc((size_t)qsize, sizeof(uint64_t));
+        if (w->q.ring == NULL) {
+            pool_destroy(p);
+            snprintf(err, errlen, "out of memory");
+            return NULL;
+        }
+        w->L = pool_state(script, i + 1, err, errlen);
+        if (w->L == NULL) {
+            pool_destroy(p);
+            return NULL;
+        }
+    }
+    for (i = 0; i < nworkers; i++) {
+        pool_worker *w = &p->workers[i];
+#ifdef _WIN32
+        w->thread = CreateThread(NULL, 0, pool_thread, w, 0, NULL);
+        w->started = w->thread != NULL;
+#else
+        w->started = pthread_create(&w->thread, NULL, pool_thread, w) == 0;
+#endif
+        if (!w->started) {
+            pool_destroy(p);
+            snprintf(err, errlen, "cannot start worker %u", i + 1);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+int wst_pool_submit(wst_pool *p, const void *data, size_t len) {
+    uint64_t seq = p->submitted;
+    pool_slot *s = &p->slots[seq & p->mask];
+    pool_queue *q = &p->workers[seq % p->nworkers].q;
+    uint64_t tail, depth;
+
+    if (seq - p->collected > p->mask)
+        return 0;
+    if (!pool_reserve(&s->data, &s->cap, len))
+        return -1;
+    memcpy(s->data, data, len);
+    s->len = len;
+
+    tail = q->tail;
+    wst_atomic_store64(&q->ring[tail & p->qmask], seq);
+    wst_atomic_store64(&q->tail, tail + 1);
+    depth = tail + 1 - wst_atomic_load64(&q->head);
+    if (depth > q->max_depth)
+        wst_atomic_store64(&q->max_depth, depth);
+    p->submitted = seq + 1;
+    return 1;
+}
+
+int wst_pool_result(wst_pool *p, const void **data, size_t *len, int *status) {
+    uint64_t seq = p->collected;
+    pool_slot *s = &p->slots[seq & p->mask];
+    unsigned spins = 0;
+
+    if (seq == p->submitted)
+        return 0;
+    while (wst_atomic_load64(&s->done) != seq + 1)
+        pool_backoff(&spins);
+    *data = s->out;
+    *len = s->outlen;
+    *status = s->status;
+    p->collected = seq + 1;
+    return 1;
+}
+
+unsigned wst_pool_workers(const wst_pool *p) {
+    return p->nworkers;
+}
+
+void wst_pool_getstats(const wst_pool *p, unsigned i, wst_pool_stats *stats) {
+    const pool_worker *w = &p->workers[i];
+    uint64_t head = wst_atomic_load64(&w->q.head);
+
+    stats->records = wst_atomic_load64(&w->records);
+    stats->bytes = wst_atomic_load64(&w->bytes);
+    stats->errors = wst_atomic_load64(&w->errors);
+    stats->stolen = wst_atomic_load64(&w->stolen);
+    stats->busy_ns = wst_atomic_load64(&w->busy_ns);
+    stats->depth = (uint32_t)(wst_atomic_load64(&w->q.tail) - head);
+    stats->max_depth = (uint32_t)wst_atomic_load64(&w->q.max_depth);
+}
+
+void wst_pool_free(wst_pool *p) {
+    if (p)
+        pool_destroy(p);
+}
@@ -0,0 +1,78 @@
+/*
+ * wst_pool.h
+ *
+ * A pool of worker threads, each owning a Lua state with the library loaded,
+ * that runs a Lua handler on every record submitted to it and gives back the
+ * results in the order the records were submitted.
+ *
+ * Records are queued to the workers in turn through lock-free queues; a
+ * worker whose queue is empty takes records from the others' queues, so a
+ * slow record does not hold up the records queued behind it. The states
+ * share compiled layouts through the registry (see wst_registry.h), so a
+ * format is compiled once for the whole pool.
+ *
+ * The submitting thread alone calls wst_pool_submit() and wst_pool_result();
+ * wst_pool_getstats() can be called from any thread.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_POOL_H
+#define _WST_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wst_abi.h"
+
+/* the most workers of a pool */
+#define WST_POOL_MAXWORKERS     256
+
+/* status of a result */
+#define WST_POOL_OK     0
+#define WST_POOL_ERROR  1   /* the handler raised an error; the result is its message */
+
+typedef struct _wst_pool wst_pool;
+
+/* Statistics of a worker, counted since the pool started */
+typedef struct _wst_pool_stats {
+    uint64_t records;       /* records handled */
+    uint64_t bytes;         /* bytes of the records handled */
+    uint64_t errors;        /* records whose handler raised an error */
+    uint64_t stolen;        /* records taken from other workers' queues */
+    uint64_t busy_ns;       /* time spent running the handler, in nanoseconds */
+    uint32_t depth;         /* records waiting in the worker's queue */
+    uint32_t max_depth;     /* the most records that waited in it at once */
+} wst_pool_stats;
+
+/* Starts 'nworkers' workers. Each runs the Lua chunk in the file 'script' once, with
+ * the worker's number (1..nworkers) as argument, in its own state; the chunk returns
+ * the handler, a function called with each record, as a string, and its number
+ * (1, 2...). The handler returns the result, a string, or nil for an empty one.
+ * At most 'window' records (rounded up to a power of 2) are submitted and not yet
+ * collected at any time. Returns NULL and a message in 'err' on error. */
+WST_API wst_pool *wst_pool_new(const char *script, unsigned nworkers, unsigned window,
+                               char *err, size_t errlen);
+
+/* Submits a copy of the record data[0..len). Returns 1, 0 if 'window' records are
+ * waiting to be collected (collect one with wst_pool_result() first), or -1 if
+ * there is not enough memory. */
+WST_API int wst_pool_submit(wst_pool *p, const void *data, size_t len);
+
+/* Waits for the result of the oldest record not yet collected. Returns 1 and the
+ * result in *data and *len, valid until the next call to wst_pool_submit() or
+ * wst_pool_result(), and its status (WST_POOL_*) in *status; or 0 if there is no
+ * record to collect. */
+WST_API int wst_pool_result(wst_pool *p, const void **data, size_t *len, int *status);
+
+/* Returns the number of workers of the pool */
+WST_API unsigned wst_pool_workers(const wst_pool *p);
+
+/* Gets the statistics of worker 'i' (0..workers-1) */
+WST_API void wst_pool_getstats(const wst_pool *p, unsigned i, wst_pool_stats *stats);
+
+/* Stops the workers, once they have handled the records already submitted, and frees
+ * the pool and its states. Results not collected are dropped. */
+WST_API void wst_pool_free(wst_pool *p);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * wst_pool_main.c
+ *
+ * wstpool: runs a Lua handler on every record of a file, on a pool of
+ * worker states (see wst_pool.h), and writes the results in input order.
+ *
+ *   wstpool [-n workers] [-w window] [-r size] [-s] script.lua [input]
+ *
+ * Records are the lines of the input (without their end of line), or blocks
+ * of 'size' bytes with -r. The input is read from stdin if no file is given.
+ * The handler's results are written to stdout as they are, in the order of
+ * the records; errors are reported on stderr, with the record's number. -s
+ * prints the statistics of each worker to stderr at the end.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "wst_pool.h"
+
+#define READ_CHUNK  65536
+
+static const char usage[] =
+    "usage: wstpool [-n workers] [-w window] [-r size] [-s] script.lua [input]\n"
+    "  -n workers  number of worker states (default 4)\n"
+    "  -w window   records submitted before their results are written (default 1024)\n"
+    "  -r size     records are blocks of 'size' bytes (default: lines)\n"
+    "  -s          print the statistics of each worker to stderr\n";
+
+/* Reads the input in chunks and cuts it into records */
+typedef struct {
+    FILE *f;
+    size_t recsize;         /* 0 for lines */
+    char *buf;
+    size_t cap, start, end;
+    int eof;
+} reader;
+
+/* Returns the next record in *rec and *len, valid until the next call; 0 at the end */
+static int read_record(reader *r, const char **rec, size_t *len) {
+    for (;;) {
+        size_t avail = r->end - r->start;
+        const char *p = r->buf + r->start;
+        if (r->recsize) {
+            if (avail >= r->recsize || (r->eof && avail > 0)) {
+                *len = avail >= r->recsize ? r->recsize : avail;
+                *rec = p;
+                r->start += *len;
+                return 1;
+            }
+        } else {
+            const char *nl = avail ? (const char *)memchr(p, '\n', avail) : NULL;
+            if (nl || (r->eof && avail > 0)) {
+                *len = nl ? (size_t)(nl - p) : avail;
+                *rec = p;
+                r->start += *len + (nl != NULL);
+                if (*len > 0 && p[*len - 1] == '\r')
+                    (*len)--;
+                return 1;
+            }
+        }
+        if (r->eof)
+            return 0;
+        /* keep the partial record and read more after it */
+        memmove(r->buf, p, avail);
+        r->start = 0;
+        r->end = avail;
+        if (r->cap - r->end < READ_CHUNK) {
+            char *nbuf = (char *)realloc(r->buf, r->cap * 2);
+            if (nbuf == NULL) {
+                fprintf(stderr, "wstpool: out of memory\n");
+                exit(1);
+            }
+            r->buf = nbuf;
+            r->cap *= 2;
+        }
+        avail = fread(r->buf + r->end, 1, r->cap - r->end, r->f);
+        r->end += avail;
+        if (avail == 0)
+            r->eof = 1;
+    }
+}
+
+/* Writes the result of the oldest record; returns 0 if there is none */
+static int write_result(wst_pool *p, uint64_t *n, int *failed) {
+    const void *data;
+    size_t len;
+    int status;
+    if (!wst_pool_result(p, &data, &len, &status))
+        return 0;
+    (*n)++;
+    if (status == WST_POOL_OK) {
+        fwrite(data, 1, len, stdout);
+    } else {
+        fprintf(stderr, "wstpool: record %lu: %.*s\n", (unsigned long)*n, (int)len, (const char *)data);
+        *failed = 1;
+    }
+    return 1;
+}
+
+static void print_stats(const wst_pool *p) {
+    unsigned i;
+    fprintf(stderr, "%6s %12s %14s %8s %10s %12s %6s %6s\n",
+            "worker", "records", "bytes", "errors", "stolen", "records/s", "depth", "max");
+    for (i = 0; i < wst_pool_workers(p); i++) {
+        wst_pool_stats st;
+        wst_pool_getstats(p, i, &st);
+        fprintf(stderr, "%6u %12lu %14lu %8lu %10lu %12.0f %6u %6u\n", i + 1,
+                (unsigned long)st.records, (unsigned long)st.bytes, (unsigned long)st.errors,
+                (unsigned long)st.stolen, st.busy_ns ? st.records * 1e9 / st.busy_ns : 0.0,
+                st.depth, st.max_depth);
+    }
+}
+
+/* Parses the number following option argv[*i] */
+static unsigned long option_number(int argc, char **argv, int *i) {
+    char *end;
+    unsigned long v;
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "wstpool: %s needs a number\n%s", argv[*i], usage);
+        exit(2);
+    }
+    v = strtoul(argv[++*i], &end, 10);
+    if (*end != '\0' || v == 0) {
+        fprintf(stderr, "wstpool: bad number for %s: %s\n", argv[*i - 1], argv[*i]);
+        exit(2);
+    }
+    return v;
+}
+
+int main(int argc, char **argv) {
+    unsigned long nworkers = 4, window = 1024;
+    int stats = 0, failed = 0, i;
+    const char *script = NULL, *input = NULL, *rec;
+    char err[512];
+    reader r;
+    wst_pool *p;
+    size_t len;
+    uint64_t n = 0;
+
+    memset(&r, 0, sizeof(r));
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            nworkers = option_number(argc, argv, &i);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            window = option_number(argc, argv, &i);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            r.recsize = option_number(argc, argv, &i);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "wstpool: unknown option %s\n%s", argv[i], usage);
+            return 2;
+        } else if (script == NULL) {
+            script = argv[i];
+        } else if (input == NULL) {
+            input = argv[i];
+        } else {
+            fprintf(stderr, "%s", usage);
+            return 2;
+        }
+    }
+    if (script == NULL) {
+        fprintf(stderr, "%s", usage);
+        return 2;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    r.f = input ? fopen(input, "rb") : stdin;
+    if (r.f == NULL) {
+        fprintf(stderr, "wstpool: cannot open %s\n", input);
+        return 1;
+    }
+    r.cap = 2 * READ_CHUNK + r.recsize;
+    r.buf = (char *)malloc(r.cap);
+    p = wst_pool_new(script, nworkers > WST_POOL_MAXWORKERS ? WST_POOL_MAXWORKERS + 1 : (unsigned)nworkers,
+                     window > 0xffffffffUL ? 0 : (unsigned)window, err, sizeof(err));
+    if (r.buf == NULL || p == NULL) {
+        fprintf(stderr, "wstpool: %s\n", p ? "out of memory" : err);
+        return 1;
+    }
+
+    while (read_record(&r, &rec, &len)) {
+        int ok;
+        while ((ok = wst_pool_submit(p, rec, len)) == 0)
+            write_result(p, &n, &failed);
+        if (ok < 0) {
+            fprintf(stderr, "wstpool: out of memory\n");
+            return 1;
+        }
+    }
+    while (write_result(p, &n, &failed))
+        ;
+    fflush(stdout);
+    if (stats)
+        print_stats(p);
+    wst_pool_free(p);
+    if (input)
+        fclose(r.f);
+    free(r.buf);
+    return failed;
+}
@@ -0,0 +1,275 @@
+/*
+ * wst_registry.c
+ *
+ * The process-wide registry of compiled layouts, see wst_registry.h.
+ *
+ * The registry is an open-addressing hash table of pointers to immutable
+ * entries. Readers load the table and the slots with acquire semantics and
+ * never write; writers fill an entry completely before publishing it with a
+ * release store. Entries are never removed from a table that is in use: when
+ * the table fills up, a new one is built, without the entries whose layout
+ * only the registry still references, and published the same way.
+ *
+ * Such a layout is claimed by taking its reference count from 1 to 0, and a
+ * reader only takes a reference to a layout whose count is not 0, so nobody
+ * gets a dropped layout. Readers may still be probing the old table, though,
+ * so it is freed with the entries dropped once no reader is in
+ * wst_registry_find(): a reader announces itself in reg_readers before it
+ * loads the table, and a writer checks reg_readers after publishing the new
+ * one, with a full barrier in between on both sides.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#include "wst_atomic.h"
+#include "wst_registry.h"
+
+typedef struct _wst_regentry {
+    struct _wst_regentry *dropped;  /* the next entry dropped, not freed yet */
+    uint64_t hash;
+    wst_layout *layout;     /* the registry's reference */
+    int keep;               /* kept even if unused */
+    size_t len;
+    char key[1];
+} wst_regentry;
+
+typedef struct _wst_regtable {
+    struct _wst_regtable *retired;  /* the next table replaced, not freed yet */
+    size_t mask;                    /* the number of slots - 1 */
+    size_t count;
+    wst_regentry *slots[1];
+} wst_regtable;
+
+static wst_regtable *reg_table;
+static int32_t reg_lock;
+static int32_t reg_readers;         /* threads in wst_registry_find() */
+static wst_regtable *reg_retired;
+static wst_regentry *reg_dropped;
+
+/* the spins waiting for the lock before yielding the processor */
+#define REG_SPINS   64
+
+/* Takes the lock, which is only held briefly: spins a little, then yields the processor to
+ * a holder that may have been preempted */
+static void reg_lockwait(void) {
+    unsigned n = 0;
+    while (!wst_atomic_trylock(&reg_lock)) {
+        while (wst_atomic_load32(&reg_lock) != 0) {
+            if (++n < REG_SPINS) {
+                wst_atomic_pause();
+            } else {
+#ifdef _WIN32
+                Sleep(0);
+#else
+                sched_yield();
+#endif
+            }
+        }
+    }
+}
+
+/* FNV-1a */
+static uint64_t reg_hash(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    while (len-- > 0)
+        h = (h ^ (unsigned char)*key++) * 1099511628211ULL;
+    return h;
+}
+
+/* Returns the slot of the entry with the key in 't', or of the empty slot where it would go */
+static size_t reg_probe(wst_regtable *t, uint64_t h, const char *key, size_t len, wst_regentry **found) {
+    size_t i = (size_t)h & t->mask;
+    for (;;) {
+        wst_regentry *e = (wst_regentry *)wst_atomic_loadp(&t->slots[i]);
+        if (e == NULL || (e->hash == h && e->len == len && memcmp(e->key, key, len) == 0)) {
+            *found = e;
+            return i;
+        }
+        i = (i + 1) & t->mask;
+    }
+}
+
+/* Returns a new reference to 'l', or NULL if it is being dropped */
+static wst_layout *reg_tryref(wst_layout *l) {
+    int32_t n;
+    if (l->flags & WST_LSTATIC)
+        return l;
+    do {
+        n = wst_atomic_load32(&l->refs);
+        if (n == 0)
+            return NULL;
+    } while (!wst_atomic_cas32(&l->refs, n, n + 1));
+    return l;
+}
+
+wst_layout *wst_registry_find(const char *key, size_t len) {
+    wst_regtable *t;
+    wst_regentry *e = NULL;
+    wst_layout *l = NULL;
+    wst_atomic_inc(&reg_readers);
+    wst_atomic_fence();
+    t = (wst_regtable *)wst_atomic_loadp(&reg_table);
+    if (t != NULL)
+        reg_probe(t, reg_hash(key, len), key, len, &e);
+    if (e != NULL)
+        l = reg_tryref(e->layout);
+    wst_atomic_dec(&reg_readers);
+    return l;
+}
+
+/* Claims the layout of 'e' to drop it, if only the registry references it */
+static int reg_claim(wst_regentry *e) {
+    return !e->keep && !(e->layout->flags & WST_LSTATIC) && wst_atomic_cas32(&e->layout->refs, 1, 0);
+}
+
+/* Makes a table holding the entries of 't' that are still used, with room for as many more
+ * again, and moves the others to the dropped entries; returns NULL if out of memory */
+static wst_regtable *reg_rebuild(wst_regtable *t) {
+    size_t nslots = 16, live = 0, i;
+    wst_regtable *nt;
+    if (t != NULL) {
+        for (i = 0; i <= t->mask; i++) {
+            wst_regentry *e = t->slots[i];
+            if (e != NULL && !reg_claim(e))
+                live++;
+        }
+    }
+    while (nslots < 4 * (live + 1))
+        nslots *= 2;
+    nt = (wst_regtable *)calloc(1, sizeof(wst_regtable) + (nslots - 1) * sizeof(wst_regentry *));
+    if (nt != NULL) {
+        nt->mask = nslots - 1;
+        nt->count = live;
+    }
+    for (i = 0; t != NULL && i <= t->mask; i++) {
+        wst_regentry *e = t->slots[i], *other;
+        if (e == NULL)
+            continue;
+        if (!(e->layout->flags & WST_LSTATIC) && wst_atomic_load32(&e->layout->refs) == 0) {
+            if (nt == NULL) {
+                /* keep it after all: nobody could take a reference to it meanwhile */
+                wst_atomic_cas32(&e->layout->refs, 0, 1);
+            } else {
+                e->dropped = reg_dropped;
+                reg_dropped = e;
+            }
+        } else if (nt != NULL) {
+            nt->slots[reg_probe(nt, e->hash, e->key, e->len, &other)] = e;
+        }
+    }
+    return nt;
+}
+
+/* Frees the tables replaced and the entries dropped if no reader can be using them */
+static void reg_collect(void) {
+    wst_atomic_fence();
+    if (wst_atomic_load32(&reg_readers) != 0)
+        return;
+    while (reg_retired != NULL) {
+        wst_regtable *t = reg_retired;
+        reg_retired = t->retired;
+        free(t);
+    }
+    while (reg_dropped != NULL) {
+        wst_regentry *e = reg_dropped;
+        reg_dropped = e->dropped;
+        free(e->layout);
+        free(e);
+    }
+}
+
+wst_layout *wst_registry_add(const char *key, size_t len, wst_layout *l, int keep) {
+    uint64_t h = reg_hash(key, len);
+    wst_regtable *t;
+    wst_regentry *e = NULL, *other;
+    wst_layout *r = NULL;
+    size_t i;
+
+    reg_lockwait();
+    t = reg_table;
+    if (t != NULL)
+        reg_probe(t, h, key, len, &e);
+    if (e != NULL) {
+        /* the entries of the table in use are not being dropped */
+        r = wst_layout_ref(e->layout);
+        goto done;
+    }
+    if (t == NULL || 2 * (t->count + 1) > t->mask + 1) {
+        wst_regtable *nt = reg_rebuild(t);
+        if (nt == NULL)
+            goto done;
+        wst_atomic_storep(&reg_table, nt);
+        if (t != NULL) {
+            t->retired = reg_retired;
+            reg_retired = t;
+        }
+        t = nt;
+    }
+    e = (wst_regentry *)malloc(sizeof(wst_regentry) + len);
+    if (e == NULL)
+        goto done;
+    e->dropped = NULL;
+    e->hash = h;
+    e->layout = wst_layout_ref(l);
+    e->keep = keep;
+    e->len = len;
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    i = reg_probe(t, h, key, len, &other);
+    wst_atomic_storep(&t->slots[i], e);
+    t->count++;
+    r = wst_layout_ref(l);
+done:
+    reg_collect();
+    wst_atomic_unlock(&reg_lock);
+    return r;
+}
+
+size_t wst_registry_count(void) {
+    size_t n;
+    reg_lockwait();
+    n = reg_table ? reg_table->count : 0;
+    wst_atomic_unlock(&reg_lock);
+    return n;
+}
+
+int wst_registry_foreach(int (*fn)(const char *key, size_t len, const wst_layout *l, void *ud),
+                         void *ud) {
+    wst_regtable *t;
+    wst_regentry **entries;
+    size_t i, n = 0;
+    int rc = 0;
+
+    /* take the entries, then call fn without the lock: holding a reference to its layout
+       keeps an entry from being dropped */
+    reg_lockwait();
+    t = reg_table;
+    entries = (wst_regentry **)malloc((t ? t->count : 0) * sizeof(*entries) + 1);
+    for (i = 0; entries != NULL && t != NULL && i <= t->mask; i++) {
+        if (t->slots[i] != NULL) {
+            entries[n++] = t->slots[i];
+            wst_layout_ref(t->slots[i]->layout);
+        }
+    }
+    wst_atomic_unlock(&reg_lock);
+    if (entries == NULL)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (rc == 0)
+            rc = fn(entries[i]->key, entries[i]->len, entries[i]->layout, ud);
+        wst_layout_unref(entries[i]->layout);
+    }
+    free(entries);
+    return rc;
+}
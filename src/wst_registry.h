@@ -0,0 +1,39 @@
+/*
+ * wst_registry.h
+ *
+ * A process-wide registry of compiled layouts, so that Lua states running in
+ * different threads share one copy of each layout instead of compiling their
+ * own. Layouts are looked up by key without taking a lock; adding one takes a
+ * short spinlock. A layout registered to be kept stays for the life of the
+ * process; the others are dropped once the registry holds the only reference
+ * to them, when the registry next grows.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_REGISTRY_H
+#define _WST_REGISTRY_H
+
+#include <stddef.h>
+
+#include "wst_layout.h"
+
+/* Returns the layout registered under key[0..len), with a new reference, or NULL */
+extern wst_layout *wst_registry_find(const char *key, size_t len);
+
+/* Registers 'l' under key[0..len) unless another layout is registered under it already,
+ * for the life of the process if 'keep' is nonzero. Returns the layout registered under
+ * the key, with a new reference: 'l' itself, or the one another thread registered first.
+ * Returns NULL if out of memory. */
+extern wst_layout *wst_registry_add(const char *key, size_t len, wst_layout *l, int keep);
+
+/* Returns the number of layouts registered */
+extern size_t wst_registry_count(void);
+
+/* Calls fn for each key and layout registered when it is called, without holding the
+ * lock, so fn can take its time; stops, returning its value, at the first call that
+ * returns nonzero. Returns -1 if out of memory. */
+extern int wst_registry_foreach(int (*fn)(const char *key, size_t len, const wst_layout *l, void *ud),
+                                void *ud);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * wst_ring.c
+ *
+ * Shared memory ring, see wst_ring.h.
+ *
+ * The mapping starts with a header and is followed by the slots, 'stride'
+ * bytes apart. Each slot starts with its 'seq' and the record's length. Slot
+ * i is free for the record at position pos when its seq is pos: initially i,
+ * and pos + nslots once the consumer of the record at pos releases it. The
+ * producer alone writes the records and advances 'tail' (the records
+ * published); the consumers claim records by advancing 'claim' up to 'tail'
+ * with a compare-and-swap.
+ *
+ * A batch is released with one store, to the seq of its first slot, after
+ * its length: claims cut the positions into consecutive batches, so the
+ * producer reaches the first slot of a batch before the others, and takes
+ * them all as free when it finds it released. Batches are released out of
+ * order, by different consumers, so there is no single position up to which
+ * the slots are free.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "wst_atomic.h"
+#include "wst_ring.h"
+
+/* "WSTRING" and the version of the layout below */
+#define RING_MAGIC      UINT64_C(0x02474e4952545357)
+
+#define RING_SPINS      256
+#define RING_NAPUS      50
+
+typedef struct {
+    uint64_t magic;         /* RING_MAGIC, stored last when the ring is made */
+    uint32_t nslots;        /* a power of 2 */
+    uint32_t slotsize;      /* the largest record */
+    uint64_t stride;        /* bytes from one slot to the next, a multiple of 64 */
+    uint64_t closed;        /* set by the producer when no more records will come */
+    char pad0[32];
+    uint64_t tail;          /* records published */
+    char pad1[56];
+    uint64_t claim;         /* records claimed by the consumers */
+    char pad2[56];
+} ring_header;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t len;
+    uint64_t batch;         /* in the first slot of a batch, the slots released with it */
+    uint8_t data[1];
+} ring_slot;
+
+#define RING_SLOTHEADER offsetof(ring_slot, data)
+
+/* The geometry of the ring is read from the header once, when it is checked: another
+ * process can write the header, and must not make this one index out of the mapping */
+struct _wst_ring {
+    ring_header *h;
+    uint8_t *slots;
+    size_t size;            /* of the mapping */
+    uint64_t mask;          /* nslots - 1 */
+    uint64_t stride;
+    uint32_t nslots;
+    uint32_t slotsize;
+    int producer;
+    uint64_t head;          /* the producer's next record */
+    uint64_t free;          /* the producer's records before this one have free slots */
+    char *name;             /* the producer's, to remove it */
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
+
+#define ring_slot_at(r,pos) ((ring_slot *)((r)->slots + ((pos) & (r)->mask) * (r)->stride))
+
+static uint64_t ring_now_ms(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+static void ring_backoff(unsigned *spins) {
+    unsigned n = (*spins)++;
+    if (n < RING_SPINS)
+        return;
+#ifdef _WIN32
+    Sleep(n < 2 * RING_SPINS ? 0 : 1);
+#else
+    if (n < 2 * RING_SPINS) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, RING_NAPUS * 1000 };
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+/* Unmaps the ring and frees it */
+static void ring_unmap(wst_ring *r) {
+#ifdef _WIN32
+    if (r->h)
+        UnmapViewOfFile(r->h);
+    if (r->mapping)
+        CloseHandle(r->mapping);
+#else
+    if (r->h)
+        munmap(r->h, r->size);
+#endif
+    free(r->name);
+    free(r);
+}
+
+wst_ring *wst_ring_create(const char *name, uint32_t nslots, uint32_t slotsize,
+                          char *err, size_t errlen) {
+    wst_ring *r;
+    uint64_t n = 1, stride, i;
+#ifdef _WIN32
+    DWORD hi, lo;
+#else
+    int fd;
+#endif
+
+    if (nslots == 0 || nslots > WST_RING_MAXSLOTS) {
+        snprintf(err, errlen, "the number of slots must be between 1 and %u", WST_RING_MAXSLOTS);
+        return NULL;
+    }
+    if (slotsize == 0 || slotsize > WST_RING_MAXSLOTSIZE) {
+        snprintf(err, errlen, "the slot size must be between 1 and %u", WST_RING_MAXSLOTSIZE);
+        return NULL;
+    }
+    while (n < nslots)
+        n *= 2;
+    stride = (RING_SLOTHEADER + slotsize + 63) & ~(uint64_t)63;
+    if (n * stride > ((size_t)-1) - sizeof(ring_header)) {
+        snprintf(err, errlen, "the ring is too large");
+        return NULL;
+    }
+    r = (wst_ring *)calloc(1, sizeof(wst_ring));
+    if (r == NULL || (r->name = (char *)malloc(strlen(name) + 1)) == NULL) {
+        free(r);
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    strcpy(r->name, name);
+    r->producer = 1;
+    r->size = (size_t)(sizeof(ring_header) + n * stride);
+
+#ifdef _WIN32
+    hi = (DWORD)((uint64_t)r->size >> 32);
+    lo = (DWORD)r->size;
+    r->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, hi, lo, name);
+    if (r->mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+        ring_unmap(r);
+        snprintf(err, errlen, "cannot create %s", name);
+        return NULL;
+    }
+    r->h = (ring_header *)MapViewOfFile(r->mapping, FILE_MAP_ALL_ACCESS, 0, 0, r->size);
+    if (r->h == NULL) {
+        ring_unmap(r);
+        snprintf(err, errlen, "cannot map %s", name);
+        return NULL;
+    }
+#else
+    shm_unlink(name);   /* consumers of a ring of that name keep their mapping */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        snprintf(err, errlen, "cannot create %s: %s", name, strerror(errno));
+        ring_unmap(r);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)r->size) != 0) {
+        snprintf(err, errlen, "cannot size %s: %s", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        ring_unmap(r);
+        return NULL;
+    }
+    r->h = (ring_header *)mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->h == MAP_FAILED) {
+        r->h = NULL;
+        snprintf(err, errlen, "cannot map %s: %s", name, strerror(errno));
+        shm_unlink(name);
+        ring_unmap(r);
+        return NULL;
+    }
+#endif
+
+    /* the mapping is zero filled */
+    r->slots = (uint8_t *)(r->h + 1);
+    r->mask = n - 1;
+    r->stride = stride;
+    r->nslots = (uint32_t)n;
+    r->slotsize = slotsize;
+    r->free = n;
+    r->h->nslots = (uint32_t)n;
+    r->h->slotsize = slotsize;
+    r->h->stride = stride;
+    for (i = 0; i < n; i++)
+        ring_slot_at(r, i)->seq = i;
+    wst_atomic_store64(&r->h->magic, RING_MAGIC);
+    return r;
+}
+
+void *wst_ring_reserve(wst_ring *r) {
+    ring_slot *s = ring_slot_at(r, r->head);
+    if (r->head >= r->free) {
+        uint64_t n;
+        if (wst_atomic_load64(&s->seq) != r->head)
+            return NULL;
+        /* the batch starting here was released whole */
+        n = s->batch;
+        r->free = r->head + (n >= 1 && n <= r->nslots ? n : 1);
+    }
+    return s->data;
+}
+
+void wst_ring_commit(wst_ring *r, size_t len) {
+    ring_slot_at(r, r->head)->len = len;
+    r->head++;
+}
+
+int wst_ring_push(wst_ring *r, const void *data, size_t len) {
+    void *slot;
+    if (len > r->slotsize)
+        return -1;
+    slot = wst_ring_reserve(r);
+    if (slot == NULL)
+        return 0;
+    memcpy(slot, data, len);
+    wst_ring_commit(r, len);
+    return 1;
+}
+
+void wst_ring_publish(wst_ring *r) {
+    wst_atomic_store64(&r->h->tail, r->head);
+}
+
+wst_ring *wst_ring_open(const char *name, char *err, size_t errlen) {
+    wst_ring *r = (wst_ring *)calloc(1, sizeof(wst_ring));
+    uint64_t magic, nslots, slotsize, stride;
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION mi;
+#else
+    struct stat st;
+    int fd;
+#endif
+
+    if (r == NULL) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+#ifdef _WIN32
+    r->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    r->h = r->mapping ? (ring_header *)MapViewOfFile(r->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (r->h == NULL || VirtualQuery(r->h, &mi, sizeof(mi)) == 0) {
+        ring_unmap(r);
+        snprintf(err, errlen, "cannot open %s", name);
+        return NULL;
+    }
+    r->size = mi.RegionSize;
+#else
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        snprintf(err, errlen, "cannot open %s: %s", name, strerror(errno));
+        ring_unmap(r);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(ring_header) || (uint64_t)st.st_size > (size_t)-1) {
+        close(fd);
+        ring_unmap(r);
+        snprintf(err, errlen, "%s is not a ring", name);
+        return NULL;
+    }
+    r->size = (size_t)st.st_size;
+    r->h = (ring_header *)mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->h == MAP_FAILED) {
+        r->h = NULL;
+        snprintf(err, errlen, "cannot map %s: %s", name, strerror(errno));
+        ring_unmap(r);
+        return NULL;
+    }
+#endif
+
+    /* the magic is stored last, so it is loaded first */
+    magic = wst_atomic_load64(&r->h->magic);
+    nslots = r->h->nslots;
+    slotsize = r->h->slotsize;
+    stride = r->h->stride;
+    if (magic != RING_MAGIC || nslots == 0 || (nslots & (nslots - 1)) != 0
+        || slotsize == 0 || stride < RING_SLOTHEADER + slotsize || (stride & 63) != 0
+        || stride > (r->size - sizeof(ring_header)) / nslots) {
+        ring_unmap(r);
+        snprintf(err, errlen, "%s is not a ring of this version of the library", name);
+        return NULL;
+    }
+    r->slots = (uint8_t *)(r->h + 1);
+    r->mask = nslots - 1;
+    r->stride = stride;
+    r->nslots = (uint32_t)nslots;
+    r->slotsize = (uint32_t)slotsize;
+    return r;
+}
+
+uint32_t wst_ring_acquire(wst_ring *r, uint32_t max, uint64_t *first) {
+    for (;;) {
+        uint64_t c = wst_atomic_load64(&r->h->claim);
+        uint64_t n = wst_atomic_load64(&r->h->tail) - c;
+        if (n == 0 || max == 0)
+            return 0;
+        if (n > max)
+            n = max;
+        if (wst_atomic_cas64(&r->h->claim, c, c + n)) {
+            *first = c;
+            return (uint32_t)n;
+        }
+    }
+}
+
+const void *wst_ring_record(const wst_ring *r, uint64_t pos, size_t *len) {
+    const ring_slot *s = ring_slot_at(r, pos);
+    uint64_t l = s->len;
+    /* the length is checked, as a faulty producer must not make consumers read past the slot */
+    *len = (size_t)(l <= r->slotsize ? l : r->slotsize);
+    return s->data;
+}
+
+void wst_ring_release(wst_ring *r, uint64_t first, uint32_t n) {
+    ring_slot *s = ring_slot_at(r, first);
+    if (n == 0)
+        return;
+    s->batch = n;
+    wst_atomic_store64(&s->seq, first + r->mask + 1);
+}
+
+int wst_ring_wait(const wst_ring *r, long timeout) {
+    uint64_t start = ring_now_ms();
+    unsigned spins = 0;
+    for (;;) {
+        /* closed is read first, so records published before it was set are counted */
+        int closed = wst_atomic_load64(&r->h->closed) != 0;
+        if (wst_ring_pending(r) > 0)
+            return 1;
+        if (closed)
+            return -1;
+        if (timeout >= 0 && ring_now_ms() - start >= (uint64_t)timeout)
+            return 0;
+        ring_backoff(&spins);
+    }
+}
+
+long wst_ring_acquire_wait(wst_ring *r, uint32_t max, uint64_t *first, long timeout) {
+    uint64_t deadline = timeout >= 0 ? ring_now_ms() + (uint64_t)timeout : 0;
+    for (;;) {
+        uint32_t n = wst_ring_acquire(r, max, first);
+        int w;
+        if (n > 0)
+            return (long)n;
+        if (timeout < 0) {
+            w = wst_ring_wait(r, -1);
+        } else {
+            uint64_t now = ring_now_ms();
+            w = wst_ring_wait(r, now < deadline ? (long)(deadline - now) : 0);
+        }
+        if (w <= 0)
+            return w;
+        /* another consumer may claim the records first: wait again, until the deadline */
+    }
+}
+
+uint64_t wst_ring_pending(const wst_ring *r) {
+    uint64_t c = wst_atomic_load64(&r->h->claim);
+    uint64_t t = wst_atomic_load64(&r->h->tail);
+    return t > c ? t - c : 0;
+}
+
+uint32_t wst_ring_slots(const wst_ring *r) {
+    return r->nslots;
+}
+
+uint32_t wst_ring_slotsize(const wst_ring *r) {
+    return r->slotsize;
+}
+
+void wst_ring_close(wst_ring *r) {
+    if (r == NULL)
+        return;
+    if (r->producer) {
+        wst_ring_publish(r);
+        wst_atomic_store64(&r->h->closed, 1);
+#ifndef _WIN32
+        shm_unlink(r->name);
+#endif
+    }
+    ring_unmap(r);
+}
@@ -0,0 +1,92 @@
+/*
+ * wst_ring.h
+ *
+ * A ring of fixed-size slots in shared memory, through which one producer
+ * process hands records to consumer processes without copying them: the
+ * producer writes each record into a slot, and a consumer reads it in place
+ * and gives the slot back once done. Each record goes to one consumer.
+ *
+ * Consumers take records in batches: one compare-and-swap claims up to 'max'
+ * records and one store gives them back, and the producer makes the records
+ * it wrote visible with one store per wst_ring_publish(). A slot is reused
+ * only once the consumer holding it has released it, so a consumer that stops
+ * without releasing its batch stops the producer after one lap of the ring.
+ *
+ * The ring is named like a POSIX shared memory object ("/name"); on Windows
+ * the name is that of a file mapping.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_RING_H
+#define _WST_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wst_abi.h"
+
+/* the most slots of a ring, and the largest slot */
+#define WST_RING_MAXSLOTS       (1u << 24)
+#define WST_RING_MAXSLOTSIZE    (1u << 24)
+
+typedef struct _wst_ring wst_ring;
+
+/* Creates the ring 'name' of 'nslots' (rounded up to a power of 2) slots of 'slotsize'
+ * bytes, for its producer, replacing any ring of that name (on Windows, a ring still
+ * open under that name is an error). Returns NULL and a message in 'err' on error. */
+WST_API wst_ring *wst_ring_create(const char *name, uint32_t nslots, uint32_t slotsize,
+                                  char *err, size_t errlen);
+
+/* Returns the slot for the next record, of wst_ring_slotsize() bytes, or NULL if the ring
+ * is full: the consumers have not released the slot yet. */
+WST_API void *wst_ring_reserve(wst_ring *r);
+
+/* Ends the record written to the slot wst_ring_reserve() returned, of 'len' bytes */
+WST_API void wst_ring_commit(wst_ring *r, size_t len);
+
+/* Copies a record to the next slot. Returns 1, 0 if the ring is full, or -1 if the record
+ * is larger than a slot. */
+WST_API int wst_ring_push(wst_ring *r, const void *data, size_t len);
+
+/* Makes the records committed so far visible to the consumers */
+WST_API void wst_ring_publish(wst_ring *r);
+
+/* Opens the ring 'name' for a consumer. Returns NULL and a message in 'err' if there is
+ * no such ring or it was made by another version of the library. */
+WST_API wst_ring *wst_ring_open(const char *name, char *err, size_t errlen);
+
+/* Claims up to 'max' published records, the ones from *first on. Returns their number,
+ * 0 if none is waiting. */
+WST_API uint32_t wst_ring_acquire(wst_ring *r, uint32_t max, uint64_t *first);
+
+/* Returns record 'pos' claimed by wst_ring_acquire(), and its length in *len */
+WST_API const void *wst_ring_record(const wst_ring *r, uint64_t pos, size_t *len);
+
+/* Gives back the n slots of the records from 'first' on, once they have been read: the
+ * whole batch wst_ring_acquire() claimed, as the producer learns of it from its first slot */
+WST_API void wst_ring_release(wst_ring *r, uint64_t first, uint32_t n);
+
+/* Waits up to 'timeout' milliseconds (forever if negative) for published records. Returns
+ * 1 if some are waiting, 0 on timeout, or -1 if the producer has closed the ring and
+ * every record has been claimed. */
+WST_API int wst_ring_wait(const wst_ring *r, long timeout);
+
+/* Claims up to 'max' published records like wst_ring_acquire(), waiting up to 'timeout'
+ * milliseconds in all (forever if negative) for some, even if other consumers claim the
+ * records it waited for. Returns their number, 0 on timeout, or -1 if the producer has
+ * closed the ring and every record has been claimed. */
+WST_API long wst_ring_acquire_wait(wst_ring *r, uint32_t max, uint64_t *first, long timeout);
+
+/* Returns the number of records published and not yet claimed */
+WST_API uint64_t wst_ring_pending(const wst_ring *r);
+
+WST_API uint32_t wst_ring_slots(const wst_ring *r);
+WST_API uint32_t wst_ring_slotsize(const wst_ring *r);
+
+/* Unmaps the ring. Closing the producer's ring publishes what was committed, tells the
+ * consumers that no more records will come and removes the name; the consumers keep
+ * their mapping until they close theirs. */
+WST_API void wst_ring_close(wst_ring *r);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ * wst_store.c
+ *
+ * Files of compiled layouts, see wst_store.h.
+ *
+ * Layouts are position independent (their parts are found by offsets from
+ * their start), so the layouts of a store are used right where the file is
+ * mapped. They are marked WST_LSTATIC, as the mapping is read-only and is
+ * kept for the life of the process.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "wst_atomic.h"
+#include "wst_registry.h"
+#include "wst_store.h"
+
+#define STORE_MAGIC     "WSTLAYO\n"
+#define STORE_VERSION   1
+
+/* entries and layouts start at multiples of this */
+#define STORE_ALIGN     8
+#define storealign(n)   (((n) + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1))
+
+typedef struct {
+    char     magic[8];      /* STORE_MAGIC */
+    uint32_t version;       /* STORE_VERSION */
+    uint32_t signature;     /* store_signature() of the library that wrote the file */
+    uint32_t count;         /* number of entries */
+    uint32_t reserved;
+    uint64_t size;          /* bytes of entries after the header */
+    uint64_t checksum;      /* FNV-1a of those bytes */
+} store_header;
+
+/* Each entry is the key length and the layout size, the key, and the layout,
+ * each padded to STORE_ALIGN */
+typedef struct {
+    uint32_t keylen;
+    uint32_t bytes;
+} store_entry;
+
+static uint64_t store_fnv(uint64_t h, const void *p, size_t n) {
+    const unsigned char *s = (const unsigned char *)p;
+    while (n-- > 0)
+        h = (h ^ *s++) * 1099511628211ULL;
+    return h;
+}
+
+#define FNV_INIT    14695981039346656037ULL
+
+/* Identifies the representation of layouts in this build */
+static uint32_t store_signature(void) {
+    const uint32_t parts[] = {
+        WST_LAYOUT_VERSION, (uint32_t)sizeof(wst_layout), (uint32_t)sizeof(wst_field),
+        (uint32_t)sizeof(void *), 0x01020304
+    };
+    uint64_t h = store_fnv(FNV_INIT, parts, sizeof(parts));  /* the last part gives the byte order */
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+typedef struct {
+    FILE *f;
+    uint32_t count;
+    uint64_t size;
+    uint64_t checksum;
+    int failed;
+} store_writer;
+
+static void store_write(store_writer *w, const void *p, size_t n) {
+    static const char zeros[STORE_ALIGN] = { 0 };
+    if (p == NULL)
+        p = zeros;
+    if (fwrite(p, 1, n, w->f) != n)
+        w->failed = 1;
+    w->checksum = store_fnv(w->checksum, p, n);
+    w->size += n;
+}
+
+static int store_add(const char *key, size_t len, const wst_layout *l, void *ud) {
+    store_writer *w = (store_writer *)ud;
+    store_entry e;
+    wst_layout copy;
+    e.keylen = (uint32_t)len;
+    e.bytes = l->bytes;
+    store_write(w, &e, sizeof(e));
+    store_write(w, key, len);
+    store_write(w, NULL, storealign(len) - len);
+    /* the header of the layout is written as it will be used: static */
+    memcpy(&copy, l, sizeof(copy));
+    copy.refs = 0;
+    copy.flags |= WST_LSTATIC;
+    store_write(w, &copy, sizeof(copy));
+    store_write(w, (const char *)l + sizeof(copy), l->bytes - sizeof(copy));
+    store_write(w, NULL, storealign(l->bytes) - l->bytes);
+    w->count++;
+    return w->failed;
+}
+
+long wst_store_save(const char *path, char *err, size_t errlen) {
+    store_writer w;
+    store_header h;
+    size_t plen = strlen(path);
+    char *tmp = (char *)malloc(plen + 5);
+
+    if (tmp == NULL) {
+        snprintf(err, errlen, "out of memory");
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    memset(&w, 0, sizeof(w));
+    w.checksum = FNV_INIT;
+    w.f = fopen(tmp, "wb");
+    if (w.f == NULL) {
+        snprintf(err, errlen, "cannot create %s", tmp);
+        free(tmp);
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    fwrite(&h, 1, sizeof(h), w.f);  /* filled in at the end */
+    if (wst_registry_foreach(store_add, &w) != 0)
+        w.failed = 1;
+
+    memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+    h.version = STORE_VERSION;
+    h.signature = store_signature();
+    h.count = w.count;
+    h.size = w.size;
+    h.checksum = w.checksum;
+    if (fseek(w.f, 0, SEEK_SET) != 0 || fwrite(&h, 1, sizeof(h), w.f) != sizeof(h))
+        w.failed = 1;
+    if (fclose(w.f) != 0)
+        w.failed = 1;
+#ifdef _WIN32
+    if (!w.failed && !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING))
+        w.failed = 1;
+#else
+    if (!w.failed && rename(tmp, path) != 0)
+        w.failed = 1;
+#endif
+    if (w.failed) {
+        remove(tmp);
+        snprintf(err, errlen, "cannot write %s", path);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return (long)w.count;
+}
+
+/* Maps a whole file read-only; returns NULL on error */
+static const unsigned char *store_map(const char *path, size_t *size) {
+    void *p = NULL;
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER fsize;
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (GetFileSizeEx(file, &fsize) && fsize.QuadPart >= (LONGLONG)sizeof(store_header)
+            && (uint64_t)fsize.QuadPart <= (size_t)-1) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (size_t)fsize.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(store_header)
+            && (uint64_t)st.st_size <= (size_t)-1) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+#endif
+    return (const unsigned char *)p;
+}
+
+static void store_unmap(const unsigned char *p, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile((LPCVOID)p);
+#else
+    munmap((void *)p, size);
+#endif
+}
+
+/* Checks the elements of the layout 'l': each is one the compiler makes, '[' and ']' match,
+ * and in a fixed layout the offsets, sizes and value indexes are those the compiler gives,
+ * so that nothing reads past the extent or pushes more values than counted */
+static int store_checkfields(const wst_layout *l) {
+    uint32_t open[WST_MAXGROUPDEPTH], depth = 0, i;
+    uint64_t pos = 0, extent = 0, nvalues = 0, nresults = 0;
+
+    for (i = 0; i < l->nfields; i++) {
+        const wst_field *f = &l->fields[i];
+        const char *none = "";
+        size_t size;
+        int vals;
+
+        if (f->endian > WST_LITTLE || (f->flags & ~(WST_NOASSIGN | WST_PREVCOUNT)) != 0 || f->reserved != 0)
+            return 0;
+        if (f->bound != 0 && f->opt != 'X' && f->opt != 's' && f->opt != 'w' && f->opt != '[')
+            return 0;
+        switch (f->opt) {
+            case '[':
+                if (l->fixed || depth == WST_MAXGROUPDEPTH || f->size != 0 || f->bound <= i
+                        || f->bound >= l->nfields || l->fields[f->bound].opt != ']')
+                    return 0;
+                open[depth++] = i;
+                continue;
+            case ']':
+                if (depth == 0 || l->fields[open[--depth]].bound != i)
+                    return 0;
+                continue;
+            case 'b': case 'B': case 'h': case 'H': case 'l': case 'L': case 'T':
+            case 'e': case 'E': case 'f': case 'd':
+                /* read with their native size */
+                if (wst_optsize(f->opt, &none, &size) != WST_OK || f->size != size)
+                    return 0;
+                break;
+            case 'i': case 'I':
+                if (f->size > WST_MAXINTSIZE)
+                    return 0;
+                break;
+            case 'x': case 'c': case 'W':
+                break;
+            case 's': case 'w': case 'X': case '=':
+                if (f->size != 0)
+                    return 0;
+                break;
+            default:
+                return 0;
+        }
+
+        switch (f->opt) {
+            case 'x': case 'X': case '=':
+                vals = 0;
+                break;
+            case 's': case 'c': case 'w': case 'W':
+                vals = !(f->flags & WST_NOASSIGN);
+                break;
+            default:
+                vals = f->size && !(f->flags & WST_NOASSIGN);
+                break;
+        }
+        nvalues += (uint64_t)vals * f->count;
+        if (!l->fixed)
+            continue;
+        if ((f->flags & WST_PREVCOUNT) || f->opt == 's' || f->opt == 'w'
+                || (f->size == 0 && (f->opt == 'c' || f->opt == 'W')))
+            return 0;
+        if (f->align)
+            pos += (f->align - (pos & (f->align - 1))) & (f->align - 1);
+        if (f->offset != pos || f->value != nresults)
+            return 0;
+        if (pos + (uint64_t)f->size * f->count + f->bound > extent)
+            extent = pos + (uint64_t)f->size * f->count + f->bound;
+        pos += (uint64_t)f->size * f->count;
+        if (extent > UINT32_MAX)
+            return 0;
+        if (vals || f->opt == '=')
+            nresults += f->count;
+    }
+    if (depth != 0 || l->align == 0)
+        return 0;
+    if (l->fixed) {
+        if (pos != l->size || (extent < pos ? pos : extent) != l->extent || nresults != l->nresults
+                || nvalues != l->nvalues || l->variable)
+            return 0;
+    }
+    return 1;
+}
+
+/* Checks the names of the layout 'l' of 'bytes' bytes, whose format ends at 'fmtend' */
+static int store_checknames(const wst_layout *l, uint32_t bytes, size_t fmtend) {
+    const uint32_t *offsets = (const uint32_t *)((const char *)l + l->names);
+    size_t table = (size_t)l->names + ((size_t)l->nnames + l->nslots) * sizeof(uint32_t);
+    uint32_t i, empty = 0;
+
+    if (l->names == 0)
+        return l->nnames == 0 && l->nslots == 0;
+    if (l->names < fmtend || l->names % sizeof(uint32_t) != 0 || table > bytes)
+        return 0;
+    if (l->nslots == 0 || (l->nslots & (l->nslots - 1)) != 0
+            || l->nnames > (l->fixed ? l->nresults : l->nvalues))
+        return 0;
+    for (i = 0; i < l->nnames; i++) {
+        if (offsets[i] != 0 && (offsets[i] < table || offsets[i] >= bytes
+                                || memchr((const char *)l + offsets[i], '\0', bytes - offsets[i]) == NULL))
+            return 0;
+    }
+    /* lookups stop at an empty slot */
+    for (i = 0; i < l->nslots; i++) {
+        uint32_t v = offsets[l->nnames + i];
+        if (v == 0)
+            empty++;
+        else if (v > l->nnames || offsets[v - 1] == 0)
+            return 0;
+    }
+    return empty > 0;
+}
+
+/* Checks that the layout of 'bytes' bytes at 'l' is whole, was written as static and is
+ * one the compiler could have made: a damaged store must not make decoding read out of
+ * bounds */
+static int store_checklayout(const wst_layout *l, uint32_t bytes) {
+    const char *format = (const char *)l + l->format;
+    const char *fmtend;
+    if (bytes < sizeof(wst_layout) || l->bytes != bytes || l->flags != WST_LSTATIC)
+        return 0;
+    if (l->nfields > WST_MAXFIELDS || l->format != sizeof(wst_layout) + (size_t)l->nfields * sizeof(wst_field))
+        return 0;
+    if (l->format >= bytes || (fmtend = (const char *)memchr(format, '\0', bytes - l->format)) == NULL)
+        return 0;
+    return store_checkfields(l) && store_checknames(l, bytes, (size_t)(fmtend + 1 - (const char *)l));
+}
+
+long wst_store_load(const char *path, char *err, size_t errlen) {
+    size_t size = 0, pos;
+    const unsigned char *base = store_map(path, &size);
+    store_header h;
+    uint32_t i, used = 0;
+
+    if (base == NULL) {
+        snprintf(err, errlen, "cannot map %s", path);
+        return -1;
+    }
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, STORE_MAGIC, sizeof(h.magic)) != 0) {
+        snprintf(err, errlen, "%s is not a layout store", path);
+        goto fail;
+    }
+    if (h.version != STORE_VERSION || h.signature != store_signature()) {
+        snprintf(err, errlen, "%s was written by another version of the library", path);
+        goto fail;
+    }
+    if (h.size != size - sizeof(h) || store_fnv(FNV_INIT, base + sizeof(h), (size_t)h.size) != h.checksum) {
+        snprintf(err, errlen, "%s is damaged", path);
+        goto fail;
+    }
+
+    /* check every entry before registering any */
+    for (i = 0, pos = sizeof(h); i < h.count; i++) {
+        store_entry e;
+        if (size - pos < sizeof(e))
+            break;
+        memcpy(&e, base + pos, sizeof(e));
+        pos += sizeof(e);
+        if (size - pos < storealign(e.keylen))
+            break;
+        pos += storealign(e.keylen);
+        if (size - pos < storealign(e.bytes) || !store_checklayout((const wst_layout *)(base + pos), e.bytes))
+            break;
+        pos += storealign(e.bytes);
+    }
+    if (i != h.count || pos != size) {
+        snprintf(err, errlen, "%s is damaged", path);
+        goto fail;
+    }
+
+    for (i = 0, pos = sizeof(h); i < h.count; i++) {
+        store_entry e;
+        const char *key;
+        wst_layout *l, *r;
+        memcpy(&e, base + pos, sizeof(e));
+        key = (const char *)base + pos + sizeof(e);
+        pos += sizeof(e) + storealign(e.keylen);
+        l = (wst_layout *)(base + pos);
+        pos += storealign(e.bytes);
+        r = wst_registry_add(key, e.keylen, l, 1);
+        if (r == l)
+            used++;
+        wst_layout_unref(r);
+    }
+    if (used == 0)
+        store_unmap(base, size);  /* otherwise the registry uses it for good */
+    return (long)h.count;
+
+fail:
+    store_unmap(base, size);
+    return -1;
+}
+
+void wst_store_preload(void) {
+    static int32_t done;
+    const char *path;
+    char err[128];
+    if (!wst_atomic_trylock(&done))
+        return;  /* another state did it, or is doing it */
+    path = getenv(WST_STORE_ENV);
+    if (path != NULL && *path != '\0')
+        wst_store_load(path, err, sizeof(err));
+}
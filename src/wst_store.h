@@ -0,0 +1,36 @@
+/*
+ * wst_store.h
+ *
+ * A file of compiled layouts, to start without compiling them again: the
+ * layouts of the registry are saved to it, and loading it maps the file and
+ * registers the layouts in place, without copying or compiling them.
+ *
+ * The file starts with a header holding a version, a signature of the layout
+ * representation of the library that wrote it and a checksum of the contents;
+ * a file written by a different build, or damaged, is not loaded.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _WST_STORE_H
+#define _WST_STORE_H
+
+#include <stddef.h>
+
+/* the environment variable naming a store that luaopen_wiresharktypes() loads */
+#define WST_STORE_ENV   "WIRESHARKTYPES_LAYOUTS"
+
+/* Saves all the layouts of the registry to 'path'. Returns their number, or -1 and
+ * a message in 'err'. The file is replaced atomically where the system allows it. */
+extern long wst_store_save(const char *path, char *err, size_t errlen);
+
+/* Maps the store at 'path' and registers its layouts; keys already registered keep
+ * their layouts. Returns the number of layouts in the store, or -1 and a message
+ * in 'err' if the store cannot be read, is damaged or was written by another build. */
+extern long wst_store_load(const char *path, char *err, size_t errlen);
+
+/* Loads the store named by WST_STORE_ENV, if set, the first time it is called in the
+ * process; errors are ignored, as the layouts can still be compiled */
+extern void wst_store_preload(void);
+
+#endif
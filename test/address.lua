@@ -0,0 +1,110 @@
+-- Tests Struct address formatting/parsing functions
+
+local function testing(...)
+	print("---- Testing "..tostring(...).." ----")
+end
+
+local function test(name, ...)
+	io.stdout:write("test "..name.."...")
+	if (...) == true then
+		io.stdout:write("passed\n")
+	else
+		io.stdout:write("failed!\n")
+		error(name.." test failed!")
+	end
+end
+
+local lib = Struct
+
+testing("ipv4tostr")
+test("ipv4tostr1", lib.ipv4tostr("\192\168\0\1") == "192.168.0.1")
+test("ipv4tostr2", lib.ipv4tostr("\0\0\0\0") == "0.0.0.0")
+test("ipv4tostr3", lib.ipv4tostr("\255\255\255\255") == "255.255.255.255")
+test("ipv4tostr4", lib.ipv4tostr("xx\10\20\30\40", 3) == "10.20.30.40")
+test("ipv4tostr5", not pcall(lib.ipv4tostr, "\1\2\3"))
+test("ipv4tostr6", not pcall(lib.ipv4tostr, "\1\2\3\4", 2))
+
+local col = lib.ipv4tostr("\1\2\3\4\0\0\5\6\7\8\0\0\9\10\11\12", 1, 3, 6)
+test("ipv4tostr_batch1", #col == 3 and col[1] == "1.2.3.4" and col[2] == "5.6.7.8" and col[3] == "9.10.11.12")
+col = lib.ipv4tostr("\1\2\3\4\5\6\7\8", 1, 2)
+test("ipv4tostr_batch2", #col == 2 and col[2] == "5.6.7.8")
+test("ipv4tostr_batch3", #lib.ipv4tostr("", 1, 0) == 0)
+test("ipv4tostr_batch4", not pcall(lib.ipv4tostr, "\1\2\3\4\5\6\7", 1, 2))
+-- a huge stride or count must not wrap around the bounds check
+test("ipv4tostr_batch5", not pcall(lib.ipv4tostr, "\1\2\3\4", 1, 5, 2^62) and not pcall(lib.ipv4tostr, "\1\2\3\4", 1, 2, 2^63 - 1024)
+	and not pcall(lib.ipv4tostr, "\1\2\3\4", 1, 2^62, 1) and not pcall(lib.ipv4tostr, "\1\2\3\4", 1, 2^31, 0x7fffffff)
+	and not pcall(lib.ipv6tostr, string.rep("\0", 16), 1, 3, 2^61) and not pcall(lib.ipv4tostr, "\1\2\3\4", 2^62)
+	and lib.ipv4tostr("\1\2\3\4", 1, 1, 2^62)[1] == "1.2.3.4")
+
+testing("ipv6tostr")
+local function v6(hex) return lib.fromhex(hex) end
+local v6tests = {
+	{ "00000000000000000000000000000000", "::" },
+	{ "00000000000000000000000000000001", "::1" },
+	{ "20010db8000000000000000000000001", "2001:db8::1" },
+	{ "20010db8000000010000000000000001", "2001:db8:0:1::1" },
+	{ "20010db8000000000001000000000001", "2001:db8::1:0:0:1" },
+	{ "20010db8000100000000000000000000", "2001:db8:1::" },
+	{ "20010db8000000010001000100010001", "2001:db8:0:1:1:1:1:1" },
+	{ "20010DB8AAAABBBBCCCCDDDDEEEE0001", "2001:db8:aaaa:bbbb:cccc:dddd:eeee:1" },
+	{ "fe800000000000000202b3fffe1e8329", "fe80::202:b3ff:fe1e:8329" },
+	{ "00000000000000000000ffffc0000280", "::ffff:192.0.2.128" },
+}
+for i, t in ipairs(v6tests) do
+	test("ipv6tostr"..i, lib.ipv6tostr(v6(t[1])) == t[2])
+	test("strtoipv6_"..i, lib.strtoipv6(t[2]) == v6(t[1]))
+end
+col = lib.ipv6tostr(v6(v6tests[2][1]..v6tests[3][1]), 1, 2)
+test("ipv6tostr_batch1", #col == 2 and col[1] == "::1" and col[2] == "2001:db8::1")
+
+testing("ethertostr")
+test("ethertostr1", lib.ethertostr("\0\17\34\51\68\255") == "00:11:22:33:44:ff")
+col = lib.ethertostr("\1\2\3\4\5\6\7\8\9\10\11\12", 1, 2)
+test("ethertostr_batch1", col[1] == "01:02:03:04:05:06" and col[2] == "07:08:09:0a:0b:0c")
+
+testing("address parsers")
+test("strtoipv4_1", lib.strtoipv4("192.168.0.1") == "\192\168\0\1")
+test("strtoipv4_2", lib.strtoipv4("255.255.255.255") == "\255\255\255\255")
+test("strtoipv4_3", lib.strtoipv4("256.1.1.1") == nil)
+test("strtoipv4_4", lib.strtoipv4("1.1.1") == nil)
+test("strtoipv4_5", lib.strtoipv4("1.1.1.1.") == nil)
+test("strtoipv4_6", lib.strtoipv4("01.1.1.1") == nil)
+test("strtoipv4_7", lib.strtoipv4("") == nil)
+test("strtoipv6_a", lib.strtoipv6("2001:DB8:0:0:0:0:0:1") == v6("20010db8000000000000000000000001"))
+test("strtoipv6_b", lib.strtoipv6("1:2:3:4:5:6:7:8") == v6("00010002000300040005000600070008"))
+test("strtoipv6_c", lib.strtoipv6("::1.2.3.4") == v6("00000000000000000000000001020304"))
+test("strtoipv6_d", lib.strtoipv6("1::2::3") == nil)
+test("strtoipv6_e", lib.strtoipv6("1:2:3:4:5:6:7:8:9") == nil)
+test("strtoipv6_f", lib.strtoipv6("1:2:3:4:5:6:7") == nil)
+test("strtoipv6_g", lib.strtoipv6(":1::") == nil)
+test("strtoipv6_h", lib.strtoipv6("12345::") == nil)
+test("strtoipv6_i", lib.strtoipv6("1:2:3:4:5:6:7::8") == nil)
+test("strtoether1", lib.strtoether("00:11:22:33:44:FF") == "\0\17\34\51\68\255")
+test("strtoether2", lib.strtoether("00-11-22-33-44-ff") == "\0\17\34\51\68\255")
+test("strtoether3", lib.strtoether("0011223344ff") == "\0\17\34\51\68\255")
+test("strtoether4", lib.strtoether("00:11-22:33:44:ff") == nil)
+test("strtoether5", lib.strtoether("00:11:22:33:44") == nil)
+
+local bin, idx = lib.strtoipv4({ "1.2.3.4", "5.6.7.8" })
+test("strtoipv4_batch1", bin == "\1\2\3\4\5\6\7\8" and idx == nil)
+bin, idx = lib.strtoipv4({ "1.2.3.4", "bogus", "5.6.7.8" })
+test("strtoipv4_batch2", bin == nil and idx == 2)
+test("strtoipv4_batch3", lib.strtoipv4({}) == "")
+
+testing("address round trip")
+local ok = true
+for i = 0, 255 do
+	local a = string.char(i, 255 - i, (i * 7) % 256, 1)
+	if lib.strtoipv4(lib.ipv4tostr(a)) ~= a then ok = false end
+end
+test("roundtrip_ipv4", ok)
+ok = true
+for i = 0, 255 do
+	local a = string.rep("\0", i % 16) .. string.char(i) .. string.rep("\0", 15 - (i % 16))
+	if lib.strtoipv6(lib.ipv6tostr(a)) ~= a then ok = false end
+end
+test("roundtrip_ipv6", ok)
+
+print("\n-----------------------------\n")
+
+print("All address tests passed!\n\n")
@@ -0,0 +1,418 @@
+-- Tests compiled Struct layouts and tag dispatch
+
+local function testing(...)
+	print("---- Testing "..tostring(...).." ----")
+end
+
+local function test(name, ...)
+	io.stdout:write("test "..name.."...")
+	if (...) == true then
+		io.stdout:write("passed\n")
+	else
+		io.stdout:write("failed!\n")
+		error(name.." test failed!")
+	end
+end
+
+local lib = Struct
+
+-- compares the results of Struct.unpack and a compiled layout
+local function same(fmt, data, pos)
+	local a = { pcall(lib.unpack, fmt, data, pos) }
+	local b = { pcall(lib.compile(fmt).unpack, lib.compile(fmt), data, pos) }
+	if #a ~= #b or a[1] ~= b[1] then return false end
+	if a[1] then
+		-- storing into a table must give the same values
+		local t = {}
+		local ok, p, n = pcall(lib.compile(fmt).unpack_into, lib.compile(fmt), t, data, pos)
+		if not ok or p ~= a[#a] or n ~= #a - 2 then return false end
+		for i = 1, n do
+			if tostring(t[i]) ~= tostring(a[i + 1]) then return false end
+		end
+	end
+	if not a[1] then
+		-- the non-raising variants must agree on the error too
+		local c = { lib.tryunpack(fmt, data, pos) }
+		local d = { lib.compile(fmt):tryunpack(data, pos) }
+		return c[1] == nil and c[2] == d[2] and c[3] == d[3]
+	end
+	for i = 2, #a do
+		if tostring(a[i]) ~= tostring(b[i]) then return false end
+	end
+	return true
+end
+
+testing("compile")
+local l = lib.compile(">I2 i4 (I2) c3")
+test("compile1", l.format == ">I2 i4 (I2) c3")
+test("compile2", l.size == 11)
+test("compile3", l.values == 3)
+test("compile4", lib.compile("s").size == nil)
+test("compile5", lib.compile("<I2 s c0").values == lib.values("<I2 s c0"))
+test("compile6", not pcall(lib.compile, "I2 y"))
+test("compile7", not pcall(lib.compile, "i33"))
+test("compile8", not pcall(lib.compile, "!3 i4"))
+test("compile9", tostring(l) == 'Layout(">I2 i4 (I2) c3")')
+
+local a, b, c, pos = l:unpack("\0\1\255\255\255\254\0\0abc")
+test("unpack1", a == 1 and b == -2 and c == "abc" and pos == 12)
+test("unpack2", not pcall(l.unpack, l, "\0\1\255\255\255\254\0\0ab"))
+test("pack1", l:pack(1, -2, "abc") == "\0\1\255\255\255\254\0\0abc")
+
+a, b, c, pos = l:tryunpack("\0\1\255\255\255\254\0\0abc")
+test("tryunpack1", a == 1 and b == -2 and c == "abc" and pos == 12)
+a, b, c = l:tryunpack("\0\1\255\255\255\254\0\0ab")
+test("tryunpack2", a == nil and b == "short" and c == 9)
+a, b, c = lib.compile("!4 b i4"):tryunpack("x\1\0\0\0\0\0", 2)
+test("tryunpack3", a == nil and b == "short" and c == 5)
+a, b, c = lib.compile("b s"):tryunpack("\1abc")
+test("tryunpack4", a == nil and b == "unfinished" and c == 2)
+
+local t = {}
+pos, b = l:unpack_into(t, "\0\1\255\255\255\254\0\0abc")
+test("unpack_into1", pos == 12 and b == 3 and t[1] == 1 and t[2] == -2 and t[3] == "abc")
+pos, b = lib.compile("B c0 ="):unpack_into(t, "\2hi")
+test("unpack_into2", pos == 4 and b == 2 and t[1] == "hi" and t[2] == 4 and t[3] == "abc")
+test("unpack_into3", not pcall(l.unpack_into, l, t, "\0"))
+local wide = lib.compile(string.rep("<I2", 300))
+pos, b = wide:unpack_into(t, string.rep("\1\0", 300))
+test("unpack_into4", pos == 601 and b == 300 and t[300] == 1)
+
+testing("compiled vs interpreted")
+local data = "\1\2\3\4\5\6\7\8\9\10\11\12\13\14\15\16hello\0\3\0abc\0d\0\0\0"
+local fmts = {
+	"<I2 I4 b B", "!4 b i4 h", "!8 b d", "! b i8", ">!2 b h b i3 I",
+	"b X4 I4", "b X8", "(I2) I2 =", "= b = b", "<c0", "B c0",
+	"x3 s", "x16 s6", "x16 s5", "x21 <w", "x22 <W2 >W1", "<I2 (c2) I2",
+	"<e E", "!4 bi3 bi3", "I4 I4 I4 I4 I4",
+	"4I4", ">2[B H] 3b", "!4 b 3h", "!4 2[b i2]", "0I4 B", "B *B",
+	"B *[b s]", "<2[(B) c0]", "x2 *[B]",
+}
+for i, fmt in ipairs(fmts) do
+	for pos = 1, 6 do
+		test("same"..i.."_"..pos, same(fmt, data, pos))
+	end
+end
+
+testing("compiled repeat counts")
+local r = lib.compile(">2[B H] 4I2")
+test("repeat1", r.size == 14 and r.values == 8)
+test("repeat2", select(9, r:unpack(string.rep("\1", 14))) == 15)
+local v = lib.compile("B *[B s]")
+test("repeat3", v.size == nil and v.values == nil)
+local a, b, pos = v:unpack("\1\7ab\0")
+test("repeat4", a == 7 and b == "ab" and pos == 6)
+test("repeat5", not pcall(lib.compile, "2[B") and not pcall(lib.compile, "3<B"))
+test("repeat6", not pcall(lib.compile, "99999999999B"))
+test("repeat7", lib.compile("!4 b 3h").size == 8)
+-- a group too large to unroll is repeated as a loop, with the same values
+local big = lib.compile("1000000[B]")
+local t = {}
+test("repeat8", big.size == nil and big.values == 1000000 and big:unpack_into(t, string.rep("\1", 999999) .. "\2") == 1000001
+	and #t == 1000000 and t[1] == 1 and t[1000000] == 2)
+local d = "\7" .. string.rep("\1\2", 5000)
+local u, w = { lib.compile("<B 5000[H >]"):unpack(d) }, { lib.unpack("<B 5000[H >]", d) }
+test("repeat9", #u == 5002 and u[2] == 513 and u[3] == 258 and u[5001] == 258 and u[5002] == w[5002] and u[5001] == w[5001])
+-- a repetition that reads nothing stops the loop, whatever the count
+test("repeat10", lib.compile("I4 *[]"):unpack("\255\255\255\255") == 5 and lib.unpack("I4 *[]", "\255\255\255\255") == 5
+	and lib.compile("I4 *[(0B)]"):unpack_into({}, "\255\255\255\255") == 5)
+-- so does an element that reads nothing and has no value
+local ff = "\255\255\255\255"
+test("repeat11", lib.unpack("<I4 *x0", ff) == 5 and lib.compile("<I4 *x0"):unpack(ff) == 5
+	and lib.unpack("<!4 I4 *X4", ff .. ff) == 5 and lib.compile("<!4 I4 *X4"):unpack(ff .. ff) == 5
+	and lib.unpack_into({}, "<I4 *x0 (0B)", ff) == 5 and lib.compile("<I4 *x0"):unpack_into({}, ff) == 5
+	and lib.unpack("<!4 B *X4 B", "\2\0\0\0\9\0\0\0") == 9 and select(2, lib.compile("<!4 B *X4 B"):unpack("\2\0\0\0\9\0\0\0")) == 6
+	and lib.tryunpack("<I4 *x0 B", ff) == nil and select(2, lib.compile("<I4 *x0 B"):tryunpack(ff)) == "short")
+
+testing("views")
+-- a view gives the values Struct.unpack returns, by index
+local vfmts = {
+	"<I2 I4 b B", "!4 b i4 h", "!8 b d", ">!2 b h b i3 I", "b X4 I4", "(I2) I2 =", "= b = b",
+	"<I2 (c2) I2", "<e E", "!4 bi3 bi3", "4I4", ">2[B H] 3b", "!4 b 3h", "!4 2[b i2]", "x16 c5",
+}
+for i, fmt in ipairs(vfmts) do
+	local l, ok = lib.compile(fmt), true
+	for _, pos in ipairs({1, 9}) do
+		local want = { lib.unpack(fmt, data, pos) }
+		local view = l:view(data, pos)
+		ok = ok and #view == #want - 1 and view[0] == nil and view[#want] == nil
+		for k = 1, #want - 1 do
+			ok = ok and tostring(view[k]) == tostring(want[k])
+		end
+	end
+	test("view"..i, ok)
+end
+local hdr = lib.compile(">B B H I4", { "type", "flags", "length" })
+local view = hdr:view("\1\2\0\3\0\0\0\4")
+test("view_names1", view.type == 1 and view.flags == 2 and view.length == 3 and view[4] == 4)
+test("view_names2", not pcall(function() return view.nosuch end))
+test("view_retarget1", view:retarget("xx\9\8\0\7\0\0\0\6", 3) == view and view.flags == 8 and view[4] == 6)
+test("view_retarget2", not pcall(view.retarget, view, "\1\2\3") and view.flags == 8)
+test("view_retarget3", tostring(view) == 'View(">B B H I4") at 3')
+test("view_errors1", not pcall(lib.compile("B s").view, lib.compile("B s"), "\1a\0"))
+test("view_errors2", not pcall(lib.compile("!4 i4").view, lib.compile("!4 i4"), "\0\0\0\0\0", 2))
+test("view_errors3", not pcall(lib.compile, "B", { "a", "b" }) and not pcall(lib.compile, "B B", { "a", "a" })
+	and not pcall(lib.compile, "B", { 1 }))
+test("view_unnamed", lib.compile("B B B", { "a", false, "c" }):view("\1\2\3").c == 3)
+
+testing("compile_ffi")
+if not pcall(require, "ffi") then
+	test("compile_ffi0", not pcall(lib.compile_ffi, "B"))
+else
+	-- compares a generated unpacker against Struct.unpack, errors included
+	local function ffisame(fmt, data, pos)
+		local a = { pcall(lib.unpack, fmt, data, pos) }
+		local b = { pcall(lib.compile_ffi(fmt), data, pos) }
+		if #a ~= #b then return false end
+		for i = 1, #a do
+			if tostring(a[i]) ~= tostring(b[i]) then return false end
+		end
+		return true
+	end
+
+	local seed, bytes = 7, {}
+	for i = 1, 256 do
+		seed = (seed * 1103515245 + 12345) % 2147483648
+		bytes[i] = string.char(math.floor(seed / 65536) % 256)
+	end
+	local random = table.concat(bytes)
+	local edges = string.rep("\255", 64) .. string.rep("\0", 64) .. string.rep("\127\128", 32)
+	local ffifmts = {
+		"b B h H l L T", ">b B h H l L T", "<i2 I2 >i2 I2", "i3 I3 >i3 I3",
+		"<i4 I4 >i4 I4", "<i5 I6 >i7 I8", "<i8 >i8", "f d >f d",
+		"!4 b i4 h d", "!8 b d", ">!2 b h b i3 I", "b X4 I4", "(I2) I2 =",
+		"= b = b", "c5 <c1 x3 c2", "<e E >e E", "<I12 >i16", ">W2 <W1",
+		">4I4", ">2[B H] 3b", "!4 b 3h", "!4 2[b i2]", "0I4 B", "",
+	}
+	for i, fmt in ipairs(ffifmts) do
+		local ok = true
+		for pos = 1, 9 do
+			ok = ok and ffisame(fmt, random, pos) and ffisame(fmt, edges, pos)
+				and ffisame(fmt, edges, 128 + pos)
+		end
+		test("compile_ffi"..i, ok)
+	end
+
+	local f = lib.compile_ffi(">I2 i4")
+	test("compile_ffi_cache", lib.compile_ffi(">I2 i4") == f)
+	test("compile_ffi_short", ffisame(">I2 i4", "\0\1\0", 1) and not pcall(f, "\0\1\0"))
+	test("compile_ffi_args", ffisame(">I2 i4", random, "3") and ffisame(">I2 i4", random, 0)
+		and ffisame(">I2 i4", random, 1.5) and ffisame(">I2 i4", 12, 1))
+	test("compile_ffi_nosize", not pcall(lib.compile_ffi, "B s") and not pcall(lib.compile_ffi, "B *B"))
+	test("compile_ffi_toomany", not pcall(lib.compile_ffi, "200B") and pcall(lib.compile_ffi, "20B"))
+	-- a hot loop, compiled by the JIT, decodes the same values as Struct.unpack
+	local sum, expected = 0, 0
+	for pos = 1, 200, 4 do
+		local a, b = f(random, pos)
+		sum = sum + a * 65536 + b
+	end
+	for pos = 1, 200, 4 do
+		local a, b = lib.unpack(">I2 i4", random, pos)
+		expected = expected + a * 65536 + b
+	end
+	test("compile_ffi_loop", sum == expected)
+
+	testing("to_cdef")
+	local ffi, bit = require "ffi", require "bit"
+	-- reads value k of an overlaid record the way the to_cdef() documentation says
+	local function field(rec, methods, k, expected)
+		local v
+		if methods["f"..k] then v = rec["f"..k](rec) else v = rec["f"..k] end
+		if type(expected) == "string" and type(v) == "cdata" then return ffi.string(v, #expected) end
+		if type(expected) == "number" and type(v) == "cdata" then return tonumber(v) end
+		if type(v) == "cdata" then return (tostring(v):gsub("U?LL$", "")) end
+		return v
+	end
+	local scalar = {
+		">I2 <I4 b x3 !4 i4 >d <d f >f c3 (I2) i3 >i3 <I6 >i8 e >E >W2 <h",
+		"<I2 I4 I8 >I2 I4 I8 b B", "!8 b d h", "x5 <i5 >I7 I3 (c2) X4 i2",
+	}
+	for i, fmt in ipairs(scalar) do
+		local name = "cdeftest"..i
+		local decl, src = lib.to_cdef(fmt, name)
+		ffi.cdef(decl)
+		local methods = loadstring(src)(ffi, bit, lib.unpack)
+		ffi.metatype(name, { __index = methods })
+		local ok = ffi.sizeof(name) == lib.compile(fmt).size
+		for pos = 1, 65, 8 do
+			local rec = ffi.cast(name.." *", ffi.cast("const char *", random) + pos - 1)
+			local vals = { lib.unpack(fmt, random, pos) }
+			for k = 1, #vals - 1 do
+				ok = ok and tostring(field(rec, methods, k, vals[k])) == tostring(vals[k])
+			end
+		end
+		test("to_cdef"..i, ok)
+	end
+
+	local decl, src = lib.to_cdef("!4 b >3H <2i4 2c2 =", "cdefarrays")
+	ffi.cdef(decl)
+	local m = loadstring(src)(ffi, bit, lib.unpack)
+	ffi.metatype("cdefarrays", { __index = m })
+	local rec = ffi.cast("cdefarrays *", random)
+	local v = { lib.unpack("!4 b >3H <2i4 2c2 =", random) }
+	test("to_cdef_arrays1", ffi.sizeof("cdefarrays") == 20 and ffi.offsetof("cdefarrays", "f5") == 8)
+	test("to_cdef_arrays2", rec:f2(0) == v[2] and rec:f2(2) == v[4] and rec.f5[1] == v[6])
+	test("to_cdef_arrays3", ffi.string(rec.f7[1], 2) == v[8] and v[9] == 21)
+	test("to_cdef_errors", not pcall(lib.to_cdef, "B s", "x") and not pcall(lib.to_cdef, "B", "1x")
+		and not pcall(lib.to_cdef, "B", "a-b") and not pcall(lib.to_cdef, "B"))
+end
+
+testing("switch")
+local d = lib.switch(">B", {
+	[1] = ">I2",
+	[2] = lib.compile(">s"),
+	[3] = "",
+})
+local tag, v, pos = d:unpack("\1\0\5")
+test("switch1", tag == 1 and v == 5 and pos == 4)
+tag, v, pos = d:unpack("xx\2abc\0", 3)
+test("switch2", tag == 2 and v == "abc" and pos == 8)
+tag, pos = d:unpack("\3")
+test("switch3", tag == 3 and pos == 2)
+tag, v = d:unpack("\4\0\0")
+test("switch4", tag == nil and v == 4)
+test("switch5", not pcall(d.unpack, d, "\1\0"))
+tag, v, pos = d:tryunpack("\1\0")
+test("switch6", tag == nil and v == "short" and pos == 2)
+tag, v, pos = d:tryunpack("")
+test("switch7", tag == nil and v == "short" and pos == 1)
+tag, v = d:tryunpack("\4")
+test("switch8", tag == nil and v == 4)
+tag, v, pos = d:tryunpack("\1\0\5")
+test("switch9", tag == 1 and v == 5 and pos == 4)
+
+d = lib.switch(">B", { [1] = "B" }, ">I2")
+tag, v, pos = d:unpack("\9\1\2")
+test("switch_default1", tag == 9 and v == 258 and pos == 4)
+tag, v, pos = d:unpack("\1\1\2")
+test("switch_default2", tag == 1 and v == 1 and pos == 3)
+
+-- sparse tags use a hash
+local cases = {}
+for i = 1, 100 do cases[i * 1000003 - 50000000] = "c"..(i % 7 + 1) end
+d = lib.switch("<i4", cases)
+local ok = true
+for i = 1, 100 do
+	local t = i * 1000003 - 50000000
+	local msg = lib.pack("<i4", t)..string.rep("z", 8)
+	local rt, s, p = d:unpack(msg)
+	if rt ~= t or s ~= string.rep("z", i % 7 + 1) or p ~= 6 + i % 7 then ok = false end
+end
+test("switch_sparse1", ok)
+tag, v = d:unpack(lib.pack("<i4", 12345))
+test("switch_sparse2", tag == nil and v == 12345)
+
+-- the tag layout can have more values than the tag
+d = lib.switch("<B B", { [7] = "<I2" })
+local t, x, y, p = d:unpack("\7\8\1\0")
+test("switch_tagvalues", t == 7 and x == 8 and y == 1 and p == 5)
+
+d = lib.switch("B", {})
+test("switch_empty", d:unpack("\1") == nil)
+test("switch_badtag1", not pcall(lib.switch, "B", { x = "B" }))
+test("switch_badtag2", not pcall(lib.switch, "B", { [1.5] = "B" }))
+test("switch_badfmt1", not pcall(lib.switch, "B", { [1] = "y" }))
+test("switch_badfmt2", not pcall(lib.switch, "(B)", { [1] = "B" }))
+test("switch_badfmt3", not pcall(lib.switch, "B", { [1] = 5 }))
+
+testing("shared layouts")
+-- layouts compiled with the same format and names are shared, others are not
+local a = lib.compile(">H H", { "src", "dst" })
+local b = lib.compile(">H H", { "sport", "dport" })
+local v = a:view("\0\80\1\187")
+local w = b:view("\0\80\1\187")
+test("compile_shared1", v.src == 80 and v.dst == 443 and w.sport == 80 and w.dport == 443 and not pcall(function() return w.src end))
+test("compile_shared2", lib.compile(">H H", { "src", "dst" }):view("\0\1\0\2").dst == 2 and not pcall(function() return lib.compile(">H H", { "src" }):view("\0\1\0\2").dst end))
+test("compile_shared3", lib.compile(">H H").format == ">H H" and not pcall(lib.compile, ">H H", { 5 }))
+-- a name holding a NUL would make the same key as two names
+test("compile_shared4", not pcall(lib.compile, ">H H", { "a\0b" }) and lib.compile(">H H", { "a", "b" }):view("\0\1\0\2").b == 2)
+test("shared1", lib.shared("layout test pair") == nil)
+local p1 = lib.share("layout test pair", ">H H")
+local p2 = lib.share("layout test pair", lib.compile("<I4"))
+test("shared2", p1.format == ">H H" and p2.format == ">H H" and lib.shared("layout test pair").format == ">H H")
+test("shared3", lib.shared("layout test pair"):unpack("\0\1\0\2") == 1 and not pcall(lib.share, "x", "y") and not pcall(lib.share, 1, ">H"))
+-- layouts compiled and no longer used are dropped from the registry as it grows, the others stay
+local held = lib.compile(">H", { "held" })
+for i = 1, 3000 do
+	lib.compile(">H", { "n" .. i })
+	if i % 500 == 0 then collectgarbage() end
+end
+collectgarbage()
+test("compile_dropped", held:view("\0\7").held == 7 and lib.compile(">H", { "held" }):view("\0\1").held == 1
+	and lib.compile(">H", { "n2999" }):view("\0\2").n2999 == 2 and lib.shared("layout test pair").format == ">H H")
+
+testing("stored layouts")
+local stored = lib.compile("<I4 H", { "a", "b" })
+local store = os.tmpname()
+local saved = lib.save_layouts(store)
+test("store_save", saved >= 4)
+test("store_load", lib.load_layouts(store) == saved and lib.shared("layout test pair").format == ">H H")
+local f = io.open(store, "rb")
+local bytes = f:read("*a")
+f:close()
+local function load(contents)
+	local g = io.open(store, "wb")
+	g:write(contents)
+	g:close()
+	return lib.load_layouts(store)
+end
+local n, err = load(bytes:sub(1, -2))
+test("store_damaged1", n == nil and err:find("damaged") ~= nil)
+n, err = load(bytes:sub(1, 60) .. string.char((bytes:byte(61) + 1) % 256) .. bytes:sub(62))
+test("store_damaged2", n == nil and err:find("damaged") ~= nil)
+n, err = load("not a layout store at all, just some text")
+test("store_damaged3", n == nil and err:find("not a layout store") ~= nil)
+n, err = load(bytes:sub(1, 8) .. "\255\255\255\255" .. bytes:sub(13))
+test("store_version", n == nil and err:find("another version") ~= nil)
+
+-- a layout that passes the checksum is still checked before it is used: reseal() writes the
+-- checksum of the entries (64-bit FNV-1a, in 16-bit limbs) into the header
+local little = lib.pack("H", 1) == "\1\0"
+local function reseal(contents)
+	local h = { 0x2325, 0x8422, 0x9ce4, 0xcbf2 }
+	for i = 41, #contents do
+		h[1] = bit.bxor(h[1], contents:byte(i))
+		-- times 0x100000001b3
+		local r = { h[1] * 0x1b3, h[2] * 0x1b3, h[3] * 0x1b3 + h[1] * 0x100, h[4] * 0x1b3 + h[2] * 0x100 }
+		local carry = 0
+		for k = 1, 4 do
+			local v = r[k] + carry
+			h[k] = v % 0x10000
+			carry = math.floor(v / 0x10000)
+		end
+	end
+	local sum = little and lib.pack("<H H H H", h[1], h[2], h[3], h[4]) or lib.pack(">H H H H", h[4], h[3], h[2], h[1])
+	return contents:sub(1, 32) .. sum .. contents:sub(41)
+end
+test("store_reseal", load(reseal(bytes)) == saved)
+-- the second field (of 28 bytes) of ">H H" with names src and dst: its size is 8 bytes into it, its offset 16
+local key = "F>H H\0src\0dst"
+local k = bytes:find(key, 1, true)
+local layout = k + math.ceil(#key / 8) * 8
+local fields = layout + 15 * 4
+local function patch(at, value)
+	return reseal(bytes:sub(1, at - 1) .. lib.pack("I4", value) .. bytes:sub(at + 4))
+end
+n, err = load(patch(fields + 28 + 16, 1000))
+test("store_badoffset", n == nil and err:find("damaged") ~= nil)
+n, err = load(patch(fields + 28 + 8, 64))
+test("store_badsize", n == nil and err:find("damaged") ~= nil)
+n, err = load(patch(layout + 4 * 4, 1))
+test("store_badextent", n == nil and err:find("damaged") ~= nil)
+n, err = load(patch(layout + 11 * 4, 3))
+test("store_badnames", n == nil and err:find("damaged") ~= nil)
+-- layouts loaded under keys not registered yet are used from the mapped file: this store has
+-- "<I4 H" under the key of "<I4<H", which compiles to the same elements
+key = "F<I4 H\0a\0b"
+k = bytes:find(key, 1, true)
+n = load(reseal(bytes:sub(1, k - 1) .. "F<I4<H\0a\0b" .. bytes:sub(k + #key)))
+local mapped = lib.compile("<I4<H", { "a", "b" })
+local mv = mapped:view("\1\0\0\0\2\0")
+test("store_mapped", n == saved and mapped.format == "<I4 H" and mv.a == 1 and mv.b == 2
+	and select(2, mapped:unpack("\7\0\0\0\9\0")) == 9 and stored.format == "<I4 H")
+os.remove(store)
+test("store_missing", lib.load_layouts(store) == nil and not pcall(lib.save_layouts, store .. "/no/such/dir/x"))
+
+print("\n-----------------------------\n")
+
+print("All layout tests passed!\n\n")
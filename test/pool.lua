@@ -0,0 +1,84 @@
+-- Tests the wstpool program: lua pool.lua path/to/wstpool
+
+local function testing(...)
+	print("---- Testing "..tostring(...).." ----")
+end
+
+local function test(name, ...)
+	io.stdout:write("test "..name.."...")
+	if (...) == true then
+		io.stdout:write("passed\n")
+	else
+		io.stdout:write("failed!\n")
+		error(name.." test failed!")
+	end
+end
+
+local wstpool = assert(arg and arg[1], "usage: pool.lua path/to/wstpool")
+
+local function readfile(name)
+	local f = assert(io.open(name, "rb"))
+	local s = f:read("*a")
+	f:close()
+	return s
+end
+
+-- records of random lengths, some of which make the handler fail
+math.randomseed(7)
+local input, records, bytes = os.tmpname(), {}, 0
+local f = assert(io.open(input, "wb"))
+for i = 1, 3000 do
+	local rec = i % 97 == 0 and "error " .. i or string.rep(string.char(97 + i % 26), math.random(0, 40))
+	records[i] = rec
+	bytes = bytes + #rec
+	f:write(rec, "\n")
+end
+f:close()
+
+-- runs wstpool on the input; returns its output, its error lines and the statistics lines
+local function run(options)
+	local out, err = os.tmpname(), os.tmpname()
+	os.execute(string.format("%s %s -s poolhandler.lua %s > %s 2> %s", wstpool, options, input, out, err))
+	local output, errors, stats = readfile(out), {}, {}
+	for line in readfile(err):gmatch("[^\n]+") do
+		if line:match("^wstpool: ") then
+			errors[#errors + 1] = line
+		elseif line:match("^%s*%d") then
+			stats[#stats + 1] = line
+		end
+	end
+	os.remove(out)
+	os.remove(err)
+	return output, errors, stats
+end
+
+local expected, experrors, nerrors = {}, {}, 0
+for i, rec in ipairs(records) do
+	if rec:sub(1, 5) == "error" then
+		nerrors = nerrors + 1
+		experrors[#experrors + 1] = "wstpool: record " .. i .. ": bad record"
+	else
+		expected[#expected + 1] = string.format("%d %d %s\n", i, #rec, rec:upper())
+	end
+end
+expected = table.concat(expected)
+
+for _, options in ipairs({ "-n 4", "-n 4 -w 16", "-n 3 -w 6", "-n 1 -w 1" }) do
+	testing("wstpool " .. options)
+	local output, errors, stats = run(options)
+	test("order", output == expected)
+	test("errors", #errors == #experrors and table.concat(errors, "\n") == table.concat(experrors, "\n"))
+	-- worker, records, bytes, errors, stolen, records/s, depth, max
+	local n, b, e = 0, 0, 0
+	for _, line in ipairs(stats) do
+		local w, r, by, er, st, rate, depth = line:match("^%s*(%d+)%s+(%d+)%s+(%d+)%s+(%d+)%s+(%d+)%s+(%d+)%s+(%d+)")
+		n, b, e = n + tonumber(r), b + tonumber(by), e + tonumber(er)
+		if tonumber(depth) ~= 0 then n = -1 end
+	end
+	test("stats", #stats == tonumber(options:match("-n (%d+)")) and n == #records and b == bytes and e == nerrors)
+end
+os.remove(input)
+
+print("\n-----------------------------\n")
+
+print("All pool tests passed!\n\n")
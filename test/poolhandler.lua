@@ -0,0 +1,15 @@
+-- A wstpool handler for pool.lua: takes a random time over each record, so that
+-- records finish out of order and the workers steal from each other
+
+local worker = ...
+math.randomseed(worker)
+
+return function(rec, n)
+	local t = os.clock() + math.random() * 0.0002
+	while os.clock() < t do end
+	if rec:sub(1, 5) == "error" then
+		error("bad record", 0)
+	end
+	local len = Struct.unpack(">I2", Struct.pack(">I2", #rec))
+	return string.format("%d %d %s\n", n, len, rec:upper())
+end
@@ -337,6 +337,612 @@ test("format_unpack5",a == "bye")
 
 
 
+testing("bounded strings")
+x = "abc\0def\0"
+a, i = lib.unpack("s4", x)
+test("bounded_unpack1", a == "abc" and i == 5)
+test("bounded_unpack2", not pcall(lib.unpack, "s3", x))
+a, b, i = lib.unpack("s8s8", x)
+test("bounded_unpack3", a == "abc" and b == "def" and i == 9)
+test("bounded_unpack4", not pcall(lib.unpack, "s8", "abcdefghijk"))
+test("bounded_unpack5", not pcall(lib.unpack, "s20", "abcdef"))
+test("bounded_pack1", lib.pack("s4", "abc") == "abc\0")
+test("bounded_pack2", not pcall(lib.pack, "s4", "abcd"))
+test("bounded_values1", lib.values("s4 B s16") == 3)
+
+testing("utf-16 strings")
+local u16le = "h\0\233\0l\0\172\32\61\216\0\222\0\0"   -- "h", e-acute, "l", euro, U+1F600, NUL
+local u8 = "h\195\169l\226\130\172\240\159\152\128"
+a, i = lib.unpack("<w", u16le)
+test("utf16_unpack1", a == u8 and i == #u16le + 1)
+test("utf16_pack1", lib.pack("<w", u8) == u16le)
+local u16be = lib.pack(">w", u8)
+test("utf16_pack2", #u16be == #u16le and u16be:sub(1,2) == "\0h")
+test("utf16_unpack2", lib.unpack(">w", u16be) == u8)
+a, b, i = lib.unpack("<ws", u16le.."ok\0")
+test("utf16_unpack3", a == u8 and b == "ok" and i == #u16le + 4)
+test("utf16_unpack4", not pcall(lib.unpack, "<w", "a\0b\0"))
+test("utf16_unpack5", not pcall(lib.unpack, "<w3", u16le))
+test("utf16_unpack6", lib.unpack("<w7", u16le) == u8)
+test("utf16_unpack7", lib.unpack("<w", "\0\0") == "")
+-- long enough to go through the block scanner, with odd start position
+local long = string.rep("A\0", 37).."\1\1\0\0"
+a, i = lib.unpack("<w", "x"..long, 2)
+test("utf16_unpack8", a == string.rep("A", 37).."\196\129" and i == #long + 2)
+test("utf16_unpack9", lib.unpack("<W3", "a\0b\0c\0") == "abc")
+test("utf16_unpack10", lib.unpack(">W2", "\0a\0b") == "ab")
+test("utf16_unpack11", lib.unpack("<BW0", "\2a\0b\0") == "ab")
+test("utf16_unpack12", not pcall(lib.unpack, "<BW0", "\3a\0b\0"))
+test("utf16_unpack13", lib.unpack("<W1", "\0\216") == "\239\191\189")  -- lone surrogate
+test("utf16_unpack14", lib.unpack("<W2", "\0\220\0\216") == "\239\191\189\239\191\189")
+test("utf16_pack3", lib.pack("<W2", "abc") == "a\0b\0")
+test("utf16_pack4", not pcall(lib.pack, "<W4", "abc"))
+test("utf16_pack5", lib.pack("<BW0", 2, "ab") == "\2a\0b\0")
+test("utf16_pack6", not pcall(lib.pack, "<w3", "abc"))
+test("utf16_pack7", lib.pack("<w4", "abc") == "a\0b\0c\0\0\0")
+test("utf16_size1", lib.size("<W4") == 8)
+test("utf16_size2", not pcall(lib.size, "w"))
+test("utf16_size3", not pcall(lib.size, "W0"))
+test("utf16_values1", lib.values("<w W2 BW0") == 4)
+
+
+testing("tlv")
+-- RADIUS-style: 1-byte type, 1-byte length including the 2-byte header
+local radius = "\1\5abc\4\6\10\0\0\1\80\2"
+local tags, offs, lens = {}, {}, {}
+for t, o, l in lib.tlv(radius, "B", "B", 1, nil, "h") do
+	tags[#tags+1], offs[#offs+1], lens[#lens+1] = t, o, l
+end
+test("tlv1", #tags == 3 and tags[1] == 1 and tags[2] == 4 and tags[3] == 80)
+test("tlv2", offs[1] == 3 and lens[1] == 3 and radius:sub(offs[1], offs[1]+lens[1]-1) == "abc")
+test("tlv3", offs[2] == 8 and lens[2] == 4 and offs[3] == 14 and lens[3] == 0)
+-- DHCP-style: the length excludes the header
+local t, o, l = lib.tlv("\53\1\5", "B", "B")()
+test("tlv4", t == 53 and o == 3 and l == 1)
+-- wider, big-endian tags and lengths, with begin and end positions
+local lldp = "xx\0\1\0\2hi\0\2\0\1!\0\3\0\0yy"
+local at, ao, al, stop = lib.tlv(lldp, ">I2", ">I2", 3, #lldp - 2, "a")
+test("tlv5", #at == 3 and at[1] == 1 and ao[1] == 7 and al[1] == 2 and at[2] == 2 and al[2] == 1)
+test("tlv6", at[3] == 3 and al[3] == 0 and stop == #lldp - 1)
+-- malformed lengths stop iteration without an error
+at, ao, al, stop = lib.tlv("\1\2ab\2\9ab", "B", "B", 1, nil, "a")
+test("tlv7", #at == 1 and stop == 5)
+at, ao, al, stop = lib.tlv("\1\1x", "B", "B", 1, nil, "ah")
+test("tlv8", #at == 0 and stop == 1)
+at, ao, al, stop = lib.tlv("\1\0\2", "B", "B", 1, nil, "a")
+test("tlv9", #at == 1 and stop == 3)
+local n = 0
+for _ in lib.tlv("\1\0\2\200\3", "B", "B") do n = n + 1 end
+test("tlv10", n == 1)
+at = lib.tlv("\255\255\0\1\0", "<i2", ">I2", 1, nil, "a")
+test("tlv11", #at == 1 and at[1] == -1)
+at = lib.tlv("", "B", "B", 1, nil, "a")
+test("tlv12", #at == 0)
+test("tlv13", not pcall(lib.tlv, "\1\0", "s", "B"))
+test("tlv14", not pcall(lib.tlv, "\1\0", "B", "c1"))
+test("tlv15", not pcall(lib.tlv, "\1\0", "B", "B", 1, nil, "z"))
+test("tlv16", not pcall(lib.tlv, "\1\0\0", "!2 >H", "B"))
+test("tlv17", #lib.tlv("\1\0", lib.compile("B"), lib.compile("B"), 1, nil, "a") == 1)
+
+
+testing("ber")
+local hex = lib.fromhex
+-- SEQUENCE { INTEGER 5, OCTET STRING "hi", [1] { NULL } }
+local der = hex("300b02010504026869a1020500")
+local t, pos = lib.ber(der)
+test("ber1", t and t.n == 5 and pos == #der + 1)
+test("ber2", t.class[1] == 0 and t.tag[1] == 16 and t.constructed[1] == true and t.header[1] == 1 and t.offset[1] == 3 and t.length[1] == 11)
+test("ber3", t.tag[2] == 2 and t.offset[2] == 5 and t.length[2] == 1 and t.depth[2] == 1)
+test("ber4", t.tag[3] == 4 and der:sub(t.offset[3], t.offset[3] + t.length[3] - 1) == "hi")
+test("ber5", t.class[4] == 2 and t.tag[4] == 1 and t.constructed[4] and t.depth[4] == 1)
+test("ber6", t.tag[5] == 5 and t.length[5] == 0 and t.depth[5] == 2)
+-- indefinite lengths, high tag numbers, long-form lengths
+local ber = hex("3080" .. "5f8100820003616263" .. "a080" .. "0101ff" .. "0000" .. "0000")
+t = lib.ber(ber)
+test("ber7", t and t.n == 4 and t.length[1] == #ber - 4)
+test("ber8", t.class[2] == 1 and t.tag[2] == 128 and t.length[2] == 3 and t.offset[2] == 9)
+test("ber9", t.tag[3] == 0 and t.class[3] == 2 and t.length[3] == 3 and t.depth[4] == 2)
+-- several top-level elements, begin and end
+t, pos = lib.ber("xx" .. hex("0500" .. "0500") .. "yy", 3, 6)
+test("ber10", t.n == 2 and t.header[2] == 5 and pos == 7)
+-- malformed data
+local v, msg, epos = lib.ber(hex("3005020105"))
+test("ber11", v == nil and msg == "length exceeds the enclosing data" and epos == 1)
+v, msg, epos = lib.ber(hex("30800500"))
+test("ber12", v == nil and msg == "missing end-of-contents")
+v, msg = lib.ber(hex("0480"))
+test("ber13", v == nil and msg == "indefinite length on a primitive element")
+v, msg, epos = lib.ber(hex("30020000"))
+test("ber14", v == nil and msg == "unexpected end-of-contents" and epos == 3)
+v, msg = lib.ber(hex("30"))
+test("ber15", v == nil and msg == "truncated length")
+v, msg = lib.ber(string.rep(hex("3080"), 40))
+test("ber16", v == nil and msg == "maximum depth exceeded")
+v, msg = lib.ber(string.rep(hex("3080"), 40) .. string.rep(hex("0000"), 40), 1, nil, 40)
+test("ber17", v and v.n == 40 and v.depth[40] == 39)
+test("ber18", not pcall(lib.ber, "", 1, nil, 1000))
+test("ber19", lib.ber("").n == 0)
+
+testing("berinteger")
+test("berinteger1", lib.berinteger(hex("05")) == Int64(5))
+test("berinteger2", lib.berinteger(hex("ff")) == Int64(-1))
+test("berinteger3", lib.berinteger(hex("0080")) == Int64(128))
+test("berinteger4", lib.berinteger(hex("8000000000000000")) == Int64.min())
+test("berinteger5", lib.berinteger(hex("00ffffffffffffffff")) == UInt64.max())
+test("berinteger6", lib.berinteger(hex("01ffffffffffffffff")) == nil)
+test("berinteger7", lib.berinteger("") == nil)
+test("berinteger8", lib.berinteger(hex("02020100"), 3, 2) == Int64(256))
+test("berinteger9", not pcall(lib.berinteger, hex("0201"), 2, 5))
+
+testing("beroid")
+test("beroid1", lib.beroid(hex("2a864886f70d01")) == "1.2.840.113549.1")
+test("beroid2", lib.beroid(hex("550403")) == "2.5.4.3")
+test("beroid3", lib.beroid(hex("8837")) == "2.999")
+test("beroid4", lib.beroid(hex("06032a8648"), 3, 3) == "1.2.840")
+test("beroid5", lib.beroid(hex("2a86")) == nil)
+test("beroid6", lib.beroid(hex("2a8001")) == nil)
+test("beroid7", lib.beroid("") == nil)
+test("beroid8", lib.beroid(hex("00")) == "0.0")
+
+
+testing("pbscan")
+-- field 1 varint 150, field 2 "testing", field 3 { field 1 varint 1 }, field 4 fixed32, field 5 fixed64
+local pb = hex("089601" .. "120774657374696e67" .. "1a020801" .. "2578563412" .. "290100000000000080")
+local t = lib.pbscan(pb)
+test("pbscan1", t and t.n == 6)
+test("pbscan2", t.field[1] == 1 and t.wiretype[1] == 0 and t.value[1] == 150 and t.offset[1] == 2 and t.length[1] == 2)
+test("pbscan3", t.field[2] == 2 and t.wiretype[2] == 2 and pb:sub(t.offset[2], t.offset[2] + t.length[2] - 1) == "testing")
+test("pbscan4", t.nested[2] == false and t.value[2] == false)
+test("pbscan5", t.field[3] == 3 and t.nested[3] == true and t.field[4] == 1 and t.value[4] == 1 and t.depth[4] == 1)
+test("pbscan6", t.field[5] == 4 and t.wiretype[5] == 5 and t.value[5] == 0x12345678 and t.depth[5] == 0)
+test("pbscan7", t.field[6] == 5 and t.value[6] == UInt64(1, 0x80000000))
+-- varints above 2^53 become UInt64
+t = lib.pbscan(hex("08ffffffffffffffffff01" .. "088080808080808010"))
+test("pbscan8", t.value[1] == UInt64.max() and t.value[2] == 2^53)
+-- no recursion with a depth of 0
+t = lib.pbscan(pb, 1, nil, 0)
+test("pbscan9", t.n == 5 and t.nested[3] == false)
+-- begin and end
+t = lib.pbscan("xx" .. hex("0801") .. "yy", 3, 4)
+test("pbscan10", t.n == 1 and t.value[1] == 1)
+test("pbscan11", lib.pbscan("").n == 0)
+-- malformed data
+local v, msg, epos = lib.pbscan(hex("0801" .. "1205616263"))
+test("pbscan12", v == nil and msg == "length exceeds the enclosing data" and epos == 3)
+v, msg = lib.pbscan(hex("0880"))
+test("pbscan13", v == nil and msg == "malformed varint")
+v, msg = lib.pbscan(hex("0b00"))
+test("pbscan14", v == nil and msg == "unsupported wire type")
+v, msg = lib.pbscan(hex("0001"))
+test("pbscan15", v == nil and msg == "invalid field number")
+test("pbscan16", not pcall(lib.pbscan, "", 1, nil, 100))
+
+
+testing("tryunpack")
+a, b, i = lib.tryunpack(">I2 s", "\0\1ab\0")
+test("tryunpack1", a == 1 and b == "ab" and i == 6)
+a, b, i = lib.tryunpack(">I2 I4", "\0\1\0\0")
+test("tryunpack2", a == nil and b == "short" and i == 3)
+a, b, i = lib.tryunpack("b s", "\1abc")
+test("tryunpack3", a == nil and b == "unfinished" and i == 2)
+a, b, i = lib.tryunpack("s3", "abcd\0")
+test("tryunpack4", a == nil and b == "bound" and i == 1)
+a, b, i = lib.tryunpack("(b) c0", "\3abc")
+test("tryunpack5", a == nil and b == "nosize" and i == 2)
+a, b, i = lib.tryunpack("b c0", "\9abc")
+test("tryunpack6", a == nil and b == "short" and i == 2)
+a, b, i = lib.tryunpack("<w", "a\0b\0", 1)
+test("tryunpack7", a == nil and b == "unfinished" and i == 1)
+a, b, i = lib.tryunpack("b", "", 1)
+test("tryunpack8", a == nil and b == "short" and i == 1)
+test("tryunpack9", not pcall(lib.tryunpack, "y", "abc"))
+test("tryunpack10", not pcall(lib.tryunpack, "b", 5))
+local ok, msg = pcall(lib.unpack, ">I2 I4", "\0\1\0\0")
+test("tryunpack11", not ok and msg:find("data string too short", 1, true) ~= nil)
+ok, msg = pcall(lib.unpack, "s3", "abcd\0")
+test("tryunpack12", not ok and msg:find("string exceeds maximum length", 1, true) ~= nil)
+
+
+testing("unpack_into")
+local t = {}
+i, a = lib.unpack_into(t, ">I2 s (b) c2 =", "\0\7ab\0\9xy")
+test("unpack_into1", i == 9 and a == 4 and t[1] == 7 and t[2] == "ab" and t[3] == "xy" and t[4] == 9)
+i, a = lib.unpack_into(t, "B c0 B", "\2hi\5")
+test("unpack_into2", i == 5 and a == 2 and t[1] == "hi" and t[2] == 5 and t[3] == "xy")
+i = lib.unpack_into(t, "B", "\1\2", 2)
+test("unpack_into3", i == 3 and t[1] == 2)
+local wide = string.rep("<I2", 300)
+local data = string.rep("\1\0", 300)
+i, a = lib.unpack_into(t, wide, data)
+test("unpack_into4", i == 601 and a == 300 and t[300] == 1)
+test("unpack_into5", not pcall(lib.unpack_into, t, ">I4", "\1\2"))
+test("unpack_into6", not pcall(lib.unpack_into, nil, ">I4", "\1\2\3\4"))
+local ok, msg = pcall(lib.unpack_into, t, ">I4", "\1\2")
+test("unpack_into7", msg:find("#3", 1, true) ~= nil)
+
+
+
+testing("repeat counts and groups")
+test("repeat1", lib.pack(">3H", 1, 2, 3) == lib.pack(">H H H", 1, 2, 3))
+test("repeat2", lib.size(">16I4") == 64 and lib.values(">16I4") == 16)
+test("repeat3", lib.size("!4 3[b i4]") == 24 and lib.values("2[B (B) >H]") == 4)
+test("repeat4", lib.pack("2[B >H]", 1, 2, 3, 4) == "\1\0\2\3\0\4")
+a, b, c, d, i = lib.unpack("2[B >H]", "\1\0\2\3\0\4")
+test("repeat5", a == 1 and b == 2 and c == 3 and d == 4 and i == 7)
+test("repeat6", lib.pack(">B *H", 2, 5, 6) == "\2\0\5\0\6")
+a, b, i = lib.unpack(">B *H", "\2\0\5\0\6")
+test("repeat7", a == 5 and b == 6 and i == 6)
+a, b, c, i = lib.unpack("B *[B s] B", "\1\7ab\0\9")
+test("repeat8", a == 7 and b == "ab" and c == 9 and i == 7)
+test("repeat9", select("#", lib.unpack("B *B", "\0")) == 1)
+test("repeat10", lib.pack("0B 2[]") == "" and lib.size("0I4 B") == 1)
+test("repeat11", lib.pack("!4 b 2i2 b", 1, 2, 3, 4) == "\1\0\2\0\3\0\4")
+test("repeat12", lib.pack(">2[1[2B] H]", 1, 2, 3, 4, 5, 6) == "\1\2\0\3\4\5\0\6")
+test("repeat13", lib.unpack("3x B", "\0\0\0\5") == 5)
+local ok, msg = pcall(lib.unpack, "*B", "\1")
+test("repeat14", not ok and msg:find("needs a previous", 1, true) ~= nil)
+a, b, i = lib.tryunpack(">B *H", "\2\0\5")
+test("repeat15", a == nil and b == "short" and i == 4)
+test("repeat16", select(2, lib.tryunpack("c2 *B", "ab")) == "nosize")
+test("repeat17", not pcall(lib.size, "B *B") and not pcall(lib.values, "B *[B]"))
+test("repeat18", not pcall(lib.pack, "2[B") and not pcall(lib.pack, "3!4 B", 1))
+test("repeat19", not pcall(lib.pack, "99999999999B") and not pcall(lib.pack, "*B", 1))
+test("repeat20", not pcall(lib.size, string.rep("[", 33) .. string.rep("]", 33)))
+test("repeat21", lib.size(string.rep("[", 32) .. "B" .. string.rep("]", 32)) == 1)
+
+
+testing("C entry points")
+test("cdef1", type(lib.cdef()) == "string" and lib.cdef():find("wst_load_u32be", 1, true) ~= nil)
+local hasffi, ffi = pcall(require, "ffi")
+local sopath = hasffi and package.searchpath and package.searchpath("wiresharktypes", package.cpath)
+if sopath then
+	ffi.cdef(lib.cdef())
+	local C = ffi.load(sopath)
+	local raw = "\1\2\3\4\5\6\7\8\192\168\0\1"
+	local p = ffi.cast("const uint8_t *", raw)
+	test("cdef2", C.wst_load_u32be(p) == lib.unpack(">I4", raw) and C.wst_load_u32le(p) == lib.unpack("<I4", raw))
+	test("cdef3", C.wst_load_u16be(p) == 0x0102 and C.wst_load_u16le(p) == 0x0201)
+	test("cdef4", C.wst_load_u64be(p) == 0x0102030405060708ULL and C.wst_load_u64le(p) == 0x0807060504030201ULL)
+	local buf = ffi.new("char[?]", 64)
+	test("cdef5", ffi.string(buf, C.wst_bin2hex(buf, p, 8, 0)) == lib.tohex(raw:sub(1, 8)))
+	local bin = ffi.new("uint8_t[?]", 8)
+	test("cdef6", ffi.string(bin, C.wst_hex2bin(bin, "0a:0B:zz", 8, ":")) == "\10\11")
+	test("cdef7", ffi.string(buf, C.wst_ipv4_to_str(buf, p + 8)) == "192.168.0.1")
+	local a16 = ffi.new("uint8_t[16]")
+	test("cdef8", C.wst_str_to_ipv6("fe80::1", 7, a16) == 1 and ffi.string(buf, C.wst_ipv6_to_str(buf, a16)) == "fe80::1")
+	test("cdef9", C.wst_str_to_ether("00:11:22:33:44:5G", 17, a16) == 0)
+	test("cdef10", ffi.string(C.wst_cdef()) == lib.cdef())
+end
+
+testing("filter")
+local recs = {}
+for i = 0, 99 do
+	recs[#recs + 1] = lib.pack(">H H b c2", i, i % 3 == 0 and 443 or 80, i % 7 - 3, i % 2 == 0 and "ok" or "no")
+end
+local blob = table.concat(recs)
+local function brute(pred)
+	local t = {}
+	for i = 0, 99 do
+		local a, b, c, d = lib.unpack(">H H b c2", blob, i * 7 + 1)
+		if pred(a, b, c, d) then t[#t + 1] = i * 7 + 1 end
+	end
+	return t
+end
+local function sameset(a, b)
+	if #a ~= #b then return false end
+	for i = 1, #a do if a[i] ~= b[i] then return false end end
+	return true
+end
+local fpos, fend = lib.filter(">H H b c2", blob, { "and", { "~=", 3, 0 }, { "==", 2, 443 } })
+test("filter1", sameset(fpos, brute(function(a, b, c) return c ~= 0 and b == 443 end)) and fend == 701)
+test("filter2", sameset(lib.filter(">H H b c2", blob, { "or", { "<", 3, -1 }, { "not", { "<=", 1, 90 } } }),
+	brute(function(a, b, c) return c < -1 or not (a <= 90) end)))
+test("filter3", sameset(lib.filter(">H H b c2", blob, { "==", 4, "ok" }), brute(function(a, b, c, d) return d == "ok" end)))
+test("filter4", sameset(lib.filter(">H H b c2", blob, { "&", 1, 5 }), brute(function(a) return a % 2 == 1 or a % 8 >= 4 end)))
+test("filter5", #lib.filter(">H H b c2", blob, { ">=", 1, UInt64(98) }) == 2
+	and #lib.filter(">H H b c2", blob, { ">", 3, Int64(-2) }) == #brute(function(a, b, c) return c > -2 end))
+local recs2 = lib.filter(lib.compile(">H H b c2", { "id", "port" }), blob, { "==", "id", 42 }, 1, "records")
+test("filter6", recs2 == recs[43])
+fpos, fend = lib.filter(">H H b c2", blob:sub(1, 20), { "and" }, 8)
+test("filter7", sameset(fpos, { 8 }) and fend == 15)
+test("filter8", #lib.filter("<E", lib.pack("<E E", UInt64(0, 0x80000000), UInt64(1)), { ">", 1, UInt64(0, 0x7fffffff) }) == 1
+	and #lib.filter("<e", lib.pack("<e", Int64(-1)), { "<", 1, 0 }) == 1
+	and #lib.filter("<d", lib.pack("<d d", 0/0, 1.5), { "~=", 1, 1.5 }) == 1)
+-- integers and floats compare exactly beyond 2^53 and outside the range of 64-bit integers
+local umax, p53 = UInt64(0xffffffff, 0xffffffff), UInt64(0, 0x200000)
+test("filter10", #lib.filter("<E", lib.pack("<E", umax), { "<", 1, 2^64 }) == 1
+	and #lib.filter("<E", lib.pack("<E", umax), { "==", 1, 2^64 }) == 0
+	and #lib.filter("<e", lib.pack("<e", Int64(0, 0x80000000)), { ">", 1, -2^64 }) == 1
+	and #lib.filter("<d", lib.pack("<d", 2^53), { "<", 1, p53 + 1 }) == 1
+	and #lib.filter("<d", lib.pack("<d", 2^53), { "==", 1, p53 }) == 1
+	and #lib.filter("<E", lib.pack("<E", p53 + 1), { ">", 1, 2^53 }) == 1
+	and #lib.filter("<e", lib.pack("<e e e", Int64(-3), Int64(-2), Int64(3)), { "<", 1, -2.5 }) == 1
+	and #lib.filter("<E", lib.pack("<E", umax), { "<", 1, 1/0 }) == 1 and #lib.filter("<e", lib.pack("<e", Int64(0)), { "~=", 1, 0/0 }) == 1)
+test("filter9", not pcall(lib.filter, "B s", "\1a\0", { "and" }) and not pcall(lib.filter, "B", "\1", { "=", 1, 1 })
+	and not pcall(lib.filter, "B", "\1", { "==", 2, 1 }) and not pcall(lib.filter, "c2", "ab", { "==", 1, 1 })
+	and not pcall(lib.filter, "B", "\1", { "==", "x", 1 }) and not pcall(lib.filter, "!4 i4 B", "", { "and" }))
+
+testing("aggregate")
+local agg = lib.aggregate(">H H b c2", blob, 2, 3)
+local want = {}
+for i = 0, 99 do
+	local a, b, c = lib.unpack(">H H b c2", blob, i * 7 + 1)
+	local g = want[b] or { count = 0, sum = 0, min = c, max = c }
+	g.count, g.sum, g.min, g.max = g.count + 1, g.sum + c, math.min(g.min, c), math.max(g.max, c)
+	want[b] = g
+end
+local ok = true
+for k, g in pairs(want) do
+	local r = agg[k]
+	ok = ok and r and r.count == g.count and r.sum == g.sum and r.min == g.min and r.max == g.max
+end
+for k in pairs(agg) do ok = ok and want[k] ~= nil end
+test("aggregate1", ok)
+agg = lib.aggregate(lib.compile(">H H b c2", { "id", "port", "delta", "state" }), blob, "state", nil)
+test("aggregate2", agg.ok.count == 50 and agg.no.count == 50 and agg.ok.sum == nil)
+agg = lib.aggregate(">H H b c2", blob, 3, 1, { "max" })
+test("aggregate3", agg[-3].max == 98 and agg[-3].count == nil)
+-- many keys make the table grow
+local keys = {}
+for i = 1, 3000 do keys[i] = lib.pack("<I4 I4", i % 1000, i) end
+agg = lib.aggregate("<I4 I4", table.concat(keys), 1, 2)
+test("aggregate4", agg[7].count == 3 and agg[7].sum == 7 + 1007 + 2007 and agg[0].max == 3000)
+-- sums that a double cannot hold are exact
+agg = lib.aggregate("<B x7 E", lib.pack("B x7 E B x7 E", 1, UInt64(0xffffffff, 0x1fffff), 1, UInt64(3)), 1, 2)
+test("aggregate5", tostring(agg[1].sum) == tostring(UInt64(2, 0x200000)) and agg[1].min == 3)
+test("aggregate6", not pcall(lib.aggregate, "<E", lib.pack("<E E", UInt64(0, 0x80000000), UInt64(0, 0x80000000)), 1, 1))
+agg = lib.aggregate("<e", lib.pack("<e e", Int64(-1), Int64(0xffffffff, 0x7fffffff)), 1)
+test("aggregate7", agg[-1].count == 1 and #(function() local n = {} for k in pairs(agg) do n[#n+1] = k end return n end)() == 2)
+agg = lib.aggregate("<B d", lib.pack("<B d B d B d", 1, 0/0, 1, 2.5, 1, -1), 1, 2)
+test("aggregate8", agg[1].min == -1 and agg[1].max == 2.5 and agg[1].sum ~= agg[1].sum)
+test("aggregate9", not pcall(lib.aggregate, "<B d", "", 2, 1) and not pcall(lib.aggregate, "B c2", "", 1, 2)
+	and not pcall(lib.aggregate, "B", "", 1, nil, { "sum" }) and not pcall(lib.aggregate, "B B", "", 1, 2, { "avg" }))
+
+testing("sort")
+local function sorted(fmt, blob, key, cmp)
+	local size, t = lib.size(fmt), {}
+	for p = 1, #blob - size + 1, size do t[#t + 1] = { p, (select(key, lib.unpack(fmt, blob, p))) } end
+	table.sort(t, function(a, b) if a[2] ~= b[2] then return cmp(a[2], b[2]) end return a[1] < b[1] end)
+	local pos = {}
+	for i, e in ipairs(t) do pos[i] = e[1] end
+	return pos
+end
+local lt = function(a, b) return a < b end
+for _, key in ipairs({ 1, 2, 3 }) do
+	test("sort"..key, sameset(lib.sort(">H H b c2", blob, key, "positions"), sorted(">H H b c2", blob, key, lt)))
+end
+local rnd, nums = 12345, {}
+for i = 1, 500 do
+	rnd = (rnd * 1103515245 + 12345) % 2147483648
+	nums[i] = lib.pack("<i4 d I2", rnd - 1073741824, (rnd % 1000 - 500) / 7, i)
+end
+local blob2 = table.concat(nums)
+test("sort4", sameset(lib.sort("<i4 d I2", blob2, 1, "positions"), sorted("<i4 d I2", blob2, 1, lt)))
+test("sort5", sameset(lib.sort("<i4 d I2", blob2, 2, "positions"), sorted("<i4 d I2", blob2, 2, lt)))
+local sblob, send = lib.sort("<i4 d I2", blob2 .. "xyz", 1)
+local prev, ok = -math.huge, #sblob == #blob2 and send == #blob2 + 1
+for p = 1, #sblob, 14 do
+	local v = lib.unpack("<i4", sblob, p)
+	ok = ok and v >= prev
+	prev = v
+end
+test("sort6", ok)
+local e = lib.pack("<e e e E", Int64(-1), Int64(0xffffffff, 0x7fffffff), Int64(0, 0x80000000), UInt64(0))
+test("sort7", sameset(lib.sort("<e", e:sub(1, 24), 1, "positions"), { 17, 1, 9 }))
+test("sort8", lib.sort("B", "", 1) == "" and not pcall(lib.sort, "c2", "ab", 1) and not pcall(lib.sort, "B", "a", 1, "x"))
+
+testing("bsearch")
+local ranges = {}
+for i = 0, 199 do
+	ranges[#ranges + 1] = lib.pack(">I4 I4 c3", i * 100, i * 100 + 49, string.format("%03d", i))
+end
+local rblob = table.concat(ranges)
+local function at(i) return i * 11 + 1 end
+test("bsearch1", lib.bsearch(">I4 I4 c3", rblob, 1, 500) == at(5) and lib.bsearch(">I4 I4 c3", rblob, 1, 501) == nil)
+test("bsearch2", lib.bsearch(">I4 I4 c3", rblob, 1, 0) == at(0) and lib.bsearch(">I4 I4 c3", rblob, 1, 19900) == at(199))
+test("bsearch3", lib.bsearch(">I4 I4 c3", rblob, 1, 501, "lower") == at(6) and lib.bsearch(">I4 I4 c3", rblob, 1, -5, "lower") == at(0)
+	and lib.bsearch(">I4 I4 c3", rblob, 1, 19901, "lower") == nil)
+test("bsearch4", lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, 525, "range") == at(5) and lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, 549, "range") == at(5)
+	and lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, 550, "range") == nil and lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, -1, "range") == nil
+	and lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, 19949, "range") == at(199) and lib.bsearch(">I4 I4 c3", rblob, { 1, 2 }, 19950, "range") == nil)
+test("bsearch5", lib.bsearch(">I4 I4 c3", rblob, 3, "042") == at(42) and lib.bsearch(">I4 I4 c3", rblob, 3, "04") == nil
+	and lib.bsearch(">I4 I4 c3", rblob, 3, "04", "lower") == at(40))
+local named = lib.compile(">I4 I4 c3", { "first", "last", "name" })
+test("bsearch6", lib.bsearch(named, rblob, { "first", "last" }, UInt64(1234), "range") == at(12)
+	and lib.bsearch(named, rblob, "first", Int64(1200)) == at(12) and lib.bsearch(named, rblob, "first", 1200.5) == nil)
+local dups = lib.pack("<h h h h h", -3, 1, 1, 1, 7)
+test("bsearch7", lib.bsearch("<h", dups, 1, 1) == 3 and lib.bsearch("<h", dups, 1, -3) == 1 and lib.bsearch("<h", dups, 1, 1, "exact", 5) == 5
+	and lib.bsearch("<h", "", 1, 1) == nil and lib.bsearch("<h", dups .. "x", 1, 8, "lower") == nil)
+test("bsearch8", not pcall(lib.bsearch, "<h", dups, 1, 0/0) and not pcall(lib.bsearch, "<h", dups, 1, 1, "range")
+	and not pcall(lib.bsearch, ">I4 I4 c3", rblob, { 1, 3 }, 1, "range") and not pcall(lib.bsearch, "<h", dups, 1, "1")
+	and not pcall(lib.bsearch, "<h", dups, 1, 1, "x"))
+
+testing("Buffer")
+local path = os.tmpname()
+local f = io.open(path, "wb")
+f:write(rblob)
+f:close()
+local buf = Buffer.map(path)
+test("Buffer1", #buf == #rblob and buf:sub(1, 11) == rblob:sub(1, 11) and buf:sub(-3) == "199" and buf:sub(5, 4) == ""
+	and tostring(buf) == "Buffer(" .. #rblob .. " bytes)")
+test("Buffer2", lib.bsearch(named, buf, { "first", "last" }, 7725, "range") == at(77) and lib.bsearch(named, buf, "name", "150") == at(150))
+test("Buffer3", sameset(lib.filter(named, buf, { "<", "first", 1000 }), lib.filter(named, rblob, { "<", "first", 1000 }))
+	and lib.sort(named, buf, "first") == lib.sort(named, rblob, "first"))
+buf:close()
+test("Buffer4", #buf == 0 and tostring(buf) == "Buffer(closed)" and not pcall(lib.bsearch, named, buf, 1, 0) and not pcall(lib.bsearch, named, 42, 1, 0))
+f = io.open(path, "wb")
+f:close()
+buf = Buffer.map(path)
+test("Buffer5", #buf == 0 and lib.bsearch("B", buf, 1, 0) == nil and not pcall(Buffer.map, path .. ".missing"))
+buf:close()
+os.remove(path)
+
+testing("index")
+local recs, want = {}, {}
+for i = 1, 1000 do
+	local k = (i * 7919) % 613
+	recs[i] = lib.pack("<i2 E c4", k - 300, UInt64(k, 0x80000000), string.format("%04d", k))
+	want[k - 300] = want[k - 300] or {}
+	table.insert(want[k - 300], (i - 1) * 14 + 1)
+end
+local iblob = table.concat(recs)
+local idx = lib.index("<i2 E c4", iblob, 1)
+local ok = #idx == 1000 and tostring(idx) == 'Index("<i2 E c4") of 1000 records'
+for k = -300, 312 do
+	local all = idx:get_all(k)
+	ok = ok and sameset(all, want[k]) and idx:get(k) == want[k][1]
+end
+test("index1", ok)
+test("index2", idx:get(313) == nil and idx:get(-301) == nil and idx:get(0.5) == nil and #idx:get_all(1000) == 0 and idx:get(Int64(-300)) == want[-300][1])
+local idx2 = lib.index(lib.compile("<i2 E c4", { "k", "big", "name" }), iblob, "big")
+test("index3", idx2:get(UInt64(12, 0x80000000)) == want[12 - 300][1] and idx2:get(UInt64(12)) == nil and idx2:get(-1) == nil)
+local idx3 = lib.index("<i2 E c4", iblob, 3)
+test("index4", sameset(idx3:get_all("0007"), want[7 - 300]) and idx3:get("007") == nil and idx3:get("x007") == nil and not pcall(idx3.get, idx3, 7))
+test("index5", #lib.index("B", "", 1) == 0 and lib.index("B", "", 1):get(0) == nil and not pcall(lib.index, "d", "12345678", 1)
+	and not pcall(lib.index, "B", "abc", 2) and lib.index(">H", "\0\1\0\2\0", 1, 2):get(512) == 4)
+path = os.tmpname()
+f = io.open(path, "wb")
+f:write(iblob)
+f:close()
+buf = Buffer.map(path)
+local idx4 = lib.index("<i2 E c4", buf, 1)
+test("index6", sameset(idx4:get_all(5), want[5]))
+buf:close()
+test("index7", not pcall(idx4.get, idx4, 5))
+os.remove(path)
+
+testing("cache")
+local function same(a, b)
+	if #a ~= #b then return false end
+	for i = 1, #a do if a[i] ~= b[i] then return false end end
+	return true
+end
+local cache = lib.cache()
+local frame = lib.pack(">H H I4 s", 80, 443, 12345, "payload")
+test("cache1", same({cache:unpack(">H H I4", frame)}, {lib.unpack(">H H I4", frame)})
+	and same({cache:unpack(">H H I4", frame)}, {lib.unpack(">H H I4", frame)})
+	and same({cache:unpack(">H H I4 s", frame)}, {lib.unpack(">H H I4 s", frame)})
+	and same({cache:unpack(">H H I4 s", frame)}, {lib.unpack(">H H I4 s", frame)}))
+local st = cache:stats()
+test("cache2", st.hits == 2 and st.misses == 2 and st.entries == 2 and st.evictions == 0 and st.bytes > 0 and st.budget == 16 * 1024 * 1024)
+-- fixed-size records are found again by content, others by data string
+local copy = frame .. "x"
+cache:unpack(">H H I4", copy)
+cache:unpack(">H H I4 s", copy)
+st = cache:stats()
+test("cache3", st.hits == 3 and st.misses == 3)
+local l = lib.compile(">H =")
+test("cache4", same({cache:unpack(l, frame, 3)}, {lib.unpack(">H =", frame, 3)}) and same({cache:unpack(l, "xx" .. frame:sub(3), 3)}, {443, 5, 5})
+	and same({cache:unpack(l, frame, 1)}, {80, 3, 3}) and cache:stats().hits == 4)
+test("cache5", not pcall(cache.unpack, cache, ">I4", "abc") and not pcall(cache.unpack, cache, ">H s", "\0\1") and not pcall(lib.cache, -1))
+local small = lib.cache(1000)
+for i = 1, 200 do
+	local v = small:unpack("<I4 c8", lib.pack("<I4 c8", i, "abcdefgh"))
+	assert(v == i)
+end
+st = small:stats()
+test("cache6", st.misses == 200 and st.evictions > 0 and st.entries + st.evictions == 200 and st.bytes <= 1000)
+test("cache7", small:unpack("<I4 c8", lib.pack("<I4 c8", 200, "abcdefgh")) == 200 and small:stats().hits == 1
+	and small:unpack("<I4 c8", lib.pack("<I4 c8", 1, "abcdefgh")) == 1 and small:stats().misses == 201)
+small:clear()
+st = small:stats()
+test("cache8", st.entries == 0 and st.bytes == 0 and st.hits == 0 and tostring(small) == "Cache(0 records)"
+	and lib.cache(0):unpack("B", "x") == 120)
+
+testing("parallel_unpack")
+local pfmt = lib.compile("<i2 B I4 e f d c3 =", { "short", "byte", "word", "big", "float", "double", "name", "next" })
+local precs = {}
+for i = 1, 40000 do
+	precs[i] = lib.pack("<i2 B I4 e f d c3", i - 20000, i % 256, i * 65537 % 4294967296, Int64(i, -i), i / 4, i / 3, string.format("%03d", i % 1000))
+end
+local pblob = table.concat(precs) .. "xy"
+local cols, pend = lib.parallel_unpack(pfmt, pblob, 4)
+local ok = #cols == 8 and pend == #pblob - 1 and cols.word == cols[3] and cols.next == cols[8]
+for i = 1, #cols do ok = ok and #cols[i] == 40000 end
+for i = 1, 40000, 7 do
+	local want = {lib.unpack("<i2 B I4 e f d c3 =", pblob, (i - 1) * 30 + 1)}
+	for j = 1, 8 do ok = ok and cols[j][i] == want[j] end
+end
+test("parallel_unpack1", ok and cols[4][40000] == Int64(40000, -40000) and cols[7][1] == "001")
+local one = lib.parallel_unpack(pfmt, pblob, 1)
+ok = true
+for i = 1, 40000, 3 do ok = ok and one[3][i] == cols[3][i] and one.name[i] == cols.name[i] end
+test("parallel_unpack2", ok and cols[1][0] == nil and cols[1][40001] == nil and cols[1][1.5] == nil)
+test("parallel_unpack3", cols.word:ctype() == "uint32_t" and select(2, cols.name:ctype()) == 3
+	and type(cols.word:pointer()) == "userdata" and tostring(cols.big) == "Column(int64_t) of 40000 values")
+local path = os.tmpname()
+local f = io.open(path, "wb")
+f:write(pblob)
+f:close()
+local pbuf = Buffer.map(path)
+local bcols, bend = lib.parallel_unpack(">I2", pbuf, 64, 3)
+test("parallel_unpack4", bend == #pblob + 1 and #bcols[1] == (#pblob - 2) / 2 and bcols[1][1] == lib.unpack(">I2", pblob, 3))
+pbuf:close()
+os.remove(path)
+test("parallel_unpack5", not pcall(lib.parallel_unpack, "<i2 s", pblob, 2) and not pcall(lib.parallel_unpack, "<i2", pblob, 0)
+	and not pcall(lib.parallel_unpack, "<i16", pblob, 2) and #lib.parallel_unpack("<d", "", 2)[1] == 0)
+
+testing("shared memory ring")
+local rname = "/wst_test_" .. tostring(os.time()) .. "_" .. tostring(math.random(1000000))
+local prod = Ring.create(rname, 5, 16)
+local cons = assert(Ring.open(rname))
+test("ring1", tostring(prod) == "Ring(8 slots of 16 bytes)" and #cons == 0 and #cons:acquire() == 0
+	and select(2, Ring.open(rname .. "x")) ~= nil)
+test("ring2", prod:push(lib.pack(">H H I4", 80, 443, 7), "abc", "defg") == 3 and #cons == 3)
+local batch = cons:acquire(2)
+test("ring3", #batch == 2 and #cons == 1 and tostring(batch[1]) == "Buffer(8 bytes)"
+	and lib.unpack(">H H I4", batch[1]) == 80 and select(2, lib.unpack(">H H I4", batch[1])) == 443
+	and batch[2]:sub(1) == "abc" and lib.tryunpack("c3", batch[2]) == "abc")
+-- each batch has new views, and those of the batch released are closed
+local kept = batch[1]
+local batch2 = cons:acquire(8)
+local ok, err = pcall(lib.unpack, "B", kept)
+test("ring4", batch2 ~= batch and #batch2 == 1 and batch2[1]:sub(1) == "defg" and batch[1] == kept
+	and not ok and err:find("closed") ~= nil and #batch[2] == 0)
+-- the slots released come back; the ones held do not
+local n = prod:push("1", "2", "3", "4", "5", "6", "7", "8", "9", "10")
+test("ring5", n == 7 and #cons:acquire(100) == 7 and prod:push("x", "y") == 1)
+cons:release()
+test("ring6", prod:push(lib.pack("<e", Int64(-5)), UInt64(1):encode()) == 2 and not pcall(prod.push, prod, string.rep("x", 17))
+	and not pcall(cons.push, cons, "x") and not pcall(prod.acquire, prod))
+batch = cons:acquire()
+test("ring7", #batch == 3 and batch[1]:sub(1) == "x" and Int64.decode(batch[2], true) == Int64(-5)
+	and UInt64.decode(batch[3]) == UInt64(1))
+prod:close()
+test("ring8", cons:acquire(8, -1) == nil and tostring(prod) == "Ring(closed)" and not pcall(prod.push, prod, "x")
+	and select(2, Ring.open(rname)) ~= nil)
+cons:close()
+
+testing("generated decoders")
+if lib.generated then
+	local seed = 7
+	local bytes = {}
+	for i = 1, 300 do
+		seed = (seed * 1103515245 + 12345) % 2147483648
+		bytes[i] = string.char(math.floor(seed / 65536) % 256)
+	end
+	local data = table.concat(bytes)
+	for name, fmt in pairs(lib.generated) do
+		local unpack, pack = lib["unpack_" .. name], lib["pack_" .. name]
+		local ok = true
+		for pos = 1, 5 do
+			local want, got = {lib.unpack(fmt, data, pos)}, {unpack(data, pos)}
+			ok = ok and #want == #got
+			for i = 1, #want do
+				ok = ok and want[i] == got[i]
+			end
+			ok = ok and pack(unpack(data, pos)) == lib.pack(fmt, lib.unpack(fmt, data, pos))
+		end
+		test("generated_" .. name, ok)
+		local size = lib.size(fmt)
+		test("generated_" .. name .. "_short", not pcall(unpack, data:sub(1, size - 1))
+			and not pcall(unpack, data, #data - size + 2) and unpack(data, #data - size + 1) ~= nil)
+	end
+	test("generated1", lib.unpack_udp(lib.pack_udp(53, 1024, 8, 0)) == 53)
+	test("generated2", select(5, lib.unpack_udp("\0\0\0\0\0\0\0\0", 1)) == 9)
+	test("generated3", not pcall(lib.unpack_udp, {}) and not pcall(lib.pack_udp, 1, 2, 3))
+end
+
 -- test for weird conditions
 testing("weird conditions")
 test("weird_pack1",lib.pack(">>>h <!!!<h", 10, 10) == string.char(0, 10, 10, 0))
@@ -6,4 +6,6 @@ function typeof(obj)
 end
 
 require("int64")
-require("struct")
\ No newline at end of file
+require("struct")
+require("address")
+require("layout")
\ No newline at end of file